@@ -150,6 +150,7 @@ void CConfig::Load (void)
 	m_bProfileEnabled = m_Properties.GetNumber ("ProfileEnabled", 0) != 0;
 	m_bPerformanceSelectToLoad = m_Properties.GetNumber ("PerformanceSelectToLoad", 1) != 0;
 	m_bPerformanceSelectChannel = m_Properties.GetNumber ("PerformanceSelectChannel", 0);
+	m_nPerformanceFadeTime = m_Properties.GetNumber ("PerformanceFadeTime", 0);
 }
 
 const char *CConfig::GetSoundDevice (void) const
@@ -496,3 +497,8 @@ unsigned CConfig::GetPerformanceSelectChannel (void) const
 {
 	return m_bPerformanceSelectChannel;
 }
+
+unsigned CConfig::GetPerformanceFadeTime (void) const
+{
+	return m_nPerformanceFadeTime;
+}
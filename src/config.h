@@ -164,6 +164,7 @@ public:
 	// Load performance mode. 0 for load just rotating encoder, 1 load just when Select is pushed
 	bool GetPerformanceSelectToLoad (void) const;
 	unsigned GetPerformanceSelectChannel (void) const;
+	unsigned GetPerformanceFadeTime (void) const;		// ms, 0 to switch without fade
 
 private:
 	CPropertiesFatFsFile m_Properties;
@@ -247,6 +248,7 @@ private:
 	bool m_bProfileEnabled;
 	bool m_bPerformanceSelectToLoad;
 	unsigned m_bPerformanceSelectChannel;
+	unsigned m_nPerformanceFadeTime;
 };
 
 #endif
@@ -0,0 +1,262 @@
+//
+// midiclock.cpp
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "midiclock.h"
+#include <circle/logger.h>
+#include <assert.h>
+
+LOGMODULE ("midiclock");
+
+// DLL coefficients, see F. Adriaensen: "Using a DLL to filter time".
+// The loop bandwidth is 1/50 of the clock rate (about 1 Hz at 120 BPM).
+#define DLL_OMEGA	(2.0f * 3.14159265f / 50.0f)
+#define DLL_B		(1.41421356f * DLL_OMEGA)
+#define DLL_C		(DLL_OMEGA * DLL_OMEGA)
+
+#define MIN_PERIOD	(60000000U / (300 * CMIDIClock::TicksPerBeat))	// 300 BPM
+#define MAX_PERIOD	(60000000U / (20 * CMIDIClock::TicksPerBeat))	// 20 BPM
+
+CMIDIClock::CMIDIClock (void)
+:	m_nValidTicks (0),
+	m_nLastTicks (0),
+	m_nPredictedTicks (0),
+	m_fPeriod (0.0f),
+	m_bRunning (false),
+	m_bFirstTick (false),
+	m_nPositionTicks (0),
+	m_nJitterCount (0),
+	m_fJitterSum (0.0f),
+	m_nJitterMaxMicros (0),
+	m_nResyncs (0),
+	m_nLastDumpTicks (0)
+{
+}
+
+CMIDIClock::~CMIDIClock (void)
+{
+}
+
+void CMIDIClock::Tick (void)
+{
+	unsigned nTicks = CTimer::GetClockTicks ();
+
+	m_SpinLock.Acquire ();
+
+	if (m_bRunning)
+	{
+		if (m_bFirstTick)
+		{
+			m_bFirstTick = false;		// this tick is the start of beat 0
+		}
+		else
+		{
+			m_nPositionTicks++;
+		}
+	}
+
+	if (m_nValidTicks == 0)
+	{
+		Reset (nTicks);
+	}
+	else if (m_nValidTicks == 1)
+	{
+		unsigned nPeriod = nTicks - m_nLastTicks;
+		if (MIN_PERIOD <= nPeriod && nPeriod <= MAX_PERIOD)
+		{
+			m_fPeriod = nPeriod;
+			m_nPredictedTicks = nTicks + nPeriod;
+			m_nValidTicks++;
+		}
+		else
+		{
+			Reset (nTicks);
+		}
+	}
+	else
+	{
+		int nError = (int) (nTicks - m_nPredictedTicks);
+
+		if (   nError > (int) m_fPeriod
+		    || nError < -(int) m_fPeriod / 2)
+		{
+			// missed ticks or the clock has been restarted
+			m_nResyncs++;
+
+			Reset (nTicks);
+		}
+		else
+		{
+			float fJitter = (float) (nTicks - m_nLastTicks) - m_fPeriod;
+			if (fJitter < 0.0f)
+			{
+				fJitter = -fJitter;
+			}
+
+			m_fJitterSum += fJitter;
+			m_nJitterCount++;
+			if ((unsigned) fJitter > m_nJitterMaxMicros)
+			{
+				m_nJitterMaxMicros = (unsigned) fJitter;
+			}
+
+			m_nPredictedTicks += (int) (DLL_B * nError + m_fPeriod + 0.5f);
+			m_fPeriod += DLL_C * nError;
+
+			if (m_nValidTicks < LockTicks)
+			{
+				m_nValidTicks++;
+			}
+		}
+	}
+
+	m_nLastTicks = nTicks;
+
+	m_SpinLock.Release ();
+}
+
+void CMIDIClock::Start (void)
+{
+	m_SpinLock.Acquire ();
+
+	m_bRunning = true;
+	m_bFirstTick = true;
+	m_nPositionTicks = 0;
+
+	m_SpinLock.Release ();
+}
+
+void CMIDIClock::Continue (void)
+{
+	m_SpinLock.Acquire ();
+
+	m_bRunning = true;
+
+	m_SpinLock.Release ();
+}
+
+void CMIDIClock::Stop (void)
+{
+	m_SpinLock.Acquire ();
+
+	m_bRunning = false;
+
+	m_SpinLock.Release ();
+}
+
+void CMIDIClock::GetPosition (unsigned nSampleRate, TPosition *pPosition)
+{
+	assert (nSampleRate > 0);
+	assert (pPosition);
+
+	unsigned nTicks = CTimer::GetClockTicks ();
+
+	m_SpinLock.Acquire ();
+
+	if (   !m_bRunning
+	    || m_bFirstTick
+	    || m_nValidTicks < LockTicks)
+	{
+		m_SpinLock.Release ();
+
+		pPosition->bRunning = false;
+		pPosition->nBeat = 0;
+		pPosition->fPhase = 0.0f;
+		pPosition->fPhaseIncrement = 0.0f;
+
+		return;
+	}
+
+	// interpolate between the (filtered) last tick and the predicted next one
+	float fPeriod = m_fPeriod;
+	float fFraction = (fPeriod - (float) (int) (m_nPredictedTicks - nTicks)) / fPeriod;
+	if (fFraction < 0.0f)
+	{
+		fFraction = 0.0f;
+	}
+	else if (fFraction > 0.999f)
+	{
+		fFraction = 0.999f;		// do not run ahead, if clock stalls
+	}
+
+	unsigned nPositionTicks = m_nPositionTicks;
+
+	m_SpinLock.Release ();
+
+	pPosition->bRunning = true;
+	pPosition->nBeat = nPositionTicks / TicksPerBeat;
+	pPosition->fPhase = ((nPositionTicks % TicksPerBeat) + fFraction) / TicksPerBeat;
+	pPosition->fPhaseIncrement = (float) CLOCKHZ / (fPeriod * TicksPerBeat * nSampleRate);
+}
+
+unsigned CMIDIClock::GetTempo (void)
+{
+	m_SpinLock.Acquire ();
+
+	unsigned nTempo = 0;
+	if (m_nValidTicks >= LockTicks)
+	{
+		nTempo = (unsigned) (60.0f * 100.0f * CLOCKHZ / (m_fPeriod * TicksPerBeat) + 0.5f);
+	}
+
+	m_SpinLock.Release ();
+
+	return nTempo;
+}
+
+void CMIDIClock::Dump (unsigned nIntervalTicks)
+{
+	unsigned nTicks = CTimer::GetClockTicks ();
+
+	if (nTicks - m_nLastDumpTicks < nIntervalTicks)
+	{
+		return;
+	}
+
+	m_nLastDumpTicks = nTicks;
+
+	unsigned nTempo = GetTempo ();
+
+	m_SpinLock.Acquire ();
+
+	unsigned nJitterCount = m_nJitterCount;
+	unsigned nJitterAvgMicros = nJitterCount ? (unsigned) (m_fJitterSum / nJitterCount) : 0;
+	unsigned nJitterMaxMicros = m_nJitterMaxMicros;
+	unsigned nResyncs = m_nResyncs;
+
+	m_nJitterCount = 0;
+	m_fJitterSum = 0.0f;
+	m_nJitterMaxMicros = 0;
+	m_nResyncs = 0;
+
+	m_SpinLock.Release ();
+
+	if (nTempo == 0)
+	{
+		return;
+	}
+
+	LOGNOTE ("%u.%02u BPM, jitter average %uus, maximum %uus, %u resyncs",
+		 nTempo / 100, nTempo % 100, nJitterAvgMicros, nJitterMaxMicros, nResyncs);
+}
+
+void CMIDIClock::Reset (unsigned nTicks)
+{
+	m_nValidTicks = 1;
+	m_nLastTicks = nTicks;
+}
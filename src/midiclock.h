@@ -0,0 +1,91 @@
+//
+// midiclock.h
+//
+// Tracks the MIDI clock (0xF8) and estimates its tempo
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _midiclock_h
+#define _midiclock_h
+
+#include <circle/types.h>
+#include <circle/timer.h>
+#include <circle/spinlock.h>
+
+// The clock messages are timestamped with the system timer on arrival.
+// The tempo is estimated with a second order delay-locked loop (DLL),
+// which follows tempo changes smoothly, but rejects the jitter of the
+// MIDI transport (e.g. USB hubs). The jitter of the received clock
+// against the filtered period is measured too.
+
+class CMIDIClock
+{
+public:
+	static const unsigned TicksPerBeat = 24;	// MIDI clocks per quarter note
+	static const unsigned LockTicks = TicksPerBeat;	// ticks until tempo is valid
+
+	struct TPosition
+	{
+		bool	bRunning;		// started and tempo locked
+		unsigned nBeat;			// beats since start
+		float	fPhase;			// 0.0 .. < 1.0 within beat
+		float	fPhaseIncrement;	// phase increment per sample
+	};
+
+public:
+	CMIDIClock (void);
+	~CMIDIClock (void);
+
+	// called from the MIDI path
+	void Tick (void);			// 0xF8
+	void Start (void);			// 0xFA
+	void Continue (void);			// 0xFB
+	void Stop (void);			// 0xFC
+
+	// called from the audio path at the start of a block,
+	// the phase of sample n in the block is fPhase + n*fPhaseIncrement
+	void GetPosition (unsigned nSampleRate, TPosition *pPosition);
+
+	unsigned GetTempo (void);		// BPM * 100, 0 if not locked
+
+	void Dump (unsigned nIntervalTicks = CLOCKHZ);	// tempo and jitter statistics
+
+private:
+	void Reset (unsigned nTicks);
+
+private:
+	CSpinLock m_SpinLock;
+
+	unsigned m_nValidTicks;		// ticks since (re)start of the DLL
+	unsigned m_nLastTicks;		// timestamp of last tick
+	unsigned m_nPredictedTicks;	// predicted timestamp of next tick
+	float m_fPeriod;		// filtered period (us)
+
+	bool m_bRunning;
+	bool m_bFirstTick;		// first tick after start
+	unsigned m_nPositionTicks;	// ticks since start
+
+	// jitter statistics, reset on Dump()
+	unsigned m_nJitterCount;
+	float m_fJitterSum;		// us
+	unsigned m_nJitterMaxMicros;
+	unsigned m_nResyncs;
+
+	unsigned m_nLastDumpTicks;
+};
+
+#endif
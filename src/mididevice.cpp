@@ -40,39 +40,77 @@ LOGMODULE ("mididevice");
 	#define MIDI_CC_MODULATION			1
 	#define MIDI_CC_BREATH_CONTROLLER	2 
 	#define MIDI_CC_FOOT_PEDAL 		4
+	#define MIDI_CC_DATA_ENTRY_MSB		6
 	#define MIDI_CC_VOLUME				7
 	#define MIDI_CC_PAN_POSITION		10
 	#define MIDI_CC_BANK_SELECT_LSB		32
+	#define MIDI_CC_DATA_ENTRY_LSB		38
 	#define MIDI_CC_BANK_SUSTAIN		64
 	#define MIDI_CC_RESONANCE			71
 	#define MIDI_CC_FREQUENCY_CUTOFF	74
 	#define MIDI_CC_REVERB_LEVEL		91
 	#define MIDI_CC_DETUNE_LEVEL		94
+	#define MIDI_CC_DATA_INCREMENT		96
+	#define MIDI_CC_DATA_DECREMENT		97
+	#define MIDI_CC_NRPN_LSB			98
+	#define MIDI_CC_NRPN_MSB			99
+	#define MIDI_CC_RPN_LSB				100
+	#define MIDI_CC_RPN_MSB				101
 	#define MIDI_CC_ALL_SOUND_OFF		120
 	#define MIDI_CC_ALL_NOTES_OFF		123
 #define MIDI_PROGRAM_CHANGE	0b1100
 #define MIDI_PITCH_BEND		0b1110
 
+// Registered parameter numbers
+#define MIDI_RPN_PITCH_BEND_RANGE	0x0000
+#define MIDI_RPN_FINE_TUNING		0x0001
+#define MIDI_RPN_NULL			0x3FFF
+
+// Non-registered parameter numbers (MSB):
+//	0 .. 5	OP1 .. OP6, LSB is the OP parameter (0 .. 20, 21 = OP enable)
+//	6	voice global parameter, LSB is the offset from 126 (0 .. 29)
+//	64	TG parameter, LSB is CMiniDexed::TTGParameter
+#define MIDI_NRPN_TG_PARAMETER		64
+
 #define MIDI_SYSTEM_EXCLUSIVE_BEGIN	0xF0
 #define MIDI_SYSTEM_EXCLUSIVE_END	0xF7
 #define MIDI_TIMING_CLOCK	0xF8
+#define MIDI_START		0xFA
+#define MIDI_CONTINUE		0xFB
+#define MIDI_STOP		0xFC
 #define MIDI_ACTIVE_SENSING	0xFE
 
 CMIDIDevice::TDeviceMap CMIDIDevice::s_DeviceMap;
 
 CMIDIDevice::CMIDIDevice (CMiniDexed *pSynthesizer, CConfig *pConfig, CUserInterface *pUI)
-:	m_pSynthesizer (pSynthesizer),
+:	m_pMIDILog (pSynthesizer->GetMIDILog ()),
+	m_pSynthesizer (pSynthesizer),
 	m_pConfig (pConfig),
-	m_pUI (pUI)
+	m_pUI (pUI),
+	m_pMIDIClock (pSynthesizer->GetMIDIClock ()),
+	m_pDispatchTimer (0)
 {
+	assert (m_pMIDILog);
+
 	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
 	{
 		m_ChannelMap[nTG] = Disabled;
 	}
+
+	for (unsigned nChannel = 0; nChannel < Channels; nChannel++)
+	{
+		m_ParameterState[nChannel].bNRPN = false;
+		m_ParameterState[nChannel].ucNumberMSB = 0x7F;	// RPN null
+		m_ParameterState[nChannel].ucNumberLSB = 0x7F;
+		m_ParameterState[nChannel].ucDataMSB = 0;
+		m_ParameterState[nChannel].ucDataLSB = 0;
+	}
 }
 
 CMIDIDevice::~CMIDIDevice (void)
 {
+	delete m_pDispatchTimer;
+
 	m_pSynthesizer = 0;
 }
 
@@ -93,45 +131,18 @@ void CMIDIDevice::MIDIMessageHandler (const u8 *pMessage, size_t nLength, unsign
 	// The packet contents are just normal MIDI data - see
 	// https://www.midi.org/specifications/item/table-1-summary-of-midi-message
 
+	if (m_pDispatchTimer)
+	{
+		m_pDispatchTimer->Start ();
+	}
+
 	if (m_pConfig->GetMIDIDumpEnabled ())
 	{
-		switch (nLength)
+		if (   nLength != 1
+		    || (   pMessage[0] != MIDI_TIMING_CLOCK
+			&& pMessage[0] != MIDI_ACTIVE_SENSING))
 		{
-		case 1:
-			if (   pMessage[0] != MIDI_TIMING_CLOCK
-			    && pMessage[0] != MIDI_ACTIVE_SENSING)
-			{
-				printf ("MIDI%u: %02X\n", nCable, (unsigned) pMessage[0]);
-			}
-			break;
-
-		case 2:
-			printf ("MIDI%u: %02X %02X\n", nCable,
-				(unsigned) pMessage[0], (unsigned) pMessage[1]);
-			break;
-
-		case 3:
-			printf ("MIDI%u: %02X %02X %02X\n", nCable,
-				(unsigned) pMessage[0], (unsigned) pMessage[1],
-				(unsigned) pMessage[2]);
-			break;
-		default:
-			switch(pMessage[0])
-			{
-				case MIDI_SYSTEM_EXCLUSIVE_BEGIN:
-					printf("MIDI%u: SysEx data length: [%d]:",nCable, uint16_t(nLength));
-					for (uint16_t i = 0; i < nLength; i++)
-					{
-						if((i % 16) == 0)
-							printf("\n%04d:",i);
-						printf(" 0x%02x",pMessage[i]);
-					}
-					printf("\n");
-					break;
-				default:
-					printf("MIDI%u: Unhandled MIDI event type %0x02x\n",nCable,pMessage[0]);
-			}
-			break;
+			m_pMIDILog->WriteMessage (pMessage, nLength, nCable);
 		}
 	}
 
@@ -164,6 +175,23 @@ void CMIDIDevice::MIDIMessageHandler (const u8 *pMessage, size_t nLength, unsign
 
 	if (nLength < 2)
 	{
+		if (nLength == 1)
+		{
+			switch (pMessage[0])
+			{
+			case MIDI_TIMING_CLOCK:	m_pMIDIClock->Tick ();		break;
+			case MIDI_START:	m_pMIDIClock->Start ();		break;
+			case MIDI_CONTINUE:	m_pMIDIClock->Continue ();	break;
+			case MIDI_STOP:		m_pMIDIClock->Stop ();		break;
+			default:						break;
+			}
+		}
+
+		if (m_pDispatchTimer)
+		{
+			m_pDispatchTimer->Stop ();
+		}
+
 		// LOGERR("MIDI message is shorter than 2 bytes!");
 		return;
 	}
@@ -178,15 +206,26 @@ void CMIDIDevice::MIDIMessageHandler (const u8 *pMessage, size_t nLength, unsign
 	if (pMessage[0] == MIDI_SYSTEM_EXCLUSIVE_BEGIN && pMessage[3] == 0x04 &&  pMessage[4] == 0x01 && pMessage[nLength-1] == MIDI_SYSTEM_EXCLUSIVE_END) // MASTER VOLUME
 	{
 		float32_t nMasterVolume=((pMessage[5] & 0x7c) & ((pMessage[6] & 0x7c) <<7))/(1<<14);
-		LOGNOTE("Master volume: %f",nMasterVolume);
+		m_pMIDILog->WriteMasterVolume (nMasterVolume);
 		m_pSynthesizer->setMasterVolume(nMasterVolume);
 	}
+	else if (CPerformanceSysEx::IsPerformanceSysEx (pMessage, nLength))
+	{
+		m_pSynthesizer->ReceivePerformanceSysEx (pMessage, nLength);
+	}
 	else
 	{
 		// Perform any MiniDexed level MIDI handling before specific Tone Generators
 		switch (ucType)
 		{
 		case MIDI_CONTROL_CHANGE:
+			if (nLength < 3)
+			{
+				break;
+			}
+			UpdateParameterState (ucChannel, pMessage[1], pMessage[2]);
+			m_pUI->UIMIDICmdHandler (ucChannel, ucStatus & 0xF0, pMessage[1], pMessage[2]);
+			break;
 		case MIDI_NOTE_OFF:
 		case MIDI_NOTE_ON:
 			if (nLength < 3)
@@ -212,6 +251,14 @@ void CMIDIDevice::MIDIMessageHandler (const u8 *pMessage, size_t nLength, unsign
 			break;
 		}
 
+		// Bank dumps are added to the voice bank store once, not per TG
+		if (   ucStatus == MIDI_SYSTEM_EXCLUSIVE_BEGIN
+		    && nLength == sizeof (CSysExFileLoader::TVoiceBank)
+		    && pMessage[3] == 0x09)
+		{
+			m_pSynthesizer->GetSysExFileLoader ()->ReceiveBank (pMessage, nLength);
+		}
+
 		// Process MIDI for each Tone Generator
 		for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
 		{
@@ -221,7 +268,7 @@ void CMIDIDevice::MIDIMessageHandler (const u8 *pMessage, size_t nLength, unsign
 				uint8_t ucSysExChannel = (pMessage[2] & 0x0F);
 				if (m_ChannelMap[nTG] == ucSysExChannel || m_ChannelMap[nTG] == OmniMode)
 				{
-					LOGNOTE("MIDI-SYSEX: channel: %u, len: %u, TG: %u",m_ChannelMap[nTG],nLength,nTG);
+					m_pMIDILog->WriteSysExChannel (m_ChannelMap[nTG], nLength, nTG);
 					HandleSystemExclusive(pMessage, nLength, nCable, nTG);
 				}
 			}
@@ -334,6 +381,13 @@ void CMIDIDevice::MIDIMessageHandler (const u8 *pMessage, size_t nLength, unsign
 							}
 							break;
 		
+						case MIDI_CC_DATA_ENTRY_MSB:
+						case MIDI_CC_DATA_ENTRY_LSB:
+						case MIDI_CC_DATA_INCREMENT:
+						case MIDI_CC_DATA_DECREMENT:
+							ApplyParameterChange (ucChannel, nTG);
+							break;
+		
 						case MIDI_CC_ALL_SOUND_OFF:
 							m_pSynthesizer->panic (pMessage[2], nTG);
 							break;
@@ -354,7 +408,9 @@ void CMIDIDevice::MIDIMessageHandler (const u8 *pMessage, size_t nLength, unsign
 						// do program change only if enabled in config and not in "Performance Select Channel" mode
 						if( m_pConfig->GetMIDIRXProgramChange() && ( m_pSynthesizer->GetPerformanceSelectChannel() == Disabled) ) {
 							//printf("Program Change to %d (%d)\n", ucChannel, m_pSynthesizer->GetPerformanceSelectChannel());
-							m_pSynthesizer->ProgramChange (pMessage[1], nTG);
+							// m_MIDISpinLock disables IRQs, so a bank, which is not
+							// in memory, must not be read here, but from Process()
+							m_pSynthesizer->ProgramChange (pMessage[1], nTG, false);
 						}
 						break;
 		
@@ -379,6 +435,135 @@ void CMIDIDevice::MIDIMessageHandler (const u8 *pMessage, size_t nLength, unsign
 		}
 	}
 	m_MIDISpinLock.Release ();
+
+	if (m_pDispatchTimer)
+	{
+		m_pDispatchTimer->Stop ();
+	}
+}
+
+void CMIDIDevice::UpdateParameterState (u8 ucChannel, u8 ucController, u8 ucValue)
+{
+	assert (ucChannel < Channels);
+	TParameterState *pState = &m_ParameterState[ucChannel];
+
+	switch (ucController)
+	{
+	case MIDI_CC_NRPN_MSB:
+		pState->bNRPN = true;
+		pState->ucNumberMSB = ucValue;
+		break;
+
+	case MIDI_CC_NRPN_LSB:
+		pState->bNRPN = true;
+		pState->ucNumberLSB = ucValue;
+		break;
+
+	case MIDI_CC_RPN_MSB:
+		pState->bNRPN = false;
+		pState->ucNumberMSB = ucValue;
+		break;
+
+	case MIDI_CC_RPN_LSB:
+		pState->bNRPN = false;
+		pState->ucNumberLSB = ucValue;
+		break;
+
+	case MIDI_CC_DATA_ENTRY_MSB:
+		pState->ucDataMSB = ucValue;
+		pState->ucDataLSB = 0;
+		break;
+
+	case MIDI_CC_DATA_ENTRY_LSB:
+		pState->ucDataLSB = ucValue;
+		break;
+
+	case MIDI_CC_DATA_INCREMENT:
+		if (pState->ucDataMSB < 127)
+		{
+			pState->ucDataMSB++;
+		}
+		break;
+
+	case MIDI_CC_DATA_DECREMENT:
+		if (pState->ucDataMSB > 0)
+		{
+			pState->ucDataMSB--;
+		}
+		break;
+
+	default:
+		break;
+	}
+}
+
+void CMIDIDevice::ApplyParameterChange (u8 ucChannel, unsigned nTG)
+{
+	assert (ucChannel < Channels);
+	const TParameterState *pState = &m_ParameterState[ucChannel];
+
+	unsigned nNumber = (unsigned) pState->ucNumberMSB << 7 | pState->ucNumberLSB;
+	unsigned nValue = (unsigned) pState->ucDataMSB << 7 | pState->ucDataLSB;	// 14-bit
+
+	if (!pState->bNRPN)
+	{
+		switch (nNumber)
+		{
+		case MIDI_RPN_PITCH_BEND_RANGE:
+			m_pSynthesizer->setPitchbendRange (pState->ucDataMSB, nTG);
+			break;
+
+		case MIDI_RPN_FINE_TUNING:
+			// 0x2000 is center, +/- 100 cents
+			m_pSynthesizer->SetMasterTune (maplong (nValue, 0, 0x3FFF, -99, 99), nTG);
+			break;
+
+		case MIDI_RPN_NULL:
+		default:
+			break;
+		}
+
+		return;
+	}
+
+	if (pState->ucNumberMSB < CMiniDexed::NoOP)
+	{
+		if (pState->ucNumberLSB <= DEXED_OP_ENABLE)
+		{
+			// NRPN MSB 0 is OP1, which has index 0 in SetVoiceParameter()
+			m_pSynthesizer->QueueVoiceParameter (pState->ucNumberLSB, pState->ucDataMSB,
+							     pState->ucNumberMSB, nTG);
+		}
+	}
+	else if (pState->ucNumberMSB == CMiniDexed::NoOP)
+	{
+		if (pState->ucNumberLSB < 156 - CMiniDexed::NoOP*21)
+		{
+			m_pSynthesizer->QueueVoiceParameter (pState->ucNumberLSB, pState->ucDataMSB,
+							     CMiniDexed::NoOP, nTG);
+		}
+	}
+	else if (pState->ucNumberMSB == MIDI_NRPN_TG_PARAMETER)
+	{
+		CMiniDexed::TTGParameter Parameter = (CMiniDexed::TTGParameter) pState->ucNumberLSB;
+		switch (Parameter)
+		{
+		case CMiniDexed::TGParameterVoiceBank:		// use bank select instead
+		case CMiniDexed::TGParameterVoiceBankMSB:
+		case CMiniDexed::TGParameterVoiceBankLSB:
+		case CMiniDexed::TGParameterProgram:		// use program change instead
+		case CMiniDexed::TGParameterMasterTune:		// use RPN fine tuning instead
+		case CMiniDexed::TGParameterMIDIChannel:
+			break;
+
+		default:
+			if (Parameter < CMiniDexed::TGParameterUnknown)
+			{
+				m_pSynthesizer->SetTGParameter (Parameter, pState->ucDataMSB, nTG);
+			}
+			break;
+		}
+	}
 }
 
 void CMIDIDevice::AddDevice (const char *pDeviceName)
@@ -390,6 +575,23 @@ void CMIDIDevice::AddDevice (const char *pDeviceName)
 	assert (!m_DeviceName.empty ());
 
 	s_DeviceMap.insert (std::pair<std::string, CMIDIDevice *> (pDeviceName, this));
+
+	if (m_pConfig->GetProfileEnabled ())
+	{
+		std::string TimerName ("MIDI ");
+		TimerName += m_DeviceName;
+
+		m_pDispatchTimer = new CPerformanceTimer (TimerName.c_str ());
+		assert (m_pDispatchTimer);
+	}
+}
+
+void CMIDIDevice::DumpProfile (void)
+{
+	if (m_pDispatchTimer)
+	{
+		m_pDispatchTimer->Dump ();
+	}
 }
 
 void CMIDIDevice::HandleSystemExclusive(const uint8_t* pMessage, const size_t nLength, const unsigned nCable, const uint8_t nTG)
@@ -397,112 +599,62 @@ void CMIDIDevice::HandleSystemExclusive(const uint8_t* pMessage, const size_t nL
   int16_t sysex_return;
 
   sysex_return = m_pSynthesizer->checkSystemExclusive(pMessage, nLength, nTG);
-  LOGDBG("SYSEX handler return value: %d", sysex_return);
+  m_pMIDILog->WriteSysExResult (sysex_return, pMessage, nLength, nTG);
 
   switch (sysex_return)
   {
-    case -1:
-      LOGERR("SysEx end status byte not detected.");
-      break;
-    case -2:
-      LOGERR("SysEx vendor not Yamaha.");
-      break;
-    case -3:
-      LOGERR("Unknown SysEx parameter change.");
-      break;
-    case -4:
-      LOGERR("Unknown SysEx voice or function.");
-      break;
-    case -5:
-      LOGERR("Not a SysEx voice bulk upload.");
-      break;
-    case -6:
-      LOGERR("Wrong length for SysEx voice bulk upload (not 155).");
-      break;
-    case -7:
-      LOGERR("Checksum error for one voice.");
-      break;
-    case -8:
-      LOGERR("Not a SysEx bank bulk upload.");
-      break;
-    case -9:
-      LOGERR("Wrong length for SysEx bank bulk upload (not 4096).");
-    case -10:
-      LOGERR("Checksum error for bank.");
-      break;
-    case -11:
-      LOGERR("Unknown SysEx message.");
-      break;
     case 64:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setMonoMode(pMessage[5],nTG);
       break;
     case 65:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setPitchbendRange(pMessage[5],nTG);
       break;
     case 66:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setPitchbendStep(pMessage[5],nTG);
       break;
     case 67:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setPortamentoMode(pMessage[5],nTG);
       break;
     case 68:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setPortamentoGlissando(pMessage[5],nTG);
       break;
     case 69:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setPortamentoTime(pMessage[5],nTG);
       break;
     case 70:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setModWheelRange(pMessage[5],nTG);
       break;
     case 71:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setModWheelTarget(pMessage[5],nTG);
       break;
     case 72:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setFootControllerRange(pMessage[5],nTG);
       break;
     case 73:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setFootControllerTarget(pMessage[5],nTG);
       break;
     case 74:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setBreathControllerRange(pMessage[5],nTG);
       break;
     case 75:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setBreathControllerTarget(pMessage[5],nTG);
       break;
     case 76:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setAftertouchRange(pMessage[5],nTG);
       break;
     case 77:
-      LOGDBG("SysEx Function parameter change: %d Value %d",pMessage[4],pMessage[5]);
       m_pSynthesizer->setAftertouchTarget(pMessage[5],nTG);
       break;
     case 100:
       // load sysex-data into voice memory
-      LOGDBG("One Voice bulk upload");
       m_pSynthesizer->loadVoiceParameters(pMessage,nTG);
       break;
     case 200:
-      LOGDBG("Bank bulk upload.");
-      //TODO: add code for storing a bank bulk upload
-      LOGNOTE("Currently code  for storing a bulk bank upload is missing!");
+      // bank bulk upload, has already been passed to CSysExFileLoader::ReceiveBank()
       break;
     default:
       if(sysex_return >= 300 && sysex_return < 500)
       {
-        LOGDBG("SysEx voice parameter change: Parameter %d value: %d",pMessage[4] + ((pMessage[3] & 0x03) * 128), pMessage[5]);
         m_pSynthesizer->setVoiceDataElement(pMessage[4] + ((pMessage[3] & 0x03) * 128), pMessage[5],nTG);
         switch(pMessage[4] + ((pMessage[3] & 0x03) * 128))
         {
@@ -513,13 +665,20 @@ void CMIDIDevice::HandleSystemExclusive(const uint8_t* pMessage, const size_t nL
       }
       else if(sysex_return >= 500 && sysex_return < 600)
       {
-        LOGDBG("SysEx send voice %u request",sysex_return-500);
         SendSystemExclusiveVoice(sysex_return-500, nCable, nTG);
       }
       break;
   }
 }
 
+void CMIDIDevice::SendSystemExclusive (const u8 *pMessage, size_t nLength)
+{
+	for (auto &rDevice : s_DeviceMap)
+	{
+		rDevice.second->Send (pMessage, nLength);
+	}
+}
+
 void CMIDIDevice::SendSystemExclusiveVoice(uint8_t nVoice, const unsigned nCable, uint8_t nTG)
 {
   uint8_t voicedump[163];
@@ -29,6 +29,9 @@
 #include <circle/types.h>
 #include <circle/spinlock.h>
 #include "userinterface.h"
+#include "midilog.h"
+#include "midiclock.h"
+#include "perftimer.h"
 
 class CMiniDexed;
 
@@ -53,19 +56,45 @@ public:
 	virtual void Send (const u8 *pMessage, size_t nLength, unsigned nCable = 0) {}
 	virtual void SendSystemExclusiveVoice(uint8_t nVoice, const unsigned nCable, uint8_t nTG);
 
+	static void SendSystemExclusive (const u8 *pMessage, size_t nLength);	// to all devices
+
+	void DumpProfile (void);		// if ProfileEnabled
+
 protected:
 	void MIDIMessageHandler (const u8 *pMessage, size_t nLength, unsigned nCable = 0);
 	void AddDevice (const char *pDeviceName);
 	void HandleSystemExclusive(const uint8_t* pMessage, const size_t nLength, const unsigned nCable, const uint8_t nTG);
+
+	CMIDILog *m_pMIDILog;
+
+private:
+	void UpdateParameterState (u8 ucChannel, u8 ucController, u8 ucValue);
+	void ApplyParameterChange (u8 ucChannel, unsigned nTG);
+
+private:
+	struct TParameterState		// RPN/NRPN state per MIDI channel
+	{
+		bool bNRPN;
+		u8 ucNumberMSB;
+		u8 ucNumberLSB;
+		u8 ucDataMSB;
+		u8 ucDataLSB;
+	};
+
 private:
 	CMiniDexed *m_pSynthesizer;
 	CConfig *m_pConfig;
 	CUserInterface *m_pUI;
+	CMIDIClock *m_pMIDIClock;
 
 	u8 m_ChannelMap[CConfig::ToneGenerators];
 
+	TParameterState m_ParameterState[Channels];
+
 	std::string m_DeviceName;
 
+	CPerformanceTimer *m_pDispatchTimer;	// duration of MIDIMessageHandler()
+
 	typedef std::unordered_map<std::string, CMIDIDevice *> TDeviceMap;
 	static TDeviceMap s_DeviceMap;
 
@@ -0,0 +1,329 @@
+//
+// midilog.cpp
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "midilog.h"
+#include <circle/logger.h>
+#include <circle/timer.h>
+#include <string.h>
+#include <stdio.h>
+#include <assert.h>
+
+LOGMODULE ("midilog");
+
+#define MIDI_SYSTEM_EXCLUSIVE_BEGIN	0xF0
+
+CMIDILog::CMIDILog (void)
+:	m_nIn (0),
+	m_nOut (0),
+	m_nDropped (0),
+	m_nDroppedReported (0)
+{
+	static_assert ((Entries & (Entries-1)) == 0, "Entries must be a power of 2");
+}
+
+CMIDILog::~CMIDILog (void)
+{
+}
+
+void CMIDILog::WriteMessage (const u8 *pMessage, size_t nLength, unsigned nCable)
+{
+	assert (pMessage);
+
+	TEntry Entry;
+	Entry.Type = EntryMessage;
+	Entry.nCable = nCable;
+	Entry.nTG = 0;
+	Entry.nValue = 0;
+	SetData (&Entry, pMessage, nLength, 0);
+
+	Write (Entry);
+}
+
+void CMIDILog::WriteSerialData (const u8 *pData, size_t nLength)
+{
+	assert (pData);
+
+	TEntry Entry;
+	Entry.Type = EntrySerialData;
+	Entry.nCable = 0;
+	Entry.nTG = 0;
+	Entry.nValue = 0;
+
+	// split the block into as many entries as needed
+	for (size_t nOffset = 0; nOffset < nLength; nOffset += MaxEntryData)
+	{
+		SetData (&Entry, pData, nLength, nOffset);
+
+		Write (Entry);
+	}
+}
+
+void CMIDILog::WriteSysExChannel (unsigned nChannel, size_t nLength, unsigned nTG)
+{
+	TEntry Entry;
+	Entry.Type = EntrySysExChannel;
+	Entry.nCable = 0;
+	Entry.nTG = nTG;
+	Entry.nValue = nChannel;
+	SetData (&Entry, 0, nLength, 0);
+
+	Write (Entry);
+}
+
+void CMIDILog::WriteSysExResult (int nResult, const u8 *pMessage, size_t nLength, unsigned nTG)
+{
+	assert (pMessage);
+
+	TEntry Entry;
+	Entry.Type = EntrySysExResult;
+	Entry.nCable = 0;
+	Entry.nTG = nTG;
+	Entry.nValue = nResult;
+	SetData (&Entry, pMessage, nLength, 0);
+
+	Write (Entry);
+}
+
+void CMIDILog::WriteMasterVolume (float fVolume)
+{
+	TEntry Entry;
+	Entry.Type = EntryMasterVolume;
+	Entry.nCable = 0;
+	Entry.nTG = 0;
+	Entry.fValue = fVolume;
+	SetData (&Entry, 0, 0, 0);
+
+	Write (Entry);
+}
+
+void CMIDILog::Flush (void)
+{
+	TEntry Entry;
+	for (unsigned i = 0; i < MaxFlushEntries && Read (&Entry); i++)
+	{
+		Print (Entry);
+	}
+
+	unsigned nDropped = m_nDropped;		// may be incremented from interrupt
+	if (nDropped != m_nDroppedReported)
+	{
+		LOGWARN ("%u MIDI log entries dropped", nDropped - m_nDroppedReported);
+
+		m_nDroppedReported = nDropped;
+	}
+}
+
+unsigned CMIDILog::GetDropped (void) const
+{
+	return m_nDropped;
+}
+
+void CMIDILog::SetData (TEntry *pEntry, const u8 *pData, size_t nLength, size_t nOffset)
+{
+	assert (pEntry);
+
+	pEntry->nLength = nLength;
+	pEntry->nOffset = nOffset;
+	pEntry->nDataLength = 0;
+
+	if (pData && nOffset < nLength)
+	{
+		size_t nDataLength = nLength - nOffset;
+		if (nDataLength > MaxEntryData)
+		{
+			nDataLength = MaxEntryData;
+		}
+
+		memcpy (pEntry->Data, pData + nOffset, nDataLength);
+		pEntry->nDataLength = nDataLength;
+	}
+}
+
+void CMIDILog::Write (const TEntry &rEntry)
+{
+	m_SpinLock.Acquire ();
+
+	if (m_nIn - m_nOut >= Entries)
+	{
+		m_nDropped++;
+
+		m_SpinLock.Release ();
+
+		return;
+	}
+
+	TEntry *pEntry = &m_Entry[m_nIn & (Entries-1)];
+	*pEntry = rEntry;
+	pEntry->nTicks = CTimer::GetClockTicks ();
+
+	m_nIn++;
+
+	m_SpinLock.Release ();
+}
+
+bool CMIDILog::Read (TEntry *pEntry)
+{
+	assert (pEntry);
+
+	m_SpinLock.Acquire ();
+
+	if (m_nIn == m_nOut)
+	{
+		m_SpinLock.Release ();
+
+		return false;
+	}
+
+	*pEntry = m_Entry[m_nOut & (Entries-1)];
+
+	m_nOut++;
+
+	m_SpinLock.Release ();
+
+	return true;
+}
+
+void CMIDILog::Print (const TEntry &rEntry)
+{
+	unsigned nSecs = rEntry.nTicks / CLOCKHZ;
+	unsigned nMicros = (rEntry.nTicks % CLOCKHZ) / (CLOCKHZ / 1000000);
+
+	switch (rEntry.Type)
+	{
+	case EntryMessage:
+		printf ("[%u.%06u] MIDI%u:", nSecs, nMicros, (unsigned) rEntry.nCable);
+
+		if (rEntry.nLength > 3)
+		{
+			if (rEntry.Data[0] != MIDI_SYSTEM_EXCLUSIVE_BEGIN)
+			{
+				printf (" Unhandled MIDI event type 0x%02x\n", (unsigned) rEntry.Data[0]);
+				break;
+			}
+
+			printf (" SysEx data length: [%u]:", (unsigned) rEntry.nLength);
+		}
+
+		for (unsigned i = 0; i < rEntry.nDataLength; i++)
+		{
+			printf (" %02X", (unsigned) rEntry.Data[i]);
+		}
+
+		printf (rEntry.nDataLength < rEntry.nLength ? " ...\n" : "\n");
+		break;
+
+	case EntrySerialData:
+		printf ("[%u.%06u] Incoming MIDI data %04u:", nSecs, nMicros, (unsigned) rEntry.nOffset);
+
+		for (unsigned i = 0; i < rEntry.nDataLength; i++)
+		{
+			printf (" 0x%02x", (unsigned) rEntry.Data[i]);
+		}
+
+		printf ("\n");
+		break;
+
+	case EntrySysExChannel:
+		LOGNOTE ("[%u.%06u] MIDI-SYSEX: channel: %u, len: %u, TG: %u", nSecs, nMicros,
+			 (unsigned) rEntry.nValue, (unsigned) rEntry.nLength, (unsigned) rEntry.nTG);
+		break;
+
+	case EntryMasterVolume:
+		LOGNOTE ("[%u.%06u] Master volume: %f", nSecs, nMicros, rEntry.fValue);
+		break;
+
+	case EntrySysExResult: {
+		// parameter number and value of parameter change messages
+		unsigned nParam = rEntry.nDataLength > 4 ? rEntry.Data[4] : 0;
+		unsigned nValue = rEntry.nDataLength > 5 ? rEntry.Data[5] : 0;
+		unsigned nGroup = rEntry.nDataLength > 3 ? rEntry.Data[3] & 0x03 : 0;
+
+		switch (rEntry.nValue)
+		{
+		case -1:
+			LOGERR ("SysEx end status byte not detected.");
+			break;
+		case -2:
+			LOGERR ("SysEx vendor not Yamaha.");
+			break;
+		case -3:
+			LOGERR ("Unknown SysEx parameter change.");
+			break;
+		case -4:
+			LOGERR ("Unknown SysEx voice or function.");
+			break;
+		case -5:
+			LOGERR ("Not a SysEx voice bulk upload.");
+			break;
+		case -6:
+			LOGERR ("Wrong length for SysEx voice bulk upload (not 155).");
+			break;
+		case -7:
+			LOGERR ("Checksum error for one voice.");
+			break;
+		case -8:
+			LOGERR ("Not a SysEx bank bulk upload.");
+			break;
+		case -9:
+			LOGERR ("Wrong length for SysEx bank bulk upload (not 4096).");
+			break;
+		case -10:
+			LOGERR ("Checksum error for bank.");
+			break;
+		case -11:
+			LOGERR ("Unknown SysEx message.");
+			break;
+		case 100:
+			LOGDBG ("[%u.%06u] TG%u: One Voice bulk upload", nSecs, nMicros,
+				(unsigned) rEntry.nTG);
+			break;
+		case 200:
+			LOGDBG ("[%u.%06u] TG%u: Bank bulk upload.", nSecs, nMicros,
+				(unsigned) rEntry.nTG);
+			break;
+		default:
+			if (64 <= rEntry.nValue && rEntry.nValue <= 77)
+			{
+				LOGDBG ("[%u.%06u] TG%u: SysEx Function parameter change: %u Value %u",
+					nSecs, nMicros, (unsigned) rEntry.nTG, nParam, nValue);
+			}
+			else if (300 <= rEntry.nValue && rEntry.nValue < 500)
+			{
+				LOGDBG ("[%u.%06u] TG%u: SysEx voice parameter change: Parameter %u value: %u",
+					nSecs, nMicros, (unsigned) rEntry.nTG, nParam + nGroup*128, nValue);
+			}
+			else if (500 <= rEntry.nValue && rEntry.nValue < 600)
+			{
+				LOGDBG ("[%u.%06u] TG%u: SysEx send voice %u request", nSecs, nMicros,
+					(unsigned) rEntry.nTG, (unsigned) rEntry.nValue-500);
+			}
+			else
+			{
+				LOGDBG ("[%u.%06u] TG%u: SYSEX handler return value: %d", nSecs, nMicros,
+					(unsigned) rEntry.nTG, rEntry.nValue);
+			}
+			break;
+		}
+		} break;
+
+	default:
+		assert (0);
+		break;
+	}
+}
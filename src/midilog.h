@@ -0,0 +1,105 @@
+//
+// midilog.h
+//
+// Deferred logging of MIDI dump and SysEx diagnostics
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _midilog_h
+#define _midilog_h
+
+#include <stdint.h>
+#include <circle/types.h>
+#include <circle/spinlock.h>
+
+// The MIDI path must not format text or call the logger, because this
+// changes its timing. Instead binary entries with a timestamp are written
+// into a ring buffer here and are formatted later by Flush(), which is
+// called from the core 0 main loop. If the ring is full, entries are
+// dropped and counted.
+
+class CMIDILog
+{
+public:
+	static const unsigned Entries = 256;		// must be a power of 2
+	static const unsigned MaxEntryData = 16;	// bytes of message data kept per entry
+	static const unsigned MaxFlushEntries = 32;	// per call of Flush()
+
+	enum TEntryType
+	{
+		EntryMessage,		// received MIDI message (dump)
+		EntrySerialData,	// raw data read from serial MIDI (dump)
+		EntrySysExChannel,	// SysEx message routed to a TG
+		EntrySysExResult,	// result of CMiniDexed::checkSystemExclusive()
+		EntryMasterVolume,	// master volume SysEx
+		EntryUnknown
+	};
+
+public:
+	CMIDILog (void);
+	~CMIDILog (void);
+
+	// may be called from the MIDI path (task or IRQ level)
+	void WriteMessage (const u8 *pMessage, size_t nLength, unsigned nCable);
+	void WriteSerialData (const u8 *pData, size_t nLength);
+	void WriteSysExChannel (unsigned nChannel, size_t nLength, unsigned nTG);
+	void WriteSysExResult (int nResult, const u8 *pMessage, size_t nLength, unsigned nTG);
+	void WriteMasterVolume (float fVolume);
+
+	// called from core 0 main loop only
+	void Flush (void);
+
+	unsigned GetDropped (void) const;
+
+private:
+	struct TEntry
+	{
+		unsigned nTicks;
+		u8 Type;		// TEntryType
+		u8 nCable;
+		u8 nTG;
+		u8 nDataLength;		// valid bytes in Data[]
+		u16 nLength;		// original length of message
+		u16 nOffset;		// offset of Data[] in message
+		union
+		{
+			int nValue;
+			float fValue;
+		};
+		u8 Data[MaxEntryData];
+	};
+
+	static void SetData (TEntry *pEntry, const u8 *pData, size_t nLength, size_t nOffset);
+
+	void Write (const TEntry &rEntry);
+	bool Read (TEntry *pEntry);
+
+	static void Print (const TEntry &rEntry);
+
+private:
+	TEntry m_Entry[Entries];
+
+	volatile unsigned m_nIn;
+	volatile unsigned m_nOut;
+
+	volatile unsigned m_nDropped;
+	unsigned m_nDroppedReported;
+
+	CSpinLock m_SpinLock;
+};
+
+#endif
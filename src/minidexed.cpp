@@ -24,6 +24,7 @@
 #include <circle/sound/i2ssoundbasedevice.h>
 #include <circle/sound/hdmisoundbasedevice.h>
 #include <circle/gpiopin.h>
+#include <circle/synchronize.h>
 #include <string.h>
 #include <stdio.h>
 #include <assert.h>
@@ -39,6 +40,8 @@ CMiniDexed::CMiniDexed (CConfig *pConfig, CInterruptSystem *pInterrupt,
 	m_pConfig (pConfig),
 	m_UI (this, pGPIOManager, pI2CMaster, pConfig),
 	m_PerformanceConfig (pFileSystem),
+	m_Setlist (&m_PerformanceConfig, &m_SysExFileLoader),
+	m_PerformanceSysEx (this, &m_PerformanceConfig),
 	m_PCKeyboard (this, pConfig, &m_UI),
 	m_SerialMIDI (this, pInterrupt, pConfig, &m_UI),
 	m_bUseSerial (false),
@@ -46,16 +49,28 @@ CMiniDexed::CMiniDexed (CConfig *pConfig, CInterruptSystem *pInterrupt,
 	m_bChannelsSwapped (pConfig->GetChannelsSwapped ()),
 #ifdef ARM_ALLOW_MULTI_CORE
 	m_nActiveTGsLog2 (0),
+	m_bSoundStarted (false),
+	m_bInitFailed (false),
 #endif
 	m_GetChunkTimer ("GetChunk",
 			 1000000U * pConfig->GetChunkSize ()/2 / pConfig->GetSampleRate ()),
 	m_bProfileEnabled (m_pConfig->GetProfileEnabled ()),
 	m_bSavePerformance (false),
 	m_bSavePerformanceNewFile (false),
+	m_bPerformanceSaving (false),
 	m_bSetNewPerformance (false),
+	m_nPendingSetlistEntry (0),
+	m_bSetlistSelectPending (false),
 	m_bDeletePerformance (false),
-	m_bLoadPerformanceBusy(false)
+	m_bLoadPerformanceBusy(false),
+	m_bPerformancePending (false),
+	m_bPerformanceApplied (false),
+	m_bVoiceParametersApplied (false),
+	m_nPerformanceFadeFrames (pConfig->GetPerformanceFadeTime () * pConfig->GetSampleRate () / 1000),
+	m_fPerformanceFadeGain (0.0f)			// fade in on start
 {
+	m_ClockPosition.bRunning = false;
+
 	assert (m_pConfig);
 
 	for (unsigned i = 0; i < CConfig::ToneGenerators; i++)
@@ -63,6 +78,8 @@ CMiniDexed::CMiniDexed (CConfig *pConfig, CInterruptSystem *pInterrupt,
 		m_nVoiceBankID[i] = 0;
 		m_nVoiceBankIDMSB[i] = 0;
 		m_nProgram[i] = 0;
+		m_nPendingProgram[i] = 0;
+		m_bProgramChangePending[i] = false;
 		m_nVolume[i] = 100;
 		m_nPan[i] = 64;
 		m_nMasterTune[i] = 0;
@@ -90,6 +107,7 @@ CMiniDexed::CMiniDexed (CConfig *pConfig, CInterruptSystem *pInterrupt,
 		
 		m_nReverbSend[i] = 0;
 		m_uchOPMask[i] = 0b111111;	// All operators on
+		m_bVoiceParameterQueued[i] = false;
 
 		m_pTG[i] = new CDexedAdapter (CConfig::MaxNotes, pConfig->GetSampleRate ());
 		assert (m_pTG[i]);
@@ -173,6 +191,14 @@ bool CMiniDexed::Initialize (void)
 		return false;
 	}
 
+#ifdef ARM_ALLOW_MULTI_CORE
+	// start secondary cores, they validate the voice banks read by Load()
+	if (!CMultiCoreSupport::Initialize ())
+	{
+		return false;
+	}
+#endif
+
 	m_SysExFileLoader.Load (m_pConfig->GetHeaderlessSysExVoices ());
 
 	if (m_SerialMIDI.Initialize ())
@@ -181,6 +207,8 @@ bool CMiniDexed::Initialize (void)
 
 		m_bUseSerial = true;
 	}
+
+	m_PerformanceSysEx.SetSerialMIDI (m_bUseSerial);
 	
 	if (m_pConfig->GetMIDIRXProgramChange())
 	{
@@ -218,9 +246,13 @@ bool CMiniDexed::Initialize (void)
 		reverb_send_mixer->gain(i,mapfloat(m_nReverbSend[i],0,99,0.0f,1.0f));
 	}
 
+	// complete a save, which has been interrupted by a power loss
+	m_PerformanceConfig.RecoverSave ();
+
 	if (m_PerformanceConfig.Load ())
 	{
 		LoadPerformanceParameters(); 
+		ApplyPendingPerformance ();		// sound is not running yet
 	}
 	else
 	{
@@ -232,12 +264,22 @@ bool CMiniDexed::Initialize (void)
 	{
 		LOGERR ("Cannot create internal Performance folder, new performances can't be created");
 	}
+
+	// start with the first entry of the setlist, if there is one
+	if (m_Setlist.Load ())
+	{
+		SetlistSelect (0);
+	}
 	
 	// setup and start the sound device
 	if (!m_pSoundDevice->AllocateQueueFrames (m_pConfig->GetChunkSize ()))
 	{
 		LOGERR ("Cannot allocate sound queue");
 
+#ifdef ARM_ALLOW_MULTI_CORE
+		m_bInitFailed = true;			// let the secondary cores halt
+#endif
+
 		return false;
 	}
 
@@ -252,11 +294,9 @@ bool CMiniDexed::Initialize (void)
 	m_pSoundDevice->Start ();
 
 #ifdef ARM_ALLOW_MULTI_CORE
-	// start secondary cores
-	if (!CMultiCoreSupport::Initialize ())
-	{
-		return false;
-	}
+	// let the secondary cores start their work
+	DataMemBarrier ();
+	m_bSoundStarted = true;
 #endif
 	
 	return true;
@@ -283,20 +323,64 @@ void CMiniDexed::Process (bool bPlugAndPlayUpdated)
 
 	m_UI.Process ();
 
-	if (m_bSavePerformance)
+	m_MIDILog.Flush ();
+
+	m_SysExFileLoader.Process ();
+
+	if (   m_bPerformanceApplied
+	    || m_bVoiceParametersApplied)
+	{
+		m_bPerformanceApplied = false;
+		m_bVoiceParametersApplied = false;
+
+		m_UI.ParameterChanged ();
+	}
+
+	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
+	{
+		if (m_bProgramChangePending[nTG])
+		{
+			ProgramChange (m_nPendingProgram[nTG], nTG);
+		}
+	}
+
+	if (m_bSetlistSelectPending)
+	{
+		m_bSetlistSelectPending = false;
+
+		SetlistSelect (m_nPendingSetlistEntry);
+		m_UI.ParameterChanged ();
+	}
+
+	// a new save waits, until the previous one has been written
+	if (m_bSavePerformance && !m_PerformanceConfig.IsSaving ())
 	{
-		DoSavePerformance ();
+		if (!DoSavePerformance ())
+		{
+			m_UI.PerformanceSaved (false);
+		}
 
 		m_bSavePerformance = false;
 	}
 
-	if (m_bSavePerformanceNewFile)
+	if (m_bSavePerformanceNewFile && !m_PerformanceConfig.IsSaving ())
 	{
-		DoSavePerformanceNewFile ();
+		if (!DoSavePerformanceNewFile ())
+		{
+			m_UI.PerformanceSaved (false);
+		}
 		m_bSavePerformanceNewFile = false;
 	}
+
+	if (m_bPerformanceSaving && !m_PerformanceConfig.IsSaving ())
+	{
+		m_bPerformanceSaving = false;
+
+		m_UI.PerformanceSaved (   m_PerformanceConfig.GetSaveStatus ()
+				       == CPerformanceConfig::SaveCompleted);
+	}
 	
-	if (m_bSetNewPerformance && !m_bLoadPerformanceBusy)
+	if (m_bSetNewPerformance && !m_bLoadPerformanceBusy && !m_bPerformancePending)
 	{
 		DoSetNewPerformance ();
 		if (m_nSetNewPerformanceID == GetActualPerformanceID())
@@ -306,15 +390,41 @@ void CMiniDexed::Process (bool bPlugAndPlayUpdated)
 		
 	}
 	
-	if(m_bDeletePerformance)
+	if(m_bDeletePerformance && !m_PerformanceConfig.IsSaving ())
 	{
 		DoDeletePerformance ();
 		m_bDeletePerformance = false;
 	}
+
+	if (   !m_bSetNewPerformance
+	    || m_PerformanceConfig.IsSaving ())
+	{
+		m_PerformanceConfig.Process ();
+	}
+
+	if (!m_bSetNewPerformance)
+	{
+		m_Setlist.Process ();
+	}
+
+	m_PerformanceSysEx.Process ();
 		
 	if (m_bProfileEnabled)
 	{
 		m_GetChunkTimer.Dump ();
+		m_MIDIClock.Dump ();
+		m_SysExFileLoader.Dump ();
+		m_PerformanceConfig.Dump ();
+
+		for (unsigned i = 0; i < CConfig::MaxUSBMIDIDevices; i++)
+		{
+			m_pMIDIKeyboard[i]->DumpProfile ();
+		}
+
+		if (m_bUseSerial)
+		{
+			m_SerialMIDI.DumpProfile ();
+		}
 	}
 }
 
@@ -324,6 +434,16 @@ void CMiniDexed::Run (unsigned nCore)
 {
 	assert (1 <= nCore && nCore < CORES);
 
+	m_SysExFileLoader.LoadWorker ();				// returns, when loaded
+
+	while (!m_bSoundStarted)
+	{
+		if (m_bInitFailed)
+		{
+			return;				// core halts
+		}
+	}
+
 	if (nCore == 1)
 	{
 		m_CoreStatus[nCore] = CoreStatusIdle;			// core 1 ready
@@ -383,6 +503,21 @@ CSysExFileLoader *CMiniDexed::GetSysExFileLoader (void)
 	return &m_SysExFileLoader;
 }
 
+CMIDILog *CMiniDexed::GetMIDILog (void)
+{
+	return &m_MIDILog;
+}
+
+CMIDIClock *CMiniDexed::GetMIDIClock (void)
+{
+	return &m_MIDIClock;
+}
+
+const CMIDIClock::TPosition &CMiniDexed::GetClockPosition (void) const
+{
+	return m_ClockPosition;
+}
+
 void CMiniDexed::BankSelect (unsigned nBank, unsigned nTG)
 {
 	nBank=constrain((int)nBank,0,16383);
@@ -394,6 +529,9 @@ void CMiniDexed::BankSelect (unsigned nBank, unsigned nTG)
 		// Only change if we have the bank loaded
 		m_nVoiceBankID[nTG] = nBank;
 
+		// unpack the voices of this bank in the background
+		GetSysExFileLoader ()->PrepareBank (nBank);
+
 		m_UI.ParameterChanged ();
 	}
 }
@@ -426,7 +564,7 @@ void CMiniDexed::BankSelectLSB (unsigned nBankLSB, unsigned nTG)
 	BankSelect(nBank, nTG);
 }
 
-void CMiniDexed::ProgramChange (unsigned nProgram, unsigned nTG)
+void CMiniDexed::ProgramChange (unsigned nProgram, unsigned nTG, bool bTaskLevel)
 {
 	assert (m_pConfig);
 
@@ -457,7 +595,20 @@ void CMiniDexed::ProgramChange (unsigned nProgram, unsigned nTG)
 	m_nProgram[nTG] = nProgram;
 
 	uint8_t Buffer[156];
-	m_SysExFileLoader.GetVoice (m_nVoiceBankID[nTG]+nBankOffset, nProgram, Buffer);
+	if (!m_SysExFileLoader.GetVoice (m_nVoiceBankID[nTG]+nBankOffset, nProgram, Buffer, bTaskLevel))
+	{
+		// bank is not in memory and cannot be read from IRQ, retry from Process()
+		m_nPendingProgram[nTG] = nBankOffset * 32 + nProgram;
+		m_bProgramChangePending[nTG] = true;
+
+		return;
+	}
+	m_bProgramChangePending[nTG] = false;
+
+	// discard voice parameter changes, which have not been applied yet
+	m_VoiceQueueSpinLock.Acquire ();
+	m_bVoiceParameterQueued[nTG] = false;
+	m_VoiceQueueSpinLock.Release ();
 
 	assert (m_pTG[nTG]);
 	m_pTG[nTG]->loadVoiceParameters (Buffer);
@@ -479,6 +630,16 @@ void CMiniDexed::ProgramChangePerformance (unsigned nProgram)
 {
 	if (m_nParameter[ParameterPerformanceSelectChannel] != CMIDIDevice::Disabled)
 	{
+		if (m_Setlist.IsActive ())
+		{
+			// Program Change messages select setlist entries, this
+			// may be called at IRQ level, so it is done in Process()
+			m_nPendingSetlistEntry = nProgram;
+			m_bSetlistSelectPending = true;
+
+			return;
+		}
+
 		// Program Change messages change Performances.
 		unsigned nLastPerformance = m_PerformanceConfig.GetLastPerformance();
 
@@ -571,6 +732,13 @@ void CMiniDexed::SetResonance (int nResonance, unsigned nTG)
 
 
 void CMiniDexed::SetMIDIChannel (uint8_t uchChannel, unsigned nTG)
+{
+	AssignMIDIChannel (uchChannel, nTG);
+
+	m_UI.ParameterChanged ();
+}
+
+void CMiniDexed::AssignMIDIChannel (uint8_t uchChannel, unsigned nTG)
 {
 	assert (nTG < CConfig::ToneGenerators);
 	assert (uchChannel < CMIDIDevice::ChannelUnknown);
@@ -604,8 +772,6 @@ void CMiniDexed::SetMIDIChannel (uint8_t uchChannel, unsigned nTG)
 	static const unsigned Log2[] = {0, 0, 1, 2, 2, 3, 3, 3, 3};
 	m_nActiveTGsLog2 = Log2[nActiveTGs];
 #endif
-
-	m_UI.ParameterChanged ();
 }
 
 void CMiniDexed::keyup (int16_t pitch, unsigned nTG)
@@ -964,6 +1130,74 @@ uint8_t CMiniDexed::GetVoiceParameter (uint8_t uchOffset, unsigned nOP, unsigned
 	return m_pTG[nTG]->getVoiceDataElement (uchOffset);
 }
 
+void CMiniDexed::QueueVoiceParameter (uint8_t uchOffset, uint8_t uchValue, unsigned nOP, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	assert (m_pTG[nTG]);
+	assert (nOP <= 6);
+
+	if (nOP < 6)
+	{
+		if (uchOffset == DEXED_OP_ENABLE)
+		{
+			SetVoiceParameter (uchOffset, uchValue, nOP, nTG);	// no voice refresh
+
+			return;
+		}
+
+		nOP = 5 - nOP;		// OPs are in reverse order
+	}
+
+	uchOffset += nOP * 21;
+	assert (uchOffset < 156);
+
+	m_VoiceQueueSpinLock.Acquire ();
+
+	if (!m_bVoiceParameterQueued[nTG])
+	{
+		m_pTG[nTG]->getVoiceData (m_QueuedVoice[nTG]);
+
+		m_bVoiceParameterQueued[nTG] = true;
+	}
+
+	m_QueuedVoice[nTG][uchOffset] = uchValue;
+
+	m_VoiceQueueSpinLock.Release ();
+}
+
+void CMiniDexed::ApplyQueuedVoiceParameters (void)
+{
+	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
+	{
+		if (!m_bVoiceParameterQueued[nTG])
+		{
+			continue;
+		}
+
+		uint8_t Buffer[156];
+
+		m_VoiceQueueSpinLock.Acquire ();
+
+		bool bQueued = m_bVoiceParameterQueued[nTG];
+		if (bQueued)
+		{
+			memcpy (Buffer, m_QueuedVoice[nTG], sizeof Buffer);
+
+			m_bVoiceParameterQueued[nTG] = false;
+		}
+
+		m_VoiceQueueSpinLock.Release ();
+
+		if (bQueued)
+		{
+			assert (m_pTG[nTG]);
+			m_pTG[nTG]->loadVoiceParameters (Buffer);
+
+			m_bVoiceParametersApplied = true;	// UI is updated by Process()
+		}
+	}
+}
+
 std::string CMiniDexed::GetVoiceName (unsigned nTG)
 {
 	char VoiceName[11];
@@ -992,9 +1226,17 @@ void CMiniDexed::ProcessSound (void)
 			m_GetChunkTimer.Start ();
 		}
 
+		ApplyPendingPerformance ();
+		ApplyQueuedVoiceParameters ();
+
+		// for tempo synced processing
+		m_MIDIClock.GetPosition (m_pConfig->GetSampleRate (), &m_ClockPosition);
+
 		float32_t SampleBuffer[nFrames];
 		m_pTG[0]->getSamples (SampleBuffer, nFrames);
 
+		ApplyPerformanceFade (SampleBuffer, nFrames, 1);
+
 		// Convert single float array (mono) to int16 array
 		int16_t tmp_int[nFrames];
 		arm_float_to_q15(SampleBuffer,tmp_int,nFrames);
@@ -1025,6 +1267,12 @@ void CMiniDexed::ProcessSound (void)
 			m_GetChunkTimer.Start ();
 		}
 
+		ApplyPendingPerformance ();
+		ApplyQueuedVoiceParameters ();
+
+		// for tempo synced processing
+		m_MIDIClock.GetPosition (m_pConfig->GetSampleRate (), &m_ClockPosition);
+
 		m_nFramesToProcess = nFrames;
 
 		// kick secondary cores
@@ -1127,11 +1375,16 @@ void CMiniDexed::ProcessSound (void)
 					tmp_float[(i*2)+1]=SampleBuffer[indexR][i];
 				}
 			}
+			ApplyPerformanceFade (tmp_float, nFrames, 2);
 			arm_float_to_q15(tmp_float,tmp_int,nFrames*2);
 		}
 		else
+		{
 			arm_fill_q15(0, tmp_int, nFrames * 2);
 
+			m_fPerformanceFadeGain = 0.0f;		// is silent anyway
+		}
+
 		if (m_pSoundDevice->Write (tmp_int, sizeof(tmp_int)) != (int) sizeof(tmp_int))
 		{
 			LOGERR ("Sound data dropped");
@@ -1178,7 +1431,7 @@ bool CMiniDexed::SavePerformance (bool bSaveAsDeault)
 	return true;
 }
 
-bool CMiniDexed::DoSavePerformance (void)
+void CMiniDexed::UpdatePerformanceConfig (void)
 {
 	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
 	{
@@ -1223,13 +1476,22 @@ bool CMiniDexed::DoSavePerformance (void)
 	m_PerformanceConfig.SetReverbLowPass (m_nParameter[ParameterReverbLowPass]);
 	m_PerformanceConfig.SetReverbDiffusion (m_nParameter[ParameterReverbDiffusion]);
 	m_PerformanceConfig.SetReverbLevel (m_nParameter[ParameterReverbLevel]);
+}
+
+bool CMiniDexed::DoSavePerformance (void)
+{
+	UpdatePerformanceConfig ();
 
 	if(m_bSaveAsDeault)
 	{
 		m_PerformanceConfig.SetNewPerformance(0);
 		
 	}
-	return m_PerformanceConfig.Save ();
+
+	// the file is written in the background by m_PerformanceConfig.Process()
+	m_bPerformanceSaving = m_PerformanceConfig.Save ();
+
+	return m_bPerformanceSaving;
 }
 
 void CMiniDexed::setMonoMode(uint8_t mono, uint8_t nTG)
@@ -1419,6 +1681,10 @@ void CMiniDexed::loadVoiceParameters(const uint8_t* data, uint8_t nTG)
 			voice[151 + i] = 32;
 	}
 
+	m_VoiceQueueSpinLock.Acquire ();
+	m_bVoiceParameterQueued[nTG] = false;
+	m_VoiceQueueSpinLock.Release ();
+
 	m_pTG[nTG]->loadVoiceParameters(&voice[6]);
 	m_pTG[nTG]->doRefreshVoice();
 	m_UI.ParameterChanged ();
@@ -1510,6 +1776,74 @@ bool CMiniDexed::SetNewPerformance(unsigned nID)
 	return true;
 }
 
+void CMiniDexed::PrefetchPerformance (unsigned nID)
+{
+	m_PerformanceConfig.Prefetch (nID);
+}
+
+void CMiniDexed::ReceivePerformanceSysEx (const uint8_t *pMessage, size_t nLength)
+{
+	m_PerformanceSysEx.Receive (pMessage, nLength);
+}
+
+void CMiniDexed::GetCurrentPerformance (CPerformanceConfig::TPerformance *pPerformance)
+{
+	UpdatePerformanceConfig ();
+
+	m_PerformanceConfig.GetPerformance (pPerformance);
+}
+
+CMiniDexed::TImportResult CMiniDexed::ImportPerformance (
+	const CPerformanceConfig::TPerformance *pPerformance, const std::string &rFileName)
+{
+	if (   m_bSetNewPerformance
+	    || m_bLoadPerformanceBusy
+	    || m_bPerformancePending
+	    || m_PerformanceConfig.IsSaving ())
+	{
+		return ImportBusy;
+	}
+
+	if (!m_PerformanceConfig.ImportPerformance (pPerformance, rFileName))
+	{
+		return ImportRejected;
+	}
+
+	m_bPerformanceSaving = !rFileName.empty ();
+
+	// the performance is applied as a whole at the next block boundary
+	LoadPerformanceParameters ();
+
+	return ImportApplied;
+}
+
+bool CMiniDexed::IsSetlistActive (void) const
+{
+	return m_Setlist.IsActive ();
+}
+
+bool CMiniDexed::SetlistSelect (unsigned nEntry)
+{
+	unsigned nID = m_Setlist.Select (nEntry);
+	if (nID == CPerformanceConfig::NoPerformance)
+	{
+		return false;
+	}
+
+	return SetNewPerformance (nID);
+}
+
+bool CMiniDexed::SetlistStep (int nStep)
+{
+	unsigned nID = m_Setlist.Step (nStep);
+	if (nID == CPerformanceConfig::NoPerformance)
+	{
+		return false;
+	}
+
+	return SetNewPerformance (nID);
+}
+
 bool CMiniDexed::DoSetNewPerformance (void)
 {
 	m_bLoadPerformanceBusy = true;
@@ -1519,7 +1853,7 @@ bool CMiniDexed::DoSetNewPerformance (void)
 	
 	if (m_PerformanceConfig.Load ())
 	{
-		LoadPerformanceParameters();
+		LoadPerformanceParameters(); 
 		m_bLoadPerformanceBusy = false;
 		return true;
 	}
@@ -1560,56 +1894,197 @@ bool CMiniDexed::DoSavePerformanceNewFile (void)
 
 void CMiniDexed::LoadPerformanceParameters(void)
 {
+	assert (!m_bPerformancePending);
+	CPerformanceConfig::TPerformance *pPerformance = &m_PendingPerformance;
+	m_PerformanceConfig.GetPerformance (pPerformance);
+
+	// the voices are looked up here, because banks cannot be read at block boundary
 	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
+	{
+		unsigned nBank = pPerformance->nBankNumber[nTG];
+		if (m_SysExFileLoader.IsValidBank (nBank))
 		{
-			
-			BankSelect (m_PerformanceConfig.GetBankNumber (nTG), nTG);
-			ProgramChange (m_PerformanceConfig.GetVoiceNumber (nTG), nTG);
-			SetMIDIChannel (m_PerformanceConfig.GetMIDIChannel (nTG), nTG);
-			SetVolume (m_PerformanceConfig.GetVolume (nTG), nTG);
-			SetPan (m_PerformanceConfig.GetPan (nTG), nTG);
-			SetMasterTune (m_PerformanceConfig.GetDetune (nTG), nTG);
-			SetCutoff (m_PerformanceConfig.GetCutoff (nTG), nTG);
-			SetResonance (m_PerformanceConfig.GetResonance (nTG), nTG);
-			setPitchbendRange (m_PerformanceConfig.GetPitchBendRange (nTG), nTG);
-			setPitchbendStep (m_PerformanceConfig.GetPitchBendStep (nTG), nTG);
-			setPortamentoMode (m_PerformanceConfig.GetPortamentoMode (nTG), nTG);
-			setPortamentoGlissando (m_PerformanceConfig.GetPortamentoGlissando  (nTG), nTG);
-			setPortamentoTime (m_PerformanceConfig.GetPortamentoTime (nTG), nTG);
-
-			m_nNoteLimitLow[nTG] = m_PerformanceConfig.GetNoteLimitLow (nTG);
-			m_nNoteLimitHigh[nTG] = m_PerformanceConfig.GetNoteLimitHigh (nTG);
-			m_nNoteShift[nTG] = m_PerformanceConfig.GetNoteShift (nTG);
-			
-			if(m_PerformanceConfig.VoiceDataFilled(nTG)) 
-			{
-			uint8_t* tVoiceData = m_PerformanceConfig.GetVoiceDataFromTxt(nTG);
-			m_pTG[nTG]->loadVoiceParameters(tVoiceData); 
-			}
-			setMonoMode(m_PerformanceConfig.GetMonoMode(nTG) ? 1 : 0, nTG); 
-			SetReverbSend (m_PerformanceConfig.GetReverbSend (nTG), nTG);
-					
-			setModWheelRange (m_PerformanceConfig.GetModulationWheelRange (nTG),  nTG);
-			setModWheelTarget (m_PerformanceConfig.GetModulationWheelTarget (nTG),  nTG);
-			setFootControllerRange (m_PerformanceConfig.GetFootControlRange (nTG),  nTG);
-			setFootControllerTarget (m_PerformanceConfig.GetFootControlTarget (nTG),  nTG);
-			setBreathControllerRange (m_PerformanceConfig.GetBreathControlRange (nTG),  nTG);
-			setBreathControllerTarget (m_PerformanceConfig.GetBreathControlTarget (nTG),  nTG);
-			setAftertouchRange (m_PerformanceConfig.GetAftertouchRange (nTG),  nTG);
-			setAftertouchTarget (m_PerformanceConfig.GetAftertouchTarget (nTG),  nTG);
-			
-		
+			// unpack the voices of this bank in the background
+			m_SysExFileLoader.PrepareBank (nBank);
+		}
+		else
+		{
+			nBank = m_nVoiceBankID[nTG];		// like BankSelect()
+		}
+		pPerformance->nBankNumber[nTG] = nBank;
+
+		unsigned nProgram = constrain ((int) pPerformance->nVoiceNumber[nTG], 0, 31);
+		pPerformance->nVoiceNumber[nTG] = nProgram;
+
+		if (!pPerformance->bVoiceDataFilled[nTG])
+		{
+			pPerformance->bVoiceDataFilled[nTG] =
+				m_SysExFileLoader.GetVoice (nBank, nProgram, pPerformance->VoiceData[nTG], true);
+		}
+	}
+
+	DataMemBarrier ();
+
+	m_bPerformancePending = true;
+}
+
+void CMiniDexed::ApplyPendingPerformance (void)
+{
+	if (!m_bPerformancePending)
+	{
+		return;
+	}
+
+	if (   m_nPerformanceFadeFrames
+	    && m_fPerformanceFadeGain > 0.0f)
+	{
+		return;				// fade out first
+	}
+
+	DataMemBarrier ();
+
+	ApplyPerformance (&m_PendingPerformance);
+
+	DataMemBarrier ();
+
+	m_bPerformancePending = false;
+	m_bPerformanceApplied = true;
+}
+
+void CMiniDexed::ApplyPerformance (const CPerformanceConfig::TPerformance *pPerformance)
+{
+	assert (pPerformance);
+
+	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
+	{
+		CDexedAdapter *pTG = m_pTG[nTG];
+		assert (pTG);
+
+		m_nVoiceBankID[nTG] = pPerformance->nBankNumber[nTG];
+		m_nProgram[nTG] = pPerformance->nVoiceNumber[nTG];
+		m_bProgramChangePending[nTG] = false;
+
+		// discard voice parameter changes, which have not been applied yet
+		m_VoiceQueueSpinLock.Acquire ();
+		m_bVoiceParameterQueued[nTG] = false;
+		m_VoiceQueueSpinLock.Release ();
+
+		if (pPerformance->bVoiceDataFilled[nTG])
+		{
+			pTG->loadVoiceParameters ((uint8_t *) pPerformance->VoiceData[nTG]);
 		}
 
-		// Effects
-		SetParameter (ParameterCompressorEnable, m_PerformanceConfig.GetCompressorEnable () ? 1 : 0);
-		SetParameter (ParameterReverbEnable, m_PerformanceConfig.GetReverbEnable () ? 1 : 0);
-		SetParameter (ParameterReverbSize, m_PerformanceConfig.GetReverbSize ());
-		SetParameter (ParameterReverbHighDamp, m_PerformanceConfig.GetReverbHighDamp ());
-		SetParameter (ParameterReverbLowDamp, m_PerformanceConfig.GetReverbLowDamp ());
-		SetParameter (ParameterReverbLowPass, m_PerformanceConfig.GetReverbLowPass ());
-		SetParameter (ParameterReverbDiffusion, m_PerformanceConfig.GetReverbDiffusion ());
-		SetParameter (ParameterReverbLevel, m_PerformanceConfig.GetReverbLevel ());
+		AssignMIDIChannel (pPerformance->nMIDIChannel[nTG], nTG);
+
+		m_nVolume[nTG] = constrain ((int) pPerformance->nVolume[nTG], 0, 127);
+		pTG->setGain (m_nVolume[nTG] / 127.0f);
+
+		m_nPan[nTG] = constrain ((int) pPerformance->nPan[nTG], 0, 127);
+		tg_mixer->pan (nTG, mapfloat (m_nPan[nTG], 0, 127, 0.0f, 1.0f));
+		reverb_send_mixer->pan (nTG, mapfloat (m_nPan[nTG], 0, 127, 0.0f, 1.0f));
+
+		m_nReverbSend[nTG] = constrain ((int) pPerformance->nReverbSend[nTG], 0, 99);
+		reverb_send_mixer->gain (nTG, mapfloat (m_nReverbSend[nTG], 0, 99, 0.0f, 1.0f));
+
+		m_nMasterTune[nTG] = constrain (pPerformance->nDetune[nTG], -99, 99);
+		pTG->setMasterTune ((int8_t) m_nMasterTune[nTG]);
+
+		m_nCutoff[nTG] = constrain ((int) pPerformance->nCutoff[nTG], 0, 99);
+		pTG->setFilterCutoff (mapfloat (m_nCutoff[nTG], 0, 99, 0.0f, 1.0f));
+
+		m_nResonance[nTG] = constrain ((int) pPerformance->nResonance[nTG], 0, 99);
+		pTG->setFilterResonance (mapfloat (m_nResonance[nTG], 0, 99, 0.0f, 1.0f));
+
+		m_nPitchBendRange[nTG] = constrain ((int) pPerformance->nPitchBendRange[nTG], 0, 12);
+		pTG->setPitchbendRange (m_nPitchBendRange[nTG]);
+
+		m_nPitchBendStep[nTG] = constrain ((int) pPerformance->nPitchBendStep[nTG], 0, 12);
+		pTG->setPitchbendStep (m_nPitchBendStep[nTG]);
+
+		m_nPortamentoMode[nTG] = constrain ((int) pPerformance->nPortamentoMode[nTG], 0, 1);
+		pTG->setPortamentoMode (m_nPortamentoMode[nTG]);
+
+		m_nPortamentoGlissando[nTG] = constrain ((int) pPerformance->nPortamentoGlissando[nTG], 0, 1);
+		pTG->setPortamentoGlissando (m_nPortamentoGlissando[nTG]);
+
+		m_nPortamentoTime[nTG] = constrain ((int) pPerformance->nPortamentoTime[nTG], 0, 99);
+		pTG->setPortamentoTime (m_nPortamentoTime[nTG]);
+
+		m_nNoteLimitLow[nTG] = pPerformance->nNoteLimitLow[nTG];
+		m_nNoteLimitHigh[nTG] = pPerformance->nNoteLimitHigh[nTG];
+		m_nNoteShift[nTG] = pPerformance->nNoteShift[nTG];
+
+		m_bMonoMode[nTG] = pPerformance->bMonoMode[nTG];
+		pTG->setMonoMode (m_bMonoMode[nTG] ? 1 : 0);
+
+		m_nModulationWheelRange[nTG] = pPerformance->nModulationWheelRange[nTG];
+		pTG->setMWController (m_nModulationWheelRange[nTG], pTG->getModWheelTarget (), 0);
+		m_nModulationWheelTarget[nTG] = pPerformance->nModulationWheelTarget[nTG];
+		pTG->setModWheelTarget (constrain ((int) m_nModulationWheelTarget[nTG], 0, 7));
+
+		m_nFootControlRange[nTG] = pPerformance->nFootControlRange[nTG];
+		pTG->setFCController (m_nFootControlRange[nTG], pTG->getFootControllerTarget (), 0);
+		m_nFootControlTarget[nTG] = pPerformance->nFootControlTarget[nTG];
+		pTG->setFootControllerTarget (constrain ((int) m_nFootControlTarget[nTG], 0, 7));
+
+		m_nBreathControlRange[nTG] = pPerformance->nBreathControlRange[nTG];
+		pTG->setBCController (m_nBreathControlRange[nTG], pTG->getBreathControllerTarget (), 0);
+		m_nBreathControlTarget[nTG] = pPerformance->nBreathControlTarget[nTG];
+		pTG->setBreathControllerTarget (constrain ((int) m_nBreathControlTarget[nTG], 0, 7));
+
+		m_nAftertouchRange[nTG] = pPerformance->nAftertouchRange[nTG];
+		pTG->setATController (m_nAftertouchRange[nTG], pTG->getAftertouchTarget (), 0);
+		m_nAftertouchTarget[nTG] = pPerformance->nAftertouchTarget[nTG];
+		pTG->setAftertouchTarget (constrain ((int) m_nAftertouchTarget[nTG], 0, 7));
+
+		// refresh once, instead of once per parameter
+		pTG->doRefreshVoice ();
+		pTG->ControllersRefresh ();
+	}
+
+	// Effects
+	SetParameter (ParameterCompressorEnable, pPerformance->bCompressorEnable ? 1 : 0);
+	SetParameter (ParameterReverbEnable, pPerformance->bReverbEnable ? 1 : 0);
+	SetParameter (ParameterReverbSize, pPerformance->nReverbSize);
+	SetParameter (ParameterReverbHighDamp, pPerformance->nReverbHighDamp);
+	SetParameter (ParameterReverbLowDamp, pPerformance->nReverbLowDamp);
+	SetParameter (ParameterReverbLowPass, pPerformance->nReverbLowPass);
+	SetParameter (ParameterReverbDiffusion, pPerformance->nReverbDiffusion);
+	SetParameter (ParameterReverbLevel, pPerformance->nReverbLevel);
+}
+
+// fades out while a performance is pending, and in again afterwards
+void CMiniDexed::ApplyPerformanceFade (float32_t *pSamples, unsigned nFrames, unsigned nChannels)
+{
+	assert (pSamples);
+
+	if (!m_nPerformanceFadeFrames)
+	{
+		return;
+	}
+
+	float32_t fStep = 1.0f / m_nPerformanceFadeFrames;
+	if (m_bPerformancePending)
+	{
+		fStep = -fStep;
+	}
+	else if (m_fPerformanceFadeGain >= 1.0f)
+	{
+		return;
+	}
+
+	float32_t fGain = m_fPerformanceFadeGain;
+	for (unsigned i = 0; i < nFrames; i++)
+	{
+		fGain = constrain (fGain + fStep, 0.0f, 1.0f);
+
+		for (unsigned j = 0; j < nChannels; j++)
+		{
+			*pSamples++ *= fGain;
+		}
+	}
+
+	m_fPerformanceFadeGain = fGain;
 }
 
 std::string CMiniDexed::GetNewPerformanceDefaultName(void)	
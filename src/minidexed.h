@@ -25,10 +25,14 @@
 #include "userinterface.h"
 #include "sysexfileloader.h"
 #include "performanceconfig.h"
+#include "setlist.h"
+#include "performancesysex.h"
 #include "midikeyboard.h"
 #include "pckeyboard.h"
 #include "serialmididevice.h"
 #include "perftimer.h"
+#include "midilog.h"
+#include "midiclock.h"
 #include <fatfs/ff.h>
 #include <stdint.h>
 #include <string>
@@ -62,11 +66,16 @@ public:
 #endif
 
 	CSysExFileLoader *GetSysExFileLoader (void);
+	CMIDILog *GetMIDILog (void);
+	CMIDIClock *GetMIDIClock (void);
+	// clock position at the start of the current block, for tempo synced
+	// processing in the audio path (valid during ProcessSound() only)
+	const CMIDIClock::TPosition &GetClockPosition (void) const;
 
 	void BankSelect    (unsigned nBank, unsigned nTG);
 	void BankSelectMSB (unsigned nBankMSB, unsigned nTG);
 	void BankSelectLSB (unsigned nBankLSB, unsigned nTG);
-	void ProgramChange (unsigned nProgram, unsigned nTG);
+	void ProgramChange (unsigned nProgram, unsigned nTG, bool bTaskLevel = true);	// false with IRQs disabled
 	void ProgramChangePerformance (unsigned nProgram);
 	void SetVolume (unsigned nVolume, unsigned nTG);
 	void SetPan (unsigned nPan, unsigned nTG);			// 0 .. 127
@@ -120,6 +129,7 @@ public:
 	unsigned GetActualPerformanceID();
 	void SetActualPerformanceID(unsigned nID);
 	bool SetNewPerformance(unsigned nID);
+	void PrefetchPerformance (unsigned nID);	// keep in memory for fast switching
 	bool SavePerformanceNewFile ();
 	
 	bool DoSavePerformanceNewFile (void);
@@ -129,6 +139,24 @@ public:
 	unsigned GetPerformanceSelectChannel (void);
 	void SetPerformanceSelectChannel (unsigned uCh);
 
+	// performance dumps via SysEx, see performancesysex.cpp
+	void ReceivePerformanceSysEx (const uint8_t *pMessage, size_t nLength);	// task or IRQ level
+	void GetCurrentPerformance (CPerformanceConfig::TPerformance *pPerformance);
+	// applies the performance and saves it, if rFileName is not empty
+	enum TImportResult
+	{
+		ImportApplied,
+		ImportBusy,			// try again later
+		ImportRejected			// invalid file name or no space left
+	};
+	TImportResult ImportPerformance (const CPerformanceConfig::TPerformance *pPerformance,
+					 const std::string &rFileName);
+
+	// setlist.txt in the performance folder, entries are counted from 0
+	bool IsSetlistActive (void) const;
+	bool SetlistSelect (unsigned nEntry);
+	bool SetlistStep (int nStep);		// -1 or +1
+
 	// Must match the order in CUIMenu::TParameter
 	enum TParameter
 	{
@@ -204,11 +232,15 @@ public:
 	static const unsigned NoOP = 6;		// for global parameters
 	void SetVoiceParameter (uint8_t uchOffset, uint8_t uchValue, unsigned nOP, unsigned nTG);
 	uint8_t GetVoiceParameter (uint8_t uchOffset, unsigned nOP, unsigned nTG);
+	// like SetVoiceParameter(), but applied at the next block boundary,
+	// multiple changes per block result in one voice refresh only
+	void QueueVoiceParameter (uint8_t uchOffset, uint8_t uchValue, unsigned nOP, unsigned nTG);
 
 	std::string GetVoiceName (unsigned nTG);
 
 	bool SavePerformance (void);
 	bool DoSavePerformance (void);
+	void UpdatePerformanceConfig (void);	// from the current TG and effect settings
 
 	void setMasterVolume (float32_t vol);
 
@@ -217,6 +249,13 @@ private:
 	uint8_t m_uchOPMask[CConfig::ToneGenerators];
 	void LoadPerformanceParameters(void); 
 	void ProcessSound (void);
+	void ApplyQueuedVoiceParameters (void);
+	// the performance prepared by LoadPerformanceParameters() is applied
+	// as a whole at a block boundary, after fading out if enabled
+	void ApplyPendingPerformance (void);
+	void ApplyPerformance (const CPerformanceConfig::TPerformance *pPerformance);
+	void ApplyPerformanceFade (float32_t *pSamples, unsigned nFrames, unsigned nChannels);
+	void AssignMIDIChannel (uint8_t uchChannel, unsigned nTG);	// without UI update
 
 #ifdef ARM_ALLOW_MULTI_CORE
 	enum TCoreStatus
@@ -239,6 +278,8 @@ private:
 	unsigned m_nVoiceBankID[CConfig::ToneGenerators];
 	unsigned m_nVoiceBankIDMSB[CConfig::ToneGenerators];
 	unsigned m_nProgram[CConfig::ToneGenerators];
+	unsigned m_nPendingProgram[CConfig::ToneGenerators];		// deferred ProgramChange()
+	volatile bool m_bProgramChangePending[CConfig::ToneGenerators];
 	unsigned m_nVolume[CConfig::ToneGenerators];
 	unsigned m_nPan[CConfig::ToneGenerators];
 	int m_nMasterTune[CConfig::ToneGenerators];
@@ -272,9 +313,15 @@ private:
 	
 	float32_t nMasterVolume;
 
+	CMIDILog m_MIDILog;
+	CMIDIClock m_MIDIClock;
+	CMIDIClock::TPosition m_ClockPosition;		// at start of current block
+
 	CUserInterface m_UI;
 	CSysExFileLoader m_SysExFileLoader;
 	CPerformanceConfig m_PerformanceConfig;
+	CSetlist m_Setlist;
+	CPerformanceSysEx m_PerformanceSysEx;
 
 	CMIDIKeyboard *m_pMIDIKeyboard[CConfig::MaxUSBMIDIDevices];
 	CPCKeyboard m_PCKeyboard;
@@ -288,6 +335,8 @@ private:
 #ifdef ARM_ALLOW_MULTI_CORE
 	unsigned m_nActiveTGsLog2;
 	volatile TCoreStatus m_CoreStatus[CORES];
+	volatile bool m_bSoundStarted;		// secondary cores help loading before
+	volatile bool m_bInitFailed;		// secondary cores halt then
 	volatile unsigned m_nFramesToProcess;
 	float32_t m_OutputLevel[CConfig::ToneGenerators][CConfig::MaxChunkSize];
 #endif
@@ -301,14 +350,28 @@ private:
 
 	CSpinLock m_ReverbSpinLock;
 
+	uint8_t m_QueuedVoice[CConfig::ToneGenerators][156];
+	volatile bool m_bVoiceParameterQueued[CConfig::ToneGenerators];
+	CSpinLock m_VoiceQueueSpinLock;
+
 	bool m_bSavePerformance;
 	bool m_bSavePerformanceNewFile;
+	bool m_bPerformanceSaving;		// written in background, result not reported yet
 	bool m_bSetNewPerformance;
 	unsigned m_nSetNewPerformanceID;	
+	volatile unsigned m_nPendingSetlistEntry;	// from Program Change, selected by Process()
+	volatile bool m_bSetlistSelectPending;
 	bool	m_bDeletePerformance;
 	unsigned m_nDeletePerformanceID;
 	bool m_bLoadPerformanceBusy;
 	bool m_bSaveAsDeault;
+
+	CPerformanceConfig::TPerformance m_PendingPerformance;	// with voices of all TGs
+	volatile bool m_bPerformancePending;		// set by Process(), reset by ProcessSound()
+	volatile bool m_bPerformanceApplied;		// UI update pending
+	volatile bool m_bVoiceParametersApplied;	// by ProcessSound(), UI update pending
+	unsigned m_nPerformanceFadeFrames;		// 0 to switch without fade
+	float32_t m_fPerformanceFadeGain;
 };
 
 #endif
@@ -21,883 +21,2816 @@
 // along with this program.  If not, see <http://www.gnu.org/licenses/>.
 //
 #include <circle/logger.h>
+#include <circle/macros.h>
+#include <circle/timer.h>
 #include "performanceconfig.h"
 #include "mididevice.h"
+#include "sysexfileloader.h"
 #include <cstring> 
+#include <stdio.h>
+#include <strings.h>
+#include <ctype.h>
 #include <algorithm>
 
 LOGMODULE ("Performance");
 
+// A binary snapshot (extension .bin) is written next to each performance
+// INI file, so that switching performances does not need to parse the INI
+// file. It is loaded with a single read and is ignored, if its checksum
+// (FNV-1a over the whole file before it) is wrong or if size and time of
+// the INI file have changed since it was written. It is not portable
+// between builds with different CConfig::ToneGenerators.
+
+#define SNAPSHOT_MAGIC		"MDXP"
+
+struct TSnapshot
+{
+	char	Magic[4];
+	uint32_t nVersion;
+	uint32_t nPerformanceSize;		// sizeof (TPerformance)
+	uint32_t nINISize;
+	uint32_t nINITime;			// fdate << 16 | ftime
+	CPerformanceConfig::TPerformance Performance;
+	uint32_t nChecksum;
+}
+PACKED;
+
+// A performance INI file is not written directly, but a journal is written
+// before (SD:/performance.jnl), which contains the name of the INI file and
+// all chunks of it, which have changed. Only after the journal has been
+// closed, the chunks are written to the INI file and the journal is deleted.
+// If the power is lost meanwhile, a valid journal is replayed on the next
+// boot and an invalid one is deleted, because the INI file has not been
+// touched yet. This way an INI file is always either old or new, never
+// partly written. A journal, which holds only the changed chunks, is
+// replayed only onto the existing INI file, if its size is in the range of
+// the old and new size and the unchanged chunks have the expected checksum.
+// Otherwise it would create a partly zero-filled file, so it is discarded.
+//
+// TJournalHeader
+// name of the INI file (not terminated)
+// TJournalEntry + data, for each chunk
+// uint32_t checksum
+
+#define JOURNAL_MAGIC		"MDXJ"
+#define JOURNAL_FILE		"SD:/performance.jnl"
+
+struct TJournalHeader
+{
+	char	Magic[4];
+	uint32_t nVersion;
+	uint32_t nFileSize;			// of the INI file
+	uint32_t nNameLength;
+	uint32_t nEntries;
+	uint32_t nFlags;
+#define JOURNAL_FLAG_FULL	(1 << 0)	// all chunks of the file, may be created
+	uint32_t nOldFileSize;			// if not full
+	uint32_t nChunkSize;
+	uint32_t nUnchangedChecksum;		// of the chunks, which are not in the journal
+}
+PACKED;
+
+struct TJournalEntry
+{
+	uint32_t nOffset;
+	uint32_t nLength;
+}
+PACKED;
+
+// The directory index caches the scan of the performance directory, so
+// that all performances are available immediately on boot. It is verified
+// by a scan in the background and is rewritten, if performance files have
+// been added or removed on the SD card meanwhile. Performances can be put
+// into folders (banks) inside the performance directory. It is ignored, if
+// its checksum (FNV-1a over the whole file before it) is wrong.
+//
+// TDirectoryHeader
+// path relative to performance directory (null terminated), sorted, for each performance
+// uint32_t checksum
+
+#define DIRECTORY_MAGIC		"MDXD"
+#define DIRECTORY_INDEX		"SD:/" PERFORMANCE_DIR "/performance.idx"
+#define DIRECTORY_INDEX_TEMP	DIRECTORY_INDEX ".tmp"	// renamed to DIRECTORY_INDEX, when complete
+#define SCRATCH_FILE		"SD:/" PERFORMANCE_DIR "/scratch.tmp"
+
+struct TDirectoryHeader
+{
+	char	Magic[4];
+	uint32_t nVersion;
+	uint32_t nEntries;		// without the default performance
+}
+PACKED;
+
+// returns true, if the value has changed
+template <typename T>
+static inline bool Assign (T *pVariable, T Value)
+{
+	if (*pVariable == Value)
+	{
+		return false;
+	}
+
+	*pVariable = Value;
+
+	return true;
+}
+
 CPerformanceConfig::CPerformanceConfig (FATFS *pFileSystem)
-:	m_Properties ("performance.ini", pFileSystem)
+:	m_Properties ("performance.ini", pFileSystem),
+	m_FileName ("performance.ini"),
+	m_SaveState (SaveStateIdle),
+	m_SaveStatus (SaveIdle),
+	m_bSaveChanged (false),
+	m_bJournalFull (false),
+	m_nSaveOffset (0),
+	m_nSaveTG (0),
+	m_nSaveChunk (0),
+	m_nSaveStartTicks (0),
+	m_nPrefetchUse (0),
+	m_nPrefetchRequests (0),
+	m_bPrefetchPending (false),
+	m_nStringGarbage (0),
+	m_nDirectoryGeneration (0),
+	m_bScanning (false),
+	m_nScanDepth (0),
+	m_nScanStartTicks (0),
+	m_bDirectoryChanged (false),
+	m_bIndexWriting (false),
+	m_nIndexID (0),
+	m_nIndexChecksum (0),
+	nLastFileIndex (0)
 {
 	m_pFileSystem = pFileSystem; 
+
+	memset (&m_Performance, 0, sizeof m_Performance);
+	SetAllDirty ();
+
+	memset (&m_Statistics, 0, sizeof m_Statistics);
+	m_nLastDumpTicks = 0;
+	m_nLastDumpCount = 0;
+
+	ClearDirectory ();
+
+	InvalidatePrefetched (NoPerformance);
 }
 
 CPerformanceConfig::~CPerformanceConfig (void)
 {
+	if (m_bIndexWriting)
+	{
+		f_close (&m_IndexFile);
+	}
 }
 
 bool CPerformanceConfig::Load (void)
 {
-	if (!m_Properties.Load ())
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+	m_Statistics.nLoads++;
+
+	TPrefetchSlot *pSlot = FindPrefetched (nActualPerformance);
+	if (   m_SaveState != SaveStateIdle
+	    && m_FileName == m_SaveFileName)
+	{
+		// the file is being written, use the values to be saved
+		memcpy (&m_Performance, &m_SavePerformance, sizeof m_Performance);
+	}
+	else if (pSlot)
+	{
+		memcpy (&m_Performance, &pSlot->Performance, sizeof m_Performance);
+		pSlot->nLastUse = ++m_nPrefetchUse;
+
+		m_Statistics.nPrefetchHits++;
+	}
+	else if (!LoadPerformance (m_FileName, &m_Properties, &m_Performance))
+	{
+		SetAllDirty ();
+
+		return false;
+	}
+
+	unsigned nTicks = CTimer::GetClockTicks () - nStartTicks;
+	m_Statistics.nLoadTicks += nTicks;
+	if (nTicks > m_Statistics.nLoadTicksMax)
+	{
+		m_Statistics.nLoadTicksMax = nTicks;
+	}
+
+	ClearDirty ();				// same as in the file
+
+	// the performance is valid, if at least one TG is not disabled
+	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
+	{
+		if (m_Performance.nMIDIChannel[nTG] != CMIDIDevice::Disabled)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool CPerformanceConfig::LoadPerformance (const std::string &rFileName,
+					  CPropertiesFatFsFile *pProperties, TPerformance *pPerformance)
+{
+	assert (pProperties);
+	assert (pPerformance);
+
+	FILINFO FileInfo;
+	if (f_stat (rFileName.c_str (), &FileInfo) != FR_OK)
 	{
 		return false;
 	}
 
-	bool bResult = false;
+	if (!ReadSnapshot (rFileName, &FileInfo, pPerformance))
+	{
+		if (!LoadProperties (pProperties, pPerformance))
+		{
+			return false;
+		}
+
+		m_Statistics.nINIParses++;
+
+		WriteSnapshot (rFileName, pPerformance);
+	}
+	else
+	{
+		m_Statistics.nSnapshotReads++;
+	}
+
+	return true;
+}
+
+bool CPerformanceConfig::LoadProperties (CPropertiesFatFsFile *pProperties,
+					 TPerformance *pPerformance)
+{
+	assert (pProperties);
+	assert (pPerformance);
+
+	if (!pProperties->Load ())
+	{
+		return false;
+	}
 
 	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
 	{
 		CString PropertyName;
 
 		PropertyName.Format ("BankNumber%u", nTG+1);
-		m_nBankNumber[nTG] = m_Properties.GetNumber (PropertyName, 0);
+		pPerformance->nBankNumber[nTG] = pProperties->GetNumber (PropertyName, 0);
 
 		PropertyName.Format ("VoiceNumber%u", nTG+1);
-		m_nVoiceNumber[nTG] = m_Properties.GetNumber (PropertyName, 1);
-		if (m_nVoiceNumber[nTG] > 0)
+		pPerformance->nVoiceNumber[nTG] = pProperties->GetNumber (PropertyName, 1);
+		if (pPerformance->nVoiceNumber[nTG] > 0)
 		{
-			m_nVoiceNumber[nTG]--;
+			pPerformance->nVoiceNumber[nTG]--;
 		}
 
 		PropertyName.Format ("MIDIChannel%u", nTG+1);
-		unsigned nMIDIChannel = m_Properties.GetNumber (PropertyName, 255);
+		unsigned nMIDIChannel = pProperties->GetNumber (PropertyName, 255);
 		if (nMIDIChannel == 0)
 		{
-			m_nMIDIChannel[nTG] = CMIDIDevice::Disabled;
+			pPerformance->nMIDIChannel[nTG] = CMIDIDevice::Disabled;
 		}
 		else if (nMIDIChannel <= CMIDIDevice::Channels)
 		{
-			m_nMIDIChannel[nTG] = nMIDIChannel-1;
-			bResult = true;
+			pPerformance->nMIDIChannel[nTG] = nMIDIChannel-1;
 		}
 		else
 		{
-			m_nMIDIChannel[nTG] = CMIDIDevice::OmniMode;
-			bResult = true;
+			pPerformance->nMIDIChannel[nTG] = CMIDIDevice::OmniMode;
 		}
 
 		PropertyName.Format ("Volume%u", nTG+1);
-		m_nVolume[nTG] = m_Properties.GetNumber (PropertyName, 100);
+		pPerformance->nVolume[nTG] = pProperties->GetNumber (PropertyName, 100);
 
 		PropertyName.Format ("Pan%u", nTG+1);
-		m_nPan[nTG] = m_Properties.GetNumber (PropertyName, 64);
+		pPerformance->nPan[nTG] = pProperties->GetNumber (PropertyName, 64);
 
 		PropertyName.Format ("Detune%u", nTG+1);
-		m_nDetune[nTG] = m_Properties.GetSignedNumber (PropertyName, 0);
+		pPerformance->nDetune[nTG] = pProperties->GetSignedNumber (PropertyName, 0);
 
 		PropertyName.Format ("Cutoff%u", nTG+1);
-		m_nCutoff[nTG] = m_Properties.GetNumber (PropertyName, 99);
+		pPerformance->nCutoff[nTG] = pProperties->GetNumber (PropertyName, 99);
 
 		PropertyName.Format ("Resonance%u", nTG+1);
-		m_nResonance[nTG] = m_Properties.GetNumber (PropertyName, 0);
+		pPerformance->nResonance[nTG] = pProperties->GetNumber (PropertyName, 0);
 
 		PropertyName.Format ("NoteLimitLow%u", nTG+1);
-		m_nNoteLimitLow[nTG] = m_Properties.GetNumber (PropertyName, 0);
+		pPerformance->nNoteLimitLow[nTG] = pProperties->GetNumber (PropertyName, 0);
 
 		PropertyName.Format ("NoteLimitHigh%u", nTG+1);
-		m_nNoteLimitHigh[nTG] = m_Properties.GetNumber (PropertyName, 127);
+		pPerformance->nNoteLimitHigh[nTG] = pProperties->GetNumber (PropertyName, 127);
 
 		PropertyName.Format ("NoteShift%u", nTG+1);
-		m_nNoteShift[nTG] = m_Properties.GetSignedNumber (PropertyName, 0);
+		pPerformance->nNoteShift[nTG] = pProperties->GetSignedNumber (PropertyName, 0);
 
 		PropertyName.Format ("ReverbSend%u", nTG+1);
-		m_nReverbSend[nTG] = m_Properties.GetNumber (PropertyName, 50);
+		pPerformance->nReverbSend[nTG] = pProperties->GetNumber (PropertyName, 50);
 		
 		PropertyName.Format ("PitchBendRange%u", nTG+1);
-		m_nPitchBendRange[nTG] = m_Properties.GetNumber (PropertyName, 2);
+		pPerformance->nPitchBendRange[nTG] = pProperties->GetNumber (PropertyName, 2);
 
 		PropertyName.Format ("PitchBendStep%u", nTG+1);
-		m_nPitchBendStep[nTG] = m_Properties.GetNumber (PropertyName, 0);
+		pPerformance->nPitchBendStep[nTG] = pProperties->GetNumber (PropertyName, 0);
 
 		PropertyName.Format ("PortamentoMode%u", nTG+1);
-		m_nPortamentoMode[nTG] = m_Properties.GetNumber (PropertyName, 0);
+		pPerformance->nPortamentoMode[nTG] = pProperties->GetNumber (PropertyName, 0);
 
 		PropertyName.Format ("PortamentoGlissando%u", nTG+1);
-		m_nPortamentoGlissando[nTG] = m_Properties.GetNumber (PropertyName, 0);
+		pPerformance->nPortamentoGlissando[nTG] = pProperties->GetNumber (PropertyName, 0);
 
 		PropertyName.Format ("PortamentoTime%u", nTG+1);
-		m_nPortamentoTime[nTG] = m_Properties.GetNumber (PropertyName, 0);
+		pPerformance->nPortamentoTime[nTG] = pProperties->GetNumber (PropertyName, 0);
 		
 		PropertyName.Format ("VoiceData%u", nTG+1); 
-		m_nVoiceDataTxt[nTG] = m_Properties.GetString (PropertyName, "");
+		pPerformance->bVoiceDataFilled[nTG] =
+			ParseVoiceData (pProperties->GetString (PropertyName, ""),
+					pPerformance->VoiceData[nTG]);
 		
 		PropertyName.Format ("MonoMode%u", nTG+1);
-		m_bMonoMode[nTG] = m_Properties.GetNumber (PropertyName, 0) != 0;
+		pPerformance->bMonoMode[nTG] = pProperties->GetNumber (PropertyName, 0) != 0;
 				
 		PropertyName.Format ("ModulationWheelRange%u", nTG+1);
-		m_nModulationWheelRange[nTG] = m_Properties.GetNumber (PropertyName, 99); 
+		pPerformance->nModulationWheelRange[nTG] = pProperties->GetNumber (PropertyName, 99); 
 		
 		PropertyName.Format ("ModulationWheelTarget%u", nTG+1);
-		m_nModulationWheelTarget[nTG] = m_Properties.GetNumber (PropertyName, 1);
+		pPerformance->nModulationWheelTarget[nTG] = pProperties->GetNumber (PropertyName, 1);
 		
 		PropertyName.Format ("FootControlRange%u", nTG+1);
-		m_nFootControlRange[nTG] = m_Properties.GetNumber (PropertyName, 99); 
+		pPerformance->nFootControlRange[nTG] = pProperties->GetNumber (PropertyName, 99); 
 		
 		PropertyName.Format ("FootControlTarget%u", nTG+1);
-		m_nFootControlTarget[nTG] = m_Properties.GetNumber (PropertyName, 0);
+		pPerformance->nFootControlTarget[nTG] = pProperties->GetNumber (PropertyName, 0);
 		
 		PropertyName.Format ("BreathControlRange%u", nTG+1);
-		m_nBreathControlRange[nTG] = m_Properties.GetNumber (PropertyName, 99); 
+		pPerformance->nBreathControlRange[nTG] = pProperties->GetNumber (PropertyName, 99); 
 		
 		PropertyName.Format ("BreathControlTarget%u", nTG+1);
-		m_nBreathControlTarget[nTG] = m_Properties.GetNumber (PropertyName, 0);
+		pPerformance->nBreathControlTarget[nTG] = pProperties->GetNumber (PropertyName, 0);
 		
 		PropertyName.Format ("AftertouchRange%u", nTG+1);
-		m_nAftertouchRange[nTG] = m_Properties.GetNumber (PropertyName, 99); 
+		pPerformance->nAftertouchRange[nTG] = pProperties->GetNumber (PropertyName, 99); 
 		
 		PropertyName.Format ("AftertouchTarget%u", nTG+1);
-		m_nAftertouchTarget[nTG] = m_Properties.GetNumber (PropertyName, 0);
+		pPerformance->nAftertouchTarget[nTG] = pProperties->GetNumber (PropertyName, 0);
 		
 		}
 
-	m_bCompressorEnable = m_Properties.GetNumber ("CompressorEnable", 1) != 0;
+	pPerformance->bCompressorEnable = pProperties->GetNumber ("CompressorEnable", 1) != 0;
 
-	m_bReverbEnable = m_Properties.GetNumber ("ReverbEnable", 1) != 0;
-	m_nReverbSize = m_Properties.GetNumber ("ReverbSize", 70);
-	m_nReverbHighDamp = m_Properties.GetNumber ("ReverbHighDamp", 50);
-	m_nReverbLowDamp = m_Properties.GetNumber ("ReverbLowDamp", 50);
-	m_nReverbLowPass = m_Properties.GetNumber ("ReverbLowPass", 30);
-	m_nReverbDiffusion = m_Properties.GetNumber ("ReverbDiffusion", 65);
-	m_nReverbLevel = m_Properties.GetNumber ("ReverbLevel", 99);
+	pPerformance->bReverbEnable = pProperties->GetNumber ("ReverbEnable", 1) != 0;
+	pPerformance->nReverbSize = pProperties->GetNumber ("ReverbSize", 70);
+	pPerformance->nReverbHighDamp = pProperties->GetNumber ("ReverbHighDamp", 50);
+	pPerformance->nReverbLowDamp = pProperties->GetNumber ("ReverbLowDamp", 50);
+	pPerformance->nReverbLowPass = pProperties->GetNumber ("ReverbLowPass", 30);
+	pPerformance->nReverbDiffusion = pProperties->GetNumber ("ReverbDiffusion", 65);
+	pPerformance->nReverbLevel = pProperties->GetNumber ("ReverbLevel", 99);
 
-	return bResult;
+	return true;
 }
 
 bool CPerformanceConfig::Save (void)
 {
-	m_Properties.RemoveAll ();
+	if (m_SaveState != SaveStateIdle)
+	{
+		return false;
+	}
 
-	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
+	if (!IsDirty ())
 	{
-		CString PropertyName;
+		LOGDBG ("%s: Unchanged, not saved", m_FileName.c_str ());
 
-		PropertyName.Format ("BankNumber%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nBankNumber[nTG]);
+		m_SaveStatus = SaveCompleted;
+		m_Statistics.nUnchangedSaves++;
 
-		PropertyName.Format ("VoiceNumber%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nVoiceNumber[nTG]+1);
+		return true;
+	}
 
-		PropertyName.Format ("MIDIChannel%u", nTG+1);
-		unsigned nMIDIChannel = m_nMIDIChannel[nTG];
-		if (nMIDIChannel < CMIDIDevice::Channels)
+	memcpy (&m_SavePerformance, &m_Performance, sizeof m_SavePerformance);
+	memcpy (m_nSaveDirty, m_nDirty, sizeof m_nSaveDirty);
+	m_SaveFileName = m_FileName;
+
+	ClearDirty ();				// track changes, while saving
+
+	// only the changed parts of a file, which has been written before, are rewritten
+	m_bSaveChanged = m_TextFileName == m_SaveFileName;
+
+	m_SaveBuffer.clear ();
+	m_OldBuffer.clear ();
+	m_SaveChunks.clear ();
+	m_nSaveOffset = 0;
+	m_nSaveTG = 0;
+	m_nSaveChunk = 0;
+	m_nSaveStartTicks = CTimer::GetClockTicks ();
+
+	m_SaveState = SaveStateSerialise;
+	m_SaveStatus = SaveBusy;
+
+	return true;
+}
+
+CPerformanceConfig::TSaveStatus CPerformanceConfig::GetSaveStatus (void) const
+{
+	return m_SaveStatus;
+}
+
+bool CPerformanceConfig::IsSaving (void) const
+{
+	return m_SaveState != SaveStateIdle;
+}
+
+void CPerformanceConfig::ProcessSave (void)
+{
+	switch (m_SaveState)
+	{
+	case SaveStateSerialise:
+		if (m_nSaveTG < TextBlocks)
 		{
-			nMIDIChannel++;
+			unsigned nBlock = m_nSaveTG++;
+			if (   !m_bSaveChanged
+			    || m_nSaveDirty[nBlock])
+			{
+				m_SaveText[nBlock].clear ();
+				if (nBlock < CConfig::ToneGenerators)
+				{
+					SerialiseTG (m_SavePerformance, nBlock, &m_SaveText[nBlock]);
+				}
+				else
+				{
+					SerialiseEffects (m_SavePerformance, &m_SaveText[nBlock]);
+				}
+			}
+			else
+			{
+				m_SaveText[nBlock] = m_FileText[nBlock];
+			}
+
+			m_SaveBuffer += m_SaveText[nBlock];
+			if (m_bSaveChanged)
+			{
+				m_OldBuffer += m_FileText[nBlock];
+			}
 		}
-		else if (nMIDIChannel == CMIDIDevice::OmniMode)
+		else
 		{
-			nMIDIChannel = 255;
+			PrepareJournal ();
+
+			m_SaveState = SaveStateJournal;
 		}
-		else
+		break;
+
+	case SaveStateJournal:
+		if (!WriteJournalChunk ())
 		{
-			nMIDIChannel = 0;
+			AbortSave ("Cannot write journal");
+
+			return;
 		}
-		m_Properties.SetNumber (PropertyName, nMIDIChannel);
 
-		PropertyName.Format ("Volume%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nVolume[nTG]);
+		if (m_nSaveOffset >= m_JournalBuffer.length ())
+		{
+			m_SaveState = SaveStateJournalClose;
+		}
+		break;
 
-		PropertyName.Format ("Pan%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nPan[nTG]);
+	case SaveStateJournalClose:
+		if (f_close (&m_SaveFile) != FR_OK)
+		{
+			f_unlink (JOURNAL_FILE);
 
-		PropertyName.Format ("Detune%u", nTG+1);
-		m_Properties.SetSignedNumber (PropertyName, m_nDetune[nTG]);
+			AbortSave ("Cannot write journal");
 
-		PropertyName.Format ("Cutoff%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nCutoff[nTG]);
+			return;
+		}
 
-		PropertyName.Format ("Resonance%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nResonance[nTG]);
+		std::string ().swap (m_JournalBuffer);	// free memory
 
-		PropertyName.Format ("NoteLimitLow%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nNoteLimitLow[nTG]);
+		m_SaveState = SaveStateOpen;
+		break;
 
-		PropertyName.Format ("NoteLimitHigh%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nNoteLimitHigh[nTG]);
+	case SaveStateOpen:
+		// only the changed chunks are written, so the file must exist
+		if (f_open (&m_SaveFile, m_SaveFileName.c_str (),
+			    FA_WRITE | (m_bJournalFull ? FA_OPEN_ALWAYS : FA_OPEN_EXISTING)) != FR_OK)
+		{
+			// the journal is replayed on next boot
+			AbortSave ("Cannot open file");
 
-		PropertyName.Format ("NoteShift%u", nTG+1);
-		m_Properties.SetSignedNumber (PropertyName, m_nNoteShift[nTG]);
+			return;
+		}
 
-		PropertyName.Format ("ReverbSend%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nReverbSend[nTG]);
-		
-		PropertyName.Format ("PitchBendRange%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nPitchBendRange[nTG]);
+		m_SaveState = SaveStateWrite;
+		break;
 
-		PropertyName.Format ("PitchBendStep%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nPitchBendStep[nTG]);
+	case SaveStateWrite:
+		if (!WriteSaveChunk ())
+		{
+			f_close (&m_SaveFile);
 
-		PropertyName.Format ("PortamentoMode%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nPortamentoMode[nTG]);
+			AbortSave ("Write error");
 
-		PropertyName.Format ("PortamentoGlissando%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nPortamentoGlissando[nTG]);
+			return;
+		}
 
-		PropertyName.Format ("PortamentoTime%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nPortamentoTime[nTG]);
-		
-		PropertyName.Format ("VoiceData%u", nTG+1);
-		char *cstr = &m_nVoiceDataTxt[nTG][0];
-		m_Properties.SetString (PropertyName, cstr);
-		
-		PropertyName.Format ("MonoMode%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_bMonoMode[nTG] ? 1 : 0);
-				
-		PropertyName.Format ("ModulationWheelRange%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nModulationWheelRange[nTG]);
-	
-		PropertyName.Format ("ModulationWheelTarget%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nModulationWheelTarget[nTG]);	
-			
-		PropertyName.Format ("FootControlRange%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nFootControlRange[nTG]);	
-		
-		PropertyName.Format ("FootControlTarget%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nFootControlTarget[nTG]);	
-		
-		PropertyName.Format ("BreathControlRange%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nBreathControlRange[nTG]);	
-		
-		PropertyName.Format ("BreathControlTarget%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nBreathControlTarget[nTG]);	
-		
-		PropertyName.Format ("AftertouchRange%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nAftertouchRange[nTG]);	
-		
-		PropertyName.Format ("AftertouchTarget%u", nTG+1);
-		m_Properties.SetNumber (PropertyName, m_nAftertouchTarget[nTG]);			
+		if (m_nSaveChunk >= m_SaveChunks.size ())
+		{
+			m_SaveState = SaveStateClose;
+		}
+		break;
+
+	case SaveStateClose:
+		// cut off the rest, if the file has become shorter
+		if (   f_lseek (&m_SaveFile, m_SaveBuffer.length ()) != FR_OK
+		    || f_truncate (&m_SaveFile) != FR_OK
+		    || f_close (&m_SaveFile) != FR_OK)
+		{
+			AbortSave ("Write error");
 
+			return;
 		}
 
-	m_Properties.SetNumber ("CompressorEnable", m_bCompressorEnable ? 1 : 0);
+		m_SaveState = SaveStateJournalDelete;
+		break;
 
-	m_Properties.SetNumber ("ReverbEnable", m_bReverbEnable ? 1 : 0);
-	m_Properties.SetNumber ("ReverbSize", m_nReverbSize);
-	m_Properties.SetNumber ("ReverbHighDamp", m_nReverbHighDamp);
-	m_Properties.SetNumber ("ReverbLowDamp", m_nReverbLowDamp);
-	m_Properties.SetNumber ("ReverbLowPass", m_nReverbLowPass);
-	m_Properties.SetNumber ("ReverbDiffusion", m_nReverbDiffusion);
-	m_Properties.SetNumber ("ReverbLevel", m_nReverbLevel);
+	case SaveStateJournalDelete:
+		if (f_unlink (JOURNAL_FILE) != FR_OK)
+		{
+			LOGWARN (JOURNAL_FILE ": Cannot delete");	// replayed on next boot
+		}
 
-	return m_Properties.Save ();
-}
+		m_SaveState = SaveStateSnapshot;
+		break;
 
-unsigned CPerformanceConfig::GetBankNumber (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nBankNumber[nTG];
-}
+	case SaveStateSnapshot: {
+		WriteSnapshot (m_SaveFileName, &m_SavePerformance);
 
-unsigned CPerformanceConfig::GetVoiceNumber (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nVoiceNumber[nTG];
-}
+		// the prefetched copy is outdated
+		unsigned nID = nActualPerformance;
+		if (   nID < m_Directory.size ()
+		    && GetPerformancePath (nID) == m_SaveFileName)
+		{
+			InvalidatePrefetched (nID);
+		}
+		else
+		{
+			InvalidatePrefetched (NoPerformance);
+		}
 
-unsigned CPerformanceConfig::GetMIDIChannel (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nMIDIChannel[nTG];
-}
+		for (unsigned i = 0; i < TextBlocks; i++)
+		{
+			m_FileText[i].swap (m_SaveText[i]);
+		}
+		m_TextFileName = m_SaveFileName;
 
-unsigned CPerformanceConfig::GetVolume (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nVolume[nTG];
-}
+		std::string ().swap (m_SaveBuffer);	// free memory
+		std::string ().swap (m_OldBuffer);
 
-unsigned CPerformanceConfig::GetPan (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nPan[nTG];
-}
+		m_SaveState = SaveStateIdle;
+		m_SaveStatus = SaveCompleted;
 
-int CPerformanceConfig::GetDetune (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nDetune[nTG];
-}
+		unsigned nTicks = CTimer::GetClockTicks () - m_nSaveStartTicks;
+		m_Statistics.nSaves++;
+		m_Statistics.nChunksWritten += m_SaveChunks.size ();
+		m_Statistics.nSaveTicks += nTicks;
+		if (nTicks > m_Statistics.nSaveTicksMax)
+		{
+			m_Statistics.nSaveTicksMax = nTicks;
+		}
 
-unsigned CPerformanceConfig::GetCutoff (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nCutoff[nTG];
-}
+		LOGDBG ("%s: Saved in %u ms (%u chunks written)", m_SaveFileName.c_str (),
+			nTicks / 1000, (unsigned) m_SaveChunks.size ());
+		} break;
 
-unsigned CPerformanceConfig::GetResonance (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nResonance[nTG];
+	default:
+		assert (0);
+		break;
+	}
 }
 
-unsigned CPerformanceConfig::GetNoteLimitLow (unsigned nTG) const
+void CPerformanceConfig::PrepareJournal (void)
 {
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nNoteLimitLow[nTG];
-}
+	size_t nLength = m_SaveBuffer.length ();
 
-unsigned CPerformanceConfig::GetNoteLimitHigh (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nNoteLimitHigh[nTG];
-}
+	// unchanged chunks are skipped, the comparison costs no time worth mentioning
+	uint32_t nUnchangedChecksum = CSysExFileLoader::Hash (0, 0);
+	m_bJournalFull = true;
+	for (size_t nOffset = 0; nOffset < nLength; nOffset += SaveChunkSize)
+	{
+		if (   !m_bSaveChanged
+		    || nOffset >= m_OldBuffer.length ()		// file grows, compare() would throw
+		    || m_OldBuffer.compare (nOffset, SaveChunkSize, m_SaveBuffer, nOffset, SaveChunkSize) != 0)
+		{
+			m_SaveChunks.push_back (nOffset);
+		}
+		else
+		{
+			nUnchangedChecksum = CSysExFileLoader::Hash (m_SaveBuffer.data () + nOffset,
+								     std::min<size_t> (SaveChunkSize, nLength - nOffset),
+								     nUnchangedChecksum);
 
-int CPerformanceConfig::GetNoteShift (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nNoteShift[nTG];
-}
+			m_bJournalFull = false;
+		}
+	}
 
-unsigned CPerformanceConfig::GetReverbSend (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nReverbSend[nTG];
-}
+	TJournalHeader Header;
+	memcpy (Header.Magic, JOURNAL_MAGIC, sizeof Header.Magic);
+	Header.nVersion = JournalVersion;
+	Header.nFileSize = nLength;
+	Header.nNameLength = m_SaveFileName.length ();
+	Header.nEntries = m_SaveChunks.size ();
+	Header.nFlags = m_bJournalFull ? JOURNAL_FLAG_FULL : 0;
+	Header.nOldFileSize = m_bJournalFull ? 0 : m_OldBuffer.length ();
+	Header.nChunkSize = SaveChunkSize;
+	Header.nUnchangedChecksum = nUnchangedChecksum;
+
+	m_JournalBuffer.assign ((const char *) &Header, sizeof Header);
+	m_JournalBuffer.append (m_SaveFileName);
+
+	for (unsigned nOffset : m_SaveChunks)
+	{
+		TJournalEntry Entry;
+		Entry.nOffset = nOffset;
+		Entry.nLength = std::min<size_t> (SaveChunkSize, nLength - nOffset);
 
-void CPerformanceConfig::SetBankNumber (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nBankNumber[nTG] = nValue;
-}
+		m_JournalBuffer.append ((const char *) &Entry, sizeof Entry);
+		m_JournalBuffer.append (m_SaveBuffer, nOffset, Entry.nLength);
+	}
 
-void CPerformanceConfig::SetVoiceNumber (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nVoiceNumber[nTG] = nValue;
+	uint32_t nChecksum = CSysExFileLoader::Hash (m_JournalBuffer.data (), m_JournalBuffer.length ());
+	m_JournalBuffer.append ((const char *) &nChecksum, sizeof nChecksum);
 }
 
-void CPerformanceConfig::SetMIDIChannel (unsigned nValue, unsigned nTG)
+bool CPerformanceConfig::WriteJournalChunk (void)
 {
-	assert (nTG < CConfig::ToneGenerators);
-	m_nMIDIChannel[nTG] = nValue;
-}
+	if (   !m_nSaveOffset
+	    && f_open (&m_SaveFile, JOURNAL_FILE, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+	{
+		return false;
+	}
 
-void CPerformanceConfig::SetVolume (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nVolume[nTG] = nValue;
-}
+	size_t nChunkSize = m_JournalBuffer.length () - m_nSaveOffset;
+	if (nChunkSize > SaveChunkSize)
+	{
+		nChunkSize = SaveChunkSize;
+	}
 
-void CPerformanceConfig::SetPan (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nPan[nTG] = nValue;
-}
+	UINT nWritten;
+	if (   f_write (&m_SaveFile, m_JournalBuffer.data () + m_nSaveOffset, nChunkSize,
+			&nWritten) != FR_OK
+	    || nWritten != nChunkSize)
+	{
+		f_close (&m_SaveFile);
+		f_unlink (JOURNAL_FILE);
 
-void CPerformanceConfig::SetDetune (int nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nDetune[nTG] = nValue;
+		return false;
+	}
+
+	m_nSaveOffset += nChunkSize;
+
+	return true;
 }
 
-void CPerformanceConfig::SetCutoff (unsigned nValue, unsigned nTG)
+bool CPerformanceConfig::WriteSaveChunk (void)
 {
-	assert (nTG < CConfig::ToneGenerators);
-	m_nCutoff[nTG] = nValue;
+	assert (m_nSaveChunk < m_SaveChunks.size ());
+	size_t nOffset = m_SaveChunks[m_nSaveChunk++];
+	size_t nChunkSize = std::min<size_t> (SaveChunkSize, m_SaveBuffer.length () - nOffset);
+
+	UINT nWritten;
+	return    f_lseek (&m_SaveFile, nOffset) == FR_OK
+	       && f_write (&m_SaveFile, m_SaveBuffer.data () + nOffset, nChunkSize,
+			   &nWritten) == FR_OK
+	       && nWritten == nChunkSize;
 }
 
-void CPerformanceConfig::SetResonance (unsigned nValue, unsigned nTG)
+bool CPerformanceConfig::RecoverSave (void)
 {
-	assert (nTG < CConfig::ToneGenerators);
-	m_nResonance[nTG] = nValue;
-}
+	FIL File;
+	if (f_open (&File, JOURNAL_FILE, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+	{
+		return true;			// nothing to do
+	}
 
-void CPerformanceConfig::SetNoteLimitLow (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nNoteLimitLow[nTG] = nValue;
-}
+	size_t nFileSize = f_size (&File);
+	uint8_t *pBuffer = new uint8_t[nFileSize+1];
+	assert (pBuffer);
 
-void CPerformanceConfig::SetNoteLimitHigh (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nNoteLimitHigh[nTG] = nValue;
+	UINT nRead;
+	if (   f_read (&File, pBuffer, nFileSize, &nRead) != FR_OK
+	    || nRead != nFileSize)
+	{
+		nFileSize = 0;
+	}
+
+	f_close (&File);
+
+	// validate the whole journal, before anything is written
+	bool bValid = false;
+	const TJournalHeader *pHeader = (const TJournalHeader *) pBuffer;
+	size_t nDataSize = 0;
+	uint32_t nChecksum;
+	if (nFileSize >= sizeof (TJournalHeader) + sizeof nChecksum)
+	{
+		nDataSize = nFileSize - sizeof nChecksum;
+		memcpy (&nChecksum, pBuffer + nDataSize, sizeof nChecksum);
+
+		bValid =    nChecksum == CSysExFileLoader::Hash (pBuffer, nDataSize)
+			 && memcmp (pHeader->Magic, JOURNAL_MAGIC, sizeof pHeader->Magic) == 0
+			 && pHeader->nVersion == JournalVersion
+			 && pHeader->nChunkSize
+			 && sizeof (TJournalHeader) + pHeader->nNameLength <= nDataSize;
+
+		size_t nOffset = sizeof (TJournalHeader) + (bValid ? pHeader->nNameLength : 0);
+		for (unsigned i = 0; bValid && i < pHeader->nEntries; i++)
+		{
+			const TJournalEntry *pEntry = (const TJournalEntry *) (pBuffer + nOffset);
+			nOffset += sizeof (TJournalEntry);
+
+			bValid =    nOffset <= nDataSize
+				 && nOffset + pEntry->nLength <= nDataSize
+				 && pEntry->nOffset + pEntry->nLength <= pHeader->nFileSize;
+
+			nOffset += bValid ? pEntry->nLength : 0;
+		}
+	}
+
+	if (!bValid)
+	{
+		// the power has been lost, while writing the journal, the file is untouched
+		LOGWARN (JOURNAL_FILE ": Incomplete, discarded");
+
+		delete [] pBuffer;
+
+		return f_unlink (JOURNAL_FILE) == FR_OK;
+	}
+
+	std::string FileName ((const char *) pBuffer + sizeof (TJournalHeader), pHeader->nNameLength);
+
+	bool bFull = !!(pHeader->nFlags & JOURNAL_FLAG_FULL);
+	bool bOK = f_open (&File, FileName.c_str (),
+			   FA_READ | FA_WRITE | (bFull ? FA_OPEN_ALWAYS : FA_OPEN_EXISTING)) == FR_OK;
+	if (   !bFull
+	    && (   !bOK
+		|| !CheckJournalTarget (&File, pBuffer)))
+	{
+		// the file has been deleted or changed otherwise, the chunks do not fit
+		LOGWARN ("%s: Does not match journal, discarded", FileName.c_str ());
+
+		if (bOK)
+		{
+			f_close (&File);
+		}
+
+		delete [] pBuffer;
+
+		return f_unlink (JOURNAL_FILE) == FR_OK;
+	}
+
+	if (bOK)
+	{
+		size_t nOffset = sizeof (TJournalHeader) + pHeader->nNameLength;
+		for (unsigned i = 0; bOK && i < pHeader->nEntries; i++)
+		{
+			const TJournalEntry *pEntry = (const TJournalEntry *) (pBuffer + nOffset);
+			nOffset += sizeof (TJournalEntry);
+
+			UINT nWritten;
+			bOK =    f_lseek (&File, pEntry->nOffset) == FR_OK
+			      && f_write (&File, pBuffer + nOffset, pEntry->nLength, &nWritten) == FR_OK
+			      && nWritten == pEntry->nLength;
+
+			nOffset += pEntry->nLength;
+		}
+
+		bOK =    bOK
+		      && f_lseek (&File, pHeader->nFileSize) == FR_OK
+		      && f_truncate (&File) == FR_OK;
+
+		if (f_close (&File) != FR_OK)
+		{
+			bOK = false;
+		}
+	}
+
+	delete [] pBuffer;
+
+	if (!bOK)
+	{
+		LOGERR ("%s: Cannot complete interrupted save", FileName.c_str ());
+
+		return false;			// try again on next boot
+	}
+
+	LOGNOTE ("%s: Interrupted save completed", FileName.c_str ());
+
+	return f_unlink (JOURNAL_FILE) == FR_OK;
 }
 
-void CPerformanceConfig::SetNoteShift (int nValue, unsigned nTG)
+bool CPerformanceConfig::CheckJournalTarget (FIL *pFile, const uint8_t *pJournal)
 {
-	assert (nTG < CConfig::ToneGenerators);
-	m_nNoteShift[nTG] = nValue;
+	assert (pFile);
+	assert (pJournal);
+	const TJournalHeader *pHeader = (const TJournalHeader *) pJournal;
+
+	// the interrupted save has written some chunks, but not yet cut off the file
+	size_t nOldSize = pHeader->nOldFileSize;
+	size_t nNewSize = pHeader->nFileSize;
+	size_t nFileSize = f_size (pFile);
+	if (   nFileSize < std::min (nOldSize, nNewSize)
+	    || nFileSize > std::max (nOldSize, nNewSize))
+	{
+		return false;
+	}
+
+	// the chunks, which are not in the journal, have not been touched
+	uint32_t nChecksum = CSysExFileLoader::Hash (0, 0);
+	const uint8_t *pEntry = pJournal + sizeof (TJournalHeader) + pHeader->nNameLength;
+	unsigned nEntry = 0;
+	for (size_t nOffset = 0; nOffset < nNewSize; nOffset += pHeader->nChunkSize)
+	{
+		// the entries are sorted by offset
+		if (   nEntry < pHeader->nEntries
+		    && ((const TJournalEntry *) pEntry)->nOffset == nOffset)
+		{
+			pEntry += sizeof (TJournalEntry) + ((const TJournalEntry *) pEntry)->nLength;
+			nEntry++;
+
+			continue;
+		}
+
+		if (f_lseek (pFile, nOffset) != FR_OK)
+		{
+			return false;
+		}
+
+		// the chunk size may differ from SaveChunkSize of this build
+		size_t nLength = std::min<size_t> (pHeader->nChunkSize, nNewSize - nOffset);
+		while (nLength)
+		{
+			uint8_t Buffer[SaveChunkSize];
+			UINT nPart = std::min<size_t> (sizeof Buffer, nLength);
+			UINT nRead;
+			if (   f_read (pFile, Buffer, nPart, &nRead) != FR_OK
+			    || nRead != nPart)
+			{
+				return false;
+			}
+
+			nChecksum = CSysExFileLoader::Hash (Buffer, nPart, nChecksum);
+			nLength -= nPart;
+		}
+	}
+
+	return nChecksum == pHeader->nUnchangedChecksum;
 }
 
-void CPerformanceConfig::SetReverbSend (unsigned nValue, unsigned nTG)
+void CPerformanceConfig::AbortSave (const char *pReason)
 {
-	assert (nTG < CConfig::ToneGenerators);
-	m_nReverbSend[nTG] = nValue;
+	LOGWARN ("%s: %s", m_SaveFileName.c_str (), pReason);
+
+	std::string ().swap (m_SaveBuffer);
+	std::string ().swap (m_OldBuffer);
+	std::string ().swap (m_JournalBuffer);
+
+	// the file contents are unknown now
+	m_TextFileName.clear ();
+	if (m_FileName == m_SaveFileName)
+	{
+		SetAllDirty ();
+	}
+
+	m_SaveState = SaveStateIdle;
+	m_SaveStatus = SaveFailed;
 }
 
-bool CPerformanceConfig::GetCompressorEnable (void) const
+void CPerformanceConfig::SetDirty (unsigned nTG, unsigned nProperty)
 {
-	return m_bCompressorEnable;
+	assert (nTG < TextBlocks);
+	assert (nProperty < 32);
+	m_nDirty[nTG] |= 1U << nProperty;
 }
 
-bool CPerformanceConfig::GetReverbEnable (void) const
+void CPerformanceConfig::SetAllDirty (void)
 {
-	return m_bReverbEnable;
+	for (unsigned i = 0; i < TextBlocks; i++)
+	{
+		m_nDirty[i] = (uint32_t) -1;
+	}
 }
 
-unsigned CPerformanceConfig::GetReverbSize (void) const
+void CPerformanceConfig::ClearDirty (void)
 {
-	return m_nReverbSize;
+	memset (m_nDirty, 0, sizeof m_nDirty);
 }
 
-unsigned CPerformanceConfig::GetReverbHighDamp (void) const
+bool CPerformanceConfig::IsDirty (void) const
 {
-	return m_nReverbHighDamp;
+	for (unsigned i = 0; i < TextBlocks; i++)
+	{
+		if (m_nDirty[i])
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
-unsigned CPerformanceConfig::GetReverbLowDamp (void) const
+static void AppendProperty (std::string *pBuffer, const char *pName, int nValue)
 {
-	return m_nReverbLowDamp;
+	char Line[50];
+	snprintf (Line, sizeof Line, "%s=%d\n", pName, nValue);
+	pBuffer->append (Line);
 }
 
-unsigned CPerformanceConfig::GetReverbLowPass (void) const
+static void AppendProperty (std::string *pBuffer, const char *pName, unsigned nTG, int nValue)
 {
-	return m_nReverbLowPass;
+	char Name[30];
+	snprintf (Name, sizeof Name, "%s%u", pName, nTG+1);
+	AppendProperty (pBuffer, Name, nValue);
 }
 
-unsigned CPerformanceConfig::GetReverbDiffusion (void) const
+void CPerformanceConfig::SerialiseTG (const TPerformance &rPerf, unsigned nTG, std::string *pBuffer)
 {
-	return m_nReverbDiffusion;
+	assert (nTG < CConfig::ToneGenerators);
+	assert (pBuffer);
+
+	AppendProperty (pBuffer, "BankNumber", nTG, rPerf.nBankNumber[nTG]);
+	AppendProperty (pBuffer, "VoiceNumber", nTG, rPerf.nVoiceNumber[nTG]+1);
+
+	unsigned nMIDIChannel = rPerf.nMIDIChannel[nTG];
+	if (nMIDIChannel < CMIDIDevice::Channels)
+	{
+		nMIDIChannel++;
+	}
+	else if (nMIDIChannel == CMIDIDevice::OmniMode)
+	{
+		nMIDIChannel = 255;
+	}
+	else
+	{
+		nMIDIChannel = 0;
+	}
+	AppendProperty (pBuffer, "MIDIChannel", nTG, nMIDIChannel);
+
+	AppendProperty (pBuffer, "Volume", nTG, rPerf.nVolume[nTG]);
+	AppendProperty (pBuffer, "Pan", nTG, rPerf.nPan[nTG]);
+	AppendProperty (pBuffer, "Detune", nTG, rPerf.nDetune[nTG]);
+	AppendProperty (pBuffer, "Cutoff", nTG, rPerf.nCutoff[nTG]);
+	AppendProperty (pBuffer, "Resonance", nTG, rPerf.nResonance[nTG]);
+	AppendProperty (pBuffer, "NoteLimitLow", nTG, rPerf.nNoteLimitLow[nTG]);
+	AppendProperty (pBuffer, "NoteLimitHigh", nTG, rPerf.nNoteLimitHigh[nTG]);
+	AppendProperty (pBuffer, "NoteShift", nTG, rPerf.nNoteShift[nTG]);
+	AppendProperty (pBuffer, "ReverbSend", nTG, rPerf.nReverbSend[nTG]);
+	AppendProperty (pBuffer, "PitchBendRange", nTG, rPerf.nPitchBendRange[nTG]);
+	AppendProperty (pBuffer, "PitchBendStep", nTG, rPerf.nPitchBendStep[nTG]);
+	AppendProperty (pBuffer, "PortamentoMode", nTG, rPerf.nPortamentoMode[nTG]);
+	AppendProperty (pBuffer, "PortamentoGlissando", nTG, rPerf.nPortamentoGlissando[nTG]);
+	AppendProperty (pBuffer, "PortamentoTime", nTG, rPerf.nPortamentoTime[nTG]);
+
+	char Name[30];
+	snprintf (Name, sizeof Name, "VoiceData%u=", nTG+1);
+	pBuffer->append (Name);
+	if (rPerf.bVoiceDataFilled[nTG])
+	{
+		static const char HexDigit[] = "0123456789ABCDEF";
+		for (unsigned i = 0; i < NUM_VOICE_PARAM; i++)
+		{
+			if (i > 0)
+			{
+				pBuffer->push_back (' ');
+			}
+
+			pBuffer->push_back (HexDigit[rPerf.VoiceData[nTG][i] >> 4]);
+			pBuffer->push_back (HexDigit[rPerf.VoiceData[nTG][i] & 0x0F]);
+		}
+	}
+	pBuffer->push_back ('\n');
+
+	AppendProperty (pBuffer, "MonoMode", nTG, rPerf.bMonoMode[nTG] ? 1 : 0);
+
+	AppendProperty (pBuffer, "ModulationWheelRange", nTG, rPerf.nModulationWheelRange[nTG]);
+	AppendProperty (pBuffer, "ModulationWheelTarget", nTG, rPerf.nModulationWheelTarget[nTG]);
+	AppendProperty (pBuffer, "FootControlRange", nTG, rPerf.nFootControlRange[nTG]);
+	AppendProperty (pBuffer, "FootControlTarget", nTG, rPerf.nFootControlTarget[nTG]);
+	AppendProperty (pBuffer, "BreathControlRange", nTG, rPerf.nBreathControlRange[nTG]);
+	AppendProperty (pBuffer, "BreathControlTarget", nTG, rPerf.nBreathControlTarget[nTG]);
+	AppendProperty (pBuffer, "AftertouchRange", nTG, rPerf.nAftertouchRange[nTG]);
+	AppendProperty (pBuffer, "AftertouchTarget", nTG, rPerf.nAftertouchTarget[nTG]);
 }
 
-unsigned CPerformanceConfig::GetReverbLevel (void) const
+void CPerformanceConfig::SerialiseEffects (const TPerformance &rPerf, std::string *pBuffer)
 {
-	return m_nReverbLevel;
+	assert (pBuffer);
+
+	AppendProperty (pBuffer, "CompressorEnable", rPerf.bCompressorEnable ? 1 : 0);
+
+	AppendProperty (pBuffer, "ReverbEnable", rPerf.bReverbEnable ? 1 : 0);
+	AppendProperty (pBuffer, "ReverbSize", rPerf.nReverbSize);
+	AppendProperty (pBuffer, "ReverbHighDamp", rPerf.nReverbHighDamp);
+	AppendProperty (pBuffer, "ReverbLowDamp", rPerf.nReverbLowDamp);
+	AppendProperty (pBuffer, "ReverbLowPass", rPerf.nReverbLowPass);
+	AppendProperty (pBuffer, "ReverbDiffusion", rPerf.nReverbDiffusion);
+	AppendProperty (pBuffer, "ReverbLevel", rPerf.nReverbLevel);
 }
 
-void CPerformanceConfig::SetCompressorEnable (bool bValue)
+void CPerformanceConfig::Serialise (const TPerformance &rPerf, std::string *pBuffer)
 {
-	m_bCompressorEnable = bValue;
+	assert (pBuffer);
+
+	// same order as written by ProcessSave()
+	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
+	{
+		SerialiseTG (rPerf, nTG, pBuffer);
+	}
+
+	SerialiseEffects (rPerf, pBuffer);
 }
 
-void CPerformanceConfig::SetReverbEnable (bool bValue)
+void CPerformanceConfig::GetPerformance (TPerformance *pPerformance) const
 {
-	m_bReverbEnable = bValue;
+	assert (pPerformance);
+	memcpy (pPerformance, &m_Performance, sizeof *pPerformance);
 }
 
-void CPerformanceConfig::SetReverbSize (unsigned nValue)
+bool CPerformanceConfig::ReadPerformance (unsigned nID, TPerformance *pPerformance)
 {
-	m_nReverbSize = nValue;
+	assert (pPerformance);
+
+	if (nID >= m_Directory.size ())
+	{
+		return false;
+	}
+
+	std::string FileName = GetPerformancePath (nID);
+
+	TPrefetchSlot *pSlot = FindPrefetched (nID);
+	if (   m_SaveState != SaveStateIdle
+	    && FileName == m_SaveFileName)
+	{
+		memcpy (pPerformance, &m_SavePerformance, sizeof *pPerformance);
+	}
+	else if (pSlot)
+	{
+		memcpy (pPerformance, &pSlot->Performance, sizeof *pPerformance);
+	}
+	else
+	{
+		CPropertiesFatFsFile Properties (FileName.c_str (), m_pFileSystem);
+		if (!LoadPerformance (FileName, &Properties, pPerformance))
+		{
+			return false;
+		}
+	}
+
+	return true;
 }
 
-void CPerformanceConfig::SetReverbHighDamp (unsigned nValue)
+bool CPerformanceConfig::ParsePerformance (const std::string &rText, TPerformance *pPerformance)
 {
-	m_nReverbHighDamp = nValue;
+	assert (pPerformance);
+
+	// the properties parser reads from a file only
+	FIL File;
+	UINT nWritten;
+	bool bOK =    f_open (&File, SCRATCH_FILE, FA_WRITE | FA_CREATE_ALWAYS) == FR_OK
+		   && f_write (&File, rText.data (), rText.length (), &nWritten) == FR_OK
+		   && nWritten == rText.length ();
+	if (   f_close (&File) != FR_OK
+	    || !bOK)
+	{
+		LOGWARN (SCRATCH_FILE ": Cannot write");
+
+		return false;
+	}
+
+	memset (pPerformance, 0, sizeof *pPerformance);
+	CPropertiesFatFsFile Properties (SCRATCH_FILE, m_pFileSystem);
+	bOK = LoadProperties (&Properties, pPerformance);
+
+	f_unlink (SCRATCH_FILE);
+
+	return bOK;
 }
 
-void CPerformanceConfig::SetReverbLowDamp (unsigned nValue)
+bool CPerformanceConfig::ImportPerformance (const TPerformance *pPerformance,
+					    const std::string &rFileName)
 {
-	m_nReverbLowDamp = nValue;
+	assert (pPerformance);
+
+	if (m_SaveState != SaveStateIdle)
+	{
+		return false;
+	}
+
+	unsigned nID = NoPerformance;
+	if (!rFileName.empty ())
+	{
+		nID = FindPerformance (rFileName);
+		if (nID == NoPerformance)
+		{
+			// "[bank/]NNNNNN_name.ini", the bank folder is created if required
+			size_t nSlash = rFileName.find ('/');
+			unsigned nFileIndex;
+			if (   !nInternalFolderOk
+			    || (   nSlash != std::string::npos
+				&& (   nSlash == 0
+				    || rFileName[0] == '.'
+				    || rFileName.find ('/', nSlash+1) != std::string::npos))
+			    || !ParseFileIndex (rFileName.c_str (), &nFileIndex)
+			    || m_Directory.size () >= MaxPerformances)
+			{
+				LOGWARN ("%s: Invalid performance file name", rFileName.c_str ());
+
+				return false;
+			}
+
+			if (nSlash != std::string::npos)
+			{
+				std::string DirName ("SD:/" PERFORMANCE_DIR "/");
+				DirName += rFileName.substr (0, nSlash);
+				f_mkdir (DirName.c_str ());	// may exist
+			}
+
+			nID = AddPerformance (rFileName.c_str ());
+			InvalidatePrefetched (NoPerformance);	// IDs behind the new one have changed
+
+			if (m_bScanning)
+			{
+				StartScan ();			// restart, the directory has changed
+			}
+
+			m_bDirectoryChanged = true;	// index is written by Process()
+		}
+
+		SetNewPerformance (nID);
+		InvalidatePrefetched (nID);
+	}
+
+	memcpy (&m_Performance, pPerformance, sizeof m_Performance);
+	SetAllDirty ();
+
+	return   nID == NoPerformance
+	       || Save ();
 }
 
-void CPerformanceConfig::SetReverbLowPass (unsigned nValue)
+void CPerformanceConfig::Prefetch (unsigned nID)
 {
-	m_nReverbLowPass = nValue;
+	for (unsigned i = 0; i < m_nPrefetchRequests; i++)
+	{
+		if (m_nPrefetchRequest[i] == nID)
+		{
+			return;
+		}
+	}
+
+	memmove (&m_nPrefetchRequest[1], &m_nPrefetchRequest[0],
+		 (PrefetchRequests-1) * sizeof m_nPrefetchRequest[0]);
+	m_nPrefetchRequest[0] = nID;
+
+	if (m_nPrefetchRequests < PrefetchRequests)
+	{
+		m_nPrefetchRequests++;
+	}
+
+	m_bPrefetchPending = true;
 }
 
-void CPerformanceConfig::SetReverbDiffusion (unsigned nValue)
+bool CPerformanceConfig::IsPrefetched (unsigned nID) const
 {
-	m_nReverbDiffusion = nValue;
+	for (unsigned i = 0; i < PrefetchSlots; i++)
+	{
+		if (m_PrefetchSlot[i].nID == nID)
+		{
+			return true;
+		}
+	}
+
+	return false;
 }
 
-void CPerformanceConfig::SetReverbLevel (unsigned nValue)
+CPerformanceConfig::TPerformance *CPerformanceConfig::GetPrefetched (unsigned nID)
 {
-	m_nReverbLevel = nValue;
+	TPrefetchSlot *pSlot = FindPrefetched (nID);
+	if (!pSlot)
+	{
+		return nullptr;
+	}
+
+	return &pSlot->Performance;
 }
-// Pitch bender and portamento:
-void CPerformanceConfig::SetPitchBendRange (unsigned nValue, unsigned nTG)
+
+void CPerformanceConfig::GetStatistics (TStatistics *pStatistics) const
 {
-	assert (nTG < CConfig::ToneGenerators);
-	m_nPitchBendRange[nTG] = nValue;
+	assert (pStatistics);
+	memcpy (pStatistics, &m_Statistics, sizeof *pStatistics);
 }
 
-unsigned CPerformanceConfig::GetPitchBendRange (unsigned nTG) const
+void CPerformanceConfig::Dump (unsigned nIntervalTicks)
 {
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nPitchBendRange[nTG];
-}
+	unsigned nTicks = CTimer::GetClockTicks ();
 
+	if (nTicks - m_nLastDumpTicks < nIntervalTicks)
+	{
+		return;
+	}
 
-void CPerformanceConfig::SetPitchBendStep (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nPitchBendStep[nTG] = nValue;
-}
+	m_nLastDumpTicks = nTicks;
 
-unsigned CPerformanceConfig::GetPitchBendStep (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nPitchBendStep[nTG];
-}
+	unsigned nCount = m_Statistics.nLoads + m_Statistics.nSaves + m_Statistics.nUnchangedSaves;
+	if (nCount == m_nLastDumpCount)
+	{
+		return;
+	}
 
+	m_nLastDumpCount = nCount;
 
-void CPerformanceConfig::SetPortamentoMode (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nPortamentoMode[nTG] = nValue;
-}
+	const TStatistics &rStat = m_Statistics;
 
-unsigned CPerformanceConfig::GetPortamentoMode (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nPortamentoMode[nTG];
-}
+	LOGNOTE ("Load: %u calls, %u prefetched, %u snapshots, %u INI files, "
+		 "%u us average, %u us maximum",
+		 rStat.nLoads, rStat.nPrefetchHits, rStat.nSnapshotReads, rStat.nINIParses,
+		 rStat.nLoads ? rStat.nLoadTicks / rStat.nLoads : 0, rStat.nLoadTicksMax);
 
+	LOGNOTE ("Save: %u written, %u unchanged, %u chunks, %u ms average, %u ms maximum",
+		 rStat.nSaves, rStat.nUnchangedSaves, rStat.nChunksWritten,
+		 rStat.nSaves ? rStat.nSaveTicks / rStat.nSaves / 1000 : 0,
+		 rStat.nSaveTicksMax / 1000);
 
-void CPerformanceConfig::SetPortamentoGlissando (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nPortamentoGlissando[nTG] = nValue;
+	LOGNOTE ("List: %u ms, last scan %u ms, %u performances",
+		 rStat.nListTicks / 1000, rStat.nScanTicks / 1000, (unsigned) m_Directory.size ());
 }
 
-unsigned CPerformanceConfig::GetPortamentoGlissando (unsigned nTG) const
+void CPerformanceConfig::Process (void)
 {
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nPortamentoGlissando[nTG];
-}
+	if (m_SaveState != SaveStateIdle)
+	{
+		ProcessSave ();
 
+		return;
+	}
 
-void CPerformanceConfig::SetPortamentoTime (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nPortamentoTime[nTG] = nValue;
-}
+	if (ProcessPrefetch ())
+	{
+		return;
+	}
 
-unsigned CPerformanceConfig::GetPortamentoTime (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nPortamentoTime[nTG];
-}
+	if (   m_bIndexWriting
+	    || (   m_bDirectoryChanged
+		&& !m_bScanning
+		&& StartDirectoryIndex ()))
+	{
+		WriteDirectoryIndexSlice ();
 
-void CPerformanceConfig::SetMonoMode (bool bValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_bMonoMode[nTG] = bValue;
+		return;
+	}
+
+	if (m_bScanning)
+	{
+		unsigned nStartTicks = CTimer::GetClockTicks ();
+
+		bool bMore;
+		do
+		{
+			bMore = ScanStep ();
+		}
+		while (   bMore
+		       && CTimer::GetClockTicks () - nStartTicks < ScanTimeSlice);
+
+		if (!bMore)
+		{
+			FinishScan ();
+		}
+	}
 }
 
-bool CPerformanceConfig::GetMonoMode (unsigned nTG) const
+bool CPerformanceConfig::ProcessPrefetch (void)
 {
-	return m_bMonoMode[nTG];
+	if (!m_bPrefetchPending)
+	{
+		return false;
+	}
+
+	unsigned nWanted[PrefetchSlots];
+	unsigned nWantedCount = 0;
+
+	nWanted[nWantedCount++] = nActualPerformance+1;
+	nWanted[nWantedCount++] = nActualPerformance > 0 ? nActualPerformance-1 : NoPerformance;
+	for (unsigned i = 0; i < m_nPrefetchRequests; i++)
+	{
+		nWanted[nWantedCount++] = m_nPrefetchRequest[i];
+	}
+
+	for (unsigned i = 0; i < nWantedCount; i++)
+	{
+		unsigned nID = nWanted[i];
+		if (   nID >= m_Directory.size ()
+		    || nID == nActualPerformance
+		    || IsPrefetched (nID))
+		{
+			continue;
+		}
+
+		// replace the least recently used slot, which is not wanted
+		TPrefetchSlot *pSlot = nullptr;
+		for (unsigned j = 0; j < PrefetchSlots; j++)
+		{
+			TPrefetchSlot *pCandidate = &m_PrefetchSlot[j];
+			if (   std::find (nWanted, nWanted + nWantedCount, pCandidate->nID)
+				!= nWanted + nWantedCount
+			    && pCandidate->nID != NoPerformance)
+			{
+				continue;
+			}
+
+			if (   !pSlot
+			    || pCandidate->nLastUse < pSlot->nLastUse)
+			{
+				pSlot = pCandidate;
+			}
+		}
+		assert (pSlot);
+
+		std::string FileName = GetPerformancePath (nID);
+		CPropertiesFatFsFile Properties (FileName.c_str (), m_pFileSystem);
+		if (LoadPerformance (FileName, &Properties, &pSlot->Performance))
+		{
+			pSlot->nID = nID;
+			pSlot->nLastUse = ++m_nPrefetchUse;
+
+			LOGDBG ("Performance %u prefetched", nID);
+		}
+		else
+		{
+			pSlot->nID = NoPerformance;
+
+			LOGWARN ("%s: Cannot prefetch", FileName.c_str ());
+
+			// do not retry until the next change
+			m_bPrefetchPending = false;
+		}
+
+		return true;		// one performance per call
+	}
+
+	m_bPrefetchPending = false;
+
+	return false;
+}
+
+CPerformanceConfig::TPrefetchSlot *CPerformanceConfig::FindPrefetched (unsigned nID)
+{
+	for (unsigned i = 0; i < PrefetchSlots; i++)
+	{
+		if (m_PrefetchSlot[i].nID == nID)
+		{
+			return &m_PrefetchSlot[i];
+		}
+	}
+
+	return nullptr;
+}
+
+void CPerformanceConfig::InvalidatePrefetched (unsigned nID)
+{
+	for (unsigned i = 0; i < PrefetchSlots; i++)
+	{
+		if (   nID == NoPerformance
+		    || m_PrefetchSlot[i].nID == nID)
+		{
+			m_PrefetchSlot[i].nID = NoPerformance;
+			m_PrefetchSlot[i].nLastUse = 0;
+		}
+	}
+
+	m_bPrefetchPending = true;
+}
+
+unsigned CPerformanceConfig::GetBankNumber (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nBankNumber[nTG];
+}
+
+unsigned CPerformanceConfig::GetVoiceNumber (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nVoiceNumber[nTG];
+}
+
+unsigned CPerformanceConfig::GetMIDIChannel (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nMIDIChannel[nTG];
+}
+
+unsigned CPerformanceConfig::GetVolume (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nVolume[nTG];
+}
+
+unsigned CPerformanceConfig::GetPan (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nPan[nTG];
+}
+
+int CPerformanceConfig::GetDetune (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nDetune[nTG];
+}
+
+unsigned CPerformanceConfig::GetCutoff (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nCutoff[nTG];
+}
+
+unsigned CPerformanceConfig::GetResonance (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nResonance[nTG];
+}
+
+unsigned CPerformanceConfig::GetNoteLimitLow (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nNoteLimitLow[nTG];
+}
+
+unsigned CPerformanceConfig::GetNoteLimitHigh (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nNoteLimitHigh[nTG];
+}
+
+int CPerformanceConfig::GetNoteShift (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nNoteShift[nTG];
+}
+
+unsigned CPerformanceConfig::GetReverbSend (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nReverbSend[nTG];
+}
+
+void CPerformanceConfig::SetBankNumber (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nBankNumber[nTG], nValue))
+	{
+		SetDirty (nTG, TGBankNumber);
+	}
+}
+
+void CPerformanceConfig::SetVoiceNumber (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nVoiceNumber[nTG], nValue))
+	{
+		SetDirty (nTG, TGVoiceNumber);
+	}
+}
+
+void CPerformanceConfig::SetMIDIChannel (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nMIDIChannel[nTG], nValue))
+	{
+		SetDirty (nTG, TGMIDIChannel);
+	}
+}
+
+void CPerformanceConfig::SetVolume (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nVolume[nTG], nValue))
+	{
+		SetDirty (nTG, TGVolume);
+	}
+}
+
+void CPerformanceConfig::SetPan (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nPan[nTG], nValue))
+	{
+		SetDirty (nTG, TGPan);
+	}
+}
+
+void CPerformanceConfig::SetDetune (int nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nDetune[nTG], nValue))
+	{
+		SetDirty (nTG, TGDetune);
+	}
+}
+
+void CPerformanceConfig::SetCutoff (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nCutoff[nTG], nValue))
+	{
+		SetDirty (nTG, TGCutoff);
+	}
+}
+
+void CPerformanceConfig::SetResonance (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nResonance[nTG], nValue))
+	{
+		SetDirty (nTG, TGResonance);
+	}
+}
+
+void CPerformanceConfig::SetNoteLimitLow (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nNoteLimitLow[nTG], nValue))
+	{
+		SetDirty (nTG, TGNoteLimitLow);
+	}
+}
+
+void CPerformanceConfig::SetNoteLimitHigh (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nNoteLimitHigh[nTG], nValue))
+	{
+		SetDirty (nTG, TGNoteLimitHigh);
+	}
+}
+
+void CPerformanceConfig::SetNoteShift (int nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nNoteShift[nTG], nValue))
+	{
+		SetDirty (nTG, TGNoteShift);
+	}
+}
+
+void CPerformanceConfig::SetReverbSend (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nReverbSend[nTG], (int) nValue))
+	{
+		SetDirty (nTG, TGReverbSend);
+	}
+}
+
+bool CPerformanceConfig::GetCompressorEnable (void) const
+{
+	return m_Performance.bCompressorEnable;
+}
+
+bool CPerformanceConfig::GetReverbEnable (void) const
+{
+	return m_Performance.bReverbEnable;
+}
+
+unsigned CPerformanceConfig::GetReverbSize (void) const
+{
+	return m_Performance.nReverbSize;
+}
+
+unsigned CPerformanceConfig::GetReverbHighDamp (void) const
+{
+	return m_Performance.nReverbHighDamp;
+}
+
+unsigned CPerformanceConfig::GetReverbLowDamp (void) const
+{
+	return m_Performance.nReverbLowDamp;
+}
+
+unsigned CPerformanceConfig::GetReverbLowPass (void) const
+{
+	return m_Performance.nReverbLowPass;
+}
+
+unsigned CPerformanceConfig::GetReverbDiffusion (void) const
+{
+	return m_Performance.nReverbDiffusion;
+}
+
+unsigned CPerformanceConfig::GetReverbLevel (void) const
+{
+	return m_Performance.nReverbLevel;
+}
+
+void CPerformanceConfig::SetCompressorEnable (bool bValue)
+{
+	if (Assign (&m_Performance.bCompressorEnable, bValue))
+	{
+		SetDirty (CConfig::ToneGenerators, EffectCompressorEnable);
+	}
+}
+
+void CPerformanceConfig::SetReverbEnable (bool bValue)
+{
+	if (Assign (&m_Performance.bReverbEnable, bValue))
+	{
+		SetDirty (CConfig::ToneGenerators, EffectReverbEnable);
+	}
+}
+
+void CPerformanceConfig::SetReverbSize (unsigned nValue)
+{
+	if (Assign (&m_Performance.nReverbSize, nValue))
+	{
+		SetDirty (CConfig::ToneGenerators, EffectReverbSize);
+	}
+}
+
+void CPerformanceConfig::SetReverbHighDamp (unsigned nValue)
+{
+	if (Assign (&m_Performance.nReverbHighDamp, nValue))
+	{
+		SetDirty (CConfig::ToneGenerators, EffectReverbHighDamp);
+	}
+}
+
+void CPerformanceConfig::SetReverbLowDamp (unsigned nValue)
+{
+	if (Assign (&m_Performance.nReverbLowDamp, nValue))
+	{
+		SetDirty (CConfig::ToneGenerators, EffectReverbLowDamp);
+	}
+}
+
+void CPerformanceConfig::SetReverbLowPass (unsigned nValue)
+{
+	if (Assign (&m_Performance.nReverbLowPass, nValue))
+	{
+		SetDirty (CConfig::ToneGenerators, EffectReverbLowPass);
+	}
+}
+
+void CPerformanceConfig::SetReverbDiffusion (unsigned nValue)
+{
+	if (Assign (&m_Performance.nReverbDiffusion, nValue))
+	{
+		SetDirty (CConfig::ToneGenerators, EffectReverbDiffusion);
+	}
+}
+
+void CPerformanceConfig::SetReverbLevel (unsigned nValue)
+{
+	if (Assign (&m_Performance.nReverbLevel, nValue))
+	{
+		SetDirty (CConfig::ToneGenerators, EffectReverbLevel);
+	}
+}
+// Pitch bender and portamento:
+void CPerformanceConfig::SetPitchBendRange (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nPitchBendRange[nTG], nValue))
+	{
+		SetDirty (nTG, TGPitchBendRange);
+	}
+}
+
+unsigned CPerformanceConfig::GetPitchBendRange (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nPitchBendRange[nTG];
+}
+
+
+void CPerformanceConfig::SetPitchBendStep (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nPitchBendStep[nTG], nValue))
+	{
+		SetDirty (nTG, TGPitchBendStep);
+	}
+}
+
+unsigned CPerformanceConfig::GetPitchBendStep (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nPitchBendStep[nTG];
+}
+
+
+void CPerformanceConfig::SetPortamentoMode (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nPortamentoMode[nTG], nValue))
+	{
+		SetDirty (nTG, TGPortamentoMode);
+	}
+}
+
+unsigned CPerformanceConfig::GetPortamentoMode (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nPortamentoMode[nTG];
+}
+
+
+void CPerformanceConfig::SetPortamentoGlissando (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nPortamentoGlissando[nTG], nValue))
+	{
+		SetDirty (nTG, TGPortamentoGlissando);
+	}
+}
+
+unsigned CPerformanceConfig::GetPortamentoGlissando (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nPortamentoGlissando[nTG];
+}
+
+
+void CPerformanceConfig::SetPortamentoTime (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nPortamentoTime[nTG], nValue))
+	{
+		SetDirty (nTG, TGPortamentoTime);
+	}
+}
+
+unsigned CPerformanceConfig::GetPortamentoTime (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nPortamentoTime[nTG];
+}
+
+void CPerformanceConfig::SetMonoMode (bool bValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.bMonoMode[nTG], bValue))
+	{
+		SetDirty (nTG, TGMonoMode);
+	}
+}
+
+bool CPerformanceConfig::GetMonoMode (unsigned nTG) const
+{
+	return m_Performance.bMonoMode[nTG];
+}
+
+void CPerformanceConfig::SetModulationWheelRange (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nModulationWheelRange[nTG], nValue))
+	{
+		SetDirty (nTG, TGModulationWheelRange);
+	}
+}
+
+unsigned CPerformanceConfig::GetModulationWheelRange (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nModulationWheelRange[nTG];
+}
+
+void CPerformanceConfig::SetModulationWheelTarget (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nModulationWheelTarget[nTG], nValue))
+	{
+		SetDirty (nTG, TGModulationWheelTarget);
+	}
+}
+
+unsigned CPerformanceConfig::GetModulationWheelTarget (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nModulationWheelTarget[nTG];
+}
+
+void CPerformanceConfig::SetFootControlRange (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nFootControlRange[nTG], nValue))
+	{
+		SetDirty (nTG, TGFootControlRange);
+	}
+}
+
+unsigned CPerformanceConfig::GetFootControlRange (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nFootControlRange[nTG];
+}
+
+void CPerformanceConfig::SetFootControlTarget (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nFootControlTarget[nTG], nValue))
+	{
+		SetDirty (nTG, TGFootControlTarget);
+	}
+}
+
+unsigned CPerformanceConfig::GetFootControlTarget (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nFootControlTarget[nTG];
+}
+
+void CPerformanceConfig::SetBreathControlRange (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nBreathControlRange[nTG], nValue))
+	{
+		SetDirty (nTG, TGBreathControlRange);
+	}
+}
+
+unsigned CPerformanceConfig::GetBreathControlRange (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nBreathControlRange[nTG];
+}
+
+void CPerformanceConfig::SetBreathControlTarget (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nBreathControlTarget[nTG], nValue))
+	{
+		SetDirty (nTG, TGBreathControlTarget);
+	}
+}
+
+unsigned CPerformanceConfig::GetBreathControlTarget (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nBreathControlTarget[nTG];
+}
+
+void CPerformanceConfig::SetAftertouchRange (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nAftertouchRange[nTG], nValue))
+	{
+		SetDirty (nTG, TGAftertouchRange);
+	}
+}
+
+unsigned CPerformanceConfig::GetAftertouchRange (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nAftertouchRange[nTG];
+}
+
+void CPerformanceConfig::SetAftertouchTarget (unsigned nValue, unsigned nTG)
+{
+	assert (nTG < CConfig::ToneGenerators);
+	if (Assign (&m_Performance.nAftertouchTarget[nTG], nValue))
+	{
+		SetDirty (nTG, TGAftertouchTarget);
+	}
+}
+
+unsigned CPerformanceConfig::GetAftertouchTarget (unsigned nTG) const
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.nAftertouchTarget[nTG];
+}
+
+void CPerformanceConfig::SetVoiceDataToTxt (const uint8_t *pData, unsigned nTG)  
+{
+	assert (nTG < CConfig::ToneGenerators);
+	assert (pData);
+	if (   !m_Performance.bVoiceDataFilled[nTG]
+	    || memcmp (m_Performance.VoiceData[nTG], pData, NUM_VOICE_PARAM) != 0)
+	{
+		memcpy (m_Performance.VoiceData[nTG], pData, NUM_VOICE_PARAM);
+		m_Performance.bVoiceDataFilled[nTG] = true;
+
+		SetDirty (nTG, TGVoiceData);
+	}
+}
+
+uint8_t *CPerformanceConfig::GetVoiceDataFromTxt (unsigned nTG) 
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.VoiceData[nTG];
+}
+
+bool CPerformanceConfig::VoiceDataFilled(unsigned nTG) 
+{
+	assert (nTG < CConfig::ToneGenerators);
+	return m_Performance.bVoiceDataFilled[nTG];
+}
+
+// "XX XX ... XX" with NUM_VOICE_PARAM hex bytes
+bool CPerformanceConfig::ParseVoiceData (const char *pText, uint8_t *pData)
+{
+	assert (pText);
+	assert (pData);
+
+	if (!*pText)
+	{
+		return false;
+	}
+
+	for (unsigned i = 0; i < NUM_VOICE_PARAM; i++)
+	{
+		unsigned nValue = 0;
+		for (unsigned j = 0; j < 2; j++)
+		{
+			char chDigit = toupper (*pText++);
+			if ('0' <= chDigit && chDigit <= '9')
+			{
+				nValue = nValue << 4 | (chDigit - '0');
+			}
+			else if ('A' <= chDigit && chDigit <= 'F')
+			{
+				nValue = nValue << 4 | (chDigit - 'A' + 10);
+			}
+			else
+			{
+				LOGWARN ("Invalid voice data");
+
+				return false;
+			}
+		}
+
+		pData[i] = nValue;
+
+		if (*pText == ' ')
+		{
+			pText++;
+		}
+	}
+
+	return true;
+}
+
+std::string CPerformanceConfig::GetSnapshotFileName (const std::string &rFileName)
+{
+	size_t nPos = rFileName.rfind ('.');
+	assert (nPos != std::string::npos);
+
+	return rFileName.substr (0, nPos) + ".bin";
+}
+
+bool CPerformanceConfig::ReadSnapshot (const std::string &rFileName, const FILINFO *pINIFileInfo,
+				       TPerformance *pPerformance)
+{
+	assert (pINIFileInfo);
+	assert (pPerformance);
+
+	std::string FileName = GetSnapshotFileName (rFileName);
+
+	FIL File;
+	if (f_open (&File, FileName.c_str (), FA_READ | FA_OPEN_EXISTING) != FR_OK)
+	{
+		return false;
+	}
+
+	TSnapshot Snapshot;
+	UINT nRead;
+	bool bOK =    f_read (&File, &Snapshot, sizeof Snapshot, &nRead) == FR_OK
+		   && nRead == sizeof Snapshot;
+
+	f_close (&File);
+
+	if (   !bOK
+	    || Snapshot.nChecksum != CSysExFileLoader::Hash (&Snapshot, sizeof Snapshot - sizeof Snapshot.nChecksum)
+	    || memcmp (Snapshot.Magic, SNAPSHOT_MAGIC, sizeof Snapshot.Magic) != 0
+	    || Snapshot.nVersion != SnapshotVersion
+	    || Snapshot.nPerformanceSize != sizeof (TPerformance))
+	{
+		LOGWARN ("%s: Invalid snapshot", FileName.c_str ());
+
+		return false;
+	}
+
+	if (   Snapshot.nINISize != pINIFileInfo->fsize
+	    || Snapshot.nINITime != ((uint32_t) pINIFileInfo->fdate << 16 | pINIFileInfo->ftime))
+	{
+		LOGDBG ("%s: INI file has changed", FileName.c_str ());
+
+		return false;
+	}
+
+	memcpy (pPerformance, &Snapshot.Performance, sizeof *pPerformance);
+
+	return true;
+}
+
+bool CPerformanceConfig::WriteSnapshot (const std::string &rFileName,
+					const TPerformance *pPerformance)
+{
+	assert (pPerformance);
+
+	FILINFO FileInfo;
+	if (f_stat (rFileName.c_str (), &FileInfo) != FR_OK)
+	{
+		return false;
+	}
+
+	TSnapshot Snapshot;
+	memcpy (Snapshot.Magic, SNAPSHOT_MAGIC, sizeof Snapshot.Magic);
+	Snapshot.nVersion = SnapshotVersion;
+	Snapshot.nPerformanceSize = sizeof (TPerformance);
+	Snapshot.nINISize = FileInfo.fsize;
+	Snapshot.nINITime = (uint32_t) FileInfo.fdate << 16 | FileInfo.ftime;
+	memcpy (&Snapshot.Performance, pPerformance, sizeof Snapshot.Performance);
+	Snapshot.nChecksum = CSysExFileLoader::Hash (&Snapshot, sizeof Snapshot - sizeof Snapshot.nChecksum);
+
+	std::string FileName = GetSnapshotFileName (rFileName);
+
+	FIL File;
+	if (f_open (&File, FileName.c_str (), FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+	{
+		LOGWARN ("%s: Cannot create file", FileName.c_str ());
+
+		return false;
+	}
+
+	UINT nWritten;
+	bool bOK =    f_write (&File, &Snapshot, sizeof Snapshot, &nWritten) == FR_OK
+		   && nWritten == sizeof Snapshot;
+
+	if (f_close (&File) != FR_OK)
+	{
+		bOK = false;
+	}
+
+	if (!bOK)
+	{
+		LOGWARN ("%s: Write error", FileName.c_str ());
+
+		f_unlink (FileName.c_str ());
+
+		return false;
+	}
+
+	return true;
+}
+
+std::string CPerformanceConfig::GetPerformanceFileName(unsigned nID)
+{
+	if (nID >= m_Directory.size ())
+	{
+		return "";
+	}
+
+	return GetFileName (nID);
+}
+
+std::string CPerformanceConfig::GetPerformanceName(unsigned nID)
+{
+	if(nID == 0) // in order to assure retrocompatibility
+	{
+		return "Default";
+	}
+	else if (nID >= m_Directory.size ())
+	{
+		return "";
+	}
+	else
+	{
+		// without bank folder
+		const char *pFileName = GetFileName (nID);
+		const char *pSlash = strrchr (pFileName, '/');
+		std::string FileName (pSlash ? pSlash+1 : pFileName);
+
+		return FileName.substr(0,FileName.length()-4).substr(7,14);
+	}
+}
+
+unsigned CPerformanceConfig::FindPerformance (const std::string &rFileName) const
+{
+	if (rFileName == GetFileName (0))
+	{
+		return 0;
+	}
+
+	const char *pStringPool = m_StringPool.c_str ();
+	auto Less = [pStringPool] (const TPerformanceEntry &rEntry, const char *pFileName)
+		{ return strcmp (pStringPool + rEntry.nPathOffset, pFileName) < 0; };
+
+	auto Iterator = std::lower_bound (m_Directory.begin ()+1, m_Directory.end (),
+					  rFileName.c_str (), Less);
+	if (   Iterator == m_Directory.end ()
+	    || rFileName != pStringPool + Iterator->nPathOffset)
+	{
+		return NoPerformance;
+	}
+
+	return Iterator - m_Directory.begin ();
+}
+
+unsigned CPerformanceConfig::FindPerformance (unsigned nFileIndex) const
+{
+	auto Iterator = m_FileIndexMap.find (nFileIndex);
+	if (Iterator == m_FileIndexMap.end ())
+	{
+		return NoPerformance;
+	}
+
+	return Iterator->second;
+}
+
+unsigned CPerformanceConfig::GetDirectoryGeneration (void) const
+{
+	return m_nDirectoryGeneration;
+}
+
+unsigned CPerformanceConfig::GetLastPerformance()
+{
+	return m_Directory.size ();
+}
+
+unsigned CPerformanceConfig::GetActualPerformanceID()
+{
+	return nActualPerformance;
+}
+
+void CPerformanceConfig::SetActualPerformanceID(unsigned nID)
+{
+	nActualPerformance = nID;
+}
+
+bool CPerformanceConfig::GetInternalFolderOk()
+{
+	return nInternalFolderOk;
+}
+
+bool CPerformanceConfig::CheckFreePerformanceSlot(void)
+{
+	if (   m_Directory.size () < MaxPerformances
+	    && nLastFileIndex < MaxFileIndex)
+	{
+		// There is a free slot...
+		return true;
+	}
+	else
+	{
+		return false;
+	}
+}
+
+bool CPerformanceConfig::CreateNewPerformanceFile(void)
+{
+	if (!CheckFreePerformanceSlot ()) {
+		// No space left for new performances
+		LOGWARN ("No space left for new performance");
+		return false;
+	}
+
+	std::string sPerformanceName = NewPerformanceName;
+	NewPerformanceName=""; 
+	std::string nFileName;
+	std::string nPath;
+	std::string nIndex = "000000";
+	nIndex += std::to_string(++nLastFileIndex);
+	nIndex = nIndex.substr(nIndex.length()-6,6);
+	
+
+	nFileName = nIndex;
+	nFileName += "_";
+	if (strcmp(sPerformanceName.c_str(),"") == 0)
+	{
+		nFileName += "Perf";
+		nFileName += nIndex;
+	}		
+	else
+	{
+		nFileName +=sPerformanceName.substr(0,14);
+	}
+	nFileName += ".ini";
+	
+	nPath = "SD:/" ;
+	nPath += PERFORMANCE_DIR;
+	nPath += "/";
+	
+	FIL File;
+	FRESULT Result = f_open (&File, (nPath + nFileName).c_str(), FA_WRITE | FA_CREATE_ALWAYS);
+	if (Result != FR_OK)
+	{
+		return false;
+	}
+
+	if (f_close (&File) != FR_OK)
+	{
+		return false;
+	}
+	
+	nActualPerformance = AddPerformance (nFileName.c_str ());
+	nFileName = nPath + nFileName;
+	new (&m_Properties) CPropertiesFatFsFile(nFileName.c_str(), m_pFileSystem);
+	m_FileName = nFileName;
+	SetAllDirty ();				// file is empty
+	InvalidatePrefetched (NoPerformance);	// IDs behind the new one have changed
+
+	if (m_bScanning)
+	{
+		StartScan ();			// restart, the directory has changed
+	}
+
+	m_bDirectoryChanged = true;		// index is written by Process()
+	
+	return true;
+}
+
+bool CPerformanceConfig::ListPerformances()
+{
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	nInternalFolderOk=false;
+	nExternalFolderOk=false; // for future USB implementation
+	
+    DIR Directory;
+	FRESULT Result;
+	//Check if internal "performance" directory exists
+	Result = f_opendir (&Directory, "SD:/" PERFORMANCE_DIR);
+	if (Result == FR_OK)
+	{
+		nInternalFolderOk=true;		
+		f_closedir (&Directory);
+	}
+	else
+	{
+		// attenpt to create the folder
+		Result = f_mkdir("SD:/" PERFORMANCE_DIR);
+		nInternalFolderOk = (Result == FR_OK);
+	}
+	
+	ClearDirectory ();
+
+	if (nInternalFolderOk)
+	{
+		if (ReadDirectoryIndex ())
+		{
+			// verify the index in the background
+			StartScan ();
+
+			LOGNOTE ("Number of Performances: %u (from index)", (unsigned) m_Directory.size ());
+		}
+		else if (StartScan ())
+		{
+			while (ScanStep ())
+			{
+				// just continue
+			}
+
+			FinishScan ();
+		}
+	}
+	
+	InvalidatePrefetched (NoPerformance);
+
+	m_Statistics.nListTicks = CTimer::GetClockTicks () - nStartTicks;
+
+	return nInternalFolderOk;
+}   
+    
+const char *CPerformanceConfig::GetFileName (unsigned nID) const
+{
+	assert (nID < m_Directory.size ());
+	return m_StringPool.c_str () + m_Directory[nID].nPathOffset;
+}
+
+unsigned CPerformanceConfig::AddString (const char *pString)
+{
+	assert (pString);
+
+	unsigned nOffset = m_StringPool.length ();
+	m_StringPool.append (pString);
+	m_StringPool.push_back ('\0');
+
+	return nOffset;
+}
+
+void CPerformanceConfig::ClearDirectory (void)
+{
+	m_Directory.clear ();
+	m_StringPool.clear ();
+	m_nStringGarbage = 0;
+	nLastFileIndex = 0;
+
+	TPerformanceEntry Entry;
+	Entry.nPathOffset = AddString ("performance.ini"); // in order to assure retrocompatibility
+	Entry.nFileIndex = 0;
+	m_Directory.push_back (Entry);
+
+	UpdateFileIndexMap ();
+}
+
+unsigned CPerformanceConfig::AddPerformance (const char *pFileName)
+{
+	assert (pFileName);
+
+	const char *pStringPool = m_StringPool.c_str ();
+	auto Less = [pStringPool] (const TPerformanceEntry &rEntry, const char *pName)
+		{ return strcmp (pStringPool + rEntry.nPathOffset, pName) < 0; };
+
+	// default is always on first place
+	auto Iterator = std::lower_bound (m_Directory.begin ()+1, m_Directory.end (),
+					  pFileName, Less);
+
+	TPerformanceEntry Entry;
+	Entry.nPathOffset = AddString (pFileName);
+	Entry.nFileIndex = 0;
+	ParseFileIndex (pFileName, &Entry.nFileIndex);
+
+	if (Entry.nFileIndex > nLastFileIndex)
+	{
+		nLastFileIndex = Entry.nFileIndex;
+	}
+
+	Iterator = m_Directory.insert (Iterator, Entry);
+	unsigned nID = Iterator - m_Directory.begin ();
+
+	UpdateFileIndexMap ();
+
+	return nID;
+}
+
+void CPerformanceConfig::RemovePerformance (unsigned nID)
+{
+	assert (0 < nID && nID < m_Directory.size ());
+
+	m_nStringGarbage += strlen (GetFileName (nID)) + 1;
+	m_Directory.erase (m_Directory.begin () + nID);
+
+	// the removed paths remain in m_StringPool, until they use more than half of it
+	if (m_nStringGarbage > m_StringPool.length () / 2)
+	{
+		CompactStringPool ();
+	}
+
+	UpdateFileIndexMap ();
+}
+
+void CPerformanceConfig::CompactStringPool (void)
+{
+	std::string StringPool;
+	StringPool.reserve (m_StringPool.length () - m_nStringGarbage);
+
+	for (auto &rEntry : m_Directory)
+	{
+		const char *pFileName = m_StringPool.c_str () + rEntry.nPathOffset;
+
+		rEntry.nPathOffset = StringPool.length ();
+		StringPool.append (pFileName);
+		StringPool.push_back ('\0');
+	}
+
+	m_StringPool.swap (StringPool);
+	m_nStringGarbage = 0;
+}
+
+void CPerformanceConfig::UpdateFileIndexMap (void)
+{
+	m_nDirectoryGeneration++;
+
+	m_FileIndexMap.clear ();
+
+	// the directory is sorted by path, so the first match of the number is kept
+	for (unsigned nID = m_Directory.size (); nID-- > 0;)
+	{
+		m_FileIndexMap[m_Directory[nID].nFileIndex] = nID;
+	}
+}
+
+bool CPerformanceConfig::ParseFileIndex (const char *pFileName, unsigned *pFileIndex)
+{
+	assert (pFileName);
+	assert (pFileIndex);
+
+	// without bank folder
+	const char *pSlash = strrchr (pFileName, '/');
+	if (pSlash)
+	{
+		pFileName = pSlash+1;
+	}
+
+	size_t nLen = strlen (pFileName);
+	if (   nLen <= 8 || nLen >= 26				// "NNNNNN_name.ini"
+	    || pFileName[6] != '_'
+	    || strcasecmp (&pFileName[nLen-4], ".ini") != 0)
+	{
+		return false;
+	}
+
+	unsigned nFileIndex = 0;
+	for (unsigned i = 0; i < 6; i++)
+	{
+		if (!isdigit ((unsigned char) pFileName[i]))
+		{
+			return false;
+		}
+
+		nFileIndex = nFileIndex*10 + pFileName[i]-'0';
+	}
+
+	*pFileIndex = nFileIndex;
+
+	return true;
+}
+
+bool CPerformanceConfig::StartScan (void)
+{
+	while (m_nScanDepth)
+	{
+		f_closedir (&m_ScanDirectory[--m_nScanDepth]);
+	}
+
+	m_ScanFiles.clear ();
+	m_bScanning = false;
+
+	if (f_opendir (&m_ScanDirectory[0], "SD:/" PERFORMANCE_DIR) != FR_OK)
+	{
+		return false;
+	}
+
+	m_ScanPath[0].clear ();
+	m_nScanDepth = 1;
+	m_nScanStartTicks = CTimer::GetClockTicks ();
+	m_bScanning = true;
+
+	return true;
+}
+
+bool CPerformanceConfig::ScanStep (void)
+{
+	if (!m_nScanDepth)
+	{
+		return false;
+	}
+
+	unsigned nLevel = m_nScanDepth-1;
+
+	FILINFO FileInfo;
+	if (   f_readdir (&m_ScanDirectory[nLevel], &FileInfo) != FR_OK
+	    || !FileInfo.fname[0])
+	{
+		f_closedir (&m_ScanDirectory[nLevel]);
+		m_nScanDepth--;
+
+		return m_nScanDepth > 0;
+	}
+
+	if (FileInfo.fattrib & (AM_HID | AM_SYS))
+	{
+		return true;
+	}
+
+	std::string Path (m_ScanPath[nLevel]);
+	if (!Path.empty ())
+	{
+		Path += "/";
+	}
+	Path += FileInfo.fname;
+
+	if (FileInfo.fattrib & AM_DIR)
+	{
+		if (nLevel >= MaxBankDirs)
+		{
+			LOGWARN ("Too many nested folders: %s", Path.c_str ());
+
+			return true;
+		}
+
+		std::string DirName ("SD:/" PERFORMANCE_DIR "/");
+		DirName += Path;
+
+		if (f_opendir (&m_ScanDirectory[nLevel+1], DirName.c_str ()) == FR_OK)
+		{
+			m_ScanPath[nLevel+1] = Path;
+			m_nScanDepth++;
+		}
+	}
+	else
+	{
+		unsigned nFileIndex;
+		if (!ParseFileIndex (FileInfo.fname, &nFileIndex))
+		{
+			return true;
+		}
+
+		if (m_ScanFiles.size ()+1 >= MaxPerformances)
+		{
+			LOGNOTE ("Skipping performance %s", Path.c_str ());
+
+			return true;
+		}
+
+		m_ScanFiles.push_back (Path);
+	}
+
+	return true;
 }
 
-void CPerformanceConfig::SetModulationWheelRange (unsigned nValue, unsigned nTG)
+void CPerformanceConfig::FinishScan (void)
 {
-	assert (nTG < CConfig::ToneGenerators);
-	m_nModulationWheelRange[nTG] = nValue;
-}
+	assert (m_bScanning);
 
-unsigned CPerformanceConfig::GetModulationWheelRange (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nModulationWheelRange[nTG];
-}
+	while (m_nScanDepth)
+	{
+		f_closedir (&m_ScanDirectory[--m_nScanDepth]);
+	}
 
-void CPerformanceConfig::SetModulationWheelTarget (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nModulationWheelTarget[nTG] = nValue;
-}
+	m_bScanning = false;
 
-unsigned CPerformanceConfig::GetModulationWheelTarget (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nModulationWheelTarget[nTG];
-}
+	// sort by bank folder and performance number-name
+	std::sort (m_ScanFiles.begin (), m_ScanFiles.end ());
 
-void CPerformanceConfig::SetFootControlRange (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nFootControlRange[nTG] = nValue;
-}
+	bool bChanged = m_ScanFiles.size ()+1 != m_Directory.size ();
+	for (unsigned i = 0; !bChanged && i < m_ScanFiles.size (); i++)
+	{
+		bChanged = m_ScanFiles[i] != GetFileName (i+1);
+	}
 
-unsigned CPerformanceConfig::GetFootControlRange (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nFootControlRange[nTG];
-}
+	if (bChanged)
+	{
+		std::string ActualFileName;
+		if (nActualPerformance < m_Directory.size ())
+		{
+			ActualFileName = GetFileName (nActualPerformance);
+		}
 
-void CPerformanceConfig::SetFootControlTarget (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nFootControlTarget[nTG] = nValue;
-}
+		ClearDirectory ();
+		m_Directory.reserve (m_ScanFiles.size ()+1);
 
-unsigned CPerformanceConfig::GetFootControlTarget (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nFootControlTarget[nTG];
-}
+		for (auto &rFileName : m_ScanFiles)
+		{
+			TPerformanceEntry Entry;
+			Entry.nPathOffset = AddString (rFileName.c_str ());
+			Entry.nFileIndex = 0;
+			ParseFileIndex (rFileName.c_str (), &Entry.nFileIndex);
+
+			if (Entry.nFileIndex > nLastFileIndex)
+			{
+				nLastFileIndex = Entry.nFileIndex;
+			}
 
-void CPerformanceConfig::SetBreathControlRange (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nBreathControlRange[nTG] = nValue;
-}
+			m_Directory.push_back (Entry);
+		}
 
-unsigned CPerformanceConfig::GetBreathControlRange (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nBreathControlRange[nTG];
-}
+		// keep the actual performance, if it still exists
+		nActualPerformance = FindPerformance (ActualFileName);
+		if (nActualPerformance == NoPerformance)
+		{
+			nActualPerformance = 0;
+		}
 
-void CPerformanceConfig::SetBreathControlTarget (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nBreathControlTarget[nTG] = nValue;
-}
+		UpdateFileIndexMap ();
+		InvalidatePrefetched (NoPerformance);	// IDs have changed
 
-unsigned CPerformanceConfig::GetBreathControlTarget (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nBreathControlTarget[nTG];
-}
+		m_bDirectoryChanged = true;		// index is written by Process()
+	}
 
-void CPerformanceConfig::SetAftertouchRange (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nAftertouchRange[nTG] = nValue;
-}
+	std::vector<std::string> ().swap (m_ScanFiles);	// free memory
 
-unsigned CPerformanceConfig::GetAftertouchRange (unsigned nTG) const
-{
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nAftertouchRange[nTG];
-}
+	m_Statistics.nScanTicks = CTimer::GetClockTicks () - m_nScanStartTicks;
 
-void CPerformanceConfig::SetAftertouchTarget (unsigned nValue, unsigned nTG)
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nAftertouchTarget[nTG] = nValue;
+	LOGNOTE ("Number of Performances: %u", (unsigned) m_Directory.size ());
+	LOGDBG ("Performance directory %s in %u ms", bChanged ? "updated" : "verified",
+		m_Statistics.nScanTicks / 1000);
 }
 
-unsigned CPerformanceConfig::GetAftertouchTarget (unsigned nTG) const
+bool CPerformanceConfig::ReadDirectoryIndex (void)
 {
-	assert (nTG < CConfig::ToneGenerators);
-	return m_nAftertouchTarget[nTG];
-}
+	FIL File;
+	if (f_open (&File, DIRECTORY_INDEX, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+	{
+		LOGNOTE ("No performance index found, scanning directory");
 
-void CPerformanceConfig::SetVoiceDataToTxt (const uint8_t *pData, unsigned nTG)  
-{
-	assert (nTG < CConfig::ToneGenerators);
-	m_nVoiceDataTxt[nTG] = "";
-	char nDtoH[]="0123456789ABCDEF";
-	for (int i = 0; i < NUM_VOICE_PARAM; i++)
+		return false;
+	}
+
+	size_t nFileSize = f_size (&File);
+	uint8_t *pBuffer = new uint8_t[nFileSize+1];
+	assert (pBuffer);
+
+	UINT nRead;
+	if (   f_read (&File, pBuffer, nFileSize, &nRead) != FR_OK
+	    || nRead != nFileSize)
 	{
-	m_nVoiceDataTxt[nTG]  += nDtoH[(pData[i] & 0xF0)/16];
-	m_nVoiceDataTxt[nTG]  += nDtoH[pData[i] & 0x0F]  ;
-	if ( i < (NUM_VOICE_PARAM-1)  ) 
-    	{
-     	 m_nVoiceDataTxt[nTG] += " ";
-    	}
+		nFileSize = 0;
 	}
-}
 
-uint8_t *CPerformanceConfig::GetVoiceDataFromTxt (unsigned nTG) 
-{
-	assert (nTG < CConfig::ToneGenerators);
-	static uint8_t pData[NUM_VOICE_PARAM];
-	std::string nHtoD="0123456789ABCDEF";
-	 
- 	for (int i=0; i<NUM_VOICE_PARAM * 3; i=i+3)
+	f_close (&File);
+
+	bool bValid = false;
+	const TDirectoryHeader *pHeader = (const TDirectoryHeader *) pBuffer;
+	uint32_t nChecksum;
+	if (nFileSize >= sizeof (TDirectoryHeader) + sizeof nChecksum)
 	{
-  	pData[i/3] = ((nHtoD.find(toupper(m_nVoiceDataTxt[nTG][i]),0) * 16 + nHtoD.find(toupper(m_nVoiceDataTxt[nTG][i+1]),0))) & 0xFF ;
-	} 
-  
-	return pData;
-}
+		size_t nDataSize = nFileSize - sizeof nChecksum;
+		memcpy (&nChecksum, pBuffer + nDataSize, sizeof nChecksum);
 
-bool CPerformanceConfig::VoiceDataFilled(unsigned nTG) 
-{
-	return (strcmp(m_nVoiceDataTxt[nTG].c_str(),"") != 0) ;
-}
+		bValid =    nChecksum == CSysExFileLoader::Hash (pBuffer, nDataSize)
+			 && memcmp (pHeader->Magic, DIRECTORY_MAGIC, sizeof pHeader->Magic) == 0
+			 && pHeader->nVersion == DirectoryVersion
+			 && pHeader->nEntries < MaxPerformances;
 
-std::string CPerformanceConfig::GetPerformanceFileName(unsigned nID)
-{
-	return m_nPerformanceFileName[nID];
-}
+		if (bValid)
+		{
+			m_Directory.reserve (pHeader->nEntries+1);
+		}
 
-std::string CPerformanceConfig::GetPerformanceName(unsigned nID)
-{
-	if(nID == 0) // in order to assure retrocompatibility
-	{
-		return "Default";
+		size_t nOffset = sizeof (TDirectoryHeader);
+		for (unsigned i = 0; bValid && i < pHeader->nEntries; i++)
+		{
+			const char *pFileName = (const char *) pBuffer + nOffset;
+			size_t nLength = strnlen (pFileName, nDataSize - nOffset);
+			nOffset += nLength+1;
+
+			TPerformanceEntry Entry;
+			Entry.nFileIndex = 0;
+			if (   nOffset > nDataSize
+			    || !ParseFileIndex (pFileName, &Entry.nFileIndex)
+			    || (   m_Directory.size () > 1
+				&& strcmp (GetFileName (m_Directory.size ()-1), pFileName) >= 0))
+			{
+				bValid = false;
+
+				break;
+			}
+
+			Entry.nPathOffset = AddString (pFileName);
+
+			if (Entry.nFileIndex > nLastFileIndex)
+			{
+				nLastFileIndex = Entry.nFileIndex;
+			}
+
+			m_Directory.push_back (Entry);
+		}
 	}
-	else
+
+	delete [] pBuffer;
+
+	if (!bValid)
 	{
-		return m_nPerformanceFileName[nID].substr(0,m_nPerformanceFileName[nID].length()-4).substr(7,14);
+		LOGWARN (DIRECTORY_INDEX ": Invalid performance index, scanning directory");
+
+		ClearDirectory ();
+
+		return false;
 	}
-}
 
-unsigned CPerformanceConfig::GetLastPerformance()
-{
-	return nLastPerformance;
-}
+	UpdateFileIndexMap ();
 
-unsigned CPerformanceConfig::GetActualPerformanceID()
-{
-	return nActualPerformance;
+	return true;
 }
 
-void CPerformanceConfig::SetActualPerformanceID(unsigned nID)
+bool CPerformanceConfig::StartDirectoryIndex (void)
 {
-	nActualPerformance = nID;
-}
+	assert (!m_bIndexWriting);
 
-bool CPerformanceConfig::GetInternalFolderOk()
-{
-	return nInternalFolderOk;
-}
+	m_bDirectoryChanged = false;
 
-bool CPerformanceConfig::CheckFreePerformanceSlot(void)
-{
-	if (nLastPerformance < NUM_PERFORMANCES)
+	// the valid index is kept, until the new one is complete
+	if (f_open (&m_IndexFile, DIRECTORY_INDEX_TEMP, FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
 	{
-		// There is a free slot...
-		return true;
+		LOGWARN (DIRECTORY_INDEX_TEMP ": Cannot create file");
+
+		return false;
 	}
-	else
+
+	TDirectoryHeader Header;
+	memcpy (Header.Magic, DIRECTORY_MAGIC, sizeof Header.Magic);
+	Header.nVersion = DirectoryVersion;
+	Header.nEntries = m_Directory.size ()-1;
+
+	m_bIndexWriting = true;
+	m_nIndexID = 1;
+	m_nIndexChecksum = CSysExFileLoader::Hash (&Header, sizeof Header);
+
+	UINT nWritten;
+	if (   f_write (&m_IndexFile, &Header, sizeof Header, &nWritten) != FR_OK
+	    || nWritten != sizeof Header)
 	{
+		LOGWARN (DIRECTORY_INDEX_TEMP ": Write error");
+
+		AbortDirectoryIndex ();
+
 		return false;
 	}
+
+	return true;
 }
 
-bool CPerformanceConfig::CreateNewPerformanceFile(void)
+bool CPerformanceConfig::WriteDirectoryIndexSlice (void)
 {
-	if (nLastPerformance >= NUM_PERFORMANCES) {
-		// No space left for new performances
-		LOGWARN ("No space left for new performance");
+	assert (m_bIndexWriting);
+
+	if (m_bDirectoryChanged)
+	{
+		// the written part is outdated, start again in the next call
+		AbortDirectoryIndex ();
+
 		return false;
 	}
 
-	std::string sPerformanceName = NewPerformanceName;
-	NewPerformanceName=""; 
-	nActualPerformance=nLastPerformance;
-	std::string nFileName;
-	std::string nPath;
-	std::string nIndex = "000000";
-	nIndex += std::to_string(++nLastFileIndex);
-	nIndex = nIndex.substr(nIndex.length()-6,6);
-	
+	unsigned nStartTicks = CTimer::GetClockTicks ();
 
-	nFileName = nIndex;
-	nFileName += "_";
-	if (strcmp(sPerformanceName.c_str(),"") == 0)
-	{
-		nFileName += "Perf";
-		nFileName += nIndex;
-	}		
-	else
+	std::string Buffer;
+	while (   m_nIndexID < m_Directory.size ()
+	       && CTimer::GetClockTicks () - nStartTicks < ScanTimeSlice)
 	{
-		nFileName +=sPerformanceName.substr(0,14);
+		const char *pFileName = GetFileName (m_nIndexID++);
+		Buffer.append (pFileName, strlen (pFileName) + 1);
 	}
-	nFileName += ".ini";
-	m_nPerformanceFileName[nLastPerformance]= nFileName;
-	
-	nPath = "SD:/" ;
-	nPath += PERFORMANCE_DIR;
-	nPath += "/";
-	nFileName = nPath + nFileName;
-	
-	FIL File;
-	FRESULT Result = f_open (&File, nFileName.c_str(), FA_WRITE | FA_CREATE_ALWAYS);
-	if (Result != FR_OK)
+
+	m_nIndexChecksum = CSysExFileLoader::Hash (Buffer.data (), Buffer.length (), m_nIndexChecksum);
+
+	bool bComplete = m_nIndexID >= m_Directory.size ();
+	if (bComplete)
 	{
-		m_nPerformanceFileName[nLastPerformance]=nullptr;
-		return false;
+		Buffer.append ((const char *) &m_nIndexChecksum, sizeof m_nIndexChecksum);
 	}
 
-	if (f_close (&File) != FR_OK)
+	UINT nWritten;
+	if (   f_write (&m_IndexFile, Buffer.data (), Buffer.length (), &nWritten) != FR_OK
+	    || nWritten != Buffer.length ())
 	{
-		m_nPerformanceFileName[nLastPerformance]=nullptr;
+		LOGWARN (DIRECTORY_INDEX_TEMP ": Write error");
+
+		AbortDirectoryIndex ();
+
 		return false;
 	}
-	
-	nLastPerformance++;
-	new (&m_Properties) CPropertiesFatFsFile(nFileName.c_str(), m_pFileSystem);
-	
-	return true;
-}
 
-bool CPerformanceConfig::ListPerformances()
-{
-	nInternalFolderOk=false;
-	nExternalFolderOk=false; // for future USB implementation
-	nLastPerformance=0;
-	nLastFileIndex=0;
-   	m_nPerformanceFileName[nLastPerformance++]="performance.ini"; // in order to assure retrocompatibility
-	
-	unsigned nPIndex;
-    DIR Directory;
-	FILINFO FileInfo;
-	FRESULT Result;
-	//Check if internal "performance" directory exists
-	Result = f_opendir (&Directory, "SD:/" PERFORMANCE_DIR);
-	if (Result == FR_OK)
+	if (!bComplete)
 	{
-		nInternalFolderOk=true;		
-//		Result = f_closedir (&Directory);
+		return true;
 	}
-	else
+
+	m_bIndexWriting = false;
+
+	if (f_close (&m_IndexFile) != FR_OK)
 	{
-		// attenpt to create the folder
-		Result = f_mkdir("SD:/" PERFORMANCE_DIR);
-		nInternalFolderOk = (Result == FR_OK);
+		LOGWARN (DIRECTORY_INDEX_TEMP ": Write error");
+
+		f_unlink (DIRECTORY_INDEX_TEMP);
+
+		return false;
 	}
-	
-	if (nInternalFolderOk)
+
+	// f_rename() does not overwrite an existing file
+	FRESULT Result = f_unlink (DIRECTORY_INDEX);
+	if (   (Result != FR_OK && Result != FR_NO_FILE)
+	    || f_rename (DIRECTORY_INDEX_TEMP, DIRECTORY_INDEX) != FR_OK)
 	{
-	Result = f_findfirst (&Directory, &FileInfo, "SD:/" PERFORMANCE_DIR, "*.ini");
-		for (unsigned i = 0; Result == FR_OK && FileInfo.fname[0]; i++)
-		{
-			if (nLastPerformance >= NUM_PERFORMANCES) {
-				LOGNOTE ("Skipping performance %s", FileInfo.fname);
-			} else {
-				if (!(FileInfo.fattrib & (AM_HID | AM_SYS)))  
-				{
-					std::string FileName = FileInfo.fname;
-					size_t nLen = FileName.length();
-					if (   nLen > 8 && nLen <26	 && strcmp(FileName.substr(6,1).c_str(), "_")==0)
-					{			
-						nPIndex=stoi(FileName.substr(0,6));
-						if(nPIndex > nLastFileIndex)
-						{
-							nLastFileIndex=nPIndex;
-						}
-
-						m_nPerformanceFileName[nLastPerformance++]= FileName;
-					}	
-				}
-			}
+		LOGWARN (DIRECTORY_INDEX ": Cannot replace file");
 
-			Result = f_findnext (&Directory, &FileInfo);
-		}
-		// sort by performance number-name
-		if (nLastPerformance > 2)
-		{
-		sort (m_nPerformanceFileName+1, m_nPerformanceFileName + nLastPerformance); // default is always on first place. %%%%%%%%%%%%%%%%
-		}
+		f_unlink (DIRECTORY_INDEX_TEMP);
+
+		return false;
 	}
-	
-	LOGNOTE ("Number of Performances: %d", nLastPerformance);
-	
-	return nInternalFolderOk;
-}   
-    
+
+	LOGDBG ("Performance index written (%u performances)", (unsigned) m_Directory.size ()-1);
+
+	return false;
+}
+
+void CPerformanceConfig::AbortDirectoryIndex (void)
+{
+	assert (m_bIndexWriting);
+
+	f_close (&m_IndexFile);
+	f_unlink (DIRECTORY_INDEX_TEMP);
+
+	m_bIndexWriting = false;
+}
 
 void CPerformanceConfig::SetNewPerformance (unsigned nID)
 {
 		nActualPerformance=nID;
-		std::string FileN = "";
-		if (nID != 0) // in order to assure retrocompatibility
-		{
-			FileN += PERFORMANCE_DIR;
-			FileN += "/";
-		}
-		FileN += m_nPerformanceFileName[nID];
+		std::string FileN = GetPerformancePath (nID);
 		new (&m_Properties) CPropertiesFatFsFile(FileN.c_str(), m_pFileSystem);
-		
+		m_FileName = FileN;
+		SetAllDirty ();				// until loaded
+
+		m_bPrefetchPending = true;	// neighbours have changed
+}
+
+std::string CPerformanceConfig::GetPerformancePath (unsigned nID) const
+{
+	std::string FileN = "";
+	if (nID != 0) // in order to assure retrocompatibility
+	{
+		FileN += PERFORMANCE_DIR;
+		FileN += "/";
+	}
+	FileN += GetFileName (nID);
+
+	return FileN;
 }
 
 std::string CPerformanceConfig::GetNewPerformanceDefaultName(void)
@@ -924,30 +2857,36 @@ void CPerformanceConfig::SetNewPerformanceName(std::string nName)
 bool CPerformanceConfig::DeletePerformance(unsigned nID)
 {
 	bool bOK = false;
-	if(nID == 0){return bOK;} // default (performance.ini at root directory) can't be deleted
-	DIR Directory;
-	FILINFO FileInfo;
+	if(nID == 0 || nID >= m_Directory.size ()){return bOK;} // default (performance.ini at root directory) can't be deleted
+	if (m_SaveState != SaveStateIdle)
+	{
+		return bOK;		// file may be open
+	}
 	std::string FileN = "SD:/";
 	FileN += PERFORMANCE_DIR;
+	FileN += "/";
+	FileN += GetFileName (nID);
 
-	
-	FRESULT Result = f_findfirst (&Directory, &FileInfo, FileN.c_str(), m_nPerformanceFileName[nID].c_str());
-	if (Result == FR_OK && FileInfo.fname[0])
+	FRESULT Result=f_unlink (FileN.c_str());
+	if (Result == FR_OK)
 	{
-		FileN += "/";
-		FileN += m_nPerformanceFileName[nID];
-		Result=f_unlink (FileN.c_str());
-		if (Result == FR_OK)
-		{
-			SetNewPerformance(0);
-			nActualPerformance =0;
-			//nMenuSelectedPerformance=0;
-			m_nPerformanceFileName[nID]="ZZZZZZ";
-			sort (m_nPerformanceFileName+1, m_nPerformanceFileName + nLastPerformance); // test si va con -1 o no
-			--nLastPerformance;
-			m_nPerformanceFileName[nLastPerformance]=nullptr;
-			bOK=true;
+		FileN.replace (FileN.length()-4, 4, ".bin");	// snapshot
+		f_unlink (FileN.c_str());
+
+		RemovePerformance (nID);
+		InvalidatePrefetched (NoPerformance);	// IDs have changed
+
+		SetNewPerformance(0);
+		nActualPerformance =0;
+		//nMenuSelectedPerformance=0;
+
+		if (m_bScanning)
+		{
+			StartScan ();		// restart, the directory has changed
 		}
+
+		m_bDirectoryChanged = true;	// index is written by Process()
+		bOK=true;
 	}
 	return bOK;
 }
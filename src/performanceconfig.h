@@ -24,21 +24,145 @@
 #define _performanceconfig_h
 
 #include "config.h"
+#include <circle/timer.h>
 #include <fatfs/ff.h>
 #include <Properties/propertiesfatfsfile.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <unordered_map>
 #define NUM_VOICE_PARAM 156
 #define PERFORMANCE_DIR "performance" 
-#define NUM_PERFORMANCES 256
 
 class CPerformanceConfig	// Performance configuration
 {
+public:
+	struct TPerformance		// all values of a performance, image in snapshot file
+	{
+		unsigned nBankNumber[CConfig::ToneGenerators];
+		unsigned nVoiceNumber[CConfig::ToneGenerators];
+		unsigned nMIDIChannel[CConfig::ToneGenerators];
+		unsigned nVolume[CConfig::ToneGenerators];
+		unsigned nPan[CConfig::ToneGenerators];
+		int nDetune[CConfig::ToneGenerators];
+		unsigned nCutoff[CConfig::ToneGenerators];
+		unsigned nResonance[CConfig::ToneGenerators];
+		unsigned nNoteLimitLow[CConfig::ToneGenerators];
+		unsigned nNoteLimitHigh[CConfig::ToneGenerators];
+		int nNoteShift[CConfig::ToneGenerators];
+		int nReverbSend[CConfig::ToneGenerators];
+		unsigned nPitchBendRange[CConfig::ToneGenerators];
+		unsigned nPitchBendStep[CConfig::ToneGenerators];
+		unsigned nPortamentoMode[CConfig::ToneGenerators];
+		unsigned nPortamentoGlissando[CConfig::ToneGenerators];
+		unsigned nPortamentoTime[CConfig::ToneGenerators];
+		uint8_t VoiceData[CConfig::ToneGenerators][NUM_VOICE_PARAM];
+		bool bVoiceDataFilled[CConfig::ToneGenerators];
+		bool bMonoMode[CConfig::ToneGenerators];
+
+		unsigned nModulationWheelRange[CConfig::ToneGenerators];
+		unsigned nModulationWheelTarget[CConfig::ToneGenerators];
+		unsigned nFootControlRange[CConfig::ToneGenerators];
+		unsigned nFootControlTarget[CConfig::ToneGenerators];
+		unsigned nBreathControlRange[CConfig::ToneGenerators];
+		unsigned nBreathControlTarget[CConfig::ToneGenerators];
+		unsigned nAftertouchRange[CConfig::ToneGenerators];
+		unsigned nAftertouchTarget[CConfig::ToneGenerators];
+
+		bool bCompressorEnable;
+		bool bReverbEnable;
+		unsigned nReverbSize;
+		unsigned nReverbHighDamp;
+		unsigned nReverbLowDamp;
+		unsigned nReverbLowPass;
+		unsigned nReverbDiffusion;
+		unsigned nReverbLevel;
+	};
+
+	static const unsigned SnapshotVersion = 1;
+	static const unsigned DirectoryVersion = 1;
+	static const unsigned JournalVersion = 2;
+
+	static const unsigned MaxPerformances = 10000;	// including the default performance
+	static const unsigned MaxFileIndex = 999999;	// six digits in file name
+	static const unsigned NoPerformance = (unsigned) -1;
+	static const unsigned MaxBankDirs = 1;	// nested folders (banks) in PERFORMANCE_DIR
+	static const unsigned ScanTimeSlice = 1000; // Microseconds of scanning per call of Process()
+
+	static const unsigned SaveChunkSize = 512;	// bytes written per call of Process()
+
+	static const unsigned PrefetchRequests = 2;	// explicitly requested performances
+	static const unsigned PrefetchSlots = 2 + PrefetchRequests; // with previous and next
+
+	struct TStatistics
+	{
+		unsigned nLoads;		// calls of Load()
+		unsigned nPrefetchHits;		// Load() found the performance in memory
+		unsigned nSnapshotReads;	// performances read from the binary snapshot
+		unsigned nINIParses;		// performances parsed from the INI file
+		unsigned nLoadTicks;		// total duration of Load() (microseconds)
+		unsigned nLoadTicksMax;
+		unsigned nSaves;		// completed saves, which have written the file
+		unsigned nUnchangedSaves;	// Save() without changes
+		unsigned nChunksWritten;
+		unsigned nSaveTicks;		// total from Save() to completion, including pauses
+		unsigned nSaveTicksMax;
+		unsigned nListTicks;		// duration of ListPerformances()
+		unsigned nScanTicks;		// duration of the last completed scan, including pauses
+	};
+
+	enum TSaveStatus
+	{
+		SaveIdle,			// nothing saved yet
+		SaveBusy,
+		SaveCompleted,
+		SaveFailed
+	};
+
 public:
 	CPerformanceConfig (FATFS *pFileSystem);
 	~CPerformanceConfig (void);
 
+	// completes a save, which has been interrupted by a power loss,
+	// call this once on boot before Load()
+	bool RecoverSave (void);
+
 	bool Load (void);
 
+	// captures the performance and writes it in the background from Process(),
+	// returns false, if a save is already in progress
 	bool Save (void);
+	TSaveStatus GetSaveStatus (void) const;
+	bool IsSaving (void) const;
+
+	void GetPerformance (TPerformance *pPerformance) const;	// of last Load()
+
+	// reads a performance of the directory, without making it current
+	bool ReadPerformance (unsigned nID, TPerformance *pPerformance);
+
+	// text in INI file format, as written by Save()
+	static void Serialise (const TPerformance &rPerf, std::string *pBuffer);
+	bool ParsePerformance (const std::string &rText, TPerformance *pPerformance);
+
+	// makes the performance current and saves it in the background to the file
+	// rFileName in PERFORMANCE_DIR, which is created if required, nothing is
+	// saved for an empty name, returns false on invalid name or while saving
+	bool ImportPerformance (const TPerformance *pPerformance, const std::string &rFileName);
+
+	// queue a performance to be kept in memory (e.g. next in a setlist),
+	// the previous and next performance are always prefetched
+	void Prefetch (unsigned nID);
+	bool IsPrefetched (unsigned nID) const;
+	// returns nullptr, if not in memory, the data can be completed (e.g. voices from banks)
+	TPerformance *GetPrefetched (unsigned nID);
+	void InvalidatePrefetched (unsigned nID);	// NoPerformance for all, read again then
+
+	void GetStatistics (TStatistics *pStatistics) const;
+	void Dump (unsigned nIntervalTicks = CLOCKHZ);	// statistics, if changed
+
+	// call this from the main loop, writes one chunk of a performance
+	// to be saved or reads at most one performance
+	void Process (void);
 
 	// TG#
 	unsigned GetBankNumber (unsigned nTG) const;		// 0 .. 127
@@ -87,7 +211,7 @@ public:
 	void SetPortamentoGlissando (unsigned nValue, unsigned nTG);
 	void SetPortamentoTime (unsigned nValue, unsigned nTG);
 	void SetVoiceDataToTxt (const uint8_t *pData, unsigned nTG); 
-	uint8_t *GetVoiceDataFromTxt (unsigned nTG);
+	uint8_t *GetVoiceDataFromTxt (unsigned nTG);		// NUM_VOICE_PARAM bytes
 	void SetMonoMode (bool bOKValue, unsigned nTG); 
 
 	void SetModulationWheelRange (unsigned nValue, unsigned nTG);
@@ -119,11 +243,15 @@ public:
 	void SetReverbLevel (unsigned nValue);
 
 	bool VoiceDataFilled(unsigned nTG);
+	// reads the directory index, if valid, and verifies it later in Process()
 	bool ListPerformances(); 
 	//std::string m_DirName;
 	void SetNewPerformance (unsigned nID);
 	std::string GetPerformanceFileName(unsigned nID);
 	std::string GetPerformanceName(unsigned nID);
+	unsigned FindPerformance (const std::string &rFileName) const;	// NoPerformance if not found
+	unsigned FindPerformance (unsigned nFileIndex) const;		// by number in file name
+	unsigned GetDirectoryGeneration (void) const;	// changes, if the IDs have changed
 	unsigned GetLastPerformance();
 	void SetActualPerformanceID(unsigned nID);
 	unsigned GetActualPerformanceID();
@@ -134,57 +262,204 @@ public:
 	bool DeletePerformance(unsigned nID);
 	bool CheckFreePerformanceSlot(void);
 
+private:
+	bool LoadPerformance (const std::string &rFileName, CPropertiesFatFsFile *pProperties,
+			      TPerformance *pPerformance);
+	bool LoadProperties (CPropertiesFatFsFile *pProperties,	// parses the INI file
+			     TPerformance *pPerformance);
+
+	static std::string GetSnapshotFileName (const std::string &rFileName);
+	bool ReadSnapshot (const std::string &rFileName, const FILINFO *pINIFileInfo,
+			   TPerformance *pPerformance);
+	bool WriteSnapshot (const std::string &rFileName, const TPerformance *pPerformance);
+
+	std::string GetPerformancePath (unsigned nID) const;
+
+	void ProcessSave (void);
+	void PrepareJournal (void);		// from m_SaveBuffer and m_OldBuffer
+	bool WriteJournalChunk (void);		// returns false on error
+	bool CheckJournalTarget (FIL *pFile, const uint8_t *pJournal);	// of a partial journal
+	bool WriteSaveChunk (void);
+	static void SerialiseTG (const TPerformance &rPerf, unsigned nTG, std::string *pBuffer);
+	static void SerialiseEffects (const TPerformance &rPerf, std::string *pBuffer);
+	void AbortSave (const char *pReason);	// sets SaveFailed
+
+	// a property differs from the file m_FileName
+	void SetDirty (unsigned nTG, unsigned nProperty);	// nTG == ToneGenerators for effects
+	void SetAllDirty (void);
+	void ClearDirty (void);
+	bool IsDirty (void) const;
+
+	bool ProcessPrefetch (void);		// returns true, if a performance was read
+
+	struct TPrefetchSlot;
+	TPrefetchSlot *FindPrefetched (unsigned nID);
+
+	// directory of the performance files, sorted by path
+	void ClearDirectory (void);		// only the default performance
+	const char *GetFileName (unsigned nID) const;	// relative to PERFORMANCE_DIR
+	unsigned AddString (const char *pString);	// returns offset in m_StringPool
+	unsigned AddPerformance (const char *pFileName);	// keeps sorting, returns ID
+	void RemovePerformance (unsigned nID);
+	void CompactStringPool (void);		// drops removed paths
+	void UpdateFileIndexMap (void);		// after the IDs have changed
+	static bool ParseFileIndex (const char *pFileName, unsigned *pFileIndex);
+
+	bool StartScan (void);
+	bool ScanStep (void);			// returns false, if scan is complete
+	void FinishScan (void);
+
+	// the index is written by Process() in time slices, if m_bDirectoryChanged
+	bool ReadDirectoryIndex (void);
+	bool StartDirectoryIndex (void);
+	bool WriteDirectoryIndexSlice (void);	// returns false, if complete or failed
+	void AbortDirectoryIndex (void);
+
+	static bool ParseVoiceData (const char *pText, uint8_t *pData);
+
 private:
 	CPropertiesFatFsFile m_Properties;
+	std::string m_FileName;			// of the INI file
+
+	TPerformance m_Performance;
+
+	enum TTGProperty			// dirty flags of a TG
+	{
+		TGBankNumber,
+		TGVoiceNumber,
+		TGMIDIChannel,
+		TGVolume,
+		TGPan,
+		TGDetune,
+		TGCutoff,
+		TGResonance,
+		TGNoteLimitLow,
+		TGNoteLimitHigh,
+		TGNoteShift,
+		TGReverbSend,
+		TGPitchBendRange,
+		TGPitchBendStep,
+		TGPortamentoMode,
+		TGPortamentoGlissando,
+		TGPortamentoTime,
+		TGVoiceData,
+		TGMonoMode,
+		TGModulationWheelRange,
+		TGModulationWheelTarget,
+		TGFootControlRange,
+		TGFootControlTarget,
+		TGBreathControlRange,
+		TGBreathControlTarget,
+		TGAftertouchRange,
+		TGAftertouchTarget,
+		TGPropertyUnknown
+	};
+
+	enum TEffectProperty			// dirty flags of the effects
+	{
+		EffectCompressorEnable,
+		EffectReverbEnable,
+		EffectReverbSize,
+		EffectReverbHighDamp,
+		EffectReverbLowDamp,
+		EffectReverbLowPass,
+		EffectReverbDiffusion,
+		EffectReverbLevel,
+		EffectPropertyUnknown
+	};
+
+	static const unsigned TextBlocks = CConfig::ToneGenerators+1;	// TGs and effects
+
+	uint32_t m_nDirty[TextBlocks];		// bit mask of TTGProperty or TEffectProperty
+
+	// write-behind of a performance, see ProcessSave()
+	enum TSaveState
+	{
+		SaveStateIdle,
+		SaveStateSerialise,		// one TG per step
+		SaveStateJournal,		// SaveChunkSize bytes per step
+		SaveStateJournalClose,
+		SaveStateOpen,
+		SaveStateWrite,			// one changed chunk per step
+		SaveStateClose,
+		SaveStateJournalDelete,
+		SaveStateSnapshot
+	};
+
+	TSaveState m_SaveState;
+	TSaveStatus m_SaveStatus;
+	TPerformance m_SavePerformance;		// captured by Save()
+	uint32_t m_nSaveDirty[TextBlocks];
+	std::string m_SaveFileName;
+	std::string m_SaveText[TextBlocks];	// INI file text of TGs and effects
+	std::string m_SaveBuffer;		// whole INI file text
+	std::string m_OldBuffer;		// INI file text on disk, if bSaveChanged
+	bool m_bSaveChanged;			// write changed chunks only
+	bool m_bJournalFull;			// all chunks are written
+	std::vector<unsigned> m_SaveChunks;	// offsets of chunks to be written
+	std::string m_JournalBuffer;		// whole journal file
+	size_t m_nSaveOffset;			// in m_JournalBuffer
+	unsigned m_nSaveTG;
+	unsigned m_nSaveChunk;			// index in m_SaveChunks
+	FIL m_SaveFile;
+	unsigned m_nSaveStartTicks;
+
+	// INI file text, which has been written last, to find the changes
+	std::string m_FileText[TextBlocks];
+	std::string m_TextFileName;		// empty if invalid
+
+	struct TPrefetchSlot
+	{
+		unsigned nID;			// NoPerformance if unused
+		unsigned nLastUse;
+		TPerformance Performance;
+	};
+
+	TPrefetchSlot m_PrefetchSlot[PrefetchSlots];
+	unsigned m_nPrefetchUse;
+	unsigned m_nPrefetchRequest[PrefetchRequests];	// newest first
+	unsigned m_nPrefetchRequests;
+	bool m_bPrefetchPending;
+
+	struct TPerformanceEntry
+	{
+		unsigned nPathOffset;		// in m_StringPool, relative to PERFORMANCE_DIR
+		unsigned nFileIndex;		// parsed from file name
+	};
+
+	std::vector<TPerformanceEntry> m_Directory;	// [0] is the default performance
+	std::string m_StringPool;
+	size_t m_nStringGarbage;		// bytes of removed paths in m_StringPool
+	std::unordered_map<unsigned, unsigned> m_FileIndexMap;	// number in file name -> ID
+	unsigned m_nDirectoryGeneration;
+
+	// scan, which verifies the directory index in the background
+	bool m_bScanning;
+	DIR m_ScanDirectory[MaxBankDirs+1];	// open directories
+	std::string m_ScanPath[MaxBankDirs+1];	// relative to PERFORMANCE_DIR
+	unsigned m_nScanDepth;
+	std::vector<std::string> m_ScanFiles;	// found so far
+	unsigned m_nScanStartTicks;
+
+	bool m_bDirectoryChanged;		// index has to be written
+	bool m_bIndexWriting;
+	FIL m_IndexFile;
+	unsigned m_nIndexID;			// next entry to be written
+	uint32_t m_nIndexChecksum;
 
-	unsigned m_nBankNumber[CConfig::ToneGenerators];
-	unsigned m_nVoiceNumber[CConfig::ToneGenerators];
-	unsigned m_nMIDIChannel[CConfig::ToneGenerators];
-	unsigned m_nVolume[CConfig::ToneGenerators];
-	unsigned m_nPan[CConfig::ToneGenerators];
-	int m_nDetune[CConfig::ToneGenerators];
-	unsigned m_nCutoff[CConfig::ToneGenerators];
-	unsigned m_nResonance[CConfig::ToneGenerators];
-	unsigned m_nNoteLimitLow[CConfig::ToneGenerators];
-	unsigned m_nNoteLimitHigh[CConfig::ToneGenerators];
-	int m_nNoteShift[CConfig::ToneGenerators];
-	int m_nReverbSend[CConfig::ToneGenerators];
-	unsigned m_nPitchBendRange[CConfig::ToneGenerators];
-	unsigned m_nPitchBendStep[CConfig::ToneGenerators];
-	unsigned m_nPortamentoMode[CConfig::ToneGenerators];
-	unsigned m_nPortamentoGlissando[CConfig::ToneGenerators];
-	unsigned m_nPortamentoTime[CConfig::ToneGenerators];
-	std::string m_nVoiceDataTxt[CConfig::ToneGenerators]; 
-	bool m_bMonoMode[CConfig::ToneGenerators]; 
-
-	unsigned m_nModulationWheelRange[CConfig::ToneGenerators];
-	unsigned m_nModulationWheelTarget[CConfig::ToneGenerators];
-	unsigned m_nFootControlRange[CConfig::ToneGenerators];	
-	unsigned m_nFootControlTarget[CConfig::ToneGenerators];	
-	unsigned m_nBreathControlRange[CConfig::ToneGenerators];	
-	unsigned m_nBreathControlTarget[CConfig::ToneGenerators];	
-	unsigned m_nAftertouchRange[CConfig::ToneGenerators];	
-	unsigned m_nAftertouchTarget[CConfig::ToneGenerators];	
-
-	unsigned nLastPerformance;  
 	unsigned nLastFileIndex;
 	unsigned nActualPerformance = 0;  
 	//unsigned nMenuSelectedPerformance = 0; 
-	std::string m_nPerformanceFileName[NUM_PERFORMANCES];
 	FATFS *m_pFileSystem; 
 
+	TStatistics m_Statistics;
+	unsigned m_nLastDumpTicks;
+	unsigned m_nLastDumpCount;
+
 	bool nInternalFolderOk=false;
 	bool nExternalFolderOk=false; // for future USB implementation
 	std::string NewPerformanceName="";
 	
-	bool m_bCompressorEnable;
-	bool m_bReverbEnable;
-	unsigned m_nReverbSize;
-	unsigned m_nReverbHighDamp;
-	unsigned m_nReverbLowDamp;
-	unsigned m_nReverbLowPass;
-	unsigned m_nReverbDiffusion;
-	unsigned m_nReverbLevel;
 };
 
 #endif
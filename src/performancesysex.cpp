@@ -0,0 +1,472 @@
+//
+// performancesysex.cpp
+//
+// Export and import of performances via MIDI System Exclusive messages
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "performancesysex.h"
+#include "minidexed.h"
+#include "mididevice.h"
+#include <circle/logger.h>
+#include <circle/timer.h>
+#include <string.h>
+#include <assert.h>
+
+LOGMODULE ("PerformanceSysEx");
+
+// Messages (0x7D is the manufacturer ID for non-commercial use):
+//
+// F0 7D 4D 44 01 nn nn F7	dump request, nn nn: performance number (14 bits,
+//				MSB first) as in 000012_Intro.ini, 0 for performance.ini,
+//				3FFF for the current performance, 3FFE for all
+// F0 7D 4D 44 02 name F7	begin of a performance, name: file name relative to
+//				the performance folder, empty for the current performance
+// F0 7D 4D 44 03 ss text F7	data, ss: sequence number (0..127, wraps around),
+//				text: up to 256 bytes of the INI file
+// F0 7D 4D 44 04 cc*5 F7	end, cc: FNV-1a hash of the text (32 bits,
+//				7 bits per byte, least significant first)
+// F0 7D 4D 44 05 F7		end of a bulk dump
+//
+// A received performance with name is applied and saved to this file. Without
+// name it is applied only and can be saved from the menu.
+
+#define SYSEX_BEGIN		0xF0
+#define SYSEX_END		0xF7
+#define SYSEX_ID		0x7D
+#define SYSEX_SIGNATURE1	0x4D	// 'M'
+#define SYSEX_SIGNATURE2	0x44	// 'D'
+
+#define SYSEX_HEADER_SIZE	5	// incl. command
+
+#define COMMAND_REQUEST		0x01
+#define COMMAND_BEGIN		0x02
+#define COMMAND_DATA		0x03
+#define COMMAND_END		0x04
+#define COMMAND_BULK_END	0x05
+
+#define NoRequest		((unsigned) -1)
+
+#define MIDI_WIRE_TICKS		320	// microseconds per byte at 31250 baud
+
+CPerformanceSysEx::CPerformanceSysEx (CMiniDexed *pSynthesizer,
+				      CPerformanceConfig *pPerformanceConfig)
+:	m_pSynthesizer (pSynthesizer),
+	m_pPerformanceConfig (pPerformanceConfig),
+	m_bSerialMIDI (false),
+	m_nReceiveLength (0),
+	m_nReceiveSequence (0),
+	m_bReceiving (false),
+	m_bReceived (false),
+	m_nDumpRequest (NoRequest),
+	m_nReceiveErrors (0),
+	m_bImportPending (false),
+	m_DumpState (DumpIdle),
+	m_bBulkDump (false),
+	m_nDumpID (0),
+	m_nDumpCount (0),
+	m_nSendOffset (0),
+	m_nSendSequence (0),
+	m_nLastSendTicks (0),
+	m_nSendInterval (0)
+{
+	m_ReceiveName[0] = '\0';
+}
+
+CPerformanceSysEx::~CPerformanceSysEx (void)
+{
+}
+
+void CPerformanceSysEx::SetSerialMIDI (bool bSerialMIDI)
+{
+	m_bSerialMIDI = bSerialMIDI;
+}
+
+bool CPerformanceSysEx::IsPerformanceSysEx (const uint8_t *pMessage, size_t nLength)
+{
+	assert (pMessage);
+
+	return    nLength >= SYSEX_HEADER_SIZE+1
+	       && pMessage[0] == SYSEX_BEGIN
+	       && pMessage[1] == SYSEX_ID
+	       && pMessage[2] == SYSEX_SIGNATURE1
+	       && pMessage[3] == SYSEX_SIGNATURE2
+	       && pMessage[nLength-1] == SYSEX_END;
+}
+
+void CPerformanceSysEx::Receive (const uint8_t *pMessage, size_t nLength)
+{
+	assert (IsPerformanceSysEx (pMessage, nLength));
+
+	const uint8_t *pData = pMessage + SYSEX_HEADER_SIZE;
+	size_t nDataLength = nLength - SYSEX_HEADER_SIZE - 1;
+
+	m_SpinLock.Acquire ();
+
+	switch (pMessage[4])
+	{
+	case COMMAND_REQUEST:
+		if (nDataLength == 2)
+		{
+			m_nDumpRequest = pData[0] << 7 | pData[1];
+		}
+		break;
+
+	case COMMAND_BEGIN:
+		if (   m_bReceived			// last one not processed yet
+		    || nDataLength > MaxNameLength)
+		{
+			m_bReceiving = false;
+			m_nReceiveErrors++;
+
+			break;
+		}
+
+		memcpy (m_ReceiveName, pData, nDataLength);
+		m_ReceiveName[nDataLength] = '\0';
+		m_nReceiveLength = 0;
+		m_nReceiveSequence = 0;
+		m_bReceiving = true;
+		break;
+
+	case COMMAND_DATA:
+		if (!m_bReceiving)
+		{
+			break;
+		}
+
+		// a lost message or an overflow invalidates the whole performance
+		if (   nDataLength < 1
+		    || pData[0] != (m_nReceiveSequence & 0x7F)
+		    || m_nReceiveLength + nDataLength-1 > MaxTextSize)
+		{
+			m_bReceiving = false;
+			m_nReceiveErrors++;
+
+			break;
+		}
+
+		memcpy (m_ReceiveText + m_nReceiveLength, pData+1, nDataLength-1);
+		m_nReceiveLength += nDataLength-1;
+		m_nReceiveSequence++;
+		break;
+
+	case COMMAND_END:
+		if (!m_bReceiving)
+		{
+			break;
+		}
+
+		m_bReceiving = false;
+
+		if (nDataLength == 5)
+		{
+			uint32_t nHash = 0;
+			for (unsigned i = 0; i < 5; i++)
+			{
+				nHash |= (uint32_t) pData[i] << (7*i);
+			}
+
+			if (nHash == CSysExFileLoader::Hash (m_ReceiveText, m_nReceiveLength))
+			{
+				m_bReceived = true;
+
+				break;
+			}
+		}
+
+		m_nReceiveErrors++;
+		break;
+
+	default:
+		break;
+	}
+
+	m_SpinLock.Release ();
+}
+
+void CPerformanceSysEx::Process (void)
+{
+	if (m_nDumpRequest != NoRequest)
+	{
+		m_SpinLock.Acquire ();
+		unsigned nRequest = m_nDumpRequest;
+		m_nDumpRequest = NoRequest;
+		m_SpinLock.Release ();
+
+		if (m_DumpState != DumpIdle)
+		{
+			LOGWARN ("Dump in progress, request ignored");
+		}
+		else if (!StartDump (nRequest))
+		{
+			LOGWARN ("Performance %u not found", nRequest);
+		}
+	}
+
+	if (m_nReceiveErrors)
+	{
+		m_SpinLock.Acquire ();
+		unsigned nErrors = m_nReceiveErrors;
+		m_nReceiveErrors = 0;
+		m_SpinLock.Release ();
+
+		LOGWARN ("%u invalid performance messages", nErrors);
+	}
+
+	ProcessReceived ();
+
+	if (   m_DumpState != DumpIdle
+	    && CTimer::GetClockTicks () - m_nLastSendTicks >= m_nSendInterval)
+	{
+		SendNext ();
+	}
+}
+
+void CPerformanceSysEx::ProcessReceived (void)
+{
+	if (   !m_bImportPending
+	    && m_bReceived)
+	{
+		m_SpinLock.Acquire ();
+		std::string Text (m_ReceiveText, m_nReceiveLength);
+		m_ImportName = m_ReceiveName;
+		m_SpinLock.Release ();
+
+		m_bReceived = false;		// can receive the next one now
+
+		if (!m_pPerformanceConfig->ParsePerformance (Text, &m_ImportPerformance))
+		{
+			LOGWARN ("Received performance cannot be parsed");
+
+			return;
+		}
+
+		m_bImportPending = true;
+	}
+
+	if (!m_bImportPending)
+	{
+		return;
+	}
+
+	switch (m_pSynthesizer->ImportPerformance (&m_ImportPerformance, m_ImportName))
+	{
+	case CMiniDexed::ImportApplied:
+		m_bImportPending = false;
+
+		LOGNOTE ("Performance received (%s)",
+			 m_ImportName.empty () ? "current" : m_ImportName.c_str ());
+		break;
+
+	case CMiniDexed::ImportBusy:
+		break;				// try again later
+
+	case CMiniDexed::ImportRejected:
+		m_bImportPending = false;
+
+		LOGWARN ("Received performance rejected (%s)",
+			 m_ImportName.empty () ? "current" : m_ImportName.c_str ());
+		break;
+	}
+}
+
+bool CPerformanceSysEx::StartDump (unsigned nRequest)
+{
+	m_bBulkDump = nRequest == AllPerformances;
+	m_nDumpCount = 0;
+
+	if (nRequest == CurrentPerformance)
+	{
+		CPerformanceConfig::TPerformance *pPerformance = new CPerformanceConfig::TPerformance;
+		assert (pPerformance);
+
+		m_pSynthesizer->GetCurrentPerformance (pPerformance);
+
+		m_SendText.clear ();
+		CPerformanceConfig::Serialise (*pPerformance, &m_SendText);
+		m_SendName.clear ();
+
+		delete pPerformance;
+	}
+	else if (m_bBulkDump)
+	{
+		m_nDumpID = 0;
+		if (!PrepareNextDump ())
+		{
+			return false;
+		}
+	}
+	else
+	{
+		unsigned nID = m_pPerformanceConfig->FindPerformance (nRequest);
+		if (   nID == CPerformanceConfig::NoPerformance
+		    || !PrepareDump (nID))
+		{
+			return false;
+		}
+	}
+
+	m_DumpState = DumpBegin;
+	m_nLastSendTicks = CTimer::GetClockTicks ();
+	m_nSendInterval = 0;
+
+	return true;
+}
+
+bool CPerformanceSysEx::PrepareDump (unsigned nID)
+{
+	CPerformanceConfig::TPerformance *pPerformance = new CPerformanceConfig::TPerformance;
+	assert (pPerformance);
+
+	bool bOK = m_pPerformanceConfig->ReadPerformance (nID, pPerformance);
+	if (bOK)
+	{
+		m_SendText.clear ();
+		CPerformanceConfig::Serialise (*pPerformance, &m_SendText);
+
+		m_SendName = m_pPerformanceConfig->GetPerformanceFileName (nID);
+		for (auto &rChar : m_SendName)
+		{
+			if (rChar & 0x80)
+			{
+				rChar = '_';		// SysEx data is 7-bit
+			}
+		}
+	}
+
+	delete pPerformance;
+
+	return bOK;
+}
+
+bool CPerformanceSysEx::PrepareNextDump (void)
+{
+	// unreadable performances are skipped
+	while (m_nDumpID < m_pPerformanceConfig->GetLastPerformance ())
+	{
+		if (PrepareDump (m_nDumpID++))
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void CPerformanceSysEx::SendNext (void)
+{
+	switch (m_DumpState)
+	{
+	case DumpBegin:
+		SendMessage (COMMAND_BEGIN, m_SendName.data (), m_SendName.length ());
+
+		m_nSendOffset = 0;
+		m_nSendSequence = 0;
+		m_DumpState = DumpData;
+		break;
+
+	case DumpData: {
+		size_t nLength = m_SendText.length () - m_nSendOffset;
+		if (nLength > ChunkSize)
+		{
+			nLength = ChunkSize;
+		}
+
+		SendMessage (COMMAND_DATA, m_SendText.data () + m_nSendOffset, nLength,
+			     m_nSendSequence++ & 0x7F);
+
+		m_nSendOffset += nLength;
+		if (m_nSendOffset >= m_SendText.length ())
+		{
+			m_DumpState = DumpEnd;
+		}
+		} break;
+
+	case DumpEnd: {
+		uint32_t nHash = CSysExFileLoader::Hash (m_SendText.data (), m_SendText.length ());
+		uint8_t Checksum[5];
+		for (unsigned i = 0; i < 5; i++)
+		{
+			Checksum[i] = (nHash >> (7*i)) & 0x7F;
+		}
+
+		SendMessage (COMMAND_END, Checksum, sizeof Checksum);
+
+		m_nDumpCount++;
+
+		if (!m_bBulkDump)
+		{
+			m_DumpState = DumpIdle;
+		}
+		else
+		{
+			m_DumpState = PrepareNextDump () ? DumpBegin : DumpBulkEnd;
+		}
+		} break;
+
+	case DumpBulkEnd:
+		SendMessage (COMMAND_BULK_END, nullptr, 0);
+
+		m_DumpState = DumpIdle;
+		break;
+
+	default:
+		assert (0);
+		break;
+	}
+
+	if (m_DumpState == DumpIdle)
+	{
+		std::string ().swap (m_SendText);	// free memory
+
+		LOGNOTE ("%u performance(s) sent", m_nDumpCount);
+	}
+}
+
+void CPerformanceSysEx::SendMessage (uint8_t uchCommand, const void *pData, size_t nLength,
+				     int nSequence)
+{
+	uint8_t Message[SYSEX_HEADER_SIZE + 1 + ChunkSize + 1];
+	assert (nLength <= ChunkSize);
+
+	size_t nMessageLength = 0;
+	Message[nMessageLength++] = SYSEX_BEGIN;
+	Message[nMessageLength++] = SYSEX_ID;
+	Message[nMessageLength++] = SYSEX_SIGNATURE1;
+	Message[nMessageLength++] = SYSEX_SIGNATURE2;
+	Message[nMessageLength++] = uchCommand;
+
+	if (nSequence >= 0)
+	{
+		Message[nMessageLength++] = nSequence;
+	}
+
+	if (nLength)
+	{
+		memcpy (Message + nMessageLength, pData, nLength);
+		nMessageLength += nLength;
+	}
+
+	Message[nMessageLength++] = SYSEX_END;
+
+	CMIDIDevice::SendSystemExclusive (Message, nMessageLength);
+
+	// the next message is sent, when this one has left the serial interface
+	m_nLastSendTicks = CTimer::GetClockTicks ();
+	m_nSendInterval = m_bSerialMIDI ? nMessageLength * MIDI_WIRE_TICKS : MinSendInterval;
+}
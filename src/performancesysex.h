@@ -0,0 +1,118 @@
+//
+// performancesysex.h
+//
+// Export and import of performances via MIDI System Exclusive messages
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _performancesysex_h
+#define _performancesysex_h
+
+#include "performanceconfig.h"
+#include <stdint.h>
+#include <string>
+#include <circle/spinlock.h>
+
+class CMiniDexed;
+
+// A performance is transferred as the text of its INI file, which is 7-bit
+// ASCII and can be sent without conversion. It is split into data messages,
+// which are sent by Process() at the speed of the serial MIDI interface, so
+// that the send queues do not fill up. A received performance is buffered,
+// until the end message with the correct checksum arrives, and is applied
+// as a whole at a block boundary by CMiniDexed::ImportPerformance().
+
+class CPerformanceSysEx
+{
+public:
+	static const unsigned MaxTextSize = 16384;	// of an INI file
+	static const unsigned MaxNameLength = 64;	// incl. bank folder
+	static const unsigned ChunkSize = 256;		// text bytes per data message
+	static const unsigned MinSendInterval = 2000;	// microseconds between messages
+
+	static const unsigned CurrentPerformance = 0x3FFF;	// in dump request
+	static const unsigned AllPerformances = 0x3FFE;
+
+public:
+	CPerformanceSysEx (CMiniDexed *pSynthesizer, CPerformanceConfig *pPerformanceConfig);
+	~CPerformanceSysEx (void);
+
+	void SetSerialMIDI (bool bSerialMIDI);	// pace the messages for 31250 baud
+
+	static bool IsPerformanceSysEx (const uint8_t *pMessage, size_t nLength);
+
+	// called from the MIDI handler (task or IRQ level)
+	void Receive (const uint8_t *pMessage, size_t nLength);
+
+	// call this from the main loop, sends one message of a dump at most
+	// and applies a received performance
+	void Process (void);
+
+private:
+	void ProcessReceived (void);
+
+	bool StartDump (unsigned nRequest);
+	bool PrepareDump (unsigned nID);		// performance of directory
+	bool PrepareNextDump (void);			// of bulk dump, from m_nDumpID
+	void SendNext (void);
+	void SendMessage (uint8_t uchCommand, const void *pData, size_t nLength,
+			  int nSequence = -1);
+
+private:
+	CMiniDexed *m_pSynthesizer;
+	CPerformanceConfig *m_pPerformanceConfig;
+	bool m_bSerialMIDI;
+
+	// receive (written at IRQ level)
+	char m_ReceiveText[MaxTextSize];
+	unsigned m_nReceiveLength;
+	char m_ReceiveName[MaxNameLength+1];
+	unsigned m_nReceiveSequence;
+	bool m_bReceiving;
+	volatile bool m_bReceived;			// complete, not processed yet
+	volatile unsigned m_nDumpRequest;		// NoRequest if none
+	volatile unsigned m_nReceiveErrors;		// counted at IRQ level
+	CSpinLock m_SpinLock;
+
+	// import
+	bool m_bImportPending;				// waits until the synth is ready
+	CPerformanceConfig::TPerformance m_ImportPerformance;
+	std::string m_ImportName;
+
+	// dump
+	enum TDumpState
+	{
+		DumpIdle,
+		DumpBegin,
+		DumpData,
+		DumpEnd,
+		DumpBulkEnd
+	};
+
+	TDumpState m_DumpState;
+	bool m_bBulkDump;
+	unsigned m_nDumpID;				// next performance of bulk dump
+	unsigned m_nDumpCount;
+	std::string m_SendText;
+	std::string m_SendName;
+	unsigned m_nSendOffset;
+	unsigned m_nSendSequence;
+	unsigned m_nLastSendTicks;
+	unsigned m_nSendInterval;			// microseconds after last message
+};
+
+#endif
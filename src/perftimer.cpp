@@ -24,8 +24,13 @@ CPerformanceTimer::CPerformanceTimer (const char *pName, unsigned nDeadlineMicro
 :	m_Name (pName),
 	m_nDeadlineMicros (nDeadlineMicros),
 	m_nMaximumMicros (0),
-	m_nLastDumpTicks (0)
+	m_nLastDumpTicks (0),
+	m_nCount (0)
 {
+	for (unsigned i = 0; i < HistogramBuckets; i++)
+	{
+		m_nHistogram[i] = 0;
+	}
 }
 
 void CPerformanceTimer::Start (void)
@@ -42,6 +47,16 @@ void CPerformanceTimer::Stop (void)
 	{
 		m_nMaximumMicros = nMicros;
 	}
+
+	unsigned nBucket = 0;
+	while (nMicros > 0 && nBucket < HistogramBuckets-1)
+	{
+		nMicros >>= 1;
+		nBucket++;
+	}
+
+	m_nHistogram[nBucket]++;
+	m_nCount++;
 }
 
 void CPerformanceTimer::Dump (unsigned nIntervalTicks)
@@ -53,6 +68,10 @@ void CPerformanceTimer::Dump (unsigned nIntervalTicks)
 		m_nLastDumpTicks = nTicks;
 
 		unsigned nMaximumMicros = m_nMaximumMicros;	// may be overwritten from interrupt
+		if (nMaximumMicros == 0 && m_nCount == 0)
+		{
+			return;					// nothing measured yet
+		}
 
 		std::cout << m_Name << ": Maximum duration was " << nMaximumMicros <<  "us";
 
@@ -61,6 +80,33 @@ void CPerformanceTimer::Dump (unsigned nIntervalTicks)
 			std::cout << " (" << nMaximumMicros*100 / m_nDeadlineMicros << "%)";
 		}
 
+		unsigned nCount = m_nCount;
+		if (nCount > 0)
+		{
+			// percentiles are reported as upper bound of the histogram bucket
+			unsigned nSum = 0;
+			unsigned nPercentile50 = 0;
+			unsigned nPercentile99 = 0;
+			for (unsigned i = 0; i < HistogramBuckets; i++)
+			{
+				nSum += m_nHistogram[i];
+				if (nPercentile50 == 0 && nSum*100 >= nCount*50)
+				{
+					nPercentile50 = 1 << i;
+				}
+				if (nPercentile99 == 0 && nSum*100 >= nCount*99)
+				{
+					nPercentile99 = 1 << i;
+				}
+
+				m_nHistogram[i] = 0;
+			}
+			m_nCount = 0;
+
+			std::cout << ", " << nCount << " calls, 50% <" << nPercentile50
+				  << "us, 99% <" << nPercentile99 << "us";
+		}
+
 		std::cout << std::endl;
 	}
 }
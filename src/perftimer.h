@@ -25,6 +25,9 @@
 
 class CPerformanceTimer
 {
+public:
+	static const unsigned HistogramBuckets = 16;	// bucket n: 2^(n-1) <= duration < 2^n us
+
 public:
 	CPerformanceTimer (const char *pName, unsigned nDeadlineMicros = 0);
 
@@ -41,6 +44,10 @@ private:
 	unsigned m_nMaximumMicros;
 
 	unsigned m_nLastDumpTicks;
+
+	// since last dump
+	unsigned m_nCount;
+	unsigned m_nHistogram[HistogramBuckets];
 };
 
 #endif
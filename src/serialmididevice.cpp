@@ -71,16 +71,9 @@ void CSerialMIDIDevice::Process (void)
 		return;
 	}
 
-        if (m_pConfig->GetMIDIDumpEnabled ())
+	if (m_pConfig->GetMIDIDumpEnabled ())
 	{
-		printf("Incoming MIDI data:");
-		for (uint16_t i = 0; i < nResult; i++)
-		{
-			if((i % 8) == 0)
-				printf("\n%04d:",i);
-			printf(" 0x%02x",Buffer[i]);
-		}
-		printf("\n");
+		m_pMIDILog->WriteSerialData (Buffer, nResult);
 	}
 
 	// Process MIDI messages
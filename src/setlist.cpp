@@ -0,0 +1,336 @@
+//
+// setlist.cpp
+//
+// Fixed order of performances for live use
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#include "setlist.h"
+#include <circle/logger.h>
+#include <fatfs/ff.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <assert.h>
+
+LOGMODULE ("Setlist");
+
+// Format of setlist.txt (one entry per line):
+//
+// 12				performance number, as in 000012_Intro.ini
+// Live/000012_Intro.ini	file name, relative to the performance folder
+// # comment
+//
+// Number 0 is the default performance (performance.ini). Empty lines and
+// leading and trailing blanks are ignored.
+
+#define SETLIST_FILE		"SD:/" PERFORMANCE_DIR "/setlist.txt"
+
+CSetlist::CSetlist (CPerformanceConfig *pPerformanceConfig, CSysExFileLoader *pSysExFileLoader)
+:	m_pPerformanceConfig (pPerformanceConfig),
+	m_pSysExFileLoader (pSysExFileLoader),
+	m_nDirectoryGeneration (0),
+	m_nBankGeneration (0),
+	m_nPosition (0)
+{
+}
+
+CSetlist::~CSetlist (void)
+{
+}
+
+bool CSetlist::Load (void)
+{
+	m_Entries.clear ();
+	m_EntryID.clear ();
+	m_nPosition = 0;
+
+	FIL File;
+	if (f_open (&File, SETLIST_FILE, FA_READ | FA_OPEN_EXISTING) != FR_OK)
+	{
+		return false;
+	}
+
+	size_t nFileSize = f_size (&File);
+	char *pBuffer = new char[nFileSize+1];
+	assert (pBuffer);
+
+	UINT nRead;
+	if (   f_read (&File, pBuffer, nFileSize, &nRead) != FR_OK
+	    || nRead != nFileSize)
+	{
+		LOGWARN (SETLIST_FILE ": Read error");
+
+		nFileSize = 0;
+	}
+
+	f_close (&File);
+
+	pBuffer[nFileSize] = '\0';
+
+	unsigned nLine = 0;
+	for (char *pLine = pBuffer; *pLine; )
+	{
+		char *pEnd = pLine;
+		while (*pEnd && *pEnd != '\n')
+		{
+			pEnd++;
+		}
+
+		char *pNext = *pEnd ? pEnd+1 : pEnd;
+
+		// strip blanks and CR
+		while (pEnd > pLine && isspace ((unsigned char) pEnd[-1]))
+		{
+			pEnd--;
+		}
+		*pEnd = '\0';
+
+		while (isspace ((unsigned char) *pLine))
+		{
+			pLine++;
+		}
+
+		nLine++;
+
+		if (   *pLine
+		    && *pLine != '#')
+		{
+			if (m_Entries.size () >= MaxEntries)
+			{
+				LOGWARN ("Too many entries, ignored from line %u", nLine);
+
+				break;
+			}
+
+			m_Entries.push_back (pLine);
+		}
+
+		pLine = pNext;
+	}
+
+	delete [] pBuffer;
+
+	if (m_Entries.empty ())
+	{
+		return false;
+	}
+
+	ResolveEntries ();
+	m_nBankGeneration = m_pSysExFileLoader->GetBankGeneration ();
+
+	LOGNOTE ("%u entries", (unsigned) m_Entries.size ());
+
+	return true;
+}
+
+bool CSetlist::IsActive (void) const
+{
+	return !m_Entries.empty ();
+}
+
+unsigned CSetlist::GetEntries (void) const
+{
+	return m_Entries.size ();
+}
+
+unsigned CSetlist::GetPosition (void) const
+{
+	return m_nPosition;
+}
+
+unsigned CSetlist::Select (unsigned nEntry)
+{
+	Update ();
+
+	unsigned nID = GetPerformanceID (nEntry);
+	if (nID == CPerformanceConfig::NoPerformance)
+	{
+		if (nEntry < m_Entries.size ())
+		{
+			LOGWARN ("%s: Performance not found", m_Entries[nEntry].c_str ());
+		}
+
+		return CPerformanceConfig::NoPerformance;
+	}
+
+	m_nPosition = nEntry;
+
+	PrefetchNeighbours ();
+
+	if (!m_pPerformanceConfig->IsPrefetched (nID))
+	{
+		LOGDBG ("Entry %u was not in memory", nEntry+1);
+	}
+
+	return nID;
+}
+
+unsigned CSetlist::Step (int nStep)
+{
+	assert (nStep == -1 || nStep == 1);
+
+	// missing performances are skipped, so that the set can go on
+	for (unsigned nEntry = m_nPosition + nStep; nEntry < m_Entries.size (); nEntry += nStep)
+	{
+		unsigned nID = Select (nEntry);
+		if (nID != CPerformanceConfig::NoPerformance)
+		{
+			return nID;
+		}
+	}
+
+	return CPerformanceConfig::NoPerformance;
+}
+
+void CSetlist::Process (void)
+{
+	if (!IsActive ())
+	{
+		return;
+	}
+
+	if (Update ())
+	{
+		PrefetchNeighbours ();
+	}
+
+	// the voices, which have been unpacked into the neighbours, may be outdated
+	unsigned nBankGeneration = m_pSysExFileLoader->GetBankGeneration ();
+	if (nBankGeneration != m_nBankGeneration)
+	{
+		m_nBankGeneration = nBankGeneration;
+
+		m_pPerformanceConfig->InvalidatePrefetched (CPerformanceConfig::NoPerformance);
+		PrefetchNeighbours ();
+
+		return;
+	}
+
+	if (CompleteVoices (GetPerformanceID (m_nPosition+1)))
+	{
+		return;
+	}
+
+	if (m_nPosition > 0)
+	{
+		CompleteVoices (GetPerformanceID (m_nPosition-1));
+	}
+}
+
+unsigned CSetlist::GetPerformanceID (unsigned nEntry) const
+{
+	if (nEntry >= m_EntryID.size ())
+	{
+		return CPerformanceConfig::NoPerformance;
+	}
+
+	return m_EntryID[nEntry];
+}
+
+unsigned CSetlist::ResolveEntry (unsigned nEntry) const
+{
+	assert (nEntry < m_Entries.size ());
+	const std::string &rEntry = m_Entries[nEntry];
+
+	char *pEnd;
+	unsigned long ulNumber = strtoul (rEntry.c_str (), &pEnd, 10);
+	if (   isdigit ((unsigned char) rEntry[0])
+	    && *pEnd == '\0')
+	{
+		return m_pPerformanceConfig->FindPerformance ((unsigned) ulNumber);
+	}
+
+	return m_pPerformanceConfig->FindPerformance (rEntry);
+}
+
+void CSetlist::ResolveEntries (void)
+{
+	m_nDirectoryGeneration = m_pPerformanceConfig->GetDirectoryGeneration ();
+
+	m_EntryID.resize (m_Entries.size ());
+	for (unsigned nEntry = 0; nEntry < m_Entries.size (); nEntry++)
+	{
+		m_EntryID[nEntry] = ResolveEntry (nEntry);
+	}
+}
+
+bool CSetlist::Update (void)
+{
+	if (m_pPerformanceConfig->GetDirectoryGeneration () == m_nDirectoryGeneration)
+	{
+		return false;
+	}
+
+	ResolveEntries ();
+
+	return true;
+}
+
+void CSetlist::PrefetchNeighbours (void)
+{
+	// the next entry is the most probable one
+	if (m_nPosition > 0)
+	{
+		unsigned nPrevID = GetPerformanceID (m_nPosition-1);
+		if (nPrevID != CPerformanceConfig::NoPerformance)
+		{
+			m_pPerformanceConfig->Prefetch (nPrevID);
+		}
+	}
+
+	unsigned nNextID = GetPerformanceID (m_nPosition+1);
+	if (nNextID != CPerformanceConfig::NoPerformance)
+	{
+		m_pPerformanceConfig->Prefetch (nNextID);
+	}
+}
+
+bool CSetlist::CompleteVoices (unsigned nID)
+{
+	CPerformanceConfig::TPerformance *pPerformance = m_pPerformanceConfig->GetPrefetched (nID);
+	if (!pPerformance)
+	{
+		return false;			// not read yet
+	}
+
+	// only voices given by bank and voice number have to be unpacked,
+	// for invalid banks LoadPerformanceParameters() uses the current bank
+	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
+	{
+		unsigned nBank = pPerformance->nBankNumber[nTG];
+		if (   pPerformance->bVoiceDataFilled[nTG]
+		    || !m_pSysExFileLoader->IsValidBank (nBank))
+		{
+			continue;
+		}
+
+		unsigned nProgram = pPerformance->nVoiceNumber[nTG];
+		if (nProgram >= CSysExFileLoader::VoicesPerBank)
+		{
+			nProgram = CSysExFileLoader::VoicesPerBank-1;
+		}
+
+		if (m_pSysExFileLoader->GetVoice (nBank, nProgram, pPerformance->VoiceData[nTG], true))
+		{
+			pPerformance->bVoiceDataFilled[nTG] = true;
+
+			return true;		// one voice per call
+		}
+	}
+
+	return false;
+}
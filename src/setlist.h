@@ -0,0 +1,83 @@
+//
+// setlist.h
+//
+// Fixed order of performances for live use
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+#ifndef _setlist_h
+#define _setlist_h
+
+#include "performanceconfig.h"
+#include "sysexfileloader.h"
+#include <string>
+#include <vector>
+
+// If the file setlist.txt exists in the performance folder, Program Change
+// messages on the performance select channel select the entries of this list
+// and Program Up/Down (buttons, footswitch or MIDI buttons) steps through it.
+// The previous and next entry are kept in memory with the voices of all TGs
+// unpacked, so that a switch to them needs no file access and is applied at
+// the next block boundary. The entries are resolved to performance IDs on
+// Load() and again, when the performance directory has changed. The unpacked
+// voices are read again, when the voice banks have changed.
+
+class CSetlist
+{
+public:
+	static const unsigned MaxEntries = 1000;
+
+public:
+	CSetlist (CPerformanceConfig *pPerformanceConfig, CSysExFileLoader *pSysExFileLoader);
+	~CSetlist (void);
+
+	bool Load (void);			// returns false, if there is no setlist
+	bool IsActive (void) const;
+
+	unsigned GetEntries (void) const;
+	unsigned GetPosition (void) const;
+
+	// returns the performance ID of the new entry, or NoPerformance if
+	// the entry does not exist (the position is not changed then)
+	unsigned Select (unsigned nEntry);
+	unsigned Step (int nStep);		// -1 or +1, skips missing entries
+
+	// call this from the main loop, completes one neighbour at most
+	void Process (void);
+
+private:
+	unsigned GetPerformanceID (unsigned nEntry) const;	// from m_EntryID
+	unsigned ResolveEntry (unsigned nEntry) const;
+	void ResolveEntries (void);
+	bool Update (void);			// returns true, if the IDs have changed
+	void PrefetchNeighbours (void);
+
+	bool CompleteVoices (unsigned nID);	// returns true, if a voice was unpacked
+
+private:
+	CPerformanceConfig *m_pPerformanceConfig;
+	CSysExFileLoader *m_pSysExFileLoader;
+
+	// performance number ("12") or path relative to PERFORMANCE_DIR
+	std::vector<std::string> m_Entries;
+	std::vector<unsigned> m_EntryID;	// resolved, NoPerformance if not found
+	unsigned m_nDirectoryGeneration;	// of the resolved IDs
+	unsigned m_nBankGeneration;		// of the completed voices
+	unsigned m_nPosition;
+};
+
+#endif
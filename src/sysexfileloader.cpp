@@ -19,16 +19,84 @@
 //
 #include "sysexfileloader.h"
 #include <stdio.h>
-#include <dirent.h>
 #include <stdlib.h>
 #include <string.h>
 #include <strings.h>
+#include <ctype.h>
 #include <assert.h>
+#include <algorithm>
+#include <iterator>
 #include <circle/logger.h>
+#include <circle/synchronize.h>
 #include "voices.c"
 
 LOGMODULE ("syxfile");
 
+// The bank index file caches the directory scan and the voice names, so
+// that only changed bank files have to be read on boot. It is ignored,
+// if its checksum (FNV-1a over the whole file before it) is wrong.
+//
+// TIndexHeader
+// TIndexEntry + path (not terminated), for each bank
+// uint32_t checksum
+
+#define INDEX_MAGIC		"MDXB"
+#define INDEX_FLAG_HEADERLESS	(1 << 0)	// HeaderlessSysExVoices was set
+
+// The voice library is a single file with many banks, which can be built
+// from a voice directory with syx2lib.py. Single voices and banks are read
+// with seek and read, so that the boot time does not depend on the number
+// of banks. All values are little endian.
+//
+// TLibraryHeader
+// TLibraryEntry, for each bank
+// bank names (null terminated)
+// bank data (4096 bytes packed voices), for each bank
+
+#define LIBRARY_MAGIC		"MDXL"
+
+struct TLibraryHeader
+{
+	char	Magic[4];
+	uint32_t nVersion;
+	uint32_t nBanks;
+	uint32_t nStringsSize;
+	uint32_t nChecksum;		// FNV-1a of entries and bank names
+}
+PACKED;
+
+struct TLibraryEntry
+{
+	uint16_t nBankID;		// 0 .. MaxVoiceBankID
+	uint16_t Reserved;
+	uint32_t nNameOffset;		// into bank names
+	uint32_t nDataOffset;		// from start of file
+	uint32_t nChecksum;		// FNV-1a of the bank with SysEx header (4104 bytes)
+	char	VoiceName[CSysExFileLoader::VoicesPerBank][CSysExFileLoader::VoiceNameLength];
+}
+PACKED;
+
+struct TIndexHeader
+{
+	char	Magic[4];
+	uint32_t nVersion;
+	uint32_t nEntries;
+	uint32_t nFlags;
+}
+PACKED;
+
+struct TIndexEntry
+{
+	uint32_t nSize;
+	uint32_t nTime;
+	uint32_t nChecksum;
+	uint8_t	bHeaderless;
+	uint8_t	Reserved;
+	uint16_t nPathLength;
+	char	VoiceName[CSysExFileLoader::VoicesPerBank][CSysExFileLoader::VoiceNameLength];
+}
+PACKED;
+
 /*
 uint8_t CSysExFileLoader::s_DefaultVoice[SizeSingleVoice] =	// FM-Piano
 {
@@ -62,309 +130,2532 @@ uint8_t CSysExFileLoader::s_DefaultVoice[SizeSingleVoice] =	// INIT VOICE
 };
 
 CSysExFileLoader::CSysExFileLoader (const char *pDirName)
-:	m_DirName (pDirName)
+:	m_DirName (pDirName),
+	m_bHeaderlessSysExVoices (false),
+	m_bIndexChanged (false),
+	m_nBankGeneration (0),
+	m_bIndexWriting (false),
+	m_nIndexBankID (0),
+	m_nIndexEntries (0),
+	m_nIndexWritten (0),
+	m_nIndexChecksum (0),
+	m_nBanksRead (0),
+	m_bScanning (false),
+	m_nScanDepth (0),
+	m_nScanFiles (0),
+	m_nScanExpected (1),
+	m_nScanAdded (0),
+	m_nScanChanged (0),
+	m_nCachedBanks (0),
+	m_nUseClock (0),
+	m_nCacheHits (0),
+	m_nCacheMisses (0),
+	m_nCacheEvictions (0),
+	m_nCachePrefetches (0),
+	m_nLastDumpTicks (0),
+	m_nLastDumpAccesses (0),
+	m_nLookups (0),
+	m_nLookupTicks (0),
+	m_nLookupTicksMax (0),
+	m_nLoadTicks (0),
+	m_nScanStartTicks (0),
+	m_nScanTicks (0),
+	m_nInvalidFiles (0),
+	m_nDuplicates (0),
+	m_nSkippedDirs (0),
+	m_nVoiceRefs (0),
+	m_nUniqueVoices (0),
+	m_nDecodedHits (0),
+	m_nPrepareIn (0),
+	m_nPrepareOut (0),
+	m_nDecodeCount (0),
+	m_nPrefetchBankID (0),
+	m_nPrefetchCount (0),
+	m_bPrefetchUp (true),
+	m_nReceiveRejected (0),
+	m_nReceiveDropped (0),
+	m_nReceiveRejectedReported (0),
+	m_nReceiveDroppedReported (0),
+	m_nLoadJobIn (0),
+	m_nLoadJobOut (0),
+	m_bParallelLoad (false),
+	m_bLoadComplete (false),
+	m_pStoreFile (nullptr),
+	m_pStoreBank (nullptr),
+	m_nStoreBankID (0),
+	m_nStoreOffset (0),
+	m_bLibraryOpen (false)
 {
 	m_DirName += "/voice";
+	m_IndexFileName = m_DirName + ".idx";	// outside of the scanned directory
+	m_IndexTempName = m_IndexFileName + ".tmp";
+	m_LibraryFileName = m_DirName + ".lib";
 	m_nNumHighestBank = 0;
+	m_nBanksLoaded = 0;
+
+	for (unsigned i = 0; i < ReceiveSlots; i++)
+	{
+		m_bReceiveBankFull[i] = false;
+	}
+
+	for (unsigned i = 0; i < DecodedBanks; i++)
+	{
+		m_DecodedBank[i].nBankID = InvalidBankID;
+		m_DecodedBank[i].nLastUse = 0;
+	}
 
-	for (unsigned i = 0; i <= MaxVoiceBankID; i++)
+	for (unsigned i = 0; i < LoadJobs; i++)
 	{
-		m_pVoiceBank[i] = nullptr;
+		m_LoadJob[i].nState = LoadJobFree;
 	}
 }
 
 CSysExFileLoader::~CSysExFileLoader (void)
 {
-	for (unsigned i = 0; i <= MaxVoiceBankID; i++)
+	while (m_nScanDepth)
+	{
+		f_closedir (&m_ScanDirectory[--m_nScanDepth]);
+	}
+
+	if (m_pStoreFile)
+	{
+		fclose (m_pStoreFile);
+	}
+
+	delete m_pStoreBank;
+
+	if (m_bIndexWriting)
 	{
-		delete m_pVoiceBank[i];
+		f_close (&m_IndexFile);		// incomplete, ignored on next Load()
+	}
+
+	for (auto &rEntry : m_Bank)
+	{
+		ReleaseBank (rEntry.pVoices);
+	}
+	assert (m_VoicePool.empty ());
+
+	if (m_bLibraryOpen)
+	{
+		f_close (&m_LibraryFile);
 	}
 }
 
 void CSysExFileLoader::Load (bool bHeaderlessSysExVoices)
 {
+	assert (m_Bank.empty ());
+
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
 	m_nNumHighestBank = 0;
 	m_nBanksLoaded = 0;
+	m_nBanksRead = 0;
+	m_bHeaderlessSysExVoices = bHeaderlessSysExVoices;
+	m_bIndexChanged = false;
 
-    DIR *pDirectory = opendir (m_DirName.c_str ());
-	if (!pDirectory)
+	// banks from the library have precedence over bank files
+	m_ScannedBankID.assign (MaxVoiceBankID+1, false);
+	unsigned nLibraryBanks = ReadLibrary ();
+	PublishBanks ();
+
+	ReadIndex ();
+	bool bIndexed = !m_OldIndex.empty ();
+	AddIndexedBanks ();
+
+	if (!StartScan ())
+	{
+		if (!nLibraryBanks)
+		{
+			LOGWARN ("Directory %s not found", m_DirName.c_str ());
+		}
+
+		m_ScannedBankID.clear ();
+		m_ScannedBankID.shrink_to_fit ();
+	}
+	else if (!bIndexed)
 	{
-		LOGWARN ("Directory %s not found", m_DirName.c_str ());
+		// nothing known about the directory, scan it now (with help of LoadWorker())
+		m_bParallelLoad = true;
 
-		return;
+		while (ScanStep ())
+		{
+			// just continue
+		}
+
+		CompleteLoadJobs ();
+		m_bParallelLoad = false;
+
+		FinishScan ();
 	}
+	// otherwise the indexed banks are verified by Process() in the background
+
+	LOGDBG ("%u Banks loaded (%u read from files). Highest Bank loaded: #%u",
+		m_nBanksLoaded, m_nBanksRead, m_nNumHighestBank+1);
+	LOGDBG ("%u voices in cache, %u unique", m_nVoiceRefs, m_nUniqueVoices);
+	LOGDBG ("%u voice names indexed", (unsigned) m_NameIndex.size ());
+
+	m_nLoadTicks = CTimer::GetClockTicks () - nStartTicks;
+
+	TLoadStatistics Statistics;
+	GetLoadStatistics (&Statistics);
+	LOGNOTE ("%u Banks loaded in %u ms (%u files read, %u invalid, %u duplicate), %u KB used",
+		 Statistics.nBanks, Statistics.nLoadTicks / 1000, Statistics.nFilesRead,
+		 Statistics.nInvalidFiles, Statistics.nDuplicates,
+		 (unsigned) (Statistics.nMemory / 1024));
+
+	m_bLoadComplete = true;
+}
 
-	dirent *pEntry;
-	while ((pEntry = readdir (pDirectory)) != nullptr)
+bool CSysExFileLoader::Rescan (void)
+{
+	// a bank file, which is being written, would be found incomplete
+	if (   m_bScanning
+	    || m_pStoreFile)
 	{
-		LoadBank(m_DirName.c_str (), pEntry->d_name, bHeaderlessSysExVoices, 0);
+		return false;
 	}
-	LOGDBG ("%u Banks loaded. Highest Bank loaded: #%u", m_nBanksLoaded, m_nNumHighestBank+1);
 
-	closedir (pDirectory);
+	return StartScan ();
 }
 
-void CSysExFileLoader::LoadBank (const char * sDirName, const char * sBankName, bool bHeaderlessSysExVoices, unsigned nSubDirCount)
+bool CSysExFileLoader::IsScanning (void) const
 {
-	unsigned nBank;
-	size_t nLen = strlen (sBankName);
-	
-	if (   nLen < 5						// "[NNNN]N[_name].syx"
-		|| strcasecmp (&sBankName[nLen-4], ".syx") != 0
-		|| sscanf (sBankName, "%u", &nBank) != 1)
+	return m_bScanning;
+}
+
+unsigned CSysExFileLoader::GetScanProgress (void) const
+{
+	if (!m_bScanning)
+	{
+		return 100;
+	}
+
+	// estimated from the number of bank files known, when the scan started
+	if (m_nScanFiles >= m_nScanExpected)
 	{
-		// See if this is a subdirectory...
-		std::string Dirname (sDirName);
-		Dirname += "/";
-		Dirname += sBankName;
+		return 99;
+	}
 
-		DIR *pDirectory = opendir (Dirname.c_str ());
-		if (pDirectory)
-		{
-			if (nSubDirCount >= MaxSubDirs)
-			{
-				LOGWARN ("Too many nested subdirectories: %s", sBankName);
-				return;
-			}
-	
-			LOGDBG ("Processing subdirectory %s", sBankName);
+	return m_nScanFiles * 100 / m_nScanExpected;
+}
 
-			dirent *pEntry;
-			while ((pEntry = readdir (pDirectory)) != nullptr)
-			{
-				LoadBank(Dirname.c_str (), pEntry->d_name, bHeaderlessSysExVoices, nSubDirCount+1);
-			}
-			closedir (pDirectory);
+bool CSysExFileLoader::StartScan (void)
+{
+	assert (!m_bScanning);
+	assert (!m_nScanDepth);
+
+	if (f_opendir (&m_ScanDirectory[0], m_DirName.c_str ()) != FR_OK)
+	{
+		return false;
+	}
+
+	m_ScanPath[0].clear ();
+	m_nScanDepth = 1;
+
+	// banks from the library are not affected by the scan
+	m_ScannedBankID.assign (MaxVoiceBankID+1, false);
+	m_nScanExpected = 0;
+	for (auto &rEntry : m_Bank)
+	{
+		if (rEntry.File.nLibraryOffset)
+		{
+			m_ScannedBankID[rEntry.nBankID] = true;
 		}
 		else
 		{
-			LOGWARN ("%s: Invalid filename format", sBankName);
+			m_nScanExpected++;
 		}
-
-		return;
 	}
-	
-	// File and UI handling requires banks to be 1..indexed.
-	// Internally (and via MIDI) we need 0..indexed.
-	// Any mention of a BankID internally is assumed to be 0..indexed.
-	unsigned nBankIdx = nBank - 1;
 
-	// BankIdx goes from 0 to MaxVoiceBankID inclusive
-	if (nBankIdx > MaxVoiceBankID)
+	if (!m_nScanExpected)
 	{
-		LOGWARN ("Bank #%u is not supported", nBank);
+		m_nScanExpected = 1;
+	}
 
-		return;
+	m_nScanFiles = 0;
+	m_nScanAdded = 0;
+	m_nScanChanged = 0;
+	m_nBanksRead = 0;
+	m_nInvalidFiles = 0;
+	m_nDuplicates = 0;
+	m_nSkippedDirs = 0;
+	m_nScanStartTicks = CTimer::GetClockTicks ();
+	m_bScanning = true;
+
+	return true;
+}
+
+bool CSysExFileLoader::ScanStep (void)
+{
+	if (!m_nScanDepth)
+	{
+		return false;
 	}
 
-	if (m_pVoiceBank[nBankIdx])
+	unsigned nLevel = m_nScanDepth-1;
+
+	FILINFO FileInfo;
+	if (   f_readdir (&m_ScanDirectory[nLevel], &FileInfo) != FR_OK
+	    || !FileInfo.fname[0])
 	{
-		LOGWARN ("Bank #%u already loaded", nBank);
+		f_closedir (&m_ScanDirectory[nLevel]);
+		m_nScanDepth--;
 
-		return;
+		return m_nScanDepth > 0;
 	}
 
-	m_pVoiceBank[nBankIdx] = new TVoiceBank;
-	assert (m_pVoiceBank[nBankIdx]);
-	assert (sizeof(TVoiceBank) == VoiceSysExHdrSize + VoiceSysExSize);
-
-	std::string Filename (sDirName);
-	Filename += "/";
-	Filename += sBankName;
+	std::string Path (m_ScanPath[nLevel]);
+	if (!Path.empty ())
+	{
+		Path += "/";
+	}
+	Path += FileInfo.fname;
 
-	FILE *pFile = fopen (Filename.c_str (), "rb");
-	if (pFile)
+	if (FileInfo.fattrib & AM_DIR)
 	{
-		bool bBankLoaded = false;
-		if (   fread (m_pVoiceBank[nBankIdx], VoiceSysExHdrSize+VoiceSysExSize, 1, pFile) == 1
-			&& m_pVoiceBank[nBankIdx]->StatusStart == 0xF0
-			&& m_pVoiceBank[nBankIdx]->CompanyID   == 0x43
-			&& m_pVoiceBank[nBankIdx]->Format      == 0x09
-			&& m_pVoiceBank[nBankIdx]->StatusEnd   == 0xF7)
+		if (nLevel >= MaxSubDirs)
 		{
-			if (m_nBanksLoaded % 100 == 0)
-			{
-				LOGDBG ("Banks successfully loaded #%u", m_nBanksLoaded);
-			}
-			//LOGDBG ("Bank #%u successfully loaded", nBank);
+			LOGWARN ("Too many nested subdirectories: %s", FileInfo.fname);
 
-			m_BankFileName[nBankIdx] = sBankName;
-			if (nBankIdx > m_nNumHighestBank)
-			{
-				// This is the bank ID of the highest loaded bank
-				m_nNumHighestBank = nBankIdx;
-			}
-			m_nBanksLoaded++;
-			bBankLoaded = true;
-		}
-		else if (bHeaderlessSysExVoices)
-		{
-			// Config says to accept headerless SysEx Voice Banks
-			// so reset file pointer and try again.
-			fseek (pFile, 0, SEEK_SET);
-			if (fread (m_pVoiceBank[nBankIdx]->Voice, VoiceSysExSize, 1, pFile) == 1)
-			{
-				if (m_nBanksLoaded % 100 == 0)
-				{
-					LOGDBG ("Banks successfully loaded #%u", m_nBanksLoaded);
-				}
-				//LOGDBG ("Bank #%u successfully loaded (headerless)", nBank);
-
-				// Add in the missing header items.
-				// Naturally it isn't possible to validate these!
-				m_pVoiceBank[nBankIdx]->StatusStart = 0xF0;
-				m_pVoiceBank[nBankIdx]->CompanyID   = 0x43;
-				m_pVoiceBank[nBankIdx]->Format      = 0x09;
-				m_pVoiceBank[nBankIdx]->ByteCountMS = 0x20;
-				m_pVoiceBank[nBankIdx]->ByteCountLS = 0x00;
-				m_pVoiceBank[nBankIdx]->Checksum    = 0x00;
-				m_pVoiceBank[nBankIdx]->StatusEnd   = 0xF7;
-
-				m_BankFileName[nBankIdx] = sBankName;
-				if (nBankIdx > m_nNumHighestBank)
-				{
-					// This is the bank ID of the highest loaded bank
-					m_nNumHighestBank = nBankIdx;
-				}
-				bBankLoaded = true;
-				m_nBanksLoaded++;
-			}
+			m_nSkippedDirs++;
+
+			return true;
 		}
 
-		if (!bBankLoaded)
+		std::string DirName (m_DirName);
+		DirName += "/";
+		DirName += Path;
+
+		if (f_opendir (&m_ScanDirectory[nLevel+1], DirName.c_str ()) == FR_OK)
 		{
-			LOGWARN ("%s: Invalid size or format", Filename.c_str ());
+			LOGDBG ("Processing subdirectory %s", FileInfo.fname);
 
-			delete m_pVoiceBank[nBankIdx];
-			m_pVoiceBank[nBankIdx] = nullptr;
+			m_ScanPath[nLevel+1] = Path;
+			m_nScanDepth++;
 		}
-
-		fclose (pFile);
 	}
 	else
 	{
-		delete m_pVoiceBank[nBankIdx];
-		m_pVoiceBank[nBankIdx] = nullptr;
+		AddBankFile (Path, FileInfo.fname, &FileInfo);
+
+		m_nScanFiles++;
 	}
+
+	return true;
 }
 
-std::string CSysExFileLoader::GetBankName (unsigned nBankID)
+void CSysExFileLoader::ScanSlice (void)
 {
-	if (nBankID <= MaxVoiceBankID)
-	{
-		std::string Result = m_BankFileName[nBankID];
-
-		size_t nLen = Result.length ();
-		if (nLen > 4)
-		{
-			Result.resize (nLen-4);		// remove file extension
+	assert (m_bScanning);
 
-			unsigned nBank;
-			char BankName[30+1];
-			if (sscanf (Result.c_str (), "%u_%30s", &nBank, BankName) == 2)
-			{
-				Result = BankName;
+	unsigned nStartTicks = CTimer::GetClockTicks ();
 
-				return Result;
-			}
-		}
+	bool bMore;
+	do
+	{
+		bMore = ScanStep ();
 	}
+	while (   bMore
+	       && CTimer::GetClockTicks () - nStartTicks < ScanTimeSlice);
 
-	return "NO NAME";
+	if (bMore)
+	{
+		PublishBanks ();
+	}
+	else
+	{
+		FinishScan ();
+	}
 }
 
-unsigned CSysExFileLoader::GetNextBankUp (unsigned nBankID)
+void CSysExFileLoader::FinishScan (void)
 {
-	// Find the next loaded bank "up" from the provided bank ID
-	for (unsigned id=nBankID+1; id <= m_nNumHighestBank; id++)
+	assert (m_bScanning);
+
+	while (m_nScanDepth)
 	{
-		if (IsValidBank(id))
-		{
-			return id;
-		}
+		f_closedir (&m_ScanDirectory[--m_nScanDepth]);
 	}
-	
-	// Handle wrap-around
-	for (unsigned id=0; id<nBankID; id++)
+
+	PublishBanks ();
+
+	// banks, which have not been found, have been removed
+	std::vector<TBankEntry> Bank;
+	Bank.reserve (m_Bank.size ());
+
+	unsigned nRemoved = 0;
+	for (auto &rEntry : m_Bank)
 	{
-		if (IsValidBank(id))
+		if (   m_ScannedBankID[rEntry.nBankID]
+		    || !rEntry.File.nSize)		// received, but not stored yet
+		{
+			Bank.push_back (rEntry);
+		}
+		else
 		{
-			return id;
+			UncacheBank (&rEntry);
+
+			m_NameIndexRemoved.push_back (rEntry.nBankID);
+
+			nRemoved++;
 		}
 	}
-	
-	// If we get here there are no other banks!
-	return nBankID;
+
+	if (nRemoved)
+	{
+		m_SpinLock.Acquire ();
+		m_Bank.swap (Bank);
+		m_SpinLock.Release ();
+
+		UpdateBankCount ();
+
+		m_bIndexChanged = true;
+		m_nBankGeneration++;
+	}
+
+	m_bScanning = false;
+	m_ScannedBankID.clear ();
+	m_ScannedBankID.shrink_to_fit ();
+
+	m_nScanTicks = CTimer::GetClockTicks () - m_nScanStartTicks;
+
+	UpdateNameIndex ();
+
+	if (m_nScanAdded || m_nScanChanged || nRemoved)
+	{
+		LOGNOTE ("Bank scan: %u added, %u changed, %u removed",
+			 m_nScanAdded, m_nScanChanged, nRemoved);
+	}
+
+	// the index is written by Process() in time slices, if changed
 }
 
-unsigned CSysExFileLoader::GetNextBankDown (unsigned nBankID)
+void CSysExFileLoader::PublishBanks (void)
 {
-	// Find the next loaded bank "down" from the provided bank ID
-	for (int id=((int)nBankID)-1; id >= 0; id--)
+	if (m_NewBank.empty ())
 	{
-		if (IsValidBank((unsigned)id))
-		{
-			return id;
-		}
+		return;
 	}
 
-	// Handle wrap-around
-	for (unsigned id=m_nNumHighestBank; id>nBankID; id--)
+	auto Compare = [] (const TBankEntry &rEntry1, const TBankEntry &rEntry2)
+			{
+				return rEntry1.nBankID < rEntry2.nBankID;
+			};
+
+	std::sort (m_NewBank.begin (), m_NewBank.end (), Compare);
+
+	std::vector<TBankEntry> Bank;
+	Bank.reserve (m_Bank.size () + m_NewBank.size ());
+	std::merge (m_Bank.begin (), m_Bank.end (), m_NewBank.begin (), m_NewBank.end (),
+		    std::back_inserter (Bank), Compare);
+
+	// the new directory becomes visible at once, the old one is freed outside the lock
+	m_SpinLock.Acquire ();
+	m_Bank.swap (Bank);
+	m_SpinLock.Release ();
+
+	m_nBankGeneration++;
+
+	// banks read by the scan are kept in the cache, as far as there is space
+	for (auto &rNewEntry : m_NewBank)
 	{
-		if (IsValidBank(id))
+		m_NameIndexAdded.push_back (rNewEntry.nBankID);
+
+		TBankVoices *pVoices = rNewEntry.pVoices;
+		if (pVoices)
 		{
-			return id;
+			TBankEntry *pEntry = FindBank (rNewEntry.nBankID);
+			assert (pEntry);
+			pEntry->pVoices = nullptr;
+
+			CacheBank (pEntry, pVoices);
 		}
 	}
-	
-	// If we get here there are no other banks!
-	return nBankID;
+
+	m_NewBank.clear ();
+
+	UpdateBankCount ();
+
+	// during a scan once at the end
+	if (!m_bScanning)
+	{
+		UpdateNameIndex ();
+	}
 }
 
-bool CSysExFileLoader::IsValidBank (unsigned nBankID)
+void CSysExFileLoader::UpdateBankCount (void)
 {
-	if (m_pVoiceBank[nBankID])
+	m_nBanksLoaded = m_Bank.size ();
+	m_nNumHighestBank = m_Bank.empty () ? 0 : m_Bank.back ().nBankID;
+}
+
+void CSysExFileLoader::AddIndexedBanks (void)
+{
+	unsigned nBanks = 0;
+	for (auto &rIndexed : m_OldIndex)
 	{
-		// Use a valid "status start/end" as an indicator of a valid loaded bank
-		if ((m_pVoiceBank[nBankID]->StatusStart == 0xF0) &&
-			(m_pVoiceBank[nBankID]->StatusEnd == 0xF7))
+		const char *pPath = rIndexed.first.c_str ();
+		const char *pFileName = strrchr (pPath, '/');
+		pFileName = pFileName ? pFileName+1 : pPath;
+
+		// the index has been written from the directory, so the file name is valid
+		unsigned nBank;
+		if (   sscanf (pFileName, "%u", &nBank) != 1
+		    || nBank-1 > MaxVoiceBankID
+		    || m_ScannedBankID[nBank-1])		// in library
 		{
-			return true;
+			continue;
 		}
+		m_ScannedBankID[nBank-1] = true;
+
+		AddBank (nBank-1, pPath, ParseBankName (pFileName).c_str (),
+			 rIndexed.second.File, rIndexed.second.VoiceNames);
+
+		nBanks++;
 	}
-	return false;
-}
 
-unsigned CSysExFileLoader::GetNumHighestBank (void)
-{
-	return m_nNumHighestBank;
+	m_OldIndex.clear ();
+
+	PublishBanks ();
+
+	LOGDBG ("%u Banks taken from index", nBanks);
 }
 
-void CSysExFileLoader::GetVoice (unsigned nBankID, unsigned nVoiceID, uint8_t *pVoiceData)
+void CSysExFileLoader::AddBankFile (const std::string &rPath, const char *pFileName,
+				    const FILINFO *pFileInfo)
 {
-	if (   nBankID <= MaxVoiceBankID
-	    && nVoiceID <= VoicesPerBank)
+	assert (pFileName);
+	assert (pFileInfo);
+
+	unsigned nBank;
+	size_t nLen = strlen (pFileName);
+	if (   nLen < 5						// "[NNNN]N[_name].syx"
+		|| strcasecmp (&pFileName[nLen-4], ".syx") != 0
+		|| sscanf (pFileName, "%u", &nBank) != 1)
 	{
-		if (IsValidBank(nBankID))
-		{
-			DecodePackedVoice (m_pVoiceBank[nBankID]->Voice[nVoiceID], pVoiceData);
+		LOGWARN ("%s: Invalid filename format", pFileName);
 
-			return;
-		}
-		else
-		{
-			// Use default voices_bank instead of s_DefaultVoice for bank 0,
-			// if the bank was not successfully loaded from disk.
-			if (nBankID == 0)
-			{
-				memcpy (pVoiceData, voices_bank[0][nVoiceID], SizeSingleVoice);
+		m_nInvalidFiles++;
 
-				return;
-			}
-		}
+		return;
 	}
 
-	memcpy (pVoiceData, s_DefaultVoice, SizeSingleVoice);
+	// File and UI handling requires banks to be 1..indexed.
+	// Internally (and via MIDI) we need 0..indexed.
+	// Any mention of a BankID internally is assumed to be 0..indexed.
+	unsigned nBankIdx = nBank - 1;
+
+	// BankIdx goes from 0 to MaxVoiceBankID inclusive
+	if (nBankIdx > MaxVoiceBankID)
+	{
+		LOGWARN ("Bank #%u is not supported", nBank);
+
+		m_nInvalidFiles++;
+
+		return;
+	}
+
+	if (   m_ScannedBankID[nBankIdx]
+	    && m_bParallelLoad)
+	{
+		CompleteLoadJobs ();		// a pending read may fail and release the bank ID
+	}
+
+	if (m_ScannedBankID[nBankIdx])
+	{
+		LOGWARN ("Bank #%u already loaded", nBank);
+
+		m_nDuplicates++;
+
+		return;
+	}
+	m_ScannedBankID[nBankIdx] = true;
+
+	TBankFile File;
+	File.nLibraryOffset = 0;
+	File.nSize = pFileInfo->fsize;
+	File.nTime = (uint32_t) pFileInfo->fdate << 16 | pFileInfo->ftime;
+
+	// known banks (from the index or a previous scan) are read only, if changed
+	TBankEntry *pEntry = FindBank (nBankIdx);
+	if (   pEntry
+	    && pEntry->File.nSize == File.nSize
+	    && pEntry->File.nTime == File.nTime
+	    && rPath == GetString (pEntry->nPathOffset))
+	{
+		return;
+	}
+
+	if (m_bParallelLoad)
+	{
+		SubmitLoadJob (rPath, pFileName, nBankIdx, File);
+
+		return;
+	}
+
+	TVoiceBank *pBank = new TVoiceBank;
+	assert (pBank);
+
+	if (!ReadBankFile (rPath.c_str (), pBank, &File.bHeaderless))
+	{
+		delete pBank;
+
+		m_nInvalidFiles++;
+
+		m_ScannedBankID[nBankIdx] = false;	// removed at the end of the scan
+
+		return;
+	}
+
+	File.nChecksum = Hash (pBank, sizeof (TVoiceBank));
+
+	TVoiceNames VoiceNames;
+	GetVoiceNames (pBank, &VoiceNames);
+
+	AddBankData (rPath, pFileName, nBankIdx, File, pBank, VoiceNames);
+
+	delete pBank;
+}
+
+void CSysExFileLoader::AddBankData (const std::string &rPath, const char *pFileName,
+				    unsigned nBankIdx, const TBankFile &rFile,
+				    const TVoiceBank *pBank, const TVoiceNames &rVoiceNames)
+{
+	assert (pFileName);
+	assert (pBank);
+
+	TBankEntry *pEntry = FindBank (nBankIdx);
+	if (pEntry)
+	{
+		// changed or replaced by a file with another name
+		UncacheBank (pEntry);
+
+		if (rPath != GetString (pEntry->nPathOffset))
+		{
+			pEntry->nPathOffset = AddString (rPath.c_str ());
+			pEntry->nNameOffset = AddString (ParseBankName (pFileName).c_str ());
+		}
+
+		pEntry->File = rFile;
+		m_VoiceNames[pEntry->nVoiceNames] = rVoiceNames;
+		m_NameIndexRemoved.push_back (nBankIdx);
+		m_NameIndexAdded.push_back (nBankIdx);
+		m_nBankGeneration++;
+
+		m_nScanChanged++;
+	}
+	else
+	{
+		pEntry = AddBank (nBankIdx, rPath.c_str (), ParseBankName (pFileName).c_str (),
+				  rFile, rVoiceNames);
+		assert (pEntry);
+
+		// keep it, it has been read anyway (moved to the cache, when published)
+		if (m_nBanksRead < BankCacheSize)
+		{
+			pEntry->pVoices = InternBank (pBank);
+		}
+
+		m_nScanAdded++;
+
+		if ((m_Bank.size () + m_NewBank.size ()) % 100 == 1)
+		{
+			LOGDBG ("Banks successfully loaded #%u",
+				(unsigned) (m_Bank.size () + m_NewBank.size ()) - 1);
+		}
+	}
+
+	m_bIndexChanged = true;
+	m_nBanksRead++;
+}
+
+void CSysExFileLoader::SubmitLoadJob (const std::string &rPath, const char *pFileName,
+				      unsigned nBankIdx, const TBankFile &rFile)
+{
+	assert (pFileName);
+
+	// wait for the oldest job, if all slots are in use
+	TLoadJob *pJob = &m_LoadJob[m_nLoadJobIn % LoadJobs];
+	while (pJob->nState != LoadJobFree)
+	{
+		CompleteLoadJob ();
+	}
+
+	pJob->Path = rPath;
+	pJob->FileName = pFileName;
+	pJob->nBankID = nBankIdx;
+	pJob->File = rFile;
+	pJob->bValid = ReadBankData (rPath.c_str (), &pJob->Bank, &pJob->nRead);
+
+	DataMemBarrier ();
+	pJob->nState = LoadJobRead;		// can be taken by a worker now
+
+	m_nLoadJobIn++;
+}
+
+void CSysExFileLoader::CompleteLoadJob (void)
+{
+	assert (m_nLoadJobOut != m_nLoadJobIn);
+	TLoadJob *pJob = &m_LoadJob[m_nLoadJobOut % LoadJobs];
+
+	// do it here, if no worker has taken it yet
+	if (ClaimLoadJob (pJob))
+	{
+		ValidateLoadJob (pJob);
+	}
+
+	while (pJob->nState != LoadJobDone)
+	{
+		// just wait
+	}
+
+	DataMemBarrier ();
+
+	if (pJob->bValid)
+	{
+		AddBankData (pJob->Path, pJob->FileName.c_str (), pJob->nBankID, pJob->File,
+			     &pJob->Bank, pJob->VoiceNames);
+	}
+	else
+	{
+		LOGWARN ("%s/%s: Invalid size or format", m_DirName.c_str (), pJob->Path.c_str ());
+
+		m_nInvalidFiles++;
+
+		m_ScannedBankID[pJob->nBankID] = false;	// removed at the end of the scan
+	}
+
+	pJob->nState = LoadJobFree;
+
+	m_nLoadJobOut++;
+}
+
+void CSysExFileLoader::CompleteLoadJobs (void)
+{
+	while (m_nLoadJobOut != m_nLoadJobIn)
+	{
+		CompleteLoadJob ();
+	}
+}
+
+bool CSysExFileLoader::ClaimLoadJob (TLoadJob *pJob)
+{
+	assert (pJob);
+
+	bool bClaimed = false;
+
+	m_LoadJobLock.Acquire ();
+
+	if (pJob->nState == LoadJobRead)
+	{
+		pJob->nState = LoadJobBusy;
+
+		bClaimed = true;
+	}
+
+	m_LoadJobLock.Release ();
+
+	return bClaimed;
+}
+
+void CSysExFileLoader::ValidateLoadJob (TLoadJob *pJob)
+{
+	assert (pJob);
+	assert (pJob->nState == LoadJobBusy);
+
+	DataMemBarrier ();
+
+	if (pJob->bValid)
+	{
+		pJob->bValid = ValidateBankData (&pJob->Bank, pJob->nRead, &pJob->File.bHeaderless);
+	}
+
+	if (pJob->bValid)
+	{
+		pJob->File.nChecksum = Hash (&pJob->Bank, sizeof (TVoiceBank));
+		GetVoiceNames (&pJob->Bank, &pJob->VoiceNames);
+	}
+
+	DataMemBarrier ();
+	pJob->nState = LoadJobDone;
+}
+
+void CSysExFileLoader::LoadWorker (void)
+{
+	while (!m_bLoadComplete)
+	{
+		for (unsigned i = 0; i < LoadJobs; i++)
+		{
+			if (   m_LoadJob[i].nState == LoadJobRead
+			    && ClaimLoadJob (&m_LoadJob[i]))
+			{
+				ValidateLoadJob (&m_LoadJob[i]);
+			}
+		}
+	}
+}
+
+bool CSysExFileLoader::ReadBankFile (const char *pPath, TVoiceBank *pBank, bool *pHeaderless)
+{
+	assert (pPath);
+
+	unsigned nRead;
+	if (   !ReadBankData (pPath, pBank, &nRead)
+	    || !ValidateBankData (pBank, nRead, pHeaderless))
+	{
+		LOGWARN ("%s/%s: Invalid size or format", m_DirName.c_str (), pPath);
+
+		return false;
+	}
+
+	return true;
+}
+
+bool CSysExFileLoader::ReadBankData (const char *pPath, TVoiceBank *pBank, unsigned *pRead)
+{
+	assert (pPath);
+	assert (pBank);
+	assert (pRead);
+	assert (sizeof(TVoiceBank) == VoiceSysExHdrSize + VoiceSysExSize);
+
+	std::string Filename (m_DirName);
+	Filename += "/";
+	Filename += pPath;
+
+	FIL File;
+	if (f_open (&File, Filename.c_str (), FA_READ | FA_OPEN_EXISTING) != FR_OK)
+	{
+		return false;
+	}
+
+	UINT nRead;
+	bool bOK = f_read (&File, pBank, sizeof (TVoiceBank), &nRead) == FR_OK;
+	*pRead = nRead;
+
+	f_close (&File);
+
+	return bOK;
+}
+
+bool CSysExFileLoader::ValidateBankData (TVoiceBank *pBank, unsigned nRead, bool *pHeaderless) const
+{
+	assert (pBank);
+	assert (pHeaderless);
+
+	if (   nRead == sizeof (TVoiceBank)
+	    && pBank->StatusStart == 0xF0
+	    && pBank->CompanyID   == 0x43
+	    && pBank->Format      == 0x09
+	    && pBank->StatusEnd   == 0xF7)
+	{
+		*pHeaderless = false;
+
+		return true;
+	}
+
+	// Config says to accept headerless SysEx Voice Banks,
+	// which are the first VoiceSysExSize bytes of the file.
+	if (   m_bHeaderlessSysExVoices
+	    && nRead >= VoiceSysExSize)
+	{
+		memmove (pBank->Voice, pBank, VoiceSysExSize);
+
+		// Add in the missing header items.
+		// Naturally it isn't possible to validate these!
+		pBank->StatusStart = 0xF0;
+		pBank->CompanyID   = 0x43;
+		pBank->SubStatus   = 0x00;
+		pBank->Format      = 0x09;
+		pBank->ByteCountMS = 0x20;
+		pBank->ByteCountLS = 0x00;
+		pBank->Checksum    = 0x00;
+		pBank->StatusEnd   = 0xF7;
+
+		*pHeaderless = true;
+
+		return true;
+	}
+
+	return false;
+}
+
+bool CSysExFileLoader::LoadBankData (TBankEntry *pEntry)
+{
+	assert (pEntry);
+	assert (!pEntry->pVoices);
+
+	TVoiceBank *pBank = new TVoiceBank;
+	assert (pBank);
+
+	bool bHeaderless = false;
+	if (  pEntry->File.nLibraryOffset
+	    ? !ReadLibraryBank (pEntry->File.nLibraryOffset, pBank)
+	    : !ReadBankFile (GetString (pEntry->nPathOffset), pBank, &bHeaderless))
+	{
+		delete pBank;
+
+		return false;
+	}
+
+	uint32_t nChecksum = Hash (pBank, sizeof (TVoiceBank));
+	if (nChecksum != pEntry->File.nChecksum)
+	{
+		// changed without updating size or time, index is rewritten on next Load()
+		LOGWARN ("%s: Bank #%u has changed", GetString (pEntry->nPathOffset), pEntry->nBankID+1);
+
+		pEntry->File.nChecksum = nChecksum;
+		pEntry->File.bHeaderless = bHeaderless;
+		GetVoiceNames (pBank, &m_VoiceNames[pEntry->nVoiceNames]);
+		m_NameIndexRemoved.push_back (pEntry->nBankID);
+		m_NameIndexAdded.push_back (pEntry->nBankID);
+		m_nBankGeneration++;
+
+		if (!m_bScanning)
+		{
+			UpdateNameIndex ();
+		}
+
+		InvalidateDecodedBank (pEntry->nBankID);
+	}
+
+	CacheBank (pEntry, InternBank (pBank));
+
+	delete pBank;
+
+	return true;
+}
+
+CSysExFileLoader::TBankEntry *CSysExFileLoader::FindBank (unsigned nBankID)
+{
+	std::vector<TBankEntry>::iterator Iterator =
+		std::lower_bound (m_Bank.begin (), m_Bank.end (), nBankID,
+				  [] (const TBankEntry &rEntry, unsigned nID)
+				  {
+					return rEntry.nBankID < nID;
+				  });
+
+	if (   Iterator == m_Bank.end ()
+	    || Iterator->nBankID != nBankID)
+	{
+		return nullptr;
+	}
+
+	return &*Iterator;
+}
+
+const CSysExFileLoader::TBankEntry *CSysExFileLoader::FindBank (unsigned nBankID) const
+{
+	return const_cast<CSysExFileLoader *> (this)->FindBank (nBankID);
+}
+
+CSysExFileLoader::TBankEntry *CSysExFileLoader::AddBank (unsigned nBankID, const char *pPath,
+							  const char *pName, const TBankFile &rFile,
+							  const TVoiceNames &rVoiceNames)
+{
+	assert (pPath);
+	assert (pName);
+
+	TBankEntry Entry;
+	Entry.nBankID = nBankID;
+	Entry.File = rFile;
+	Entry.pVoices = nullptr;
+	Entry.nPathOffset = AddString (pPath);
+	Entry.nNameOffset = AddString (pName);
+
+	Entry.nVoiceNames = m_VoiceNames.size ();
+	m_VoiceNames.push_back (rVoiceNames);
+
+	m_NewBank.push_back (Entry);
+
+	return &m_NewBank.back ();
+}
+
+unsigned CSysExFileLoader::AddString (const char *pString)
+{
+	assert (pString);
+
+	unsigned nOffset = m_StringPool.length ();
+	m_StringPool.append (pString);
+	m_StringPool.push_back ('\0');
+
+	return nOffset;
+}
+
+std::string CSysExFileLoader::ParseBankName (const char *pFileName)
+{
+	assert (pFileName);
+
+	std::string Name (pFileName);
+	size_t nLen = Name.length ();
+	if (nLen > 4)
+	{
+		Name.resize (nLen-4);		// remove file extension
+
+		unsigned nBank;
+		char BankName[30+1];
+		if (sscanf (Name.c_str (), "%u_%30s", &nBank, BankName) == 2)
+		{
+			return BankName;
+		}
+	}
+
+	return "";
+}
+
+const char *CSysExFileLoader::GetString (unsigned nOffset) const
+{
+	assert (nOffset < m_StringPool.length ());
+
+	return m_StringPool.c_str () + nOffset;
+}
+
+void CSysExFileLoader::CacheBank (TBankEntry *pEntry, TBankVoices *pVoices)
+{
+	assert (pEntry);
+	assert (!pEntry->pVoices);
+	assert (pVoices);
+
+	unsigned nSlot = m_nCachedBanks;
+	TBankVoices *pEvicted = nullptr;
+
+	if (nSlot < BankCacheSize)
+	{
+		m_nCachedBanks++;
+	}
+	else
+	{
+		// evict the least recently used bank
+		unsigned nMinLastUse = (unsigned) -1;
+		for (unsigned i = 0; i < BankCacheSize; i++)
+		{
+			if (m_CacheSlot[i].nLastUse < nMinLastUse)
+			{
+				nMinLastUse = m_CacheSlot[i].nLastUse;
+				nSlot = i;
+			}
+		}
+		assert (nSlot < BankCacheSize);
+
+		TBankEntry *pEvictedEntry = FindBank (m_CacheSlot[nSlot].nBankID);
+		assert (pEvictedEntry);
+
+		m_SpinLock.Acquire ();
+		pEvicted = pEvictedEntry->pVoices;
+		pEvictedEntry->pVoices = nullptr;
+		m_SpinLock.Release ();
+
+		m_nCacheEvictions++;
+	}
+
+	m_CacheSlot[nSlot].nBankID = pEntry->nBankID;
+	m_CacheSlot[nSlot].nLastUse = ++m_nUseClock;
+
+	m_SpinLock.Acquire ();
+	pEntry->pVoices = pVoices;
+	m_SpinLock.Release ();
+
+	ReleaseBank (pEvicted);
+}
+
+void CSysExFileLoader::UncacheBank (TBankEntry *pEntry)
+{
+	assert (pEntry);
+
+	InvalidateDecodedBank (pEntry->nBankID);
+
+	if (!pEntry->pVoices)
+	{
+		return;
+	}
+
+	for (unsigned i = 0; i < m_nCachedBanks; i++)
+	{
+		if (m_CacheSlot[i].nBankID == pEntry->nBankID)
+		{
+			m_CacheSlot[i] = m_CacheSlot[--m_nCachedBanks];
+
+			break;
+		}
+	}
+
+	m_SpinLock.Acquire ();
+	TBankVoices *pVoices = pEntry->pVoices;
+	pEntry->pVoices = nullptr;
+	m_SpinLock.Release ();
+
+	ReleaseBank (pVoices);
+}
+
+CSysExFileLoader::TBankVoices *CSysExFileLoader::InternBank (const TVoiceBank *pBank)
+{
+	assert (pBank);
+
+	TBankVoices *pVoices = new TBankVoices;
+	assert (pVoices);
+
+	for (unsigned i = 0; i < VoicesPerBank; i++)
+	{
+		const uint8_t *pData = pBank->Voice[i];
+		uint32_t nHash = Hash (pData, SizePackedVoice);
+
+		TPooledVoice *&rpChain = m_VoicePool[nHash];
+
+		TPooledVoice *pVoice;
+		for (pVoice = rpChain; pVoice; pVoice = pVoice->pNext)
+		{
+			if (memcmp (pVoice->Data, pData, SizePackedVoice) == 0)
+			{
+				break;
+			}
+		}
+
+		if (!pVoice)
+		{
+			pVoice = new TPooledVoice;
+			assert (pVoice);
+
+			memcpy (pVoice->Data, pData, SizePackedVoice);
+			pVoice->nHash = nHash;
+			pVoice->nRefCount = 0;
+			pVoice->pNext = rpChain;
+			rpChain = pVoice;
+
+			m_nUniqueVoices++;
+		}
+
+		pVoice->nRefCount++;
+		pVoices->pVoice[i] = pVoice;
+	}
+
+	m_nVoiceRefs += VoicesPerBank;
+
+	return pVoices;
+}
+
+void CSysExFileLoader::ReleaseBank (TBankVoices *pVoices)
+{
+	if (!pVoices)
+	{
+		return;
+	}
+
+	for (unsigned i = 0; i < VoicesPerBank; i++)
+	{
+		TPooledVoice *pVoice = const_cast<TPooledVoice *> (pVoices->pVoice[i]);
+		assert (pVoice);
+		assert (pVoice->nRefCount > 0);
+
+		if (--pVoice->nRefCount > 0)
+		{
+			continue;
+		}
+
+		auto Iterator = m_VoicePool.find (pVoice->nHash);
+		assert (Iterator != m_VoicePool.end ());
+
+		TPooledVoice **ppLink = &Iterator->second;
+		while (*ppLink != pVoice)
+		{
+			assert (*ppLink);
+			ppLink = &(*ppLink)->pNext;
+		}
+		*ppLink = pVoice->pNext;
+
+		if (!Iterator->second)
+		{
+			m_VoicePool.erase (Iterator);
+		}
+
+		delete pVoice;
+
+		assert (m_nUniqueVoices > 0);
+		m_nUniqueVoices--;
+	}
+
+	assert (m_nVoiceRefs >= VoicesPerBank);
+	m_nVoiceRefs -= VoicesPerBank;
+
+	delete pVoices;
+}
+
+void CSysExFileLoader::TouchBank (unsigned nBankID)
+{
+	for (unsigned i = 0; i < m_nCachedBanks; i++)
+	{
+		if (m_CacheSlot[i].nBankID == nBankID)
+		{
+			m_CacheSlot[i].nLastUse = ++m_nUseClock;
+
+			break;
+		}
+	}
+}
+
+void CSysExFileLoader::StartPrefetch (unsigned nBankID, bool bUp)
+{
+	m_nPrefetchBankID = nBankID;
+	m_nPrefetchCount = PrefetchBanks + 1;	// including the selected bank
+	m_bPrefetchUp = bUp;
+}
+
+void CSysExFileLoader::Prefetch (void)
+{
+	while (m_nPrefetchCount > 0)
+	{
+		unsigned nBankID = m_nPrefetchBankID;
+
+		m_nPrefetchBankID = m_bPrefetchUp ? FindNextBankUp (nBankID) : FindNextBankDown (nBankID);
+		if (m_nPrefetchBankID == nBankID)
+		{
+			m_nPrefetchCount = 0;		// only one bank
+		}
+		else
+		{
+			m_nPrefetchCount--;
+		}
+
+		TBankEntry *pEntry = FindBank (nBankID);
+		if (   pEntry
+		    && !pEntry->pVoices)
+		{
+			if (LoadBankData (pEntry))
+			{
+				m_nCachePrefetches++;
+			}
+
+			break;				// one bank per call
+		}
+	}
+}
+
+void CSysExFileLoader::GetVoiceNames (const TVoiceBank *pBank, TVoiceNames *pVoiceNames)
+{
+	assert (pBank);
+	assert (pVoiceNames);
+
+	for (unsigned i = 0; i < VoicesPerBank; i++)
+	{
+		memcpy (pVoiceNames->Name[i], &pBank->Voice[i][118], VoiceNameLength);
+	}
+}
+
+bool CSysExFileLoader::ReceiveBank (const uint8_t *pMessage, size_t nLength)
+{
+	assert (pMessage);
+	assert (sizeof(TVoiceBank) == VoiceSysExHdrSize + VoiceSysExSize);
+
+	const TVoiceBank *pBank = (const TVoiceBank *) pMessage;
+	if (   nLength != sizeof (TVoiceBank)
+	    || pBank->StatusStart != 0xF0
+	    || pBank->CompanyID   != 0x43
+	    || (pBank->SubStatus & 0xF0) != 0x00
+	    || pBank->Format      != 0x09
+	    || pBank->ByteCountMS != 0x20
+	    || pBank->ByteCountLS != 0x00
+	    || pBank->StatusEnd   != 0xF7)
+	{
+		m_nReceiveRejected++;
+
+		return false;
+	}
+
+	unsigned nSlot;
+	for (nSlot = 0; nSlot < ReceiveSlots; nSlot++)
+	{
+		if (!m_bReceiveBankFull[nSlot])
+		{
+			break;
+		}
+	}
+
+	if (nSlot >= ReceiveSlots)
+	{
+		m_nReceiveDropped++;
+
+		return false;
+	}
+
+	// copy the voice data and calculate the checksum in one pass
+	const uint8_t *pSource = pBank->Voice[0];
+	uint8_t *pDest = m_ReceiveBank[nSlot].Voice[0];
+	uint8_t uchSum = 0;
+	for (unsigned i = 0; i < VoiceSysExSize; i++)
+	{
+		uchSum += pDest[i] = pSource[i];
+	}
+
+	if (((128 - (uchSum & 0x7F)) & 0x7F) != pBank->Checksum)
+	{
+		m_nReceiveRejected++;
+
+		return false;
+	}
+
+	m_ReceiveBank[nSlot].StatusStart = pBank->StatusStart;
+	m_ReceiveBank[nSlot].CompanyID   = pBank->CompanyID;
+	m_ReceiveBank[nSlot].SubStatus   = pBank->SubStatus;
+	m_ReceiveBank[nSlot].Format      = pBank->Format;
+	m_ReceiveBank[nSlot].ByteCountMS = pBank->ByteCountMS;
+	m_ReceiveBank[nSlot].ByteCountLS = pBank->ByteCountLS;
+	m_ReceiveBank[nSlot].Checksum    = pBank->Checksum;
+	m_ReceiveBank[nSlot].StatusEnd   = pBank->StatusEnd;
+
+	DataMemBarrier ();
+
+	m_bReceiveBankFull[nSlot] = true;
+
+	return true;
+}
+
+void CSysExFileLoader::Process (void)
+{
+	unsigned nRejected = m_nReceiveRejected;	// may be incremented from interrupt
+	if (nRejected != m_nReceiveRejectedReported)
+	{
+		LOGWARN ("%u invalid bank dump(s) received", nRejected - m_nReceiveRejectedReported);
+
+		m_nReceiveRejectedReported = nRejected;
+	}
+
+	unsigned nDropped = m_nReceiveDropped;
+	if (nDropped != m_nReceiveDroppedReported)
+	{
+		LOGWARN ("%u bank dump(s) dropped (too fast)", nDropped - m_nReceiveDroppedReported);
+
+		m_nReceiveDroppedReported = nDropped;
+	}
+
+	if (m_pStoreFile)
+	{
+		// write the next chunk of the bank file
+		TBankEntry *pEntry = FindBank (m_nStoreBankID);
+		assert (pEntry);
+		const uint8_t *pData = (const uint8_t *) m_pStoreBank;
+		assert (pData);
+
+		std::string Filename (m_DirName);
+		Filename += "/";
+		Filename += GetString (pEntry->nPathOffset);
+
+		size_t nSize = sizeof (TVoiceBank) - m_nStoreOffset;
+		if (nSize > StoreChunkSize)
+		{
+			nSize = StoreChunkSize;
+		}
+
+		bool bOK = fwrite (pData + m_nStoreOffset, nSize, 1, m_pStoreFile) == 1;
+		if (bOK)
+		{
+			m_nStoreOffset += nSize;
+			if (m_nStoreOffset < sizeof (TVoiceBank))
+			{
+				return;
+			}
+		}
+
+		if (fclose (m_pStoreFile) != 0)
+		{
+			bOK = false;
+		}
+
+		m_pStoreFile = nullptr;
+
+		delete m_pStoreBank;
+		m_pStoreBank = nullptr;
+
+		if (!bOK)
+		{
+			// a partly written file would be found invalid by the next scan,
+			// the bank remains in memory until power off (File.nSize == 0)
+			remove (Filename.c_str ());
+
+			LOGWARN ("%s: Write error, bank #%u is not stored",
+				 GetString (pEntry->nPathOffset), m_nStoreBankID+1);
+
+			return;
+		}
+
+		LOGNOTE ("Bank #%u stored as %s", m_nStoreBankID+1, GetString (pEntry->nPathOffset));
+
+		// update the index, so that the file is not read again on boot
+		FILINFO FileInfo;
+		if (f_stat (Filename.c_str (), &FileInfo) == FR_OK)
+		{
+			pEntry->File.nSize = FileInfo.fsize;
+			pEntry->File.nTime = (uint32_t) FileInfo.fdate << 16 | FileInfo.ftime;
+
+			m_bIndexChanged = true;
+		}
+
+		return;
+	}
+
+	// insert one received bank per call, not during a scan, because a bank
+	// file, which has not been scanned yet, may use the next free bank number
+	for (unsigned nSlot = 0; !m_bScanning && nSlot < ReceiveSlots; nSlot++)
+	{
+		if (m_bReceiveBankFull[nSlot])
+		{
+			InsertReceivedBank (nSlot);
+
+			m_bReceiveBankFull[nSlot] = false;
+
+			return;
+		}
+	}
+
+	if (m_nDecodeCount > 0 || m_nPrepareIn != m_nPrepareOut)
+	{
+		ProcessPrepareRequest ();
+
+		return;
+	}
+
+	// the index is written, when no received bank is stored and no scan runs
+	if (   m_bIndexWriting
+	    || (   m_bIndexChanged
+		&& !m_bScanning
+		&& StartIndex ()))
+	{
+		WriteIndexSlice ();
+
+		return;
+	}
+
+	// browsing has precedence over the background scan
+	if (   m_bScanning
+	    && !m_nPrefetchCount)
+	{
+		ScanSlice ();
+
+		return;
+	}
+
+	Prefetch ();
+}
+
+unsigned CSysExFileLoader::GetFreeBankID (void) const
+{
+	// append behind the highest bank, if possible
+	if (m_Bank.empty ())
+	{
+		return 1;		// bank 0 is kept for the default voices
+	}
+
+	if (m_nNumHighestBank < MaxVoiceBankID)
+	{
+		return m_nNumHighestBank+1;
+	}
+
+	// otherwise fill a gap
+	unsigned nBankID = 1;
+	for (auto &rEntry : m_Bank)
+	{
+		if (rEntry.nBankID > nBankID)
+		{
+			return nBankID;
+		}
+
+		if (rEntry.nBankID == nBankID)
+		{
+			nBankID++;
+		}
+	}
+
+	return MaxVoiceBankID+1;
+}
+
+bool CSysExFileLoader::InsertReceivedBank (unsigned nSlot)
+{
+	assert (nSlot < ReceiveSlots);
+	assert (m_bReceiveBankFull[nSlot]);
+	assert (!m_pStoreFile);
+	assert (!m_pStoreBank);
+	assert (!m_bScanning);
+
+	unsigned nBankID = GetFreeBankID ();
+	if (nBankID > MaxVoiceBankID)
+	{
+		LOGWARN ("No free bank number, received bank ignored");
+
+		return false;
+	}
+
+	TVoiceBank *pBank = new TVoiceBank;
+	assert (pBank);
+	*pBank = m_ReceiveBank[nSlot];
+
+	// banks are 1..indexed in file names
+	char BankName[30];
+	snprintf (BankName, sizeof BankName, "%05u_MIDI_Dump.syx", nBankID+1);
+
+	TBankFile File;
+	File.nLibraryOffset = 0;
+	File.nSize = 0;			// set, when the file has been stored
+	File.nTime = 0;
+	File.nChecksum = Hash (pBank, sizeof (TVoiceBank));
+	File.bHeaderless = false;
+
+	TVoiceNames VoiceNames;
+	GetVoiceNames (pBank, &VoiceNames);
+
+	AddBank (nBankID, BankName, ParseBankName (BankName).c_str (), File, VoiceNames);
+	PublishBanks ();
+
+	TBankEntry *pEntry = FindBank (nBankID);
+	assert (pEntry);
+
+	CacheBank (pEntry, InternBank (pBank));
+
+	LOGNOTE ("Bank #%u received", nBankID+1);
+
+	std::string Filename (m_DirName);
+	Filename += "/";
+	Filename += BankName;
+
+	m_pStoreFile = fopen (Filename.c_str (), "wb");
+	if (!m_pStoreFile)
+	{
+		LOGWARN ("%s: Cannot create file, bank #%u is not stored", Filename.c_str (), nBankID+1);
+
+		delete pBank;
+
+		return true;
+	}
+
+	m_pStoreBank = pBank;		// the cache holds the voices only
+	m_nStoreBankID = nBankID;
+	m_nStoreOffset = 0;
+
+	return true;
+}
+
+std::string CSysExFileLoader::GetBankName (unsigned nBankID)
+{
+	const TBankEntry *pEntry = FindBank (nBankID);
+	if (   pEntry
+	    && *GetString (pEntry->nNameOffset))
+	{
+		return GetString (pEntry->nNameOffset);
+	}
+
+	return "NO NAME";
+}
+
+unsigned CSysExFileLoader::GetNextBankUp (unsigned nBankID)
+{
+	unsigned nNextBankID = FindNextBankUp (nBankID);
+
+	StartPrefetch (nNextBankID, true);
+
+	return nNextBankID;
+}
+
+unsigned CSysExFileLoader::GetNextBankDown (unsigned nBankID)
+{
+	unsigned nNextBankID = FindNextBankDown (nBankID);
+
+	StartPrefetch (nNextBankID, false);
+
+	return nNextBankID;
+}
+
+unsigned CSysExFileLoader::FindNextBankUp (unsigned nBankID)
+{
+	// Find the next loaded bank "up" from the provided bank ID
+	std::vector<TBankEntry>::const_iterator Iterator =
+		std::upper_bound (m_Bank.begin (), m_Bank.end (), nBankID,
+				  [] (unsigned nID, const TBankEntry &rEntry)
+				  {
+					return nID < rEntry.nBankID;
+				  });
+
+	if (Iterator != m_Bank.end ())
+	{
+		return Iterator->nBankID;
+	}
+
+	// Handle wrap-around
+	if (   !m_Bank.empty ()
+	    && m_Bank.front ().nBankID < nBankID)
+	{
+		return m_Bank.front ().nBankID;
+	}
+
+	// If we get here there are no other banks!
+	return nBankID;
+}
+
+unsigned CSysExFileLoader::FindNextBankDown (unsigned nBankID)
+{
+	// Find the next loaded bank "down" from the provided bank ID
+	std::vector<TBankEntry>::const_iterator Iterator =
+		std::lower_bound (m_Bank.begin (), m_Bank.end (), nBankID,
+				  [] (const TBankEntry &rEntry, unsigned nID)
+				  {
+					return rEntry.nBankID < nID;
+				  });
+
+	if (Iterator != m_Bank.begin ())
+	{
+		return (Iterator-1)->nBankID;
+	}
+
+	// Handle wrap-around
+	if (   !m_Bank.empty ()
+	    && m_Bank.back ().nBankID > nBankID)
+	{
+		return m_Bank.back ().nBankID;
+	}
+
+	// If we get here there are no other banks!
+	return nBankID;
+}
+
+bool CSysExFileLoader::IsValidBank (unsigned nBankID)
+{
+	return FindBank (nBankID) != nullptr;
+}
+
+unsigned CSysExFileLoader::GetBankGeneration (void) const
+{
+	return m_nBankGeneration;
+}
+
+unsigned CSysExFileLoader::GetNumHighestBank (void)
+{
+	return m_nNumHighestBank;
+}
+
+bool CSysExFileLoader::GetVoice (unsigned nBankID, unsigned nVoiceID, uint8_t *pVoiceData,
+				 bool bTaskLevel)
+{
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	bool bResult = LookupVoice (nBankID, nVoiceID, pVoiceData, bTaskLevel);
+
+	unsigned nTicks = CTimer::GetClockTicks () - nStartTicks;
+	m_nLookups++;
+	m_nLookupTicks += nTicks;
+	if (nTicks > m_nLookupTicksMax)
+	{
+		m_nLookupTicksMax = nTicks;
+	}
+
+	return bResult;
+}
+
+bool CSysExFileLoader::LookupVoice (unsigned nBankID, unsigned nVoiceID, uint8_t *pVoiceData,
+				    bool bTaskLevel)
+{
+	if (   nBankID <= MaxVoiceBankID
+	    && nVoiceID < VoicesPerBank)
+	{
+		if (GetDecodedVoice (nBankID, nVoiceID, pVoiceData, bTaskLevel))
+		{
+			return true;
+		}
+
+		m_SpinLock.Acquire ();
+
+		TBankEntry *pEntry = FindBank (nBankID);
+		if (pEntry)
+		{
+			if (pEntry->pVoices)
+			{
+				DecodePackedVoice (pEntry->pVoices->pVoice[nVoiceID]->Data, pVoiceData);
+
+				m_SpinLock.Release ();
+
+				m_nCacheHits++;
+
+				if (bTaskLevel)
+				{
+					TouchBank (nBankID);
+				}
+
+				return true;
+			}
+
+			m_SpinLock.Release ();
+
+			if (!bTaskLevel)
+			{
+				return false;
+			}
+
+			m_nCacheMisses++;
+
+			if (pEntry->File.nLibraryOffset)
+			{
+				// read the single voice only, the bank is read by prefetch
+				uint8_t PackedVoice[SizePackedVoice];
+				if (ReadLibraryVoice (pEntry->File.nLibraryOffset, nVoiceID, PackedVoice))
+				{
+					DecodePackedVoice (PackedVoice, pVoiceData);
+
+					return true;
+				}
+			}
+			else if (LoadBankData (pEntry))
+			{
+				DecodePackedVoice (pEntry->pVoices->pVoice[nVoiceID]->Data, pVoiceData);
+
+				return true;
+			}
+		}
+		else
+		{
+			m_SpinLock.Release ();
+
+			// Use default voices_bank instead of s_DefaultVoice for bank 0,
+			// if the bank was not successfully loaded from disk.
+			if (nBankID == 0)
+			{
+				memcpy (pVoiceData, voices_bank[0][nVoiceID], SizeSingleVoice);
+
+				return true;
+			}
+		}
+	}
+
+	memcpy (pVoiceData, s_DefaultVoice, SizeSingleVoice);
+
+	return true;
+}
+
+void CSysExFileLoader::PrepareBank (unsigned nBankID)
+{
+	m_SpinLock.Acquire ();
+
+	if (m_nPrepareIn - m_nPrepareOut < PrepareRequests)
+	{
+		m_PrepareBankID[m_nPrepareIn % PrepareRequests] = nBankID;
+		m_nPrepareIn++;
+	}
+
+	m_SpinLock.Release ();
+}
+
+bool CSysExFileLoader::GetDecodedVoice (unsigned nBankID, unsigned nVoiceID, uint8_t *pVoiceData,
+					bool bTaskLevel)
+{
+	assert (nVoiceID < VoicesPerBank);
+	assert (pVoiceData);
+
+	m_SpinLock.Acquire ();
+
+	for (unsigned i = 0; i < DecodedBanks; i++)
+	{
+		if (m_DecodedBank[i].nBankID == nBankID)
+		{
+			memcpy (pVoiceData, m_DecodedBank[i].Voice[nVoiceID], SizeSingleVoice);
+
+			m_SpinLock.Release ();
+
+			m_nDecodedHits++;
+
+			if (bTaskLevel)
+			{
+				m_DecodedBank[i].nLastUse = ++m_nUseClock;
+			}
+
+			return true;
+		}
+	}
+
+	m_SpinLock.Release ();
+
+	return false;
+}
+
+void CSysExFileLoader::DecodeBank (unsigned nBankID)
+{
+	unsigned nSlot = 0;
+	for (unsigned i = 0; i < DecodedBanks; i++)
+	{
+		if (m_DecodedBank[i].nBankID == nBankID)
+		{
+			m_DecodedBank[i].nLastUse = ++m_nUseClock;
+
+			return;				// already decoded
+		}
+
+		if (m_DecodedBank[i].nLastUse < m_DecodedBank[nSlot].nLastUse)
+		{
+			nSlot = i;
+		}
+	}
+
+	TBankEntry *pEntry = FindBank (nBankID);
+	if (!pEntry)
+	{
+		return;
+	}
+
+	if (   !pEntry->pVoices
+	    && !LoadBankData (pEntry))
+	{
+		return;
+	}
+
+	// the slot is unused, while it is filled
+	m_SpinLock.Acquire ();
+	m_DecodedBank[nSlot].nBankID = InvalidBankID;
+	m_SpinLock.Release ();
+
+	for (unsigned i = 0; i < VoicesPerBank; i++)
+	{
+		DecodePackedVoice (pEntry->pVoices->pVoice[i]->Data, m_DecodedBank[nSlot].Voice[i]);
+	}
+
+	m_DecodedBank[nSlot].nLastUse = ++m_nUseClock;
+
+	m_SpinLock.Acquire ();
+	m_DecodedBank[nSlot].nBankID = nBankID;
+	m_SpinLock.Release ();
+}
+
+void CSysExFileLoader::InvalidateDecodedBank (unsigned nBankID)
+{
+	m_SpinLock.Acquire ();
+
+	for (unsigned i = 0; i < DecodedBanks; i++)
+	{
+		if (m_DecodedBank[i].nBankID == nBankID)
+		{
+			m_DecodedBank[i].nBankID = InvalidBankID;
+			m_DecodedBank[i].nLastUse = 0;
+		}
+	}
+
+	m_SpinLock.Release ();
+}
+
+void CSysExFileLoader::ProcessPrepareRequest (void)
+{
+	if (m_nDecodeCount == 0)
+	{
+		m_SpinLock.Acquire ();
+
+		if (m_nPrepareIn == m_nPrepareOut)
+		{
+			m_SpinLock.Release ();
+
+			return;
+		}
+
+		unsigned nBankID = m_PrepareBankID[m_nPrepareOut % PrepareRequests];
+		m_nPrepareOut++;
+
+		m_SpinLock.Release ();
+
+		// decoded in reverse order, the selected bank first
+		m_DecodeBankID[2] = nBankID;
+		m_DecodeBankID[1] = FindNextBankUp (nBankID);
+		m_DecodeBankID[0] = FindNextBankDown (nBankID);
+		m_nDecodeCount = 3;
+	}
+
+	// one bank per call
+	DecodeBank (m_DecodeBankID[--m_nDecodeCount]);
+}
+
+unsigned CSysExFileLoader::FindVoices (const char *pPattern, bool bSubstring, unsigned *pPosition,
+				       TVoiceMatch *pMatches, unsigned nMaxMatches)
+{
+	assert (pPattern);
+	assert (pPosition);
+	assert (pMatches);
+
+	size_t nLength = strlen (pPattern);
+	unsigned nNames = m_NameIndex.size ();
+	unsigned nPosition = *pPosition;
+	unsigned nMatches = 0;
+
+	if (   !nLength
+	    || nLength > VoiceNameLength)
+	{
+		*pPosition = nNames;
+
+		return 0;
+	}
+
+	if (!bSubstring)
+	{
+		// the matching names follow each other in the index
+		unsigned nFirst =
+			std::lower_bound (m_NameIndex.begin (), m_NameIndex.end (), pPattern,
+					  [this, nLength] (const TVoiceNameRef &rRef, const char *pKey)
+					  {
+						return CompareName (m_VoiceNames[rRef.nVoiceNames].Name[rRef.nVoiceID],
+								    pKey, nLength) < 0;
+					  }) - m_NameIndex.begin ();
+		if (nPosition < nFirst)
+		{
+			nPosition = nFirst;
+		}
+
+		for (; nPosition < nNames && nMatches < nMaxMatches; nPosition++)
+		{
+			if (CompareName (GetIndexedName (nPosition), pPattern, nLength) != 0)
+			{
+				nPosition = nNames;
+
+				break;
+			}
+
+			pMatches[nMatches].nBankID = m_NameIndex[nPosition].nBankID;
+			pMatches[nMatches].nVoiceID = m_NameIndex[nPosition].nVoiceID;
+			nMatches++;
+		}
+
+		*pPosition = nPosition;
+
+		return nMatches;
+	}
+
+	unsigned nEnd = nPosition + MaxSearchNames;
+	if (nEnd > nNames)
+	{
+		nEnd = nNames;
+	}
+
+	for (; nPosition < nEnd && nMatches < nMaxMatches; nPosition++)
+	{
+		const char *pName = GetIndexedName (nPosition);
+
+		for (unsigned i = 0; i + nLength <= VoiceNameLength; i++)
+		{
+			if (CompareName (pName + i, pPattern, nLength) == 0)
+			{
+				pMatches[nMatches].nBankID = m_NameIndex[nPosition].nBankID;
+				pMatches[nMatches].nVoiceID = m_NameIndex[nPosition].nVoiceID;
+				nMatches++;
+
+				break;
+			}
+		}
+	}
+
+	*pPosition = nPosition;
+
+	return nMatches;
+}
+
+unsigned CSysExFileLoader::GetNumVoiceNames (void)
+{
+	return m_NameIndex.size ();
+}
+
+std::string CSysExFileLoader::GetVoiceName (unsigned nBankID, unsigned nVoiceID) const
+{
+	assert (nVoiceID < VoicesPerBank);
+
+	const TBankEntry *pEntry = FindBank (nBankID);
+	if (!pEntry)
+	{
+		return "";
+	}
+
+	return std::string (m_VoiceNames[pEntry->nVoiceNames].Name[nVoiceID], VoiceNameLength);
+}
+
+void CSysExFileLoader::UpdateNameIndex (void)
+{
+	if (   m_NameIndexAdded.empty ()
+	    && m_NameIndexRemoved.empty ())
+	{
+		return;
+	}
+
+	// changed banks are removed and added again
+	if (!m_NameIndexRemoved.empty ())
+	{
+		std::sort (m_NameIndexRemoved.begin (), m_NameIndexRemoved.end ());
+
+		m_NameIndex.erase (std::remove_if (m_NameIndex.begin (), m_NameIndex.end (),
+						   [this] (const TVoiceNameRef &rRef)
+						   {
+							return std::binary_search (m_NameIndexRemoved.begin (),
+										   m_NameIndexRemoved.end (),
+										   (unsigned) rRef.nBankID);
+						   }),
+				   m_NameIndex.end ());
+
+		m_NameIndexRemoved.clear ();
+	}
+
+	std::sort (m_NameIndexAdded.begin (), m_NameIndexAdded.end ());
+	m_NameIndexAdded.erase (std::unique (m_NameIndexAdded.begin (), m_NameIndexAdded.end ()),
+				m_NameIndexAdded.end ());
+
+	size_t nIndexed = m_NameIndex.size ();
+	m_NameIndex.reserve (nIndexed + m_NameIndexAdded.size () * VoicesPerBank);
+
+	for (unsigned nBankID : m_NameIndexAdded)
+	{
+		const TBankEntry *pEntry = FindBank (nBankID);
+		if (!pEntry)
+		{
+			continue;			// removed meanwhile
+		}
+
+		for (unsigned i = 0; i < VoicesPerBank; i++)
+		{
+			TVoiceNameRef Ref;
+			Ref.nVoiceNames = pEntry->nVoiceNames;
+			Ref.nBankID = nBankID;
+			Ref.nVoiceID = i;
+
+			m_NameIndex.push_back (Ref);
+		}
+	}
+
+	m_NameIndexAdded.clear ();
+
+	// equal names are ordered by bank and voice
+	auto Compare = [this] (const TVoiceNameRef &rRef1, const TVoiceNameRef &rRef2)
+			{
+				int nDiff = CompareName (m_VoiceNames[rRef1.nVoiceNames].Name[rRef1.nVoiceID],
+							 m_VoiceNames[rRef2.nVoiceNames].Name[rRef2.nVoiceID],
+							 VoiceNameLength);
+				if (nDiff)
+				{
+					return nDiff < 0;
+				}
+
+				if (rRef1.nBankID != rRef2.nBankID)
+				{
+					return rRef1.nBankID < rRef2.nBankID;
+				}
+
+				return rRef1.nVoiceID < rRef2.nVoiceID;
+			};
+
+	// only the new names are sorted, the index is merged then
+	std::sort (m_NameIndex.begin () + nIndexed, m_NameIndex.end (), Compare);
+	std::inplace_merge (m_NameIndex.begin (), m_NameIndex.begin () + nIndexed, m_NameIndex.end (),
+			    Compare);
+}
+
+const char *CSysExFileLoader::GetIndexedName (unsigned nPosition) const
+{
+	assert (nPosition < m_NameIndex.size ());
+	const TVoiceNameRef &rRef = m_NameIndex[nPosition];
+
+	return m_VoiceNames[rRef.nVoiceNames].Name[rRef.nVoiceID];
+}
+
+int CSysExFileLoader::CompareName (const char *pName, const char *pPattern, size_t nLength)
+{
+	assert (pName);
+	assert (pPattern);
+
+	for (size_t i = 0; i < nLength; i++)
+	{
+		int nDiff = toupper ((unsigned char) pName[i]) - toupper ((unsigned char) pPattern[i]);
+		if (nDiff)
+		{
+			return nDiff;
+		}
+	}
+
+	return 0;
+}
+
+void CSysExFileLoader::GetCacheStatistics (TCacheStatistics *pStatistics) const
+{
+	assert (pStatistics);
+
+	pStatistics->nHits = m_nCacheHits;
+	pStatistics->nMisses = m_nCacheMisses;
+	pStatistics->nEvictions = m_nCacheEvictions;
+	pStatistics->nPrefetches = m_nCachePrefetches;
+	pStatistics->nResident = m_nCachedBanks;
+	pStatistics->nDecodedHits = m_nDecodedHits;
+	pStatistics->nVoices = m_nVoiceRefs;
+	pStatistics->nUniqueVoices = m_nUniqueVoices;
+	pStatistics->nLookups = m_nLookups;
+	pStatistics->nLookupTicks = m_nLookupTicks;
+	pStatistics->nLookupTicksMax = m_nLookupTicksMax;
+}
+
+void CSysExFileLoader::GetLoadStatistics (TLoadStatistics *pStatistics) const
+{
+	assert (pStatistics);
+
+	pStatistics->nLoadTicks = m_nLoadTicks;
+	pStatistics->nScanTicks = m_nScanTicks;
+	pStatistics->nBanks = m_nBanksLoaded;
+	pStatistics->nFilesRead = m_nBanksRead;
+	pStatistics->nInvalidFiles = m_nInvalidFiles;
+	pStatistics->nDuplicates = m_nDuplicates;
+	pStatistics->nSkippedDirs = m_nSkippedDirs;
+
+	pStatistics->nMemory =   m_Bank.capacity () * sizeof (TBankEntry)
+			       + m_StringPool.capacity ()
+			       + m_VoiceNames.capacity () * sizeof (TVoiceNames)
+			       + m_NameIndex.capacity () * sizeof (TVoiceNameRef)
+			       + m_nCachedBanks * sizeof (TBankVoices)
+			       + m_nUniqueVoices * sizeof (TPooledVoice)
+			       + sizeof m_DecodedBank;
+}
+
+void CSysExFileLoader::Dump (unsigned nIntervalTicks)
+{
+	unsigned nTicks = CTimer::GetClockTicks ();
+
+	if (nTicks - m_nLastDumpTicks < nIntervalTicks)
+	{
+		return;
+	}
+
+	m_nLastDumpTicks = nTicks;
+
+	TCacheStatistics Statistics;
+	GetCacheStatistics (&Statistics);
+
+	unsigned nAccesses =   Statistics.nHits + Statistics.nMisses + Statistics.nPrefetches
+			     + Statistics.nDecodedHits;
+	if (nAccesses == m_nLastDumpAccesses)
+	{
+		return;
+	}
+
+	m_nLastDumpAccesses = nAccesses;
+
+	LOGNOTE ("Bank cache: %u hits, %u misses, %u prefetches, %u evictions, %u/%u banks, "
+		 "%u unpacked hits",
+		 Statistics.nHits, Statistics.nMisses, Statistics.nPrefetches,
+		 Statistics.nEvictions, Statistics.nResident, BankCacheSize,
+		 Statistics.nDecodedHits);
+
+	// memory of the pool compared to holding each bank as a whole, only the banks
+	// in the cache are pooled, the saving is negative without duplicate voices
+	int nSaved =   (int) (Statistics.nResident * sizeof (TVoiceBank))
+		     - (int) (  Statistics.nResident * sizeof (TBankVoices)
+			      + Statistics.nUniqueVoices * sizeof (TPooledVoice));
+	LOGNOTE ("Voice lookup: %u calls, %u us average, %u us maximum",
+		 Statistics.nLookups,
+		 Statistics.nLookups ? Statistics.nLookupTicks / Statistics.nLookups : 0,
+		 Statistics.nLookupTicksMax);
+
+	LOGNOTE ("Voice pool (%u cached banks): %u voices, %u unique (%u%%), %d KB saved",
+		 Statistics.nResident, Statistics.nVoices, Statistics.nUniqueVoices,
+		 Statistics.nVoices ? Statistics.nUniqueVoices * 100 / Statistics.nVoices : 100,
+		 nSaved / 1024);
+}
+
+void CSysExFileLoader::ReadIndex (void)
+{
+	assert (m_OldIndex.empty ());
+
+	FIL File;
+	if (f_open (&File, m_IndexFileName.c_str (), FA_READ | FA_OPEN_EXISTING) != FR_OK)
+	{
+		LOGNOTE ("No bank index found, scanning all banks");
+
+		return;
+	}
+
+	size_t nFileSize = f_size (&File);
+	uint8_t *pBuffer = new uint8_t[nFileSize+1];
+	assert (pBuffer);
+
+	UINT nRead;
+	if (   f_read (&File, pBuffer, nFileSize, &nRead) != FR_OK
+	    || nRead != nFileSize)
+	{
+		nFileSize = 0;
+	}
+
+	f_close (&File);
+
+	bool bValid = false;
+	const TIndexHeader *pHeader = (const TIndexHeader *) pBuffer;
+	uint32_t nChecksum;
+	if (nFileSize >= sizeof (TIndexHeader) + sizeof nChecksum)
+	{
+		size_t nDataSize = nFileSize - sizeof nChecksum;
+		memcpy (&nChecksum, pBuffer + nDataSize, sizeof nChecksum);
+
+		bValid =    nChecksum == Hash (pBuffer, nDataSize)
+			 && memcmp (pHeader->Magic, INDEX_MAGIC, sizeof pHeader->Magic) == 0
+			 && pHeader->nVersion == IndexVersion
+			 && !!(pHeader->nFlags & INDEX_FLAG_HEADERLESS) == m_bHeaderlessSysExVoices;
+
+		size_t nOffset = sizeof (TIndexHeader);
+		for (unsigned i = 0; bValid && i < pHeader->nEntries; i++)
+		{
+			if (nOffset + sizeof (TIndexEntry) > nDataSize)
+			{
+				bValid = false;
+
+				break;
+			}
+
+			const TIndexEntry *pEntry = (const TIndexEntry *) (pBuffer + nOffset);
+			nOffset += sizeof (TIndexEntry);
+
+			if (nOffset + pEntry->nPathLength > nDataSize)
+			{
+				bValid = false;
+
+				break;
+			}
+
+			std::string Path ((const char *) pBuffer + nOffset, pEntry->nPathLength);
+			nOffset += pEntry->nPathLength;
+
+			TIndexedBank &rBank = m_OldIndex[Path];
+			rBank.File.nLibraryOffset = 0;
+			rBank.File.nSize = pEntry->nSize;
+			rBank.File.nTime = pEntry->nTime;
+			rBank.File.nChecksum = pEntry->nChecksum;
+			rBank.File.bHeaderless = !!pEntry->bHeaderless;
+			memcpy (rBank.VoiceNames.Name, pEntry->VoiceName, sizeof rBank.VoiceNames.Name);
+		}
+	}
+
+	delete [] pBuffer;
+
+	if (!bValid)
+	{
+		LOGWARN ("%s: Invalid bank index, scanning all banks", m_IndexFileName.c_str ());
+
+		m_OldIndex.clear ();
+	}
+}
+
+bool CSysExFileLoader::StartIndex (void)
+{
+	assert (!m_bIndexWriting);
+
+	// changes from now on lead to another write
+	m_bIndexChanged = false;
+
+	// the valid index is kept, until the new one is complete
+	if (f_open (&m_IndexFile, m_IndexTempName.c_str (), FA_WRITE | FA_CREATE_ALWAYS) != FR_OK)
+	{
+		LOGWARN ("%s: Cannot create file", m_IndexTempName.c_str ());
+
+		return false;
+	}
+
+	TIndexHeader Header;
+	memcpy (Header.Magic, INDEX_MAGIC, sizeof Header.Magic);
+	Header.nVersion = IndexVersion;
+	Header.nEntries = 0;
+	Header.nFlags = m_bHeaderlessSysExVoices ? INDEX_FLAG_HEADERLESS : 0;
+
+	for (auto &rBank : m_Bank)
+	{
+		if (IsIndexed (rBank))
+		{
+			Header.nEntries++;
+		}
+	}
+
+	m_nIndexBankID = 0;
+	m_nIndexEntries = Header.nEntries;
+	m_nIndexWritten = 0;
+	m_nIndexChecksum = Hash (&Header, sizeof Header);
+	m_bIndexWriting = true;
+
+	UINT nWritten;
+	if (   f_write (&m_IndexFile, &Header, sizeof Header, &nWritten) != FR_OK
+	    || nWritten != sizeof Header)
+	{
+		AbortIndex ();
+
+		return false;
+	}
+
+	return true;
+}
+
+bool CSysExFileLoader::WriteIndexSlice (void)
+{
+	assert (m_bIndexWriting);
+
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+
+	// continued by bank ID, because the directory may be swapped in between
+	std::vector<TBankEntry>::const_iterator Iterator =
+		std::lower_bound (m_Bank.begin (), m_Bank.end (), m_nIndexBankID,
+				  [] (const TBankEntry &rEntry, unsigned nID)
+				  {
+					return rEntry.nBankID < nID;
+				  });
+
+	std::string Buffer;
+	for (;    Iterator != m_Bank.end ()
+	       && CTimer::GetClockTicks () - nStartTicks < ScanTimeSlice; ++Iterator)
+	{
+		// banks, which have not been stored yet, are added later
+		if (!IsIndexed (*Iterator))
+		{
+			continue;
+		}
+
+		const char *pPath = GetString (Iterator->nPathOffset);
+
+		TIndexEntry Entry;
+		Entry.nSize = Iterator->File.nSize;
+		Entry.nTime = Iterator->File.nTime;
+		Entry.nChecksum = Iterator->File.nChecksum;
+		Entry.bHeaderless = Iterator->File.bHeaderless;
+		Entry.Reserved = 0;
+		Entry.nPathLength = strlen (pPath);
+		memcpy (Entry.VoiceName, m_VoiceNames[Iterator->nVoiceNames].Name, sizeof Entry.VoiceName);
+
+		Buffer.append ((const char *) &Entry, sizeof Entry);
+		Buffer.append (pPath);
+
+		m_nIndexWritten++;
+	}
+
+	bool bComplete = Iterator == m_Bank.end ();
+	m_nIndexBankID = bComplete ? InvalidBankID : Iterator->nBankID;
+
+	m_nIndexChecksum = Hash (Buffer.data (), Buffer.length (), m_nIndexChecksum);
+
+	if (bComplete)
+	{
+		if (m_nIndexWritten != m_nIndexEntries)
+		{
+			// a bank has been stored or removed meanwhile, try again
+			AbortIndex ();
+			m_bIndexChanged = true;
+
+			return false;
+		}
+
+		Buffer.append ((const char *) &m_nIndexChecksum, sizeof m_nIndexChecksum);
+	}
+
+	UINT nWritten;
+	if (   f_write (&m_IndexFile, Buffer.data (), Buffer.length (), &nWritten) != FR_OK
+	    || nWritten != Buffer.length ())
+	{
+		LOGWARN ("%s: Write error", m_IndexTempName.c_str ());
+
+		AbortIndex ();
+
+		return false;
+	}
+
+	if (!bComplete)
+	{
+		return true;
+	}
+
+	m_bIndexWriting = false;
+
+	if (f_close (&m_IndexFile) != FR_OK)
+	{
+		LOGWARN ("%s: Write error", m_IndexTempName.c_str ());
+
+		f_unlink (m_IndexTempName.c_str ());
+
+		return false;
+	}
+
+	// f_rename() does not overwrite an existing file
+	FRESULT Result = f_unlink (m_IndexFileName.c_str ());
+	if (   (Result != FR_OK && Result != FR_NO_FILE)
+	    || f_rename (m_IndexTempName.c_str (), m_IndexFileName.c_str ()) != FR_OK)
+	{
+		LOGWARN ("%s: Cannot replace file", m_IndexFileName.c_str ());
+
+		f_unlink (m_IndexTempName.c_str ());
+
+		return false;
+	}
+
+	LOGDBG ("Bank index written (%u banks)", m_nIndexEntries);
+
+	return false;
+}
+
+void CSysExFileLoader::AbortIndex (void)
+{
+	assert (m_bIndexWriting);
+
+	f_close (&m_IndexFile);
+	f_unlink (m_IndexTempName.c_str ());
+
+	m_bIndexWriting = false;
+}
+
+bool CSysExFileLoader::IsIndexed (const TBankEntry &rEntry)
+{
+	return    rEntry.File.nSize			// received and not stored yet
+	       && !rEntry.File.nLibraryOffset;
+}
+
+unsigned CSysExFileLoader::ReadLibrary (void)
+{
+	assert (!m_bLibraryOpen);
+
+	if (f_open (&m_LibraryFile, m_LibraryFileName.c_str (), FA_READ | FA_OPEN_EXISTING) != FR_OK)
+	{
+		return 0;
+	}
+
+	// the sizes are checked against the file, before anything is allocated
+	uint64_t nFileSize = f_size (&m_LibraryFile);
+
+	TLibraryHeader Header;
+	UINT nRead;
+	if (   f_read (&m_LibraryFile, &Header, sizeof Header, &nRead) != FR_OK
+	    || nRead != sizeof Header
+	    || memcmp (Header.Magic, LIBRARY_MAGIC, sizeof Header.Magic) != 0
+	    || Header.nVersion != LibraryVersion
+	    || Header.nBanks > MaxVoiceBankID+1
+	    ||   sizeof Header + (uint64_t) Header.nBanks * sizeof (TLibraryEntry)
+	       + Header.nStringsSize > nFileSize)
+	{
+		LOGWARN ("%s: Invalid library header", m_LibraryFileName.c_str ());
+
+		f_close (&m_LibraryFile);
+
+		return 0;
+	}
+
+	// directory and bank names are read at once
+	size_t nSize = Header.nBanks * sizeof (TLibraryEntry) + Header.nStringsSize;
+	uint8_t *pBuffer = new uint8_t[nSize+1];
+	assert (pBuffer);
+
+	if (   f_read (&m_LibraryFile, pBuffer, nSize, &nRead) != FR_OK
+	    || nRead != nSize
+	    || Hash (pBuffer, nSize) != Header.nChecksum)
+	{
+		LOGWARN ("%s: Invalid library directory", m_LibraryFileName.c_str ());
+
+		delete [] pBuffer;
+		f_close (&m_LibraryFile);
+
+		return 0;
+	}
+
+	pBuffer[nSize] = '\0';
+	const char *pStrings = (const char *) pBuffer + Header.nBanks * sizeof (TLibraryEntry);
+
+	unsigned nBanks = 0;
+	for (unsigned i = 0; i < Header.nBanks; i++)
+	{
+		const TLibraryEntry *pEntry = (const TLibraryEntry *) pBuffer + i;
+
+		if (   pEntry->nBankID > MaxVoiceBankID
+		    || pEntry->nNameOffset >= Header.nStringsSize
+		    || pEntry->nDataOffset < sizeof Header + nSize
+		    || (uint64_t) pEntry->nDataOffset + VoiceSysExSize > nFileSize)
+		{
+			LOGWARN ("%s: Invalid library entry %u", m_LibraryFileName.c_str (), i);
+
+			continue;
+		}
+
+		if (m_ScannedBankID[pEntry->nBankID])
+		{
+			LOGWARN ("Bank #%u already loaded", pEntry->nBankID+1);
+
+			continue;
+		}
+		m_ScannedBankID[pEntry->nBankID] = true;
+
+		TBankFile File;
+		File.nLibraryOffset = pEntry->nDataOffset;
+		File.nSize = VoiceSysExSize;
+		File.nTime = 0;
+		File.nChecksum = pEntry->nChecksum;
+		File.bHeaderless = false;
+
+		TVoiceNames VoiceNames;
+		memcpy (VoiceNames.Name, pEntry->VoiceName, sizeof VoiceNames.Name);
+
+		AddBank (pEntry->nBankID, "", pStrings + pEntry->nNameOffset, File, VoiceNames);
+
+		nBanks++;
+	}
+
+	delete [] pBuffer;
+
+	m_bLibraryOpen = true;
+
+	LOGDBG ("%u Banks in library %s", nBanks, m_LibraryFileName.c_str ());
+
+	return nBanks;
+}
+
+bool CSysExFileLoader::ReadLibraryBank (uint32_t nOffset, TVoiceBank *pBank)
+{
+	assert (pBank);
+
+	UINT nRead;
+	if (   !m_bLibraryOpen
+	    || f_lseek (&m_LibraryFile, nOffset) != FR_OK
+	    || f_read (&m_LibraryFile, pBank->Voice, VoiceSysExSize, &nRead) != FR_OK
+	    || nRead != VoiceSysExSize)
+	{
+		LOGWARN ("%s: Read error", m_LibraryFileName.c_str ());
+
+		return false;
+	}
+
+	const uint8_t *pData = pBank->Voice[0];
+	uint8_t uchSum = 0;
+	for (unsigned i = 0; i < VoiceSysExSize; i++)
+	{
+		uchSum += pData[i];
+	}
+
+	pBank->StatusStart = 0xF0;
+	pBank->CompanyID   = 0x43;
+	pBank->SubStatus   = 0x00;
+	pBank->Format      = 0x09;
+	pBank->ByteCountMS = 0x20;
+	pBank->ByteCountLS = 0x00;
+	pBank->Checksum    = (128 - (uchSum & 0x7F)) & 0x7F;
+	pBank->StatusEnd   = 0xF7;
+
+	return true;
+}
+
+bool CSysExFileLoader::ReadLibraryVoice (uint32_t nOffset, unsigned nVoiceID, uint8_t *pPackedVoice)
+{
+	assert (nVoiceID < VoicesPerBank);
+	assert (pPackedVoice);
+
+	UINT nRead;
+	if (   !m_bLibraryOpen
+	    || f_lseek (&m_LibraryFile, nOffset + nVoiceID * SizePackedVoice) != FR_OK
+	    || f_read (&m_LibraryFile, pPackedVoice, SizePackedVoice, &nRead) != FR_OK
+	    || nRead != SizePackedVoice)
+	{
+		LOGWARN ("%s: Read error", m_LibraryFileName.c_str ());
+
+		return false;
+	}
+
+	return true;
+}
+
+// FNV-1a
+uint32_t CSysExFileLoader::Hash (const void *pData, size_t nLength, uint32_t nHash)
+{
+	const uint8_t *p = (const uint8_t *) pData;
+
+	while (nLength--)
+	{
+		nHash ^= *p++;
+		nHash *= 16777619U;
+	}
+
+	return nHash;
 }
 
 // See: https://github.com/bwhitman/learnfm/blob/master/dx7db.py
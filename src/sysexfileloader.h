@@ -23,8 +23,14 @@
 #define _sysexfileloader_h
 
 #include <stdint.h>
+#include <stdio.h>
 #include <string>
+#include <vector>
+#include <unordered_map>
 #include <circle/macros.h>
+#include <circle/spinlock.h>
+#include <circle/timer.h>
+#include <fatfs/ff.h>
 
 class CSysExFileLoader		// Loader for DX7 .syx files
 {
@@ -36,6 +42,18 @@ public:
 	static const unsigned VoiceSysExHdrSize = 8; // Additional (optional) Header/Footer bytes for bank of 32 voices
 	static const unsigned VoiceSysExSize = 4096; // Bank of 32 voices as per DX7 MIDI Spec
 	static const unsigned MaxSubDirs = 3; // Number of nested subdirectories supported.
+	static const unsigned ReceiveSlots = 8; // Bank dumps received via MIDI, which are not stored yet
+	static const unsigned StoreChunkSize = 512; // Bytes written to file per call of Process()
+	static const unsigned VoiceNameLength = 10;
+	static const unsigned IndexVersion = 1;
+	static const unsigned LibraryVersion = 1;
+	static const unsigned BankCacheSize = 128; // Banks kept in memory (about 4 KB each)
+	static const unsigned PrefetchBanks = 4; // Banks read ahead in browse direction
+	static const unsigned DecodedBanks = 8; // Banks kept in unpacked format (about 5 KB each)
+	static const unsigned PrepareRequests = 8; // Pending PrepareBank() calls
+	static const unsigned ScanTimeSlice = 1000; // Microseconds of scanning or index writing per call of Process()
+	static const unsigned MaxSearchNames = 4096; // Voice names examined per substring search call
+	static const unsigned LoadJobs = 16; // Bank files read ahead for validation during Load()
 
 	struct TVoiceBank
 	{
@@ -53,37 +71,394 @@ public:
 	}
 	PACKED;
 
+	struct TCacheStatistics
+	{
+		unsigned nHits;			// GetVoice() found the bank in memory
+		unsigned nMisses;		// GetVoice() had to read the bank file
+		unsigned nEvictions;
+		unsigned nPrefetches;
+		unsigned nResident;		// banks in memory
+		unsigned nDecodedHits;		// GetVoice() found the voice unpacked
+		unsigned nVoices;		// voice references of resident banks
+		unsigned nUniqueVoices;		// distinct voices of resident banks
+		unsigned nLookups;		// calls of GetVoice()
+		unsigned nLookupTicks;		// total duration of GetVoice() (microseconds)
+		unsigned nLookupTicksMax;
+	};
+
+	struct TLoadStatistics		// of Load() and the last completed scan
+	{
+		unsigned nLoadTicks;		// duration of Load() (microseconds)
+		unsigned nScanTicks;		// duration of scan, including pauses
+		unsigned nBanks;
+		unsigned nFilesRead;
+		unsigned nInvalidFiles;		// invalid name, bank number, size or format
+		unsigned nDuplicates;		// bank number already loaded
+		unsigned nSkippedDirs;		// nested too deep
+		size_t nMemory;			// bytes used by directory and caches
+	};
+
+	struct TVoiceMatch
+	{
+		unsigned nBankID;
+		unsigned nVoiceID;
+	};
+
 public:
 	CSysExFileLoader (const char *pDirName = "/sysex");
 	~CSysExFileLoader (void);
 
+	// Banks known from the index are available at once and are verified
+	// by a background scan then. Without index the scan is done here.
 	void Load (bool bHeaderlessSysExVoices = false);
 
+	// Called on the secondary cores, while Load() runs on core 0. Validates
+	// bank files, which have been read by core 0 (no file I/O here). Returns,
+	// when Load() is complete. Load() does not depend on it.
+	void LoadWorker (void);
+
+	// Starts a background scan for added, changed and removed bank files,
+	// which is done by Process() in time slices. Returns false, if a scan
+	// is already running, a received bank is being stored or the directory
+	// does not exist. Received banks are inserted after the scan.
+	bool Rescan (void);
+	bool IsScanning (void) const;
+	unsigned GetScanProgress (void) const;		// percent, estimated
+
+	// Called from the MIDI path with a complete bank dump (4104 bytes).
+	// The dump is validated and queued. Returns false, if it is invalid
+	// or all receive slots are in use.
+	bool ReceiveBank (const uint8_t *pMessage, size_t nLength);
+
+	// Called from the main loop on core 0. Inserts received banks and
+	// writes them to the SD card, a chunk at a time. Otherwise reads
+	// a bank of the prefetch window or continues the scan.
+	void Process (void);
+
 	std::string GetBankName (unsigned nBankID);	// 0 .. MaxVoiceBankID
 	unsigned GetNumHighestBank (); // 0 .. MaxVoiceBankID
 	bool     IsValidBank (unsigned nBankID);
-	unsigned GetNextBankUp (unsigned nBankID);
-	unsigned GetNextBankDown (unsigned nBankID);
+	unsigned GetBankGeneration (void) const;	// changes, if a bank is added, changed or removed
+	unsigned GetNextBankUp (unsigned nBankID);	// starts prefetch upwards
+	unsigned GetNextBankDown (unsigned nBankID);	// starts prefetch downwards
 
-	void GetVoice (unsigned nBankID,		// 0 .. MaxVoiceBankID
+	// Returns false, if the bank is not in memory and this is called
+	// at IRQ level or with IRQs disabled by a spin lock, where the file
+	// must not be read. Retry at task level without a lock then.
+	bool GetVoice (unsigned nBankID,		// 0 .. MaxVoiceBankID
 		       unsigned nVoiceID,		// 0 .. 31
-		       uint8_t *pVoiceData);		// returns unpacked format (156 bytes)
+		       uint8_t *pVoiceData,		// returns unpacked format (156 bytes)
+		       bool bTaskLevel);		// on core 0 at task level, no lock held
+
+	// Called on bank select (task or IRQ level). The bank and its neighbours
+	// are unpacked by Process(), so that GetVoice() only copies the voice.
+	void PrepareBank (unsigned nBankID);
+
+	// Case insensitive search in the voice names of all banks, results are
+	// ordered by name. A prefix search uses the sorted name index. A substring
+	// search examines MaxSearchNames names per call at most. The search is
+	// continued from *pPosition (0 to start), which is set to GetNumVoiceNames()
+	// at the end. Returns the number of matches written (up to nMaxMatches).
+	unsigned FindVoices (const char *pPattern, bool bSubstring, unsigned *pPosition,
+			     TVoiceMatch *pMatches, unsigned nMaxMatches);
+	unsigned GetNumVoiceNames (void);
+	std::string GetVoiceName (unsigned nBankID, unsigned nVoiceID) const;	// from directory
+
+	void GetCacheStatistics (TCacheStatistics *pStatistics) const;
+	void GetLoadStatistics (TLoadStatistics *pStatistics) const;
+	void Dump (unsigned nIntervalTicks = CLOCKHZ);	// cache statistics, if changed
+
+	// FNV-1a, may be continued with the previous result in nHash
+	static uint32_t Hash (const void *pData, size_t nLength, uint32_t nHash = 2166136261U);
+
+private:
+	struct TBankFile		// properties of bank file
+	{
+		uint32_t nLibraryOffset;	// of bank data in library, 0 for bank file
+		uint32_t nSize;
+		uint32_t nTime;		// FatFs fdate << 16 | ftime
+		uint32_t nChecksum;	// of bank data
+		bool bHeaderless;
+	};
+
+	struct TVoiceNames
+	{
+		char Name[VoicesPerBank][VoiceNameLength];	// not terminated
+	};
+
+	struct TPooledVoice		// packed voice, shared by the cached banks containing it
+	{
+		uint8_t Data[SizePackedVoice];
+		uint32_t nHash;
+		unsigned nRefCount;
+		TPooledVoice *pNext;	// with same hash
+	};
+
+	struct TBankVoices		// resident bank
+	{
+		const TPooledVoice *pVoice[VoicesPerBank];
+	};
+
+	struct TBankEntry		// in bank directory, sorted by bank ID
+	{
+		unsigned nBankID;
+		unsigned nPathOffset;	// in m_StringPool, relative to m_DirName
+		unsigned nNameOffset;	// in m_StringPool, bank name parsed from file name
+		unsigned nVoiceNames;	// index in m_VoiceNames
+		TBankFile File;
+		TBankVoices *pVoices;	// nullptr, if not in cache
+	};
+
+	struct TIndexedBank		// read from index file
+	{
+		TBankFile File;
+		TVoiceNames VoiceNames;
+	};
+
+	typedef std::unordered_map<std::string, TIndexedBank> TBankIndex;	// path -> bank
 
 private:
 	static void DecodePackedVoice (const uint8_t *pPackedData, uint8_t *pDecodedData);
 
+	unsigned GetFreeBankID (void) const;		// not during a scan
+	bool InsertReceivedBank (unsigned nSlot);
+
+	bool StartScan (void);
+	bool ScanStep (void);		// one directory entry, returns false, if complete
+	void ScanSlice (void);
+	void FinishScan (void);		// removes banks, which have not been found
+	void AddBankFile (const std::string &rPath, const char *pFileName, const FILINFO *pFileInfo);
+	void AddBankData (const std::string &rPath, const char *pFileName, unsigned nBankIdx,
+			  const TBankFile &rFile, const TVoiceBank *pBank,
+			  const TVoiceNames &rVoiceNames);
+	bool ReadBankFile (const char *pPath, TVoiceBank *pBank, bool *pHeaderless);
+	bool ReadBankData (const char *pPath, TVoiceBank *pBank, unsigned *pRead);
+	bool ValidateBankData (TVoiceBank *pBank, unsigned nRead, bool *pHeaderless) const;
+	bool LoadBankData (TBankEntry *pEntry);
+
+	TBankEntry *FindBank (unsigned nBankID);	// nullptr, if not found
+	const TBankEntry *FindBank (unsigned nBankID) const;
+	TBankEntry *AddBank (unsigned nBankID, const char *pPath, const char *pName,
+			     const TBankFile &rFile, const TVoiceNames &rVoiceNames);	// to m_NewBank
+	void PublishBanks (void);		// merges m_NewBank into m_Bank
+	void UpdateBankCount (void);
+	void AddIndexedBanks (void);
+	unsigned AddString (const char *pString);	// returns offset in m_StringPool
+	static std::string ParseBankName (const char *pFileName);	// "" if invalid
+	const char *GetString (unsigned nOffset) const;
+
+	unsigned ReadLibrary (void);		// returns number of banks
+	bool ReadLibraryBank (uint32_t nOffset, TVoiceBank *pBank);
+	bool ReadLibraryVoice (uint32_t nOffset, unsigned nVoiceID, uint8_t *pPackedVoice);
+
+	unsigned FindNextBankUp (unsigned nBankID);
+	unsigned FindNextBankDown (unsigned nBankID);
+
+	void CacheBank (TBankEntry *pEntry, TBankVoices *pVoices);	// evicts LRU bank, if full
+	void UncacheBank (TBankEntry *pEntry);
+	TBankVoices *InternBank (const TVoiceBank *pBank);	// adds voices to the pool
+	void ReleaseBank (TBankVoices *pVoices);		// at task level, not under lock
+	void TouchBank (unsigned nBankID);
+	void StartPrefetch (unsigned nBankID, bool bUp);
+	void Prefetch (void);
+
+	bool LookupVoice (unsigned nBankID, unsigned nVoiceID, uint8_t *pVoiceData, bool bTaskLevel);
+	bool GetDecodedVoice (unsigned nBankID, unsigned nVoiceID, uint8_t *pVoiceData,
+			      bool bTaskLevel);
+	void DecodeBank (unsigned nBankID);
+	void InvalidateDecodedBank (unsigned nBankID);
+	void ProcessPrepareRequest (void);
+	static void GetVoiceNames (const TVoiceBank *pBank, TVoiceNames *pVoiceNames);
+
+	void UpdateNameIndex (void);		// with the added and removed banks
+	const char *GetIndexedName (unsigned nPosition) const;
+	static int CompareName (const char *pName, const char *pPattern, size_t nLength);
+
+	void ReadIndex (void);
+	bool StartIndex (void);
+	bool WriteIndexSlice (void);		// returns false, if complete or failed
+	void AbortIndex (void);
+	static bool IsIndexed (const TBankEntry &rEntry);
+
+	struct TLoadJob;
+	void SubmitLoadJob (const std::string &rPath, const char *pFileName, unsigned nBankIdx,
+			    const TBankFile &rFile);
+	void CompleteLoadJob (void);		// the oldest one
+	void CompleteLoadJobs (void);
+	bool ClaimLoadJob (TLoadJob *pJob);
+	void ValidateLoadJob (TLoadJob *pJob);
+
 private:
 	std::string m_DirName;
 	
 	unsigned m_nNumHighestBank;
 	unsigned m_nBanksLoaded;
 
-	TVoiceBank *m_pVoiceBank[MaxVoiceBankID+1];
-	std::string m_BankFileName[MaxVoiceBankID+1];
+	// The bank directory has an entry per installed bank only. Paths and
+	// bank names are interned in one string pool. The spin lock protects
+	// m_Bank and the cached bank pointers, which are read at IRQ level
+	// by GetVoice(), against modification at task level. New banks are
+	// collected in m_NewBank and the merged directory is swapped in.
+	// Strings and voice names of removed banks are not reclaimed.
+	std::vector<TBankEntry> m_Bank;
+	std::vector<TBankEntry> m_NewBank;
+	std::string m_StringPool;
+	std::vector<TVoiceNames> m_VoiceNames;
+	CSpinLock m_SpinLock;
+
+	bool m_bHeaderlessSysExVoices;
+	std::string m_IndexFileName;
+	std::string m_IndexTempName;	// written, renamed to m_IndexFileName on completion
+	TBankIndex m_OldIndex;		// read from index file, valid during Load()
+	bool m_bIndexChanged;		// index has to be written
+	unsigned m_nBankGeneration;
+
+	// the index is written by Process() in time slices
+	FIL m_IndexFile;
+	bool m_bIndexWriting;
+	unsigned m_nIndexBankID;	// next bank to be written
+	unsigned m_nIndexEntries;
+	unsigned m_nIndexWritten;
+	uint32_t m_nIndexChecksum;	// so far
+	unsigned m_nBanksRead;		// from bank files during scan
+
+	// directory scan, resumed by Process()
+	bool m_bScanning;
+	std::vector<bool> m_ScannedBankID;	// valid during scan
+	DIR m_ScanDirectory[MaxSubDirs+1];	// open directories
+	std::string m_ScanPath[MaxSubDirs+1];	// relative to m_DirName
+	unsigned m_nScanDepth;
+	unsigned m_nScanFiles;
+	unsigned m_nScanExpected;
+	unsigned m_nScanAdded;
+	unsigned m_nScanChanged;
 
 	static uint8_t s_DefaultVoice[SizeSingleVoice];
-	
-	void LoadBank (const char * sDirName, const char * sBankName, bool bHeaderlessSysExVoices, unsigned nSubDirCount);
+
+	// LRU bank cache
+	struct TCacheSlot
+	{
+		unsigned nBankID;
+		unsigned nLastUse;
+	};
+
+	TCacheSlot m_CacheSlot[BankCacheSize];
+	unsigned m_nCachedBanks;
+	unsigned m_nUseClock;
+
+	volatile unsigned m_nCacheHits;
+	unsigned m_nCacheMisses;
+	unsigned m_nCacheEvictions;
+	unsigned m_nCachePrefetches;
+	unsigned m_nLastDumpTicks;
+	unsigned m_nLastDumpAccesses;
+
+	// updated at task and IRQ level, an update may get lost rarely
+	volatile unsigned m_nLookups;
+	volatile unsigned m_nLookupTicks;
+	volatile unsigned m_nLookupTicksMax;
+
+	unsigned m_nLoadTicks;
+	unsigned m_nScanStartTicks;
+	unsigned m_nScanTicks;
+	unsigned m_nInvalidFiles;		// during scan
+	unsigned m_nDuplicates;
+	unsigned m_nSkippedDirs;
+
+	// Voice pool, keyed by content hash. Banks in the cache only reference
+	// their voices, so that a voice present in several banks is held once.
+	// Modified at task level only.
+	std::unordered_map<uint32_t, TPooledVoice *> m_VoicePool;
+	unsigned m_nVoiceRefs;
+	unsigned m_nUniqueVoices;
+
+	// Voice name index, sorted by name. It is updated, when banks are published,
+	// during a scan once at the end. Until then new banks are not found.
+	struct TVoiceNameRef
+	{
+		uint32_t nVoiceNames;	// index in m_VoiceNames
+		uint16_t nBankID;
+		uint8_t  nVoiceID;
+	};
+
+	std::vector<TVoiceNameRef> m_NameIndex;
+	std::vector<unsigned> m_NameIndexAdded;		// bank IDs
+	std::vector<unsigned> m_NameIndexRemoved;
+
+	// decoded voice cache, keyed by (bank, program), modified at task level only
+	static const unsigned InvalidBankID = MaxVoiceBankID+1;
+
+	struct TDecodedBank
+	{
+		unsigned nBankID;		// InvalidBankID, if slot is unused
+		unsigned nLastUse;
+		uint8_t Voice[VoicesPerBank][SizeSingleVoice];
+	};
+
+	TDecodedBank m_DecodedBank[DecodedBanks];
+	volatile unsigned m_nDecodedHits;
+
+	unsigned m_PrepareBankID[PrepareRequests];	// ring buffer
+	volatile unsigned m_nPrepareIn;
+	volatile unsigned m_nPrepareOut;
+	unsigned m_DecodeBankID[3];	// bank and neighbours of current request
+	unsigned m_nDecodeCount;
+
+	unsigned m_nPrefetchBankID;	// next bank to prefetch
+	unsigned m_nPrefetchCount;	// banks left in prefetch window
+	bool m_bPrefetchUp;
+
+	TVoiceBank m_ReceiveBank[ReceiveSlots];
+	volatile bool m_bReceiveBankFull[ReceiveSlots];
+	volatile unsigned m_nReceiveRejected;
+	volatile unsigned m_nReceiveDropped;
+	unsigned m_nReceiveRejectedReported;
+	unsigned m_nReceiveDroppedReported;
+
+	// Load() pipeline: core 0 reads the bank files, the secondary cores (or
+	// core 0, if it gets there first) validate them, hash them and extract
+	// the voice names. Jobs are completed in order by core 0, so that the
+	// result is the same as without the pipeline. FatFs is not reentrant,
+	// so all file I/O remains on core 0 and the gain is limited to the CPU
+	// time for validating and hashing (about 4 KB per bank), which overlaps
+	// with reading the next files. For a scan, which is bound by the SD card
+	// access, the pipeline saves only a small part of the time.
+	enum TLoadJobState
+	{
+		LoadJobFree,
+		LoadJobRead,		// by core 0, to be validated
+		LoadJobBusy,
+		LoadJobDone
+	};
+
+	struct TLoadJob
+	{
+		volatile TLoadJobState nState;
+		std::string Path;
+		std::string FileName;
+		unsigned nBankID;
+		TBankFile File;
+		bool bValid;
+		unsigned nRead;
+		TVoiceBank Bank;
+		TVoiceNames VoiceNames;
+	};
+
+	TLoadJob m_LoadJob[LoadJobs];
+	unsigned m_nLoadJobIn;
+	unsigned m_nLoadJobOut;
+	CSpinLock m_LoadJobLock;
+	bool m_bParallelLoad;
+	volatile bool m_bLoadComplete;
+
+	FILE *m_pStoreFile;		// bank file currently written by Process()
+	TVoiceBank *m_pStoreBank;	// its data
+	unsigned m_nStoreBankID;
+	size_t m_nStoreOffset;
+
+	std::string m_LibraryFileName;
+	FIL m_LibraryFile;		// kept open, if valid
+	bool m_bLibraryOpen;
 };
 
 #endif
@@ -54,6 +54,7 @@ const CUIMenu::TMenuItem CUIMenu::s_MainMenu[] =
 #endif
 	{"Effects",	MenuHandler,	s_EffectsMenu},
 	{"Performance",	MenuHandler, s_PerformanceMenu}, 
+	{"Rescan Banks",	RescanBanks},
 	{0}
 };
 
@@ -61,6 +62,7 @@ const CUIMenu::TMenuItem CUIMenu::s_TGMenu[] =
 {
 	{"Voice",	EditProgramNumber},
 	{"Bank",	EditVoiceBankNumber},
+	{"Search",	SearchVoice},
 	{"Volume",	EditTGParameter,	0,	CMiniDexed::TGParameterVolume},
 #ifdef ARM_ALLOW_MULTI_CORE
 	{"Pan",		EditTGParameter,	0,	CMiniDexed::TGParameterPan},
@@ -366,6 +368,9 @@ void CUIMenu::EventHandler (TMenuEvent Event)
 	switch (Event)
 	{
 	case MenuEventBack:				// pop menu
+		m_bPerformanceSaving = false;
+		m_bPerformanceSaved = false;
+
 		if (m_nCurrentMenuDepth)
 		{
 			m_nCurrentMenuDepth--;
@@ -381,6 +386,9 @@ void CUIMenu::EventHandler (TMenuEvent Event)
 		break;
 
 	case MenuEventHome:
+		m_bPerformanceSaving = false;
+		m_bPerformanceSaved = false;
+
 #ifdef ARM_ALLOW_MULTI_CORE
 		m_pParentMenu = s_MenuRoot;
 		m_pCurrentMenu = s_MainMenu;
@@ -913,7 +921,67 @@ void CUIMenu::SavePerformance (CUIMenu *pUIMenu, TMenuEvent Event)
 		return;
 	}
 
-	bool bOK = pUIMenu->m_pMiniDexed->SavePerformance (pUIMenu->m_nCurrentParameter == 1);
+	if (   !pUIMenu->m_bPerformanceSaving
+	    && !pUIMenu->m_bPerformanceSaved)
+	{
+		pUIMenu->m_pMiniDexed->SavePerformance (pUIMenu->m_nCurrentParameter == 1);
+
+		pUIMenu->m_SaveMenuName =
+			pUIMenu->m_MenuStackParent[pUIMenu->m_nCurrentMenuDepth-1]
+				[pUIMenu->m_nMenuStackItem[pUIMenu->m_nCurrentMenuDepth-1]].Name;
+		pUIMenu->m_SaveParamName = pUIMenu->m_pParentMenu[pUIMenu->m_nCurrentMenuItem].Name;
+		pUIMenu->m_bPerformanceSaving = true;
+	}
+
+	pUIMenu->ShowPerformanceSave ();
+}
+
+void CUIMenu::PerformanceSaved (bool bOK)
+{
+	if (!m_bPerformanceSaving)
+	{
+		return;			// menu has been left meanwhile
+	}
+
+	m_bPerformanceSaving = false;
+	m_bPerformanceSaved = true;
+	m_bPerformanceSaveOK = bOK;
+
+	ShowPerformanceSave ();
+
+	CTimer::Get ()->StartKernelTimer (MSEC2HZ (1500), TimerHandler, 0, this);
+}
+
+void CUIMenu::ShowPerformanceSave (void)
+{
+	const char *pValue = "Saving";
+	if (m_bPerformanceSaved)
+	{
+		pValue = m_bPerformanceSaveOK ? "Completed" : "Error";
+	}
+
+	m_pUI->DisplayWrite (m_SaveMenuName.c_str (), m_SaveParamName.c_str (), pValue, false, false);
+}
+
+void CUIMenu::RescanBanks (CUIMenu *pUIMenu, TMenuEvent Event)
+{
+	if (Event != MenuEventUpdate)
+	{
+		return;
+	}
+
+	CSysExFileLoader *pLoader = pUIMenu->m_pMiniDexed->GetSysExFileLoader ();
+	assert (pLoader);
+
+	string Value;
+	if (pLoader->IsScanning ())
+	{
+		Value = "Busy " + to_string (pLoader->GetScanProgress ()) + "%";
+	}
+	else
+	{
+		Value = pLoader->Rescan () ? "Started" : "Error";
+	}
 
 	const char *pMenuName =
 		pUIMenu->m_MenuStackParent[pUIMenu->m_nCurrentMenuDepth-1]
@@ -921,12 +989,242 @@ void CUIMenu::SavePerformance (CUIMenu *pUIMenu, TMenuEvent Event)
 
 	pUIMenu->m_pUI->DisplayWrite (pMenuName,
 				      pUIMenu->m_pParentMenu[pUIMenu->m_nCurrentMenuItem].Name,
-				      bOK ? "Completed" : "Error",
+				      Value.c_str (),
 				      false, false);
 
 	CTimer::Get ()->StartKernelTimer (MSEC2HZ (1500), TimerHandler, 0, pUIMenu);
 }
 
+void CUIMenu::SearchVoice (CUIMenu *pUIMenu, TMenuEvent Event)
+{
+	unsigned nTG = pUIMenu->m_nMenuStackParameter[pUIMenu->m_nCurrentMenuDepth-1];
+
+	string TG ("TG");
+	TG += to_string (nTG+1);
+
+	if (pUIMenu->m_bSearching)
+	{
+		if (Event == MenuEventUpdate)
+		{
+			pUIMenu->m_pUI->DisplayWrite (TG.c_str (),
+						      pUIMenu->m_pParentMenu[pUIMenu->m_nCurrentMenuItem].Name,
+						      "Searching", false, false);
+		}
+
+		return;
+	}
+
+	if (pUIMenu->m_nSearchMatches)
+	{
+		// step through the matches, the voice is selected at once
+		unsigned nMatch = pUIMenu->m_nSearchMatch;
+
+		switch (Event)
+		{
+		case MenuEventUpdate:
+			pUIMenu->ShowSearchMatch (nTG, false);
+			return;
+
+		case MenuEventStepDown:
+			if (nMatch > 0)
+			{
+				nMatch--;
+			}
+			break;
+
+		case MenuEventStepUp:
+			if (nMatch < pUIMenu->m_nSearchMatches-1)
+			{
+				nMatch++;
+			}
+			break;
+
+		case MenuEventSelect:		// edit the name again
+			pUIMenu->m_nSearchMatches = 0;
+			SearchVoice (pUIMenu, MenuEventUpdate);
+			return;
+
+		default:
+			return;
+		}
+
+		pUIMenu->m_nSearchMatch = nMatch;
+		pUIMenu->ShowSearchMatch (nTG, true);
+
+		return;
+	}
+
+	unsigned nPosition = pUIMenu->m_nSearchTextPosition;
+	char chChar = pUIMenu->m_SearchText[nPosition];
+
+	switch (Event)
+	{
+	case MenuEventUpdate:
+		break;
+
+	case MenuEventStepDown:
+		if (chChar > 32)
+		{
+			--chChar;
+		}
+		break;
+
+	case MenuEventStepUp:
+		if (chChar < 126)
+		{
+			++chChar;
+		}
+		break;
+
+	case MenuEventPressAndStepDown:
+		if (nPosition > 0)
+		{
+			--nPosition;
+		}
+		break;
+
+	case MenuEventPressAndStepUp:
+		if (nPosition < CSysExFileLoader::VoiceNameLength-1)
+		{
+			++nPosition;
+		}
+		break;
+
+	case MenuEventSelect:
+		pUIMenu->StartSearch (nTG);
+		return;
+
+	default:
+		return;
+	}
+
+	pUIMenu->m_SearchText[nPosition] = chChar;
+	pUIMenu->m_nSearchTextPosition = nPosition;
+
+	// \E[2;%dH	Cursor move to row %1 and column %2 (starting at 1)
+	// \E[?25h	Normal cursor visible
+	std::string escCursor="\E[?25h\E[2;";
+	escCursor += to_string(nPosition + 2);
+	escCursor += "H";
+
+	string Value = pUIMenu->m_SearchText + " " + escCursor;
+
+	pUIMenu->m_pUI->DisplayWrite (TG.c_str (),
+				      pUIMenu->m_pParentMenu[pUIMenu->m_nCurrentMenuItem].Name,
+				      Value.c_str (), false, false);
+}
+
+void CUIMenu::Process (void)
+{
+	if (!m_bSearching)
+	{
+		return;
+	}
+
+	// the search menu has been left
+	if (m_pParentMenu[m_nCurrentMenuItem].Handler != SearchVoice)
+	{
+		m_bSearching = false;
+		m_nSearchMatches = 0;
+
+		return;
+	}
+
+	CSysExFileLoader *pLoader = m_pMiniDexed->GetSysExFileLoader ();
+	assert (pLoader);
+
+	// MaxSearchNames names per call
+	m_nSearchMatches += pLoader->FindVoices (m_SearchPattern.c_str (), true, &m_nSearchPosition,
+						 m_SearchMatch + m_nSearchMatches,
+						 MaxSearchMatches - m_nSearchMatches);
+
+	if (   m_nSearchPosition >= pLoader->GetNumVoiceNames ()
+	    || m_nSearchMatches >= MaxSearchMatches)
+	{
+		m_bSearching = false;
+
+		ShowSearchResult (m_nSearchTG);
+	}
+}
+
+void CUIMenu::StartSearch (unsigned nTG)
+{
+	m_nSearchMatches = 0;
+
+	m_SearchPattern = m_SearchText;
+	size_t nLength = m_SearchPattern.find_last_not_of (' ');
+	if (nLength == string::npos)
+	{
+		ShowSearchResult (nTG);
+
+		return;
+	}
+	m_SearchPattern.resize (nLength+1);
+
+	CSysExFileLoader *pLoader = m_pMiniDexed->GetSysExFileLoader ();
+	assert (pLoader);
+
+	// names starting with the pattern, found in the sorted index at once
+	unsigned nPosition = 0;
+	m_nSearchMatches = pLoader->FindVoices (m_SearchPattern.c_str (), false, &nPosition,
+						m_SearchMatch, MaxSearchMatches);
+	if (m_nSearchMatches)
+	{
+		ShowSearchResult (nTG);
+
+		return;
+	}
+
+	// otherwise names containing it, searched by Process()
+	m_nSearchPosition = 0;
+	m_nSearchTG = nTG;
+	m_bSearching = true;
+
+	EventHandler (MenuEventUpdate);
+}
+
+void CUIMenu::ShowSearchResult (unsigned nTG)
+{
+	if (m_nSearchMatches)
+	{
+		m_nSearchMatch = 0;
+		ShowSearchMatch (nTG, true);
+
+		return;
+	}
+
+	string TG ("TG");
+	TG += to_string (nTG+1);
+
+	m_pUI->DisplayWrite (TG.c_str (), m_pParentMenu[m_nCurrentMenuItem].Name,
+			     "Not found", false, false);
+
+	CTimer::Get ()->StartKernelTimer (MSEC2HZ (1500), TimerHandlerNoBack, 0, this);
+}
+
+void CUIMenu::ShowSearchMatch (unsigned nTG, bool bSelect)
+{
+	assert (m_nSearchMatch < m_nSearchMatches);
+	const CSysExFileLoader::TVoiceMatch &rMatch = m_SearchMatch[m_nSearchMatch];
+
+	if (bSelect)
+	{
+		m_pMiniDexed->SetTGParameter (CMiniDexed::TGParameterVoiceBank, rMatch.nBankID, nTG);
+		m_pMiniDexed->SetTGParameter (CMiniDexed::TGParameterProgram, rMatch.nVoiceID, nTG);
+	}
+
+	string TG ("TG");
+	TG += to_string (nTG+1);
+
+	string Param = to_string (rMatch.nBankID+1) + ":" + to_string (rMatch.nVoiceID+1);
+
+	string Value =
+		m_pMiniDexed->GetSysExFileLoader ()->GetVoiceName (rMatch.nBankID, rMatch.nVoiceID);
+
+	m_pUI->DisplayWrite (TG.c_str (), Param.c_str (), Value.c_str (),
+			     m_nSearchMatch > 0, m_nSearchMatch < m_nSearchMatches-1);
+}
+
 string CUIMenu::GetGlobalValueString (unsigned nParameter, int nValue)
 {
 	string Result;
@@ -1208,6 +1506,14 @@ void CUIMenu::PgmUpDownHandler (TMenuEvent Event)
 {
 	if (m_pMiniDexed->GetParameter (CMiniDexed::ParameterPerformanceSelectChannel) != CMIDIDevice::Disabled)
 	{
+		if (m_pMiniDexed->IsSetlistActive ())
+		{
+			// Program Up/Down steps through the setlist
+			m_pMiniDexed->SetlistStep (Event == MenuEventPgmDown ? -1 : 1);
+
+			return;
+		}
+
 		// Program Up/Down acts on performances
 		unsigned nLastPerformance = m_pMiniDexed->GetLastPerformance();
 		unsigned nPerformance = m_pMiniDexed->GetActualPerformanceID();
@@ -1396,6 +1702,10 @@ void CUIMenu::PerformanceMenu (CUIMenu *pUIMenu, TMenuEvent Event)
 			{
 				pUIMenu->m_pMiniDexed->SetNewPerformance(nValue);
 			}
+			else
+			{
+				pUIMenu->m_pMiniDexed->PrefetchPerformance(nValue);
+			}
 			break;
 
 		case MenuEventStepUp:
@@ -1408,6 +1718,10 @@ void CUIMenu::PerformanceMenu (CUIMenu *pUIMenu, TMenuEvent Event)
 			{
 				pUIMenu->m_pMiniDexed->SetNewPerformance(nValue);
 			}
+			else
+			{
+				pUIMenu->m_pMiniDexed->PrefetchPerformance(nValue);
+			}
 			break;
 
 		case MenuEventSelect:	
@@ -1540,6 +1854,17 @@ void CUIMenu::InputTxt (CUIMenu *pUIMenu, TMenuEvent Event)
 		return;
 	}
 	
+	if (   pUIMenu->m_bPerformanceSaving
+	    || pUIMenu->m_bPerformanceSaved)
+	{
+		if (Event == MenuEventUpdate)
+		{
+			pUIMenu->ShowPerformanceSave ();
+		}
+
+		return;
+	}
+
 	bool bOK;
 	unsigned nPosition = pUIMenu->m_InputTextPosition;
 	unsigned nChar = pUIMenu->m_InputText[nPosition];
@@ -1598,7 +1923,16 @@ void CUIMenu::InputTxt (CUIMenu *pUIMenu, TMenuEvent Event)
 		{	
 			pUIMenu->m_pMiniDexed->SetNewPerformanceName(pUIMenu->m_InputText);
 			bOK = pUIMenu->m_pMiniDexed->SavePerformanceNewFile ();
-			MsgOk=bOK ? "Completed" : "Error";
+			if (bOK)
+			{
+				// the result is shown by PerformanceSaved()
+				pUIMenu->m_SaveMenuName = OkTitleR;
+				pUIMenu->m_SaveParamName = OkTitleL;
+				pUIMenu->m_bPerformanceSaving = true;
+				pUIMenu->ShowPerformanceSave ();
+				return;
+			}
+			MsgOk="Error";
 			pUIMenu->m_pUI->DisplayWrite (OkTitleR.c_str(), OkTitleL.c_str(), MsgOk.c_str(), false, false);
 			CTimer::Get ()->StartKernelTimer (MSEC2HZ (1500), TimerHandler, 0, pUIMenu);
 			return;
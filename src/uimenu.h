@@ -25,6 +25,7 @@
 
 #include <string>
 #include <circle/timer.h>
+#include "sysexfileloader.h"
 
 class CMiniDexed;
 class CUserInterface;
@@ -33,6 +34,7 @@ class CUIMenu
 {
 private:
 	static const unsigned MaxMenuDepth = 5;
+	static const unsigned MaxSearchMatches = 64;
 
 public:
 	enum TMenuEvent
@@ -56,6 +58,11 @@ public:
 	CUIMenu (CUserInterface *pUI, CMiniDexed *pMiniDexed);
 
 	void EventHandler (TMenuEvent Event);
+
+	// called, when a performance save, started from the menu, has finished
+	void PerformanceSaved (bool bOK);
+
+	void Process (void);		// continues a voice search
 	
 private:
 	typedef void TMenuHandler (CUIMenu *pUIMenu, TMenuEvent Event);
@@ -87,6 +94,8 @@ private:
 	static void EditVoiceParameter (CUIMenu *pUIMenu, TMenuEvent Event);
 	static void EditOPParameter (CUIMenu *pUIMenu, TMenuEvent Event);
 	static void SavePerformance (CUIMenu *pUIMenu, TMenuEvent Event);
+	static void RescanBanks (CUIMenu *pUIMenu, TMenuEvent Event);
+	static void SearchVoice (CUIMenu *pUIMenu, TMenuEvent Event);
 	static void EditTGParameter2 (CUIMenu *pUIMenu, TMenuEvent Event);
 	static void EditTGParameterModulation (CUIMenu *pUIMenu, TMenuEvent Event); 	
 	static void PerformanceMenu (CUIMenu *pUIMenu, TMenuEvent Event);
@@ -116,9 +125,15 @@ private:
 	void TGShortcutHandler (TMenuEvent Event);
 	void OPShortcutHandler (TMenuEvent Event);
 
+	void StartSearch (unsigned nTG);
+	void ShowSearchResult (unsigned nTG);
+	void ShowSearchMatch (unsigned nTG, bool bSelect);
+
 	void PgmUpDownHandler (TMenuEvent Event);
 	void TGUpDownHandler (TMenuEvent Event);
 
+	void ShowPerformanceSave (void);
+
 	static void TimerHandler (TKernelTimerHandle hTimer, void *pParam, void *pContext);
 
 	static void InputTxt (CUIMenu *pUIMenu, TMenuEvent Event);
@@ -171,6 +186,22 @@ private:
 	unsigned m_nSelectedPerformanceID =0;
 	bool m_bSplashShow=false;
 
+	bool m_bPerformanceSaving=false;	// result of save is pending
+	bool m_bPerformanceSaved=false;		// result of save is shown
+	bool m_bPerformanceSaveOK=false;
+	std::string m_SaveMenuName;
+	std::string m_SaveParamName;
+
+	std::string m_SearchText="          ";
+	unsigned m_nSearchTextPosition=0;
+	CSysExFileLoader::TVoiceMatch m_SearchMatch[MaxSearchMatches];
+	unsigned m_nSearchMatches=0;		// 0: pattern is edited
+	unsigned m_nSearchMatch=0;
+	bool m_bSearching=false;		// substring search continued by Process()
+	std::string m_SearchPattern;
+	unsigned m_nSearchPosition=0;
+	unsigned m_nSearchTG=0;
+
 };
 
 #endif
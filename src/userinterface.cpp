@@ -183,6 +183,8 @@ void CUserInterface::Process (void)
 	{
 		m_pUIButtons->Update();
 	}
+
+	m_Menu.Process ();
 }
 
 void CUserInterface::ParameterChanged (void)
@@ -190,6 +192,11 @@ void CUserInterface::ParameterChanged (void)
 	m_Menu.EventHandler (CUIMenu::MenuEventUpdate);
 }
 
+void CUserInterface::PerformanceSaved (bool bOK)
+{
+	m_Menu.PerformanceSaved (bOK);
+}
+
 void CUserInterface::DisplayWrite (const char *pMenu, const char *pParam, const char *pValue,
 				   bool bArrowDown, bool bArrowUp)
 {
@@ -44,6 +44,9 @@ public:
 
 	void ParameterChanged (void);
 
+	// called, when a performance has been written in the background
+	void PerformanceSaved (bool bOK);
+
 	// Write to display in this format:
 	// +----------------+
 	// |PARAM       MENU|
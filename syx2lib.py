@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+#
+# syx2lib.py
+#
+# Builds the single file voice library (sysex/voice.lib) from a directory
+# of DX7 voice banks (sysex/voice), as read by CSysExFileLoader. The bank
+# files are named and checked like on the device:
+#
+#   [NNNN]N[_name].syx, bank number N is 1-based, up to 3 subdirectories
+#
+# MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+# Copyright (C) 2022  The MiniDexed Team
+#
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+#
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+MAX_VOICE_BANK_ID = 16383
+MAX_SUB_DIRS = 3
+VOICE_SYSEX_SIZE = 4096
+VOICE_SYSEX_HDR_SIZE = 8
+VOICES_PER_BANK = 32
+SIZE_PACKED_VOICE = 128
+VOICE_NAME_LENGTH = 10
+
+LIBRARY_MAGIC = b"MDXL"
+LIBRARY_VERSION = 1
+
+HEADER_FORMAT = "<4sIIII"
+ENTRY_FORMAT = "<HHIII%ds" % (VOICES_PER_BANK * VOICE_NAME_LENGTH)
+
+
+def fnv1a(data, value=2166136261):
+    for byte in data:
+        value ^= byte
+        value = (value * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def sysex_bank(voices):
+    checksum = (128 - (sum(voices) & 0x7F)) & 0x7F
+    return bytes([0xF0, 0x43, 0x00, 0x09, 0x20, 0x00]) + voices + bytes([checksum, 0xF7])
+
+
+def read_bank(path, headerless):
+    with open(path, "rb") as f:
+        data = f.read()
+
+    if (    len(data) >= VOICE_SYSEX_HDR_SIZE + VOICE_SYSEX_SIZE
+        and data[0] == 0xF0 and data[1] == 0x43 and data[3] == 0x09
+        and data[VOICE_SYSEX_HDR_SIZE + VOICE_SYSEX_SIZE - 1] == 0xF7):
+        return data[6:6 + VOICE_SYSEX_SIZE]
+
+    if headerless and len(data) >= VOICE_SYSEX_SIZE:
+        return data[:VOICE_SYSEX_SIZE]
+
+    return None
+
+
+def scan(directory, subdir, depth, headerless, banks):
+    path = os.path.join(directory, subdir)
+    for name in sorted(os.listdir(path)):
+        relative = os.path.join(subdir, name) if subdir else name
+        full = os.path.join(directory, relative)
+
+        if os.path.isdir(full):
+            if depth >= MAX_SUB_DIRS:
+                print("Too many nested subdirectories: %s" % name, file=sys.stderr)
+                continue
+            scan(directory, relative, depth + 1, headerless, banks)
+            continue
+
+        match = re.match(r"(\d+)", name)
+        if len(name) < 5 or not name.lower().endswith(".syx") or not match:
+            print("%s: Invalid filename format" % name, file=sys.stderr)
+            continue
+
+        bank_id = int(match.group(1)) - 1
+        if bank_id < 0 or bank_id > MAX_VOICE_BANK_ID:
+            print("Bank #%d is not supported" % (bank_id + 1), file=sys.stderr)
+            continue
+
+        if bank_id in banks:
+            print("Bank #%d already loaded" % (bank_id + 1), file=sys.stderr)
+            continue
+
+        voices = read_bank(full, headerless)
+        if voices is None:
+            print("%s: Invalid size or format" % full, file=sys.stderr)
+            continue
+
+        # same as the sscanf ("%u_%30s") on the device
+        bank_name = ""
+        match = re.match(r"\d+_(\S{1,30})", name[:-4])
+        if match:
+            bank_name = match.group(1)
+
+        banks[bank_id] = (bank_name, voices)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Build a MiniDexed voice library")
+    parser.add_argument("source", nargs="?", default="sysex/voice",
+                        help="voice bank directory (default: sysex/voice)")
+    parser.add_argument("output", nargs="?", default="sysex/voice.lib",
+                        help="library file (default: sysex/voice.lib)")
+    parser.add_argument("--headerless", action="store_true",
+                        help="accept headerless banks (like HeaderlessSysExVoices=1)")
+    args = parser.parse_args()
+
+    banks = {}
+    scan(args.source, "", 0, args.headerless, banks)
+
+    ids = sorted(banks)
+    strings = b""
+    name_offsets = []
+    for bank_id in ids:
+        name_offsets.append(len(strings))
+        strings += banks[bank_id][0].encode("latin-1") + b"\0"
+
+    data_offset = (struct.calcsize(HEADER_FORMAT)
+                   + len(ids) * struct.calcsize(ENTRY_FORMAT) + len(strings))
+
+    directory = b""
+    for i, bank_id in enumerate(ids):
+        voices = banks[bank_id][1]
+        names = b"".join(voices[v * SIZE_PACKED_VOICE + 118:v * SIZE_PACKED_VOICE + 128]
+                         for v in range(VOICES_PER_BANK))
+        directory += struct.pack(ENTRY_FORMAT, bank_id, 0, name_offsets[i],
+                                 data_offset + i * VOICE_SYSEX_SIZE,
+                                 fnv1a(sysex_bank(voices)), names)
+
+    directory += strings
+    header = struct.pack(HEADER_FORMAT, LIBRARY_MAGIC, LIBRARY_VERSION, len(ids),
+                         len(strings), fnv1a(directory))
+
+    with open(args.output, "wb") as f:
+        f.write(header)
+        f.write(directory)
+        for bank_id in ids:
+            f.write(banks[bank_id][1])
+
+    print("%d banks written to %s" % (len(ids), args.output))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,29 @@
+//
+// config.h
+//
+// Host build of the MiniDexed tests: CConfig stub for the MIDI replay
+//
+#ifndef _config_h
+#define _config_h
+
+class CConfig
+{
+public:
+	static const unsigned ToneGenerators = 8;
+
+public:
+	unsigned GetMIDIBaudRate (void) const		{ return 31250; }
+	const char *GetMIDIThruIn (void) const		{ return ""; }
+	const char *GetMIDIThruOut (void) const		{ return ""; }
+	bool GetMIDIRXProgramChange (void) const	{ return true; }
+	bool GetIgnoreAllNotesOff (void) const		{ return false; }
+
+	bool GetMIDIDumpEnabled (void) const		{ return m_bMIDIDumpEnabled; }
+	bool GetProfileEnabled (void) const		{ return m_bProfileEnabled; }
+
+public:
+	bool m_bMIDIDumpEnabled = false;
+	bool m_bProfileEnabled = false;
+};
+
+#endif
@@ -0,0 +1,171 @@
+//
+// minidexed.h
+//
+// Host build of the MiniDexed tests: CMiniDexed stub for the MIDI replay,
+// which counts the calls from CMIDIDevice
+//
+#ifndef _minidexed_h
+#define _minidexed_h
+
+#include "config.h"
+#include "midilog.h"
+#include "midiclock.h"
+#include <stdint.h>
+#include <stddef.h>
+
+typedef float float32_t;
+
+#define DEXED_OP_ENABLE		21
+
+inline long maplong (long x, long in_min, long in_max, long out_min, long out_max)
+{
+	return (x - in_min) * (out_max - out_min) / (in_max - in_min) + out_min;
+}
+
+class CSysExFileLoader
+{
+public:
+	struct TVoiceBank
+	{
+		uint8_t StatusStart;
+		uint8_t CompanyID;
+		uint8_t Status;
+		uint8_t Format;
+		uint8_t ByteCountMS;
+		uint8_t ByteCountLS;
+		uint8_t Voice[4096];
+		uint8_t Checksum;
+		uint8_t StatusEnd;
+	}
+	__attribute__ ((packed));
+
+	bool ReceiveBank (const uint8_t *pMessage, size_t nLength)
+	{
+		m_nBanksReceived++;
+
+		return true;
+	}
+
+public:
+	unsigned m_nBanksReceived = 0;
+};
+
+class CPerformanceSysEx
+{
+public:
+	static bool IsPerformanceSysEx (const uint8_t *pMessage, size_t nLength)
+	{
+		return false;		// not replayed
+	}
+};
+
+class CMiniDexed
+{
+public:
+	static const unsigned NoOP = 6;
+
+	enum TTGParameter
+	{
+		TGParameterVoiceBank,
+		TGParameterVoiceBankMSB,
+		TGParameterVoiceBankLSB,
+		TGParameterProgram,
+		TGParameterVolume,
+		TGParameterPan,
+		TGParameterMasterTune,
+		TGParameterCutoff,
+		TGParameterResonance,
+		TGParameterMIDIChannel,
+		TGParameterUnknown = 33
+	};
+
+	struct TCalls		// counted per kind of call
+	{
+		unsigned nKeyDown;
+		unsigned nKeyUp;
+		unsigned nController;	// controllers, volume, pan, bank select and tuning
+		unsigned nPitchBend;
+		unsigned nProgramChange;
+		unsigned nVoiceParameter;
+		unsigned nSysEx;	// checkSystemExclusive()
+		unsigned nOther;
+	};
+
+public:
+	CMIDILog *GetMIDILog (void)			{ return &m_MIDILog; }
+	CMIDIClock *GetMIDIClock (void)			{ return &m_MIDIClock; }
+	CSysExFileLoader *GetSysExFileLoader (void)	{ return &m_SysExFileLoader; }
+
+	void keydown (int16_t pitch, uint8_t velocity, unsigned nTG)	{ m_Calls.nKeyDown++; }
+	void keyup (int16_t pitch, unsigned nTG)			{ m_Calls.nKeyUp++; }
+
+	void setModWheel (uint8_t value, unsigned nTG)		{ m_Calls.nController++; }
+	void setFootController (uint8_t value, unsigned nTG)	{ m_Calls.nController++; }
+	void setBreathController (uint8_t value, unsigned nTG)	{ m_Calls.nController++; }
+	void setAftertouch (uint8_t value, unsigned nTG)	{ m_Calls.nController++; }
+	void setSustain (bool sustain, unsigned nTG)		{ m_Calls.nController++; }
+	void ControllersRefresh (unsigned nTG)			{}
+	void SetVolume (unsigned nVolume, unsigned nTG)		{ m_Calls.nController++; }
+	void SetPan (unsigned nPan, unsigned nTG)		{ m_Calls.nController++; }
+	void SetCutoff (int nCutoff, unsigned nTG)		{ m_Calls.nController++; }
+	void SetResonance (int nResonance, unsigned nTG)	{ m_Calls.nController++; }
+	void SetReverbSend (unsigned nReverbSend, unsigned nTG)	{ m_Calls.nController++; }
+	void SetMasterTune (int nMasterTune, unsigned nTG)	{ m_Calls.nController++; }
+	void BankSelectMSB (unsigned nBankMSB, unsigned nTG)	{ m_Calls.nController++; }
+	void BankSelectLSB (unsigned nBankLSB, unsigned nTG)	{ m_Calls.nController++; }
+	void setPitchbend (int16_t value, unsigned nTG)		{ m_Calls.nPitchBend++; }
+	void panic (uint8_t value, unsigned nTG)		{ m_Calls.nOther++; }
+	void notesOff (uint8_t value, unsigned nTG)		{ m_Calls.nOther++; }
+
+	void ProgramChange (unsigned nProgram, unsigned nTG, bool bTaskLevel = true)
+	{
+		m_Calls.nProgramChange++;
+	}
+	void ProgramChangePerformance (unsigned nProgram)	{ m_Calls.nOther++; }
+	unsigned GetPerformanceSelectChannel (void)		{ return 17; }	// disabled
+
+	void QueueVoiceParameter (uint8_t uchOffset, uint8_t uchValue, unsigned nOP, unsigned nTG)
+	{
+		m_Calls.nVoiceParameter++;
+	}
+	void SetTGParameter (TTGParameter Parameter, int nValue, unsigned nTG)	{ m_Calls.nOther++; }
+
+	int16_t checkSystemExclusive (const uint8_t *pMessage, const uint16_t nLength, uint8_t nTG)
+	{
+		m_Calls.nSysEx++;
+
+		return nLength == sizeof (CSysExFileLoader::TVoiceBank) ? 200 : -1;
+	}
+
+	void setMonoMode (uint8_t mono, uint8_t nTG)			{ m_Calls.nOther++; }
+	void setPitchbendRange (uint8_t range, uint8_t nTG)		{ m_Calls.nOther++; }
+	void setPitchbendStep (uint8_t step, uint8_t nTG)		{ m_Calls.nOther++; }
+	void setPortamentoMode (uint8_t mode, uint8_t nTG)		{ m_Calls.nOther++; }
+	void setPortamentoGlissando (uint8_t glissando, uint8_t nTG)	{ m_Calls.nOther++; }
+	void setPortamentoTime (uint8_t time, uint8_t nTG)		{ m_Calls.nOther++; }
+	void setModWheelRange (uint8_t range, uint8_t nTG)		{ m_Calls.nOther++; }
+	void setModWheelTarget (uint8_t target, uint8_t nTG)		{ m_Calls.nOther++; }
+	void setFootControllerRange (uint8_t range, uint8_t nTG)	{ m_Calls.nOther++; }
+	void setFootControllerTarget (uint8_t target, uint8_t nTG)	{ m_Calls.nOther++; }
+	void setBreathControllerRange (uint8_t range, uint8_t nTG)	{ m_Calls.nOther++; }
+	void setBreathControllerTarget (uint8_t target, uint8_t nTG)	{ m_Calls.nOther++; }
+	void setAftertouchRange (uint8_t range, uint8_t nTG)		{ m_Calls.nOther++; }
+	void setAftertouchTarget (uint8_t target, uint8_t nTG)		{ m_Calls.nOther++; }
+	void loadVoiceParameters (const uint8_t *data, uint8_t nTG)	{ m_Calls.nOther++; }
+	void setVoiceDataElement (uint8_t data, uint8_t number, uint8_t nTG)	{ m_Calls.nOther++; }
+	void getSysExVoiceDump (uint8_t *dest, uint8_t nTG)		{ m_Calls.nOther++; }
+
+	void setMasterVolume (float32_t vol)				{ m_Calls.nOther++; }
+	void ReceivePerformanceSysEx (const uint8_t *pMessage, size_t nLength)	{}
+
+public:
+	TCalls m_Calls = {};
+
+	CSysExFileLoader m_SysExFileLoader;
+
+private:
+	CMIDILog m_MIDILog;
+	CMIDIClock m_MIDIClock;
+};
+
+#endif
@@ -0,0 +1,22 @@
+//
+// userinterface.h
+//
+// Host build of the MiniDexed tests: CUserInterface stub for the MIDI replay
+//
+#ifndef _userinterface_h
+#define _userinterface_h
+
+class CUserInterface
+{
+public:
+	void UIMIDICmdHandler (unsigned nMidiCh, unsigned nMidiCmd, unsigned nMidiData1,
+			       unsigned nMidiData2)
+	{
+		m_nMIDICmds++;
+	}
+
+public:
+	unsigned m_nMIDICmds = 0;
+};
+
+#endif
@@ -0,0 +1,329 @@
+//
+// midireplay.cpp
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Replays MIDI streams through CMIDIDevice on the host, once as complete
+// messages (like USB MIDI) and once as a byte stream through the parser of
+// CSerialMIDIDevice. The calls into CMiniDexed are counted and compared with
+// the expected ones. The throughput and the latency of each message (until
+// it has been dispatched) are reported.
+
+#include "mididevice.h"
+#include "serialmididevice.h"
+#include "minidexed.h"
+#include <circle/serial.h>
+#include <algorithm>
+#include <chrono>
+#include <vector>
+#include <string.h>
+#include <stdio.h>
+
+typedef std::vector<u8> TMessage;
+
+struct TStream
+{
+	const char *pName;
+	std::vector<TMessage> Messages;		// complete messages
+	std::vector<TMessage> SerialData;	// per message as sent on the wire
+	CMiniDexed::TCalls Expected;
+	unsigned nBanks;			// expected calls of ReceiveBank()
+	unsigned nUICmds;			// expected calls of UIMIDICmdHandler()
+};
+
+class CReplayDevice : public CMIDIDevice	// receives complete messages, like USB MIDI
+{
+public:
+	CReplayDevice (CMiniDexed *pSynthesizer, CConfig *pConfig, CUserInterface *pUI)
+	:	CMIDIDevice (pSynthesizer, pConfig, pUI)
+	{
+		AddDevice ("umidi1");
+	}
+
+	void Receive (const u8 *pMessage, size_t nLength)
+	{
+		MIDIMessageHandler (pMessage, nLength);
+	}
+};
+
+static const unsigned Channels = CConfig::ToneGenerators;	// TG n listens on channel n
+
+static void AddMessage (TStream *pStream, const TMessage &rMessage, bool bRunningStatus = false)
+{
+	static u8 s_uchLastStatus = 0;
+
+	pStream->Messages.push_back (rMessage);
+
+	TMessage Serial;
+	if (   !bRunningStatus
+	    || rMessage[0] != s_uchLastStatus
+	    || rMessage.size () == 1)
+	{
+		Serial = rMessage;
+	}
+	else
+	{
+		Serial.assign (rMessage.begin () + 1, rMessage.end ());
+	}
+
+	if (rMessage[0] < 0xF0)
+	{
+		s_uchLastStatus = rMessage[0];
+	}
+	else if (rMessage[0] < 0xF8)
+	{
+		s_uchLastStatus = 0;			// system common cancels running status
+	}
+
+	pStream->SerialData.push_back (Serial);
+}
+
+static void CreateChordStream (TStream *pStream, unsigned nChords)
+{
+	pStream->pName = "chord";
+
+	for (unsigned i = 0; i < nChords; i++)
+	{
+		u8 uchChannel = i % Channels;
+		u8 uchRoot = 36 + i % 48;
+
+		for (unsigned nNote = 0; nNote < 8; nNote++)
+		{
+			AddMessage (pStream, {(u8) (0x90 | uchChannel), (u8) (uchRoot + nNote*3), 100});
+		}
+
+		for (unsigned nNote = 0; nNote < 8; nNote++)
+		{
+			AddMessage (pStream, {(u8) (0x80 | uchChannel), (u8) (uchRoot + nNote*3), 64});
+		}
+
+		pStream->Expected.nKeyDown += 8;
+		pStream->Expected.nKeyUp += 8;
+		pStream->nUICmds += 16;
+	}
+}
+
+static void CreateControlStream (TStream *pStream, unsigned nMessages)
+{
+	pStream->pName = "CC flood";
+
+	// modulation, breath, foot, volume, pan, sustain, resonance, cutoff, reverb
+	static const u8 Controllers[] = {1, 2, 4, 7, 10, 64, 71, 74, 91};
+
+	for (unsigned i = 0; i < nMessages; i++)
+	{
+		u8 uchChannel = i % Channels;
+		u8 uchController = Controllers[i % sizeof Controllers];
+
+		AddMessage (pStream, {(u8) (0xB0 | uchChannel), uchController, (u8) (i & 0x7F)});
+
+		pStream->Expected.nController++;
+		pStream->nUICmds++;
+	}
+}
+
+static void CreateSysExStream (TStream *pStream, unsigned nBanks)
+{
+	pStream->pName = "SysEx 4 KB";
+
+	for (unsigned i = 0; i < nBanks; i++)
+	{
+		TMessage Message (sizeof (CSysExFileLoader::TVoiceBank));
+
+		Message[0] = 0xF0;
+		Message[1] = 0x43;
+		Message[2] = i % Channels;
+		Message[3] = 0x09;
+		Message[4] = 0x20;
+		Message[5] = 0x00;
+
+		u8 uchSum = 0;
+		for (unsigned j = 0; j < 4096; j++)
+		{
+			Message[6+j] = (i + j*7) & 0x7F;
+			uchSum += Message[6+j];
+		}
+
+		Message[6+4096] = -uchSum & 0x7F;
+		Message[6+4096+1] = 0xF7;
+
+		AddMessage (pStream, Message);
+
+		pStream->Expected.nSysEx++;		// one TG per channel
+		pStream->nBanks++;
+	}
+}
+
+static void CreateRunningStatusStream (TStream *pStream, unsigned nMessages)
+{
+	pStream->pName = "running status";
+
+	for (unsigned i = 0; i < nMessages; i++)
+	{
+		u8 uchNote = 48 + (i/2) % 24;
+
+		if (i % 64 == 63)
+		{
+			// pitch bend interrupts the running note status
+			AddMessage (pStream, {0xE0, 0x00, (u8) (0x40 + i % 8)}, true);
+
+			pStream->Expected.nPitchBend++;
+		}
+		else
+		{
+			// note off as note on with velocity 0
+			AddMessage (pStream, {0x90, uchNote, (u8) (i % 2 ? 0 : 100)}, true);
+
+			if (i % 2)
+			{
+				pStream->Expected.nKeyUp++;
+			}
+			else
+			{
+				pStream->Expected.nKeyDown++;
+			}
+
+			pStream->nUICmds++;
+		}
+
+		if (i % 24 == 0)
+		{
+			// real-time messages do not cancel running status
+			AddMessage (pStream, {0xF8}, true);
+		}
+	}
+}
+
+static unsigned Percentile (const std::vector<unsigned> &rSorted, unsigned nPercent)
+{
+	if (rSorted.empty ())
+	{
+		return 0;
+	}
+
+	return rSorted[(rSorted.size () - 1) * nPercent / 100];
+}
+
+static bool Replay (const TStream &rStream, bool bSerial, CMiniDexed *pSynthesizer,
+		    CUserInterface *pUI, CReplayDevice *pUSB, CSerialMIDIDevice *pSerial)
+{
+	pSynthesizer->m_Calls = {};
+	pSynthesizer->m_SysExFileLoader.m_nBanksReceived = 0;
+	pUI->m_nMIDICmds = 0;
+
+	const std::vector<TMessage> &rMessages = bSerial ? rStream.SerialData : rStream.Messages;
+
+	std::vector<unsigned> Latency;		// nanoseconds
+	Latency.reserve (rMessages.size ());
+
+	size_t nBytes = 0;
+
+	auto Start = std::chrono::steady_clock::now ();
+
+	for (auto &rMessage : rMessages)
+	{
+		auto MessageStart = std::chrono::steady_clock::now ();
+
+		if (bSerial)
+		{
+			CSerialDevice::SetReceiveData (rMessage.data (), rMessage.size ());
+			while (CSerialDevice::GetReceiveDataLeft ())
+			{
+				pSerial->Process ();	// reads up to 100 bytes
+			}
+		}
+		else
+		{
+			pUSB->Receive (rMessage.data (), rMessage.size ());
+		}
+
+		auto MessageEnd = std::chrono::steady_clock::now ();
+
+		Latency.push_back (std::chrono::duration_cast<std::chrono::nanoseconds> (
+					MessageEnd - MessageStart).count ());
+		nBytes += rMessage.size ();
+	}
+
+	double fSeconds = std::chrono::duration<double> (std::chrono::steady_clock::now () - Start).count ();
+
+	std::sort (Latency.begin (), Latency.end ());
+
+	printf ("%-15s %-6s %8u %9u %12.0f %8u %8u %8u\n",
+		rStream.pName, bSerial ? "serial" : "USB",
+		(unsigned) rMessages.size (), (unsigned) nBytes,
+		fSeconds > 0.0 ? rMessages.size () / fSeconds : 0.0,
+		Percentile (Latency, 50), Percentile (Latency, 99), Latency.back ());
+
+	const CMiniDexed::TCalls &rCalls = pSynthesizer->m_Calls;
+	const CMiniDexed::TCalls &rExpected = rStream.Expected;
+	if (   memcmp (&rCalls, &rExpected, sizeof rCalls) != 0
+	    || pSynthesizer->m_SysExFileLoader.m_nBanksReceived != rStream.nBanks
+	    || pUI->m_nMIDICmds != rStream.nUICmds)
+	{
+		fprintf (stderr, "%s (%s): dispatched calls differ: keydown %u/%u, keyup %u/%u, "
+			 "controller %u/%u, pitch bend %u/%u, SysEx %u/%u, banks %u/%u, UI %u/%u\n",
+			 rStream.pName, bSerial ? "serial" : "USB",
+			 rCalls.nKeyDown, rExpected.nKeyDown, rCalls.nKeyUp, rExpected.nKeyUp,
+			 rCalls.nController, rExpected.nController,
+			 rCalls.nPitchBend, rExpected.nPitchBend, rCalls.nSysEx, rExpected.nSysEx,
+			 pSynthesizer->m_SysExFileLoader.m_nBanksReceived, rStream.nBanks,
+			 pUI->m_nMIDICmds, rStream.nUICmds);
+
+		return false;
+	}
+
+	return true;
+}
+
+int main (void)
+{
+	static CMiniDexed Synthesizer;
+	CConfig Config;
+	CUserInterface UI;
+	CInterruptSystem Interrupt;
+
+	CReplayDevice USB (&Synthesizer, &Config, &UI);
+	CSerialMIDIDevice Serial (&Synthesizer, &Interrupt, &Config, &UI);
+	Serial.Initialize ();
+
+	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
+	{
+		USB.SetChannel (nTG, nTG);
+		Serial.SetChannel (nTG, nTG);
+	}
+
+	static TStream Streams[4];
+	CreateChordStream (&Streams[0], 4000);
+	CreateControlStream (&Streams[1], 64000);
+	CreateSysExStream (&Streams[2], 200);
+	CreateRunningStatusStream (&Streams[3], 64000);
+
+	printf ("%-15s %-6s %8s %9s %12s %8s %8s %8s\n",
+		"stream", "path", "messages", "bytes", "messages/s", "50% ns", "99% ns", "max ns");
+
+	bool bOK = true;
+	for (auto &rStream : Streams)
+	{
+		bOK &= Replay (rStream, false, &Synthesizer, &UI, &USB, &Serial);
+		bOK &= Replay (rStream, true, &Synthesizer, &UI, &USB, &Serial);
+	}
+
+	printf ("%s\n", bOK ? "PASSED" : "FAILED");
+
+	return bOK ? 0 : 1;
+}
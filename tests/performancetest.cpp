@@ -0,0 +1,394 @@
+//
+// performancetest.cpp
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Round-trips the shipped performances through CPerformanceConfig on the
+// host. The files are copied to a directory, which stands for the SD card.
+// Each performance is read from the INI file and from its snapshot, is
+// serialised and parsed again and is saved twice (the whole file, then the
+// changed chunk only). The voice data must be byte-identical to the hex
+// bytes in the original file on each step. The load and save times are
+// reported.
+//
+// Usage: performancetest [directory] (to be run in tests/)
+
+#include "performanceconfig.h"
+#include <circle/logger.h>
+#include <circle/timer.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <assert.h>
+#include <limits.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define SOURCE_DEFAULT		"../src/performance.ini"
+#define SOURCE_DIR		"../" PERFORMANCE_DIR
+
+typedef CPerformanceConfig::TPerformance TPerformance;
+
+static unsigned s_nErrors = 0;
+
+#define CHECK(cond, ...)	do { if (!(cond)) { s_nErrors++;				\
+					fprintf (stderr, "%s:%u: ", __FILE__, __LINE__);	\
+					fprintf (stderr, __VA_ARGS__);				\
+					fputc ('\n', stderr); } } while (0)
+
+struct TTiming
+{
+	const char *pName;
+	unsigned nCount;
+	unsigned nTicks;
+	unsigned nTicksMax;
+
+	void Add (unsigned nStartTicks)
+	{
+		unsigned nTicksUsed = CTimer::GetClockTicks () - nStartTicks;
+		nCount++;
+		nTicks += nTicksUsed;
+		nTicksMax = std::max (nTicksMax, nTicksUsed);
+	}
+
+	void Print (void) const
+	{
+		printf ("%-16s %8u %10u %10u\n", pName, nCount, nCount ? nTicks / nCount : 0, nTicksMax);
+	}
+};
+
+static bool ReadFile (const std::string &rPath, std::string *pText)
+{
+	FILE *pFile = fopen (rPath.c_str (), "rb");
+	if (!pFile)
+	{
+		return false;
+	}
+
+	pText->clear ();
+
+	char Buffer[4096];
+	size_t nRead;
+	while ((nRead = fread (Buffer, 1, sizeof Buffer, pFile)) > 0)
+	{
+		pText->append (Buffer, nRead);
+	}
+
+	fclose (pFile);
+
+	return true;
+}
+
+static void CopyFile (const std::string &rFrom, const std::string &rTo)
+{
+	std::string Text;
+	FILE *pFile;
+	if (   !ReadFile (rFrom, &Text)
+	    || !(pFile = fopen (rTo.c_str (), "wb")))
+	{
+		perror (rFrom.c_str ());
+		exit (1);
+	}
+
+	fwrite (Text.data (), Text.length (), 1, pFile);
+	fclose (pFile);
+}
+
+static int RemoveEntry (const char *pPath, const struct stat *pStat, int nFlag, struct FTW *pFTW)
+{
+	return remove (pPath);
+}
+
+static void RemoveTree (const std::string &rPath)
+{
+	nftw (rPath.c_str (), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static unsigned CreateFixture (const std::string &rDir)
+{
+	RemoveTree (rDir);
+
+	mkdir (rDir.c_str (), 0777);
+	mkdir ((rDir + "/" PERFORMANCE_DIR).c_str (), 0777);
+
+	CopyFile (SOURCE_DEFAULT, rDir + "/performance.ini");
+
+	// the FatFs shim works on any host directory
+	DIR Directory;
+	if (f_opendir (&Directory, SOURCE_DIR) != FR_OK)
+	{
+		perror (SOURCE_DIR);
+		exit (1);
+	}
+
+	unsigned nFiles = 1;
+	FILINFO FileInfo;
+	while (   f_readdir (&Directory, &FileInfo) == FR_OK
+	       && FileInfo.fname[0])
+	{
+		size_t nLength = strlen (FileInfo.fname);
+		if (   nLength > 4
+		    && strcmp (FileInfo.fname + nLength - 4, ".ini") == 0)
+		{
+			CopyFile (std::string (SOURCE_DIR "/") + FileInfo.fname,
+				  rDir + "/" PERFORMANCE_DIR "/" + FileInfo.fname);
+			nFiles++;
+		}
+	}
+
+	f_closedir (&Directory);
+
+	return nFiles;
+}
+
+// path relative to the SD card, as used by CPerformanceConfig
+static std::string GetPath (CPerformanceConfig *pConfig, unsigned nID)
+{
+	std::string Path (nID ? PERFORMANCE_DIR "/" : "");
+
+	return Path + pConfig->GetPerformanceFileName (nID);
+}
+
+// "VoiceDataN=XX XX ..." of the INI file text, parsed independently of CPerformanceConfig
+static bool GetVoiceData (const std::string &rText, unsigned nTG, uint8_t *pData)
+{
+	char Name[30];
+	snprintf (Name, sizeof Name, "VoiceData%u=", nTG+1);
+
+	size_t nPos = rText.find (Name);
+	if (   nPos == std::string::npos
+	    || (nPos > 0 && rText[nPos-1] != '\n'))
+	{
+		return false;
+	}
+
+	const char *pText = rText.c_str () + nPos + strlen (Name);
+	for (unsigned i = 0; i < NUM_VOICE_PARAM; i++)
+	{
+		if (i > 0 && *pText == ' ')
+		{
+			pText++;
+		}
+
+		char *pEnd;
+		unsigned long ulValue = strtoul (pText, &pEnd, 16);
+		if (   pEnd != pText + 2
+		    || ulValue > 0xFF)
+		{
+			return false;
+		}
+
+		pData[i] = ulValue;
+		pText = pEnd;
+	}
+
+	return true;
+}
+
+static void CheckVoiceData (const char *pStep, const std::string &rPath, const std::string &rText,
+			    const TPerformance &rPerformance)
+{
+	for (unsigned nTG = 0; nTG < CConfig::ToneGenerators; nTG++)
+	{
+		uint8_t VoiceData[NUM_VOICE_PARAM];
+		bool bFilled = GetVoiceData (rText, nTG, VoiceData);
+
+		CHECK (bFilled == rPerformance.bVoiceDataFilled[nTG],
+		       "%s: %s: VoiceData%u is %s", pStep, rPath.c_str (), nTG+1,
+		       bFilled ? "not loaded" : "not in the file");
+
+		CHECK (   !bFilled
+		       || memcmp (VoiceData, rPerformance.VoiceData[nTG], NUM_VOICE_PARAM) == 0,
+		       "%s: %s: VoiceData%u differs", pStep, rPath.c_str (), nTG+1);
+	}
+}
+
+static void Process (CPerformanceConfig *pConfig)
+{
+	for (unsigned i = 0; i < 1000000 && pConfig->IsSaving (); i++)
+	{
+		pConfig->Process ();
+	}
+}
+
+int main (int argc, char **argv)
+{
+	std::string Dir (argc > 1 ? argv[1] : "build/performance-sd");
+
+	CLogger::Get ()->SetLevel (LogWarning);
+
+	char WorkDir[PATH_MAX];
+	unsigned nFiles = CreateFixture (Dir);
+	if (   !getcwd (WorkDir, sizeof WorkDir)
+	    || chdir (Dir.c_str ()) != 0)
+	{
+		perror (Dir.c_str ());
+
+		return 1;
+	}
+
+	FATFS FileSystem;
+
+	TTiming List = {"list (scan)"};
+	TTiming ParseINI = {"read INI"};
+	TTiming ReadSnapshot = {"read snapshot"};
+	TTiming Serialise = {"serialise"};
+	TTiming Parse = {"parse"};
+	TTiming SaveFull = {"save whole file"};
+	TTiming SaveChanged = {"save changed"};
+
+	// the text of the original files and the performances read from them
+	std::vector<std::string> Original;
+	std::vector<TPerformance> Expected;
+
+	{
+		CPerformanceConfig Config (&FileSystem);
+
+		unsigned nStartTicks = CTimer::GetClockTicks ();
+		CHECK (Config.ListPerformances (), "No performance directory");
+		List.Add (nStartTicks);
+
+		CHECK (Config.GetLastPerformance () == nFiles, "%u performances listed, %u expected",
+		       Config.GetLastPerformance (), nFiles);
+
+		Original.resize (Config.GetLastPerformance ());
+		Expected.resize (Config.GetLastPerformance ());
+
+		for (unsigned nID = 0; nID < Config.GetLastPerformance (); nID++)
+		{
+			std::string Path = GetPath (&Config, nID);
+			CHECK (ReadFile (Path, &Original[nID]), "%s: Cannot read", Path.c_str ());
+
+			memset (&Expected[nID], 0, sizeof Expected[nID]);
+			nStartTicks = CTimer::GetClockTicks ();
+			CHECK (Config.ReadPerformance (nID, &Expected[nID]), "%s: Cannot load", Path.c_str ());
+			ParseINI.Add (nStartTicks);
+
+			CheckVoiceData ("read INI", Path, Original[nID], Expected[nID]);
+
+			// all values must survive the round-trip through the INI format
+			std::string Text[2];
+			nStartTicks = CTimer::GetClockTicks ();
+			CPerformanceConfig::Serialise (Expected[nID], &Text[0]);
+			Serialise.Add (nStartTicks);
+
+			TPerformance Performance;
+			nStartTicks = CTimer::GetClockTicks ();
+			CHECK (Config.ParsePerformance (Text[0], &Performance), "%s: Cannot parse", Path.c_str ());
+			Parse.Add (nStartTicks);
+
+			CPerformanceConfig::Serialise (Performance, &Text[1]);
+			CHECK (Text[0] == Text[1], "%s: Changed by round-trip", Path.c_str ());
+			CheckVoiceData ("round-trip", Path, Original[nID], Performance);
+		}
+	}
+
+	// the snapshots have been written by the first read
+	{
+		CPerformanceConfig Config (&FileSystem);
+		Config.ListPerformances ();
+
+		for (unsigned nID = 0; nID < Config.GetLastPerformance (); nID++)
+		{
+			std::string Path = GetPath (&Config, nID);
+
+			TPerformance Performance;
+			memset (&Performance, 0, sizeof Performance);
+			unsigned nStartTicks = CTimer::GetClockTicks ();
+			CHECK (Config.ReadPerformance (nID, &Performance), "%s: Cannot load", Path.c_str ());
+			ReadSnapshot.Add (nStartTicks);
+
+			CHECK (memcmp (&Performance, &Expected[nID], sizeof Performance) == 0,
+			       "%s: Snapshot differs", Path.c_str ());
+		}
+
+		CPerformanceConfig::TStatistics Statistics;
+		Config.GetStatistics (&Statistics);
+		CHECK (Statistics.nSnapshotReads == Config.GetLastPerformance (),
+		       "%u snapshots read", Statistics.nSnapshotReads);
+	}
+
+	// save each performance with a change and with the change undone
+	{
+		CPerformanceConfig Config (&FileSystem);
+		Config.ListPerformances ();
+
+		for (unsigned nID = 0; nID < Config.GetLastPerformance (); nID++)
+		{
+			std::string Path = GetPath (&Config, nID);
+
+			Config.SetNewPerformance (nID);
+			Config.Load ();
+
+			unsigned nVolume = Config.GetVolume (0);
+			for (unsigned i = 0; i < 2; i++)
+			{
+				Config.SetVolume (i ? nVolume : nVolume ^ 1, 0);
+
+				unsigned nStartTicks = CTimer::GetClockTicks ();
+				CHECK (Config.Save (), "%s: Cannot save", Path.c_str ());
+				Process (&Config);
+				(i ? SaveChanged : SaveFull).Add (nStartTicks);
+
+				CHECK (Config.GetSaveStatus () == CPerformanceConfig::SaveCompleted,
+				       "%s: Save failed", Path.c_str ());
+			}
+
+			// the saved file has the original values, parsed from the file itself
+			std::string Text;
+			ReadFile (Path, &Text);
+			CheckVoiceData ("save", Path, Text, Expected[nID]);
+
+			TPerformance Performance;
+			CHECK (Config.ParsePerformance (Text, &Performance), "%s: Cannot parse", Path.c_str ());
+
+			std::string Saved, Read;
+			CPerformanceConfig::Serialise (Expected[nID], &Saved);
+			CPerformanceConfig::Serialise (Performance, &Read);
+			CHECK (Saved == Read, "%s: Changed by save", Path.c_str ());
+		}
+
+		CPerformanceConfig::TStatistics Statistics;
+		Config.GetStatistics (&Statistics);
+		CHECK (Statistics.nSaves == 2 * Config.GetLastPerformance (), "%u saves", Statistics.nSaves);
+		printf ("%u performances, %u chunks written\n", Config.GetLastPerformance (),
+			Statistics.nChunksWritten);
+	}
+
+	printf ("%-16s %8s %10s %10s\n", "step", "count", "avg us", "max us");
+	List.Print ();
+	ParseINI.Print ();
+	ReadSnapshot.Print ();
+	Serialise.Print ();
+	Parse.Print ();
+	SaveFull.Print ();
+	SaveChanged.Print ();
+
+	if (chdir (WorkDir) == 0)
+	{
+		RemoveTree (Dir);
+	}
+
+	printf ("%s\n", s_nErrors ? "FAILED" : "PASSED");
+
+	return s_nErrors ? 1 : 0;
+}
@@ -0,0 +1,31 @@
+//
+// propertiesfatfsfile.h
+//
+// Host build of the MiniDexed tests: subset of the Circle API (read only)
+//
+#ifndef _Properties_propertiesfatfsfile_h
+#define _Properties_propertiesfatfsfile_h
+
+#include <circle/string.h>
+#include <fatfs/ff.h>
+#include <map>
+#include <string>
+#include <assert.h>
+
+class CPropertiesFatFsFile
+{
+public:
+	CPropertiesFatFsFile (const char *pFileName, FATFS *pFileSystem);
+
+	bool Load (void);		// "Name=Value" lines, '#' starts a comment line
+
+	const char *GetString (const char *pPropertyName, const char *pDefault = 0) const;
+	unsigned GetNumber (const char *pPropertyName, unsigned nDefault = 0) const;
+	int GetSignedNumber (const char *pPropertyName, int nDefault = 0) const;
+
+private:
+	std::string m_FileName;
+	std::map<std::string, std::string> m_Properties;
+};
+
+#endif
@@ -0,0 +1,13 @@
+//
+// interrupt.h
+//
+// Host build of the MiniDexed tests: subset of the Circle API
+//
+#ifndef _circle_interrupt_h
+#define _circle_interrupt_h
+
+class CInterruptSystem
+{
+};
+
+#endif
@@ -0,0 +1,12 @@
+//
+// macros.h
+//
+// Host build of the MiniDexed tests: subset of the Circle API
+//
+#ifndef _circle_macros_h
+#define _circle_macros_h
+
+#define PACKED		__attribute__ ((packed))
+#define ALIGN(n)	__attribute__ ((aligned (n)))
+
+#endif
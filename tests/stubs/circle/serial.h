@@ -0,0 +1,37 @@
+//
+// serial.h
+//
+// Host build of the MiniDexed tests: subset of the Circle API
+//
+#ifndef _circle_serial_h
+#define _circle_serial_h
+
+#include <circle/device.h>
+#include <circle/interrupt.h>
+#include <circle/types.h>
+
+#define SERIAL_OPTION_ONLCR	(1 << 0)
+
+class CSerialDevice : public CDevice	// receives the data given to SetReceiveData()
+{
+public:
+	CSerialDevice (CInterruptSystem *pInterruptSystem = 0, boolean bUseFIQ = FALSE,
+		       unsigned nDevice = 0) {}
+
+	boolean Initialize (unsigned nBaudrate = 115200)	{ return TRUE; }
+
+	int Read (void *pBuffer, size_t nCount) override;
+	int Write (const void *pBuffer, size_t nCount) override	{ return (int) nCount; }
+
+	unsigned GetOptions (void) const		{ return SERIAL_OPTION_ONLCR; }
+	void SetOptions (unsigned nOptions)		{}
+
+	static void SetReceiveData (const u8 *pData, size_t nLength);
+	static size_t GetReceiveDataLeft (void);
+
+private:
+	static const u8 *s_pReceiveData;
+	static size_t s_nReceiveLength;
+};
+
+#endif
@@ -0,0 +1,38 @@
+//
+// spinlock.h
+//
+// Host build of the MiniDexed tests: subset of the Circle API
+//
+#ifndef _circle_spinlock_h
+#define _circle_spinlock_h
+
+#include <circle/types.h>
+#include <atomic>
+
+#define TASK_LEVEL		0
+#define IRQ_LEVEL		1
+#define FIQ_LEVEL		2
+
+class CSpinLock		// between threads, the execution level is ignored
+{
+public:
+	CSpinLock (unsigned nTargetLevel = IRQ_LEVEL) {}
+
+	void Acquire (void)
+	{
+		while (m_Lock.test_and_set (std::memory_order_acquire))
+		{
+			// just wait
+		}
+	}
+
+	void Release (void)
+	{
+		m_Lock.clear (std::memory_order_release);
+	}
+
+private:
+	std::atomic_flag m_Lock = ATOMIC_FLAG_INIT;
+};
+
+#endif
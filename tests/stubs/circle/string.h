@@ -0,0 +1,37 @@
+//
+// string.h
+//
+// Host build of the MiniDexed tests: subset of the Circle API
+//
+#ifndef _circle_string_h
+#define _circle_string_h
+
+#include <string>
+#include <stdarg.h>
+#include <stdio.h>
+
+class CString
+{
+public:
+	operator const char *(void) const
+	{
+		return m_String.c_str ();
+	}
+
+	void Format (const char *pFormat, ...) __attribute__ ((format (printf, 2, 3)))
+	{
+		char Buffer[1000];
+
+		va_list var;
+		va_start (var, pFormat);
+		vsnprintf (Buffer, sizeof Buffer, pFormat, var);
+		va_end (var);
+
+		m_String = Buffer;
+	}
+
+private:
+	std::string m_String;
+};
+
+#endif
@@ -0,0 +1,19 @@
+//
+// timer.h
+//
+// Host build of the MiniDexed tests: subset of the Circle API
+//
+#ifndef _circle_timer_h
+#define _circle_timer_h
+
+#include <circle/types.h>
+
+#define CLOCKHZ		1000000		// microseconds
+
+class CTimer
+{
+public:
+	static unsigned GetClockTicks (void);		// from the host monotonic clock
+};
+
+#endif
@@ -0,0 +1,21 @@
+//
+// writebuffer.h
+//
+// Host build of the MiniDexed tests: subset of the Circle API
+//
+#ifndef _circle_writebuffer_h
+#define _circle_writebuffer_h
+
+#include <circle/device.h>
+
+class CWriteBufferDevice : public CDevice	// discards the written data
+{
+public:
+	CWriteBufferDevice (CDevice *pDevice, unsigned nThresholdWrite = 0) {}
+
+	int Write (const void *pBuffer, size_t nCount) override	{ return (int) nCount; }
+
+	void Update (void) {}
+};
+
+#endif
@@ -0,0 +1,286 @@
+//
+// fatfs.cpp
+//
+// Host build of the MiniDexed tests: FatFs API subset on top of POSIX.
+// A leading "SD:" of a path is removed, so that "SD:/x" is "./x".
+//
+#include <dirent.h>
+#include <fnmatch.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <string.h>
+
+typedef DIR TPosixDir;
+#define DIR FF_DIR_TYPE
+#include <fatfs/ff.h>
+#undef DIR
+
+static const char *HostPath (const TCHAR *pPath)
+{
+	if (strncmp (pPath, "SD:/", 4) == 0)
+	{
+		return pPath + 4;
+	}
+
+	return pPath;
+}
+
+static void GetFileInfo (const char *pPath, const char *pName, const struct stat *pStat,
+			 FILINFO *pInfo)
+{
+	strncpy (pInfo->fname, pName, sizeof pInfo->fname - 1);
+	pInfo->fname[sizeof pInfo->fname - 1] = '\0';
+
+	pInfo->fsize = S_ISDIR (pStat->st_mode) ? 0 : pStat->st_size;
+	pInfo->fattrib = S_ISDIR (pStat->st_mode) ? AM_DIR : AM_ARC;
+
+	struct tm Time;
+	localtime_r (&pStat->st_mtime, &Time);
+	pInfo->fdate = (Time.tm_year - 80) << 9 | (Time.tm_mon + 1) << 5 | Time.tm_mday;
+	pInfo->ftime = Time.tm_hour << 11 | Time.tm_min << 5 | Time.tm_sec / 2;
+}
+
+FRESULT f_open (FIL *fp, const TCHAR *path, BYTE mode)
+{
+	const char *pPath = HostPath (path);
+
+	const char *pMode = "rb";
+	if (mode & FA_WRITE)
+	{
+		if (mode & FA_CREATE_ALWAYS)
+		{
+			pMode = "w+b";
+		}
+		else if (mode & FA_CREATE_NEW)
+		{
+			if (access (pPath, F_OK) == 0)
+			{
+				return FR_EXIST;
+			}
+
+			pMode = "w+b";
+		}
+		else
+		{
+			pMode = "r+b";
+			if (   (mode & FA_OPEN_ALWAYS)
+			    && access (pPath, F_OK) != 0)
+			{
+				pMode = "w+b";
+			}
+		}
+	}
+
+	fp->pFile = fopen (pPath, pMode);
+	if (!fp->pFile)
+	{
+		return access (pPath, F_OK) == 0 ? FR_DENIED : FR_NO_FILE;
+	}
+
+	struct stat Stat;
+	fstat (fileno (fp->pFile), &Stat);
+	fp->objsize = Stat.st_size;
+	fp->fptr = 0;
+
+	if ((mode & FA_OPEN_APPEND) == FA_OPEN_APPEND)
+	{
+		return f_lseek (fp, fp->objsize);
+	}
+
+	return FR_OK;
+}
+
+FRESULT f_close (FIL *fp)
+{
+	FRESULT Result = fclose (fp->pFile) == 0 ? FR_OK : FR_DISK_ERR;
+	fp->pFile = 0;
+
+	return Result;
+}
+
+FRESULT f_read (FIL *fp, void *buff, UINT btr, UINT *br)
+{
+	*br = fread (buff, 1, btr, fp->pFile);
+	fp->fptr += *br;
+
+	return ferror (fp->pFile) ? FR_DISK_ERR : FR_OK;
+}
+
+FRESULT f_write (FIL *fp, const void *buff, UINT btw, UINT *bw)
+{
+	*bw = fwrite (buff, 1, btw, fp->pFile);
+	fp->fptr += *bw;
+	if (fp->fptr > fp->objsize)
+	{
+		fp->objsize = fp->fptr;
+	}
+
+	return *bw == btw ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_lseek (FIL *fp, FSIZE_t ofs)
+{
+	if (fseek (fp->pFile, ofs, SEEK_SET) != 0)
+	{
+		return FR_DISK_ERR;
+	}
+
+	fp->fptr = ofs;
+
+	return FR_OK;
+}
+
+FRESULT f_truncate (FIL *fp)
+{
+	fflush (fp->pFile);
+	if (ftruncate (fileno (fp->pFile), fp->fptr) != 0)
+	{
+		return FR_DISK_ERR;
+	}
+
+	fp->objsize = fp->fptr;
+
+	return FR_OK;
+}
+
+FRESULT f_sync (FIL *fp)
+{
+	return fflush (fp->pFile) == 0 ? FR_OK : FR_DISK_ERR;
+}
+
+FRESULT f_opendir (FF_DIR *dp, const TCHAR *path)
+{
+	const char *pPath = HostPath (path);
+
+	TPosixDir *pDir = opendir (*pPath ? pPath : ".");
+	if (!pDir)
+	{
+		return FR_NO_PATH;
+	}
+
+	dp->pDir = pDir;
+	strncpy (dp->Path, *pPath ? pPath : ".", sizeof dp->Path - 1);
+	dp->Path[sizeof dp->Path - 1] = '\0';
+	dp->Pattern[0] = '\0';
+
+	return FR_OK;
+}
+
+FRESULT f_closedir (FF_DIR *dp)
+{
+	closedir ((TPosixDir *) dp->pDir);
+	dp->pDir = 0;
+
+	return FR_OK;
+}
+
+FRESULT f_readdir (FF_DIR *dp, FILINFO *fno)
+{
+	struct dirent *pEntry;
+	do
+	{
+		pEntry = readdir ((TPosixDir *) dp->pDir);
+	}
+	while (   pEntry
+	       && (   strcmp (pEntry->d_name, ".") == 0
+		   || strcmp (pEntry->d_name, "..") == 0));
+
+	if (!pEntry)
+	{
+		fno->fname[0] = '\0';
+
+		return FR_OK;
+	}
+
+	char Path[1024];
+	snprintf (Path, sizeof Path, "%s/%s", dp->Path, pEntry->d_name);
+
+	struct stat Stat;
+	if (stat (Path, &Stat) != 0)
+	{
+		return FR_DISK_ERR;
+	}
+
+	GetFileInfo (Path, pEntry->d_name, &Stat, fno);
+
+	return FR_OK;
+}
+
+FRESULT f_findfirst (FF_DIR *dp, FILINFO *fno, const TCHAR *path, const TCHAR *pattern)
+{
+	FRESULT Result = f_opendir (dp, path);
+	if (Result != FR_OK)
+	{
+		return Result;
+	}
+
+	strncpy (dp->Pattern, pattern, sizeof dp->Pattern - 1);
+	dp->Pattern[sizeof dp->Pattern - 1] = '\0';
+
+	return f_findnext (dp, fno);
+}
+
+FRESULT f_findnext (FF_DIR *dp, FILINFO *fno)
+{
+	FRESULT Result;
+	do
+	{
+		Result = f_readdir (dp, fno);
+	}
+	while (   Result == FR_OK
+	       && fno->fname[0]
+	       && fnmatch (dp->Pattern, fno->fname, FNM_CASEFOLD) != 0);
+
+	return Result;
+}
+
+FRESULT f_mkdir (const TCHAR *path)
+{
+	if (mkdir (HostPath (path), 0777) != 0)
+	{
+		return access (HostPath (path), F_OK) == 0 ? FR_EXIST : FR_NO_PATH;
+	}
+
+	return FR_OK;
+}
+
+FRESULT f_unlink (const TCHAR *path)
+{
+	const char *pPath = HostPath (path);
+
+	if (access (pPath, F_OK) != 0)
+	{
+		return FR_NO_FILE;
+	}
+
+	return remove (pPath) == 0 ? FR_OK : FR_DENIED;
+}
+
+FRESULT f_rename (const TCHAR *path_old, const TCHAR *path_new)
+{
+	const char *pNew = HostPath (path_new);
+
+	if (access (pNew, F_OK) == 0)
+	{
+		return FR_EXIST;			// like FatFs
+	}
+
+	return rename (HostPath (path_old), pNew) == 0 ? FR_OK : FR_NO_FILE;
+}
+
+FRESULT f_stat (const TCHAR *path, FILINFO *fno)
+{
+	const char *pPath = HostPath (path);
+
+	struct stat Stat;
+	if (stat (pPath, &Stat) != 0)
+	{
+		return FR_NO_FILE;
+	}
+
+	const char *pName = strrchr (pPath, '/');
+	GetFileInfo (pPath, pName ? pName+1 : pPath, &Stat, fno);
+
+	return FR_OK;
+}
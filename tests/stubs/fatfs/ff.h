@@ -0,0 +1,96 @@
+//
+// ff.h
+//
+// Host build of the MiniDexed tests: subset of the FatFs API,
+// implemented on top of POSIX in fatfs.cpp
+//
+#ifndef _fatfs_ff_h
+#define _fatfs_ff_h
+
+#include <stdint.h>
+#include <stdio.h>
+
+typedef unsigned	UINT;
+typedef uint8_t		BYTE;
+typedef uint16_t	WORD;
+typedef uint32_t	DWORD;
+typedef uint64_t	FSIZE_t;
+typedef char		TCHAR;
+
+typedef enum
+{
+	FR_OK = 0,
+	FR_DISK_ERR,
+	FR_INT_ERR,
+	FR_NOT_READY,
+	FR_NO_FILE,
+	FR_NO_PATH,
+	FR_INVALID_NAME,
+	FR_DENIED,
+	FR_EXIST
+}
+FRESULT;
+
+struct FATFS
+{
+};
+
+struct FIL
+{
+	FILE	*pFile;
+	FSIZE_t	fptr;
+	FSIZE_t	objsize;
+};
+
+struct FF_DIR		// "DIR" clashes with <dirent.h> in fatfs.cpp
+{
+	void	*pDir;
+	TCHAR	Path[512];
+	TCHAR	Pattern[64];
+};
+typedef FF_DIR DIR;
+
+struct FILINFO
+{
+	FSIZE_t	fsize;
+	WORD	fdate;
+	WORD	ftime;
+	BYTE	fattrib;
+	TCHAR	fname[256];
+};
+
+#define FA_READ			0x01
+#define FA_WRITE		0x02
+#define FA_OPEN_EXISTING	0x00
+#define FA_CREATE_NEW		0x04
+#define FA_CREATE_ALWAYS	0x08
+#define FA_OPEN_ALWAYS		0x10
+#define FA_OPEN_APPEND		0x30
+
+#define AM_RDO			0x01
+#define AM_HID			0x02
+#define AM_SYS			0x04
+#define AM_DIR			0x10
+#define AM_ARC			0x20
+
+FRESULT f_open (FIL *fp, const TCHAR *path, BYTE mode);
+FRESULT f_close (FIL *fp);
+FRESULT f_read (FIL *fp, void *buff, UINT btr, UINT *br);
+FRESULT f_write (FIL *fp, const void *buff, UINT btw, UINT *bw);
+FRESULT f_lseek (FIL *fp, FSIZE_t ofs);
+FRESULT f_truncate (FIL *fp);
+FRESULT f_sync (FIL *fp);
+FRESULT f_opendir (DIR *dp, const TCHAR *path);
+FRESULT f_closedir (DIR *dp);
+FRESULT f_readdir (DIR *dp, FILINFO *fno);
+FRESULT f_findfirst (DIR *dp, FILINFO *fno, const TCHAR *path, const TCHAR *pattern);
+FRESULT f_findnext (DIR *dp, FILINFO *fno);
+FRESULT f_mkdir (const TCHAR *path);
+FRESULT f_unlink (const TCHAR *path);
+FRESULT f_rename (const TCHAR *path_old, const TCHAR *path_new);
+FRESULT f_stat (const TCHAR *path, FILINFO *fno);
+
+#define f_size(fp)	((fp)->objsize)
+#define f_tell(fp)	((fp)->fptr)
+
+#endif
@@ -0,0 +1,78 @@
+//
+// host.cpp
+//
+// Host build of the MiniDexed tests: implementation of the Circle API subset
+//
+#include <circle/logger.h>
+#include <circle/timer.h>
+#include <circle/serial.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <time.h>
+
+CLogger *CLogger::Get (void)
+{
+	static CLogger s_Logger;
+
+	return &s_Logger;
+}
+
+void CLogger::Write (const char *pSource, TLogSeverity Severity, const char *pMessage, ...)
+{
+	if (Severity > m_Level)
+	{
+		return;
+	}
+
+	static const char Prefix[] = "PEWND";
+	fprintf (stderr, "%c %s: ", Prefix[Severity], pSource);
+
+	va_list var;
+	va_start (var, pMessage);
+	vfprintf (stderr, pMessage, var);
+	va_end (var);
+
+	fputc ('\n', stderr);
+}
+
+void CLogger::SetLevel (TLogSeverity Level)
+{
+	m_Level = Level;
+}
+
+unsigned CTimer::GetClockTicks (void)
+{
+	struct timespec Time;
+	clock_gettime (CLOCK_MONOTONIC, &Time);
+
+	return (unsigned) ((uint64_t) Time.tv_sec * CLOCKHZ + Time.tv_nsec / (1000000000 / CLOCKHZ));
+}
+
+const u8 *CSerialDevice::s_pReceiveData = 0;
+size_t CSerialDevice::s_nReceiveLength = 0;
+
+int CSerialDevice::Read (void *pBuffer, size_t nCount)
+{
+	if (nCount > s_nReceiveLength)
+	{
+		nCount = s_nReceiveLength;
+	}
+
+	memcpy (pBuffer, s_pReceiveData, nCount);
+	s_pReceiveData += nCount;
+	s_nReceiveLength -= nCount;
+
+	return (int) nCount;
+}
+
+void CSerialDevice::SetReceiveData (const u8 *pData, size_t nLength)
+{
+	s_pReceiveData = pData;
+	s_nReceiveLength = nLength;
+}
+
+size_t CSerialDevice::GetReceiveDataLeft (void)
+{
+	return s_nReceiveLength;
+}
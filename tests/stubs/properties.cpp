@@ -0,0 +1,113 @@
+//
+// properties.cpp
+//
+// Host build of the MiniDexed tests: implementation of CPropertiesFatFsFile
+//
+#include <Properties/propertiesfatfsfile.h>
+#include <stdlib.h>
+
+CPropertiesFatFsFile::CPropertiesFatFsFile (const char *pFileName, FATFS *pFileSystem)
+:	m_FileName (pFileName)
+{
+}
+
+bool CPropertiesFatFsFile::Load (void)
+{
+	m_Properties.clear ();
+
+	FIL File;
+	if (f_open (&File, m_FileName.c_str (), FA_READ | FA_OPEN_EXISTING) != FR_OK)
+	{
+		return false;
+	}
+
+	std::string Text (f_size (&File), '\0');
+	UINT nRead;
+	bool bOK =    f_read (&File, &Text[0], Text.length (), &nRead) == FR_OK
+		   && nRead == Text.length ();
+
+	f_close (&File);
+
+	if (!bOK)
+	{
+		return false;
+	}
+
+	size_t nPos = 0;
+	while (nPos < Text.length ())
+	{
+		size_t nEnd = Text.find ('\n', nPos);
+		if (nEnd == std::string::npos)
+		{
+			nEnd = Text.length ();
+		}
+
+		std::string Line = Text.substr (nPos, nEnd - nPos);
+		nPos = nEnd + 1;
+
+		if (!Line.empty () && Line.back () == '\r')
+		{
+			Line.pop_back ();
+		}
+
+		size_t nEqual = Line.find ('=');
+		if (   Line.empty ()
+		    || Line[0] == '#'
+		    || nEqual == std::string::npos
+		    || nEqual == 0)
+		{
+			continue;
+		}
+
+		m_Properties[Line.substr (0, nEqual)] = Line.substr (nEqual + 1);
+	}
+
+	return true;
+}
+
+const char *CPropertiesFatFsFile::GetString (const char *pPropertyName, const char *pDefault) const
+{
+	auto Iterator = m_Properties.find (pPropertyName);
+	if (Iterator == m_Properties.end ())
+	{
+		return pDefault;
+	}
+
+	return Iterator->second.c_str ();
+}
+
+unsigned CPropertiesFatFsFile::GetNumber (const char *pPropertyName, unsigned nDefault) const
+{
+	const char *pValue = GetString (pPropertyName);
+	if (!pValue || !*pValue)
+	{
+		return nDefault;
+	}
+
+	char *pEnd;
+	unsigned long ulValue = strtoul (pValue, &pEnd, 10);
+	if (*pEnd)
+	{
+		return nDefault;
+	}
+
+	return (unsigned) ulValue;
+}
+
+int CPropertiesFatFsFile::GetSignedNumber (const char *pPropertyName, int nDefault) const
+{
+	const char *pValue = GetString (pPropertyName);
+	if (!pValue || !*pValue)
+	{
+		return nDefault;
+	}
+
+	char *pEnd;
+	long lValue = strtol (pValue, &pEnd, 10);
+	if (*pEnd)
+	{
+		return nDefault;
+	}
+
+	return (int) lValue;
+}
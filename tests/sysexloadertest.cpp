@@ -0,0 +1,620 @@
+//
+// sysexloadertest.cpp
+//
+// MiniDexed - Dexed FM synthesizer for bare metal Raspberry Pi
+// Copyright (C) 2022  The MiniDexed Team
+//
+// This program is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Correctness and timing of CSysExFileLoader on the host. A fixture tree of
+// bank files is generated from known voices, including malformed, truncated,
+// headerless and duplicate banks, invalid file names and a too deeply nested
+// directory. It is loaded serially, with worker threads, from the index, from
+// a library built by syx2lib.py and by a rescan after changes. Each time all
+// voices are read with GetVoice() and must be byte-identical to the generated
+// ones. Banks share voices, so that these are taken from the voice pool, and
+// there are more banks than fit into the bank cache.
+//
+// Usage: sysexloadertest [banks [directory]] (to be run in tests/)
+
+#include "sysexfileloader.h"
+#include <circle/logger.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include <assert.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <utime.h>
+
+#define SYX2LIB		"../syx2lib.py"
+
+static const unsigned SizeVoice = CSysExFileLoader::SizeSingleVoice;
+static const unsigned VoicesPerBank = CSysExFileLoader::VoicesPerBank;
+static const unsigned LoadWorkers = 3;
+
+typedef std::vector<uint8_t> TVoice;		// unpacked format
+typedef std::vector<TVoice> TBankVoices;
+
+struct TExpectedBank
+{
+	std::string Name;
+	std::vector<TBankVoices> Candidates;	// more than one for duplicate bank numbers
+};
+
+typedef std::map<unsigned, TExpectedBank> TModel;	// bank ID (0-based) -> bank
+typedef std::map<unsigned, std::string> TSnapshot;	// bank ID -> name and voices
+
+static unsigned s_nErrors = 0;
+
+#define CHECK(cond, ...)	do { if (!(cond)) { s_nErrors++;				\
+					fprintf (stderr, "%s:%u: ", __FILE__, __LINE__);	\
+					fprintf (stderr, __VA_ARGS__);				\
+					fputc ('\n', stderr); } } while (0)
+
+// maximum values of the unpacked voice parameters (DX7 VCED)
+static const uint8_t VoiceMax[SizeVoice] =
+{
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 3, 3, 7, 3, 7, 99, 1, 31, 99, 14,	// OP6
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 3, 3, 7, 3, 7, 99, 1, 31, 99, 14,	// OP5
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 3, 3, 7, 3, 7, 99, 1, 31, 99, 14,	// OP4
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 3, 3, 7, 3, 7, 99, 1, 31, 99, 14,	// OP3
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 3, 3, 7, 3, 7, 99, 1, 31, 99, 14,	// OP2
+	99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 3, 3, 7, 3, 7, 99, 1, 31, 99, 14,	// OP1
+	99, 99, 99, 99, 99, 99, 99, 99,							// pitch EG
+	31, 7, 1, 99, 99, 99, 99, 1, 5, 7, 48,						// algorithm etc.
+	126, 126, 126, 126, 126, 126, 126, 126, 126, 126,				// name
+	127										// OP enable
+};
+
+static TVoice MakeVoice (unsigned nSeed)
+{
+	TVoice Voice (SizeVoice);
+
+	uint32_t nRandom = nSeed * 2654435761U + 1;
+	for (unsigned i = 0; i < 145; i++)
+	{
+		nRandom = nRandom * 1664525U + 1013904223U;
+		Voice[i] = (nRandom >> 16) % (VoiceMax[i] + 1);
+	}
+
+	char Name[11];
+	snprintf (Name, sizeof Name, "V%09u", nSeed);
+	memcpy (&Voice[145], Name, 10);
+
+	Voice[155] = 0x3F;		// all OPs enabled
+
+	return Voice;
+}
+
+// packed format (VMEM), independent of CSysExFileLoader::DecodePackedVoice()
+static void PackVoice (const TVoice &rVoice, uint8_t *pPacked)
+{
+	const uint8_t *u = rVoice.data ();
+	uint8_t *p = pPacked;
+
+	for (unsigned op = 0; op < 6; op++, u += 21, p += 17)
+	{
+		memcpy (p, u, 11);			// EG, break point and depths
+		p[11] = u[11] | u[12] << 2;		// curves
+		p[12] = u[13] | u[20] << 3;		// rate scaling, detune
+		p[13] = u[14] | u[15] << 2;		// AMS, key velocity sensitivity
+		p[14] = u[16];				// output level
+		p[15] = u[17] | u[18] << 1;		// mode, frequency coarse
+		p[16] = u[19];				// frequency fine
+	}
+
+	u = rVoice.data ();
+	p = pPacked;
+	memcpy (&p[102], &u[126], 9);			// pitch EG, algorithm
+	p[111] = u[135] | u[136] << 3;			// feedback, OSC key sync
+	memcpy (&p[112], &u[137], 4);			// LFO
+	p[116] = u[141] | u[142] << 1 | u[143] << 4;	// LFO sync, wave, PMS
+	memcpy (&p[117], &u[144], 11);			// transpose, name
+}
+
+static std::vector<uint8_t> MakeBankFile (const TBankVoices &rVoices)
+{
+	std::vector<uint8_t> File (sizeof (CSysExFileLoader::TVoiceBank));
+	File[0] = 0xF0;
+	File[1] = 0x43;
+	File[2] = 0x00;
+	File[3] = 0x09;
+	File[4] = 0x20;
+	File[5] = 0x00;
+
+	uint8_t uchSum = 0;
+	for (unsigned i = 0; i < VoicesPerBank; i++)
+	{
+		uint8_t *pPacked = &File[6 + i*CSysExFileLoader::SizePackedVoice];
+		PackVoice (rVoices[i], pPacked);
+
+		for (unsigned j = 0; j < CSysExFileLoader::SizePackedVoice; j++)
+		{
+			uchSum += pPacked[j];
+		}
+	}
+
+	File[6+4096] = -uchSum & 0x7F;
+	File[6+4096+1] = 0xF7;
+
+	return File;
+}
+
+static void WriteFile (const std::string &rPath, const std::vector<uint8_t> &rData)
+{
+	FILE *pFile = fopen (rPath.c_str (), "wb");
+	if (!pFile)
+	{
+		perror (rPath.c_str ());
+		exit (1);
+	}
+
+	if (!rData.empty ())
+	{
+		fwrite (rData.data (), rData.size (), 1, pFile);
+	}
+
+	fclose (pFile);
+}
+
+static int RemoveEntry (const char *pPath, const struct stat *pStat, int nFlag, struct FTW *pFTW)
+{
+	return remove (pPath);
+}
+
+static void RemoveTree (const std::string &rPath)
+{
+	nftw (rPath.c_str (), RemoveEntry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static bool Exists (const std::string &rPath)
+{
+	return access (rPath.c_str (), F_OK) == 0;
+}
+
+// voices of bank n (1-based): every 10th bank is a copy of the previous one
+// and the last four voices are the same in all banks, so that voices are pooled
+static TBankVoices MakeBankVoices (unsigned nBank, unsigned nVariant = 0)
+{
+	if (nBank % 10 == 0 && !nVariant)
+	{
+		nBank--;
+	}
+
+	TBankVoices Voices;
+	for (unsigned i = 0; i < VoicesPerBank; i++)
+	{
+		Voices.push_back (MakeVoice (i >= 28 ? 1000000 + i : (nBank*VoicesPerBank + i) * 4 + nVariant));
+	}
+
+	return Voices;
+}
+
+static void AddBank (TModel *pModel, const std::string &rDir, const std::string &rSubDir,
+		     unsigned nBank, const char *pName, const TBankVoices &rVoices)
+{
+	char FileName[100];
+	snprintf (FileName, sizeof FileName, "%06u_%s.syx", nBank, pName);
+
+	std::string Path (rDir + "/voice/");
+	if (!rSubDir.empty ())
+	{
+		Path += rSubDir + "/";
+	}
+
+	WriteFile (Path + FileName, MakeBankFile (rVoices));
+
+	TExpectedBank &rBank = (*pModel)[nBank-1];
+	rBank.Name = pName;
+	rBank.Candidates.push_back (rVoices);
+}
+
+struct TFixture
+{
+	unsigned nBanks;		// valid bank numbers 1 .. nBanks
+	unsigned nFirstInvalid;		// bank number of the first malformed file
+	unsigned nHeaderless;		// bank number of the headerless file
+	unsigned nDeep;			// bank number in a too deeply nested directory
+	unsigned nDuplicate;		// bank number with two files
+	unsigned nInvalidFiles;		// without headerless banks
+	TModel Model;
+};
+
+static void CreateFixture (const std::string &rDir, unsigned nBanks, TFixture *pFixture)
+{
+	RemoveTree (rDir);
+
+	static const char *SubDirs[] = {"", "a", "a/b", "a/b/c", "a/b/c/d"};	// the last is skipped
+	mkdir (rDir.c_str (), 0777);
+	mkdir ((rDir + "/voice").c_str (), 0777);
+	for (unsigned i = 1; i < 5; i++)
+	{
+		mkdir ((rDir + "/voice/" + SubDirs[i]).c_str (), 0777);
+	}
+
+	pFixture->nBanks = nBanks;
+	TModel &rModel = pFixture->Model;
+
+	for (unsigned nBank = 1; nBank <= nBanks; nBank++)
+	{
+		char Name[20];
+		snprintf (Name, sizeof Name, "Bank%u", nBank);
+
+		AddBank (&rModel, rDir, SubDirs[nBank % 4], nBank, Name, MakeBankVoices (nBank));
+	}
+
+	// same bank number in another directory, one of both is loaded
+	pFixture->nDuplicate = 10;
+	AddBank (&rModel, rDir, "", pFixture->nDuplicate, "Bank10",
+		 MakeBankVoices (pFixture->nDuplicate, 1));
+
+	pFixture->nDeep = nBanks + 100;
+	AddBank (&rModel, rDir, SubDirs[4], pFixture->nDeep, "Deep", MakeBankVoices (pFixture->nDeep));
+	rModel.erase (pFixture->nDeep-1);
+
+	// malformed files
+	unsigned nBank = nBanks + 1;
+	pFixture->nFirstInvalid = nBank;
+	std::string Path (rDir + "/voice/");
+	char FileName[100];
+
+	std::vector<uint8_t> Data = MakeBankFile (MakeBankVoices (nBank));
+	Data[0] = 0x00;
+	snprintf (FileName, sizeof FileName, "%06u_BadStart.syx", nBank++);
+	WriteFile (Path + FileName, Data);
+
+	Data = MakeBankFile (MakeBankVoices (nBank));
+	Data.resize (2000);
+	snprintf (FileName, sizeof FileName, "%06u_Truncated.syx", nBank++);
+	WriteFile (Path + FileName, Data);
+
+	Data = MakeBankFile (MakeBankVoices (nBank));
+	Data.back () = 0x00;
+	snprintf (FileName, sizeof FileName, "%06u_BadEnd.syx", nBank++);
+	WriteFile (Path + FileName, Data);
+
+	snprintf (FileName, sizeof FileName, "%06u_Empty.syx", nBank++);
+	WriteFile (Path + FileName, std::vector<uint8_t> ());
+
+	// valid with HeaderlessSysExVoices=1 only
+	pFixture->nHeaderless = nBank;
+	Data = MakeBankFile (MakeBankVoices (nBank));
+	Data.erase (Data.begin (), Data.begin () + 6);
+	Data.resize (4096);
+	snprintf (FileName, sizeof FileName, "%06u_Headerless.syx", nBank++);
+	WriteFile (Path + FileName, Data);
+
+	// invalid file names and bank numbers
+	WriteFile (Path + "abc.syx", MakeBankFile (MakeBankVoices (1)));
+	WriteFile (Path + "readme.txt", std::vector<uint8_t> (10, 'x'));
+	WriteFile (Path + "000000_Zero.syx", MakeBankFile (MakeBankVoices (1)));
+	WriteFile (Path + "016385_Big.syx", MakeBankFile (MakeBankVoices (1)));
+
+	pFixture->nInvalidFiles = 5 + 4;
+}
+
+static TSnapshot TakeSnapshot (CSysExFileLoader *pLoader)
+{
+	TSnapshot Snapshot;
+
+	for (unsigned nBankID = 0; nBankID <= CSysExFileLoader::MaxVoiceBankID; nBankID++)
+	{
+		if (!pLoader->IsValidBank (nBankID))
+		{
+			continue;
+		}
+
+		std::string &rBank = Snapshot[nBankID];
+		rBank = pLoader->GetBankName (nBankID);
+		rBank += '\0';
+
+		for (unsigned i = 0; i < VoicesPerBank; i++)
+		{
+			uint8_t Voice[SizeVoice];
+			memset (Voice, 0xFF, sizeof Voice);
+			if (!pLoader->GetVoice (nBankID, i, Voice, true))
+			{
+				CHECK (0, "Bank #%u voice %u: GetVoice() failed", nBankID+1, i+1);
+			}
+
+			rBank.append ((const char *) Voice, sizeof Voice);
+		}
+	}
+
+	return Snapshot;
+}
+
+static void CheckModel (const char *pTest, const TSnapshot &rSnapshot, const TModel &rModel)
+{
+	CHECK (rSnapshot.size () == rModel.size (), "%s: %u banks loaded, %u expected",
+	       pTest, (unsigned) rSnapshot.size (), (unsigned) rModel.size ());
+
+	for (auto &rExpected : rModel)
+	{
+		auto Iterator = rSnapshot.find (rExpected.first);
+		if (Iterator == rSnapshot.end ())
+		{
+			CHECK (0, "%s: bank #%u missing", pTest, rExpected.first+1);
+
+			continue;
+		}
+
+		bool bMatch = false;
+		for (auto &rVoices : rExpected.second.Candidates)
+		{
+			std::string Bank (rExpected.second.Name);
+			Bank += '\0';
+			for (auto &rVoice : rVoices)
+			{
+				Bank.append ((const char *) rVoice.data (), rVoice.size ());
+			}
+
+			bMatch |= Bank == Iterator->second;
+		}
+
+		CHECK (bMatch, "%s: bank #%u differs", pTest, rExpected.first+1);
+	}
+}
+
+static void CheckStatistics (const char *pTest, CSysExFileLoader *pLoader, const TModel &rModel,
+			     unsigned nInvalidFiles)
+{
+	CSysExFileLoader::TLoadStatistics Statistics;
+	pLoader->GetLoadStatistics (&Statistics);
+
+	CHECK (Statistics.nBanks == rModel.size (), "%s: %u banks, %u expected",
+	       pTest, Statistics.nBanks, (unsigned) rModel.size ());
+	CHECK (Statistics.nInvalidFiles == nInvalidFiles, "%s: %u invalid files, %u expected",
+	       pTest, Statistics.nInvalidFiles, nInvalidFiles);
+	CHECK (Statistics.nDuplicates == 1, "%s: %u duplicates", pTest, Statistics.nDuplicates);
+	CHECK (Statistics.nSkippedDirs == 1, "%s: %u skipped directories", pTest, Statistics.nSkippedDirs);
+}
+
+static void Finish (CSysExFileLoader *pLoader, const std::string &rDir)
+{
+	// the background scan and the index are completed by Process()
+	for (unsigned i = 0; i < 1000000; i++)
+	{
+		pLoader->Process ();
+
+		if (   !pLoader->IsScanning ()
+		    && Exists (rDir + "/voice.idx")
+		    && !Exists (rDir + "/voice.idx.tmp"))
+		{
+			return;
+		}
+	}
+
+	CHECK (0, "Index has not been written");
+}
+
+static double Milliseconds (unsigned nTicks)
+{
+	return nTicks / 1000.0;
+}
+
+static void PrintTiming (const char *pTest, CSysExFileLoader *pLoader, unsigned nLoadTicks,
+			 unsigned nSnapshotTicks)
+{
+	CSysExFileLoader::TCacheStatistics Cache;
+	pLoader->GetCacheStatistics (&Cache);
+
+	printf ("%-12s %9.1f %9.1f %10.2f %8u %8u %8u %8u\n", pTest,
+		Milliseconds (nLoadTicks), Milliseconds (nSnapshotTicks),
+		Cache.nLookups ? (double) Cache.nLookupTicks / Cache.nLookups : 0.0,
+		Cache.nMisses, Cache.nEvictions, Cache.nVoices, Cache.nUniqueVoices);
+}
+
+static TSnapshot LoadAndCheck (const char *pTest, CSysExFileLoader *pLoader, const TModel &rModel)
+{
+	unsigned nStartTicks = CTimer::GetClockTicks ();
+	TSnapshot Snapshot = TakeSnapshot (pLoader);
+	unsigned nSnapshotTicks = CTimer::GetClockTicks () - nStartTicks;
+
+	CheckModel (pTest, Snapshot, rModel);
+
+	CSysExFileLoader::TLoadStatistics Statistics;
+	pLoader->GetLoadStatistics (&Statistics);
+	PrintTiming (pTest, pLoader, Statistics.nLoadTicks, nSnapshotTicks);
+
+	return Snapshot;
+}
+
+int main (int argc, char **argv)
+{
+	unsigned nBanks = argc > 1 ? atoi (argv[1]) : 300;
+	std::string Dir (argc > 2 ? argv[2] : "build/sysexloader");
+	std::string LibraryDir (Dir + "-lib");
+
+	CLogger::Get ()->SetLevel (LogPanic);		// expected warnings are not shown
+
+	assert (nBanks > CSysExFileLoader::BankCacheSize + 10);	// for evictions
+	static TFixture Fixture;
+	CreateFixture (Dir, nBanks, &Fixture);
+	const TModel &rModel = Fixture.Model;
+
+	printf ("%-12s %9s %9s %10s %8s %8s %8s %8s\n", "load", "load ms", "read ms",
+		"lookup us", "misses", "evicted", "voices", "unique");
+
+	// serial, Load() validates the bank files itself
+	TSnapshot Serial;
+	{
+		CSysExFileLoader Loader (Dir.c_str ());
+		Loader.Load ();
+		CheckStatistics ("serial", &Loader, rModel, Fixture.nInvalidFiles);
+
+		Serial = LoadAndCheck ("serial", &Loader, rModel);
+
+		CSysExFileLoader::TCacheStatistics Cache;
+		Loader.GetCacheStatistics (&Cache);
+		CHECK (Cache.nResident <= CSysExFileLoader::BankCacheSize, "%u banks resident", Cache.nResident);
+		CHECK (Cache.nEvictions > 0, "No evictions");
+		CHECK (Cache.nUniqueVoices < Cache.nVoices, "No voices pooled");
+
+		// LRU: the last bank read is resident, the first one has been evicted
+		uint8_t Voice[SizeVoice];
+		unsigned nMisses = Cache.nMisses;
+		Loader.GetVoice (rModel.rbegin ()->first, 0, Voice, true);
+		Loader.GetCacheStatistics (&Cache);
+		CHECK (Cache.nMisses == nMisses, "Most recently used bank is not resident");
+		Loader.GetVoice (rModel.begin ()->first, 0, Voice, true);
+		Loader.GetCacheStatistics (&Cache);
+		CHECK (Cache.nMisses == nMisses+1, "Least recently used bank is resident");
+
+		// not available at IRQ level, if not resident
+		CHECK (!Loader.GetVoice (rModel.begin ()->first + 50, 0, Voice, false),
+		       "Bank read at IRQ level");
+
+		// dedup: every 10th bank is a copy of the previous one
+		CHECK (Serial[19].substr (Serial[19].find ('\0')) == Serial[18].substr (Serial[18].find ('\0')),
+		       "Copied banks differ");
+	}
+
+	// parallel, with worker threads like the secondary cores
+	remove ((Dir + "/voice.idx").c_str ());
+	{
+		CSysExFileLoader Loader (Dir.c_str ());
+
+		std::vector<std::thread> Workers;
+		for (unsigned i = 0; i < LoadWorkers; i++)
+		{
+			Workers.emplace_back (&CSysExFileLoader::LoadWorker, &Loader);
+		}
+
+		Loader.Load ();
+
+		for (auto &rWorker : Workers)
+		{
+			rWorker.join ();
+		}
+
+		CheckStatistics ("parallel", &Loader, rModel, Fixture.nInvalidFiles);
+		TSnapshot Parallel = LoadAndCheck ("parallel", &Loader, rModel);
+		CHECK (Parallel == Serial, "Parallel load differs from serial load");
+
+		Finish (&Loader, Dir);
+	}
+
+	// from the index, verified by a background scan
+	TModel Changed (rModel);
+	{
+		CSysExFileLoader Loader (Dir.c_str ());
+		Loader.Load ();
+
+		CSysExFileLoader::TLoadStatistics Statistics;
+		Loader.GetLoadStatistics (&Statistics);
+		CHECK (Statistics.nFilesRead == 0, "%u files read with index", Statistics.nFilesRead);
+		CHECK (Loader.IsScanning (), "No background scan");
+
+		TSnapshot Indexed = LoadAndCheck ("index", &Loader, rModel);
+		CHECK (Indexed == Serial, "Load from index differs from serial load");
+
+		Finish (&Loader, Dir);
+		CheckStatistics ("index scan", &Loader, rModel, Fixture.nInvalidFiles);
+		CHECK (TakeSnapshot (&Loader) == Serial, "Background scan changed banks");
+
+		// rescan after a bank has been added, changed and removed
+		unsigned nAdded = nBanks + 50;
+		AddBank (&Changed, Dir, "a", nAdded, "Added", MakeBankVoices (nAdded));
+
+		char Path[200];
+		snprintf (Path, sizeof Path, "%s/voice/%s/%06u_Bank%u.syx", Dir.c_str (), "a/b/c", 7, 7);
+		CHECK (remove (Path) == 0, "%s: Cannot remove", Path);
+		Changed.erase (7-1);
+
+		snprintf (Path, sizeof Path, "%s/voice/%s/%06u_Bank%u.syx", Dir.c_str (), "a", 5, 5);
+		WriteFile (Path, MakeBankFile (MakeBankVoices (5, 2)));
+		struct utimbuf Time = {1000000000, 1000000000};		// FatFs time has 2s resolution
+		utime (Path, &Time);
+		Changed[5-1].Candidates.assign (1, MakeBankVoices (5, 2));
+
+		remove ((Dir + "/voice.idx").c_str ());		// to wait for the new one
+		CHECK (Loader.Rescan (), "Rescan failed");
+		Finish (&Loader, Dir);
+
+		unsigned nStartTicks = CTimer::GetClockTicks ();
+		TSnapshot Rescanned = TakeSnapshot (&Loader);
+		CheckModel ("rescan", Rescanned, Changed);
+		Loader.GetLoadStatistics (&Statistics);
+		PrintTiming ("rescan", &Loader, Statistics.nScanTicks, CTimer::GetClockTicks () - nStartTicks);
+
+		// the next boot takes the changes from the index
+		CSysExFileLoader Next (Dir.c_str ());
+		Next.Load ();
+		CHECK (TakeSnapshot (&Next) == Rescanned, "Index after rescan differs");
+	}
+
+	// headerless banks are accepted, and any other file of at least 4096 bytes
+	remove ((Dir + "/voice.idx").c_str ());
+	{
+		CSysExFileLoader Loader (Dir.c_str ());
+		Loader.Load (true);
+
+		CSysExFileLoader::TLoadStatistics Statistics;
+		Loader.GetLoadStatistics (&Statistics);
+		CHECK (Statistics.nInvalidFiles == Fixture.nInvalidFiles-3, "headerless: %u invalid files",
+		       Statistics.nInvalidFiles);
+		CHECK (Loader.IsValidBank (Fixture.nHeaderless-1), "Headerless bank not loaded");
+
+		uint8_t Voice[SizeVoice];
+		Loader.GetVoice (Fixture.nHeaderless-1, 3, Voice, true);
+		CHECK (memcmp (Voice, MakeBankVoices (Fixture.nHeaderless)[3].data (), SizeVoice) == 0,
+		       "Headerless bank differs");
+	}
+
+	// single file library built by syx2lib.py from the same tree
+	RemoveTree (LibraryDir);
+	mkdir (LibraryDir.c_str (), 0777);
+	std::string Command = "python3 " SYX2LIB " " + Dir + "/voice " + LibraryDir + "/voice.lib >/dev/null 2>&1";
+	if (system (Command.c_str ()) == 0)
+	{
+		CSysExFileLoader Loader (LibraryDir.c_str ());
+		Loader.Load ();
+
+		TSnapshot Library = LoadAndCheck ("library", &Loader, Changed);
+
+		// single voices are read from the library, whole banks by prefetch
+		unsigned nBankID = Changed.rbegin ()->first;
+		Loader.PrepareBank (nBankID);
+		for (unsigned i = 0; i < 100; i++)
+		{
+			Loader.Process ();
+		}
+
+		uint8_t Voice[SizeVoice];
+		CHECK (Loader.GetVoice (nBankID, 31, Voice, false), "Library bank not prepared");
+		CHECK (Library[nBankID].compare (Library[nBankID].size () - SizeVoice, SizeVoice,
+						 (const char *) Voice, SizeVoice) == 0,
+		       "Prepared library bank differs");
+	}
+	else
+	{
+		printf ("library      skipped (python3 %s failed)\n", SYX2LIB);
+	}
+
+	RemoveTree (LibraryDir);
+	RemoveTree (Dir);
+
+	printf ("%s\n", s_nErrors ? "FAILED" : "PASSED");
+
+	return s_nErrors ? 1 : 0;
+}